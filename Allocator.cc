@@ -1,14 +1,33 @@
-
 /** \file Allocator.cc
- * \brief 
+ * \brief
  * \todo Limit quantity of pools of a specific size
- * \todo stats
+ *
+ * The heap has three tiers.
+ *
+ * Small requests, up to 32KB, are rounded up into a fixed set of size
+ * classes: 16 byte steps up to 128 bytes, then four classes per power
+ * of two.  Each class has its own slabs (MemPool) and a list of the
+ * slabs that still have free slots, so allocate never searches.
+ *
+ * Medium requests, up to 1MB, are carved as page runs out of 4MB
+ * arenas.  Freed runs are handed back to the kernel straight away.
+ *
+ * Large requests get their own mapping, 2MB aligned and eligible for
+ * transparent huge pages once they are at least that big.
+ *
+ * Every slab, arena and large mapping is recorded in a page map, so
+ * free finds the owner from the address alone.
  */
 
 #include <sys/user.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <execinfo.h>
 
 #include <exception>
@@ -27,13 +46,84 @@ namespace {
     print_stack() {
         void *pointers[256];
 
-        int frame_count = backtrace( pointers, sizeof(pointers) );
+        int frame_count = backtrace( pointers, sizeof(pointers)/sizeof(pointers[0]) );
         char **frames = backtrace_symbols( pointers, frame_count );
         for ( int i = 0 ; i < frame_count ; ++i ) {
             fprintf( stderr, "frame(%03d): %s\n", i, frames[i] );
         }
     }
 
+    /*
+     * Size classes
+     */
+    const int SMALL_CLASSES = 8;
+    const int CLASSES = SMALL_CLASSES + (4 * 8);
+    const size_t LARGEST_CLASS = 32768;
+
+    /*
+     * Medium objects are page runs, large objects are mapped on their own.
+     */
+    const size_t LARGEST_MEDIUM = 1024 * 1024;
+    const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    /*
+     * Statistics are kept per size class, then one row for all medium
+     * objects and one for all large objects.
+     */
+    const int MEDIUM_ROW = CLASSES;
+    const int LARGE_ROW = CLASSES + 1;
+    const int ROWS = CLASSES + 2;
+
+    /**
+     * Map a request size to its class index.  The small classes are
+     * 16 bytes apart, after that each power of two is split in four.
+     */
+    inline int
+    class_index( size_t size ) {
+        if ( size <= 16 )  return 0;
+        if ( size <= 128 )  return ((size + 15) >> 4) - 1;
+
+        int shift = 63 - __builtin_clzl( size - 1 );
+        int sub = ((size - 1) - ((size_t)1 << shift)) >> (shift - 2);
+        return SMALL_CLASSES + ((shift - 7) * 4) + sub;
+    }
+
+    inline size_t
+    class_size( int index ) {
+        if ( index < SMALL_CLASSES )  return (index + 1) << 4;
+
+        int shift = 7 + ((index - SMALL_CLASSES) / 4);
+        int sub = (index - SMALL_CLASSES) % 4;
+        return ((size_t)1 << shift) + ((size_t)(sub + 1) << (shift - 2));
+    }
+
+    inline size_t
+    page_round( size_t length ) {
+        return (length + PAGE_SIZE - 1) & ~((size_t)PAGE_SIZE - 1);
+    }
+
+    /**
+     * Count the resident pages of a mapping.
+     */
+    size_t
+    resident( uint8_t *start, size_t length ) {
+        unsigned char vector[4096];
+        size_t pages = 0;
+
+        while ( length > 0 ) {
+            size_t chunk = length;
+            if ( chunk > (sizeof(vector) * PAGE_SIZE) )  chunk = sizeof(vector) * PAGE_SIZE;
+            if ( mincore(start, chunk, vector) == 0 ) {
+                for ( size_t i = 0 ; i < (chunk / PAGE_SIZE) ; ++i ) {
+                    if ( vector[i] & 1 )  pages++;
+                }
+            }
+            start += chunk;
+            length -= chunk;
+        }
+        return pages * PAGE_SIZE;
+    }
+
 }
 
 class MemPoolException {
@@ -46,38 +136,28 @@ public:
 class invalid_object : public MemPoolException { };
 class double_free : public MemPoolException { };
 
-/*
+/**
+ * Anything that owns pages in the page map.  The descriptors are
+ * mmap'd directly so building one never recurses into operator new.
  */
-class MemPool {
-    static const int count = 512;
-    static const int maps = count/32;
-    size_t size;
-    MemPool *next;
-    uint8_t *start;
-    uint32_t map[maps];
-    void initialize( size_t );
+class Extent {
 public:
-    MemPool() : size(0), next(NULL), start(NULL) {}
-    ~MemPool() {}
-    void *allocate( size_t );
-    void free( void * );
-
-    void usage( Tcl_Interp *, Tcl_Obj * );
+    enum Tier { SMALL, MEDIUM, LARGE };
+    Tier tier;
+    uint8_t *start;
+    size_t length;
 
-    static void* operator new (size_t size); 
-    static void operator delete (void *p);
+    Extent( Tier tier ) : tier(tier), start(NULL), length(0) {}
 
-    size_t get_size() { return size; }
-    int get_count() { return count; }
-    uint32_t available_slots();
-    MemPool *next_pool() { return next; }
+    static void* operator new (size_t size);
+    static void operator delete (void *p, size_t size);
 };
-
+
 /**
  */
 void *
-MemPool::operator new ( size_t size ) {
-    void *address = mmap( 0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+Extent::operator new ( size_t size ) {
+    void *address = mmap( 0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
     if ( address == MAP_FAILED ) {
         fprintf( stderr, "new operator failed to allocate %ld bytes\n", size );
         print_stack();
@@ -89,45 +169,57 @@ MemPool::operator new ( size_t size ) {
 /**
  */
 void
-MemPool::operator delete ( void *object ) {
-    munmap( object, sizeof(MemPool) );
+Extent::operator delete ( void *object, size_t size ) {
+    munmap( object, size );
 }
 
-static const uint32_t m1  = 0x55555555;
-static const uint32_t m2  = 0x33333333;
-static const uint32_t m4  = 0x0F0F0F0F;
-static const uint32_t m8  = 0x00FF00FF;
-static const uint32_t m16 = 0x0000FFFF;
-
 /**
+ * One slab of equal sized slots.  The free slots are tracked in a
+ * bitmap, and free_words has a bit set for each bitmap word that
+ * still has a free slot, so finding one is two bit scans.
  */
-uint32_t
-MemPool::available_slots() {
-    uint32_t sum = 0;
-    for ( int word = 0 ; word < maps ; word++ ) {
-        uint32_t hw = map[word];
-        hw -= (hw >> 1 ) & m1;
-        hw = (hw & m2) + ((hw >> 2) & m2);
-        hw = (hw + (hw >> 4)) & m4;
-        hw += hw >> 8;
-        hw += hw >> 16;
-        hw &= 0x7f;
-        sum += hw;
-    }
-    return sum;
-}
+class MemPool : public Extent {
+    static const int count = 512;
+    static const int maps = count/64;
+    size_t size;
+    int klass;
+    MemPool *next;
+    MemPool *next_partial;
+    bool partial;
+    bool released;
+    uint32_t free_words;
+    uint32_t available;
+    uint64_t map[maps];
+public:
+    MemPool( size_t, int );
+    ~MemPool() {}
+    void *allocate();
+    void free( void * );
+    void release();
+
+    size_t get_size() { return size; }
+    int get_count() { return count; }
+    int size_class() { return klass; }
+    uint32_t available_slots() { return available; }
+    bool full() { return available == 0; }
+    bool empty() { return available == count; }
+    MemPool *next_pool() { return __atomic_load_n( &next, __ATOMIC_ACQUIRE ); }
+
+    friend class Heap;
+};
 
 /**
  */
-void
-MemPool::initialize( size_t object_size ) {
-    size = object_size;
-    size_t zone = size * count;
+MemPool::MemPool( size_t object_size, int object_class )
+: Extent(SMALL), size(object_size), klass(object_class), next(NULL),
+  next_partial(NULL), partial(false), released(false), available(count)
+{
+    length = page_round( object_size * count );
 
     if ( debug ) {
-        fprintf( stderr, "Allocate %lu KB memory region for %lu byte objects\n", zone/1024, size );
+        fprintf( stderr, "Allocate %lu KB memory region for %lu byte objects\n", length/1024, size );
     }
-    start = (uint8_t *)mmap( 0, zone, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    start = (uint8_t *)mmap( 0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
 
     if ( start == MAP_FAILED ) {
         fprintf( stderr, "MemPool failed to allocate memory region for %lu byte objects\n", size );
@@ -136,128 +228,783 @@ MemPool::initialize( size_t object_size ) {
     }
 
     for ( int i = 0 ; i < maps ; i++ ) {
-        map[i] = 0xFFFFFFFF;
+        map[i] = ~(uint64_t)0;
     }
+    free_words = (1 << maps) - 1;
+}
 
+/**
+ * Take the lowest free slot.  The caller has already checked that
+ * the pool is not full.
+ */
+void *
+MemPool::allocate() {
+    int word = __builtin_ctz( free_words );
+    int bit = __builtin_ctzll( map[word] );
+
+    map[word] &= map[word] - 1;
+    if ( map[word] == 0 )  free_words &= ~(1 << word);
+    available--;
+    released = false;
+
+    int entry = (word * 64) + bit;
     if ( debug ) {
-        fprintf( stderr, "Creating new mempool\n" );
+        fprintf( stderr, "allocate entry %d from %lu size table\n", entry, size );
     }
-    next = new MemPool;
+    return start + (entry * size);
 }
 
 /**
  */
 void
-MemPool::usage( Tcl_Interp *interp, Tcl_Obj *result ) {
-    if ( size == 0 ) return;
+MemPool::free( void *object ) {
+    uint8_t *address = (uint8_t*)object;
+    size_t offset = address - start;
+    size_t entry = offset / size;
 
-    Tcl_Obj *element = Tcl_NewListObj( 0, 0 );
+    if ( (entry >= (size_t)count) or ((entry * size) != offset) ) {
+        fprintf( stderr, "MemPool: 0x%p is not an object in the %lu size table\n", object, size );
+        throw invalid_object();
+    }
 
-    Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("size", -1) );
-    Tcl_ListObjAppendElement( interp, element, Tcl_NewLongObj(size) );
+    int word  = entry / 64;
+    int bit   = entry % 64;
+    uint64_t mask = ((uint64_t)1 << bit);
 
-    Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("capacity", -1) );
-    Tcl_ListObjAppendElement( interp, element, Tcl_NewLongObj(count * size) );
+    if ( map[word] & mask ) {
+        fprintf( stderr, "MemPool: map[%d] is 0x%016lx\n", word, map[word] );
+        fprintf( stderr, "MemPool: object 0x%p already freed\n", object );
+        throw double_free();
+    }
 
-    uint32_t sum = 0;
-    for ( int word = 0 ; word < maps ; word++ ) {
-        uint32_t hw = map[word];
-        hw -= (hw >> 1 ) & m1;
-        hw = (hw & m2) + ((hw >> 2) & m2);
-        hw = (hw + (hw >> 4)) & m4;
-        hw += hw >> 8;
-        hw += hw >> 16;
-        hw &= 0x7f;
-        sum += hw;
+    if ( debug ) {
+        fprintf( stderr, "free entry %lu from %lu size table\n", entry, size );
     }
+    map[word] |= mask;
+    free_words |= (1 << word);
+    available++;
+}
+
+/**
+ * Give the pages of an empty slab back to the kernel.  The slab keeps
+ * its address range and descriptor; the pages come back zero filled
+ * the next time a slot in them is used.
+ */
+void
+MemPool::release() {
+    if ( released )  return;
+    if ( debug ) {
+        fprintf( stderr, "release empty %lu size table\n", size );
+    }
+    madvise( start, length, MADV_DONTNEED );
+    released = true;
+}
+
+/**
+ * A 4MB region handed out as runs of whole pages.  The bitmap has a
+ * bit set for each page in use, and run[] holds the length of each
+ * allocated run at its first page.
+ */
+class Arena : public Extent {
+public:
+    static const int pages = 1024;
+private:
+    static const int words = pages/64;
+    uint64_t used[words];
+    uint16_t run[pages];
+    int free_pages;
+    int runs;
+public:
+    Arena *next;
 
-    Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("available", -1) );
-    Tcl_ListObjAppendElement( interp, element, Tcl_NewLongObj(sum * size) );
+    Arena();
+    void *allocate( int );
+    void free( void * );
+
+    int in_use() { return pages - free_pages; }
+    int objects() { return runs; }
+};
 
-    Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("objects", -1) );
-    Tcl_ListObjAppendElement( interp, element, Tcl_NewLongObj(count - sum) );
+/**
+ */
+Arena::Arena() : Extent(MEDIUM), free_pages(pages), runs(0), next(NULL) {
+    length = pages * PAGE_SIZE;
+
+    if ( debug ) {
+        fprintf( stderr, "Allocate %lu KB arena for page runs\n", length/1024 );
+    }
+    start = (uint8_t *)mmap( 0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+    if ( start == MAP_FAILED ) {
+        fprintf( stderr, "MemPool failed to allocate arena\n" );
+        print_stack();
+        throw std::bad_alloc();
+    }
 
-    Tcl_ListObjAppendElement( interp, result, element );
-    next->usage( interp, result );
+    for ( int i = 0 ; i < words ; i++ ) {
+        used[i] = 0;
+    }
 }
-
+
 /**
+ * First fit: skip to the next free page, then to the next used page
+ * after it, until a gap long enough turns up.
  */
 void *
-MemPool::allocate( size_t object_size ) {
-    if ( size == 0 )  initialize( object_size );
+Arena::allocate( int count ) {
+    if ( count > free_pages )  return NULL;
 
-    if ( object_size != size ) {
-        return next->allocate( object_size );
-    }
+    int page = 0;
+    while ( page + count <= pages ) {
+        int word = page / 64;
+        uint64_t bits = ~used[word] & (~(uint64_t)0 << (page % 64));
+        while ( bits == 0 ) {
+            if ( ++word == words )  return NULL;
+            bits = ~used[word];
+        }
+        page = (word * 64) + __builtin_ctzll( bits );
+        if ( page + count > pages )  return NULL;
 
-    for ( int word = 0 ; word < maps ; word++ ) {
-        if ( map[word] == 0 ) {
-            continue;
+        int end = pages;
+        bits = used[word] & (~(uint64_t)0 << (page % 64));
+        while ( bits == 0 ) {
+            if ( ++word == words )  break;
+            bits = used[word];
         }
+        if ( bits != 0 )  end = (word * 64) + __builtin_ctzll( bits );
 
-        for ( int bit = 0 ; bit < 32 ; bit++ ) {
-            uint32_t mask = 1 << bit;
-            if ( (map[word] & mask) == 0 ) {
-                continue;
+        if ( end - page >= count ) {
+            for ( int i = page ; i < page + count ; ++i ) {
+                used[i / 64] |= (uint64_t)1 << (i % 64);
             }
+            run[page] = count;
+            free_pages -= count;
+            runs++;
+            return start + (page * PAGE_SIZE);
+        }
+        page = end;
+    }
+    return NULL;
+}
 
-            int entry = ((word * 32) + bit);
-            if ( debug ) {
-                fprintf( stderr, "allocate entry %d from %lu size table\n", entry, size );
-            }
-            void *address = start + (entry * size);
+/**
+ * Freed runs are returned to the kernel immediately -- they are at
+ * least 32KB, so the madvise is cheap next to the work that filled them.
+ */
+void
+Arena::free( void *object ) {
+    size_t offset = (uint8_t *)object - start;
+    int page = offset / PAGE_SIZE;
+
+    if ( (offset % PAGE_SIZE) != 0 ) {
+        fprintf( stderr, "MemPool: 0x%p is not the start of a page run\n", object );
+        throw invalid_object();
+    }
+    if ( (used[page / 64] & ((uint64_t)1 << (page % 64))) == 0 ) {
+        fprintf( stderr, "MemPool: page run 0x%p already freed\n", object );
+        throw double_free();
+    }
+
+    int count = run[page];
+    for ( int i = page ; i < page + count ; ++i ) {
+        used[i / 64] &= ~((uint64_t)1 << (i % 64));
+    }
+    run[page] = 0;
+    free_pages += count;
+    runs--;
+    madvise( object, count * PAGE_SIZE, MADV_DONTNEED );
+}
+
+/**
+ * A single large object in its own mapping.
+ */
+class LargeObject : public Extent {
+public:
+    size_t size;
+    uint8_t *mapping;
+    size_t mapped;
+    LargeObject *next, *previous;
+    LargeObject( size_t, size_t );
+    ~LargeObject();
+};
 
-            map[word] &= ~mask;
-            return address;
+/**
+ * Over-map by the alignment and trim both ends, so the object starts
+ * on an alignment boundary.  Objects of a huge page or more are 2MB
+ * aligned and marked for transparent huge pages.
+ */
+LargeObject::LargeObject( size_t object_size, size_t alignment )
+: Extent(LARGE), size(object_size), next(NULL), previous(NULL)
+{
+    length = page_round( object_size );
+    if ( (length >= HUGE_PAGE_SIZE) and (alignment < HUGE_PAGE_SIZE) ) {
+        alignment = HUGE_PAGE_SIZE;
+    }
+    if ( alignment < PAGE_SIZE )  alignment = PAGE_SIZE;
+
+    size_t reserve = length + alignment - PAGE_SIZE;
+    uint8_t *address = (uint8_t *)mmap( 0, reserve, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( address == MAP_FAILED ) {
+        fprintf( stderr, "MemPool failed to map %lu byte object\n", object_size );
+        print_stack();
+        throw std::bad_alloc();
+    }
+
+    start = (uint8_t *)(((uintptr_t)address + alignment - 1) & ~(alignment - 1));
+    if ( start > address )  munmap( address, start - address );
+    uint8_t *end = address + reserve;
+    if ( end > start + length )  munmap( start + length, end - (start + length) );
+
+    mapping = start;
+    mapped = length;
+#ifdef MADV_HUGEPAGE
+    if ( length >= HUGE_PAGE_SIZE )  madvise( start, length, MADV_HUGEPAGE );
+#endif
+}
+
+/**
+ */
+LargeObject::~LargeObject() {
+    munmap( mapping, mapped );
+}
+
+/*
+ * Page map
+ *
+ * A two level radix table from page number to the extent that owns the
+ * page.  Each leaf covers 1GB of address space and is mapped the first
+ * time an extent lands in that range.  Slabs and arenas are never
+ * unmapped, so their entries are permanent and lookups are done without
+ * the heap lock.  A large object clears its entry when it is freed;
+ * anyone still looking it up is using freed memory anyway.
+ */
+namespace {
+    const int ADDRESS_BITS = 47;
+    const int LEAF_BITS = 18;
+    const int ROOT_BITS = ADDRESS_BITS - PAGE_SHIFT - LEAF_BITS;
+
+    Extent **page_map[ 1 << ROOT_BITS ];
+
+    void
+    map_pages( uint8_t *start, size_t length, Extent *extent ) {
+        uintptr_t first = (uintptr_t)start >> PAGE_SHIFT;
+        uintptr_t last = ((uintptr_t)start + length - 1) >> PAGE_SHIFT;
+
+        for ( uintptr_t page = first ; page <= last ; ++page ) {
+            Extent **leaf = page_map[ page >> LEAF_BITS ];
+            if ( leaf == NULL ) {
+                void *address = mmap( 0, sizeof(Extent *) << LEAF_BITS, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+                if ( address == MAP_FAILED ) {
+                    fprintf( stderr, "MemPool failed to allocate page map\n" );
+                    print_stack();
+                    throw std::bad_alloc();
+                }
+                leaf = (Extent **)address;
+                __atomic_store_n( &page_map[page >> LEAF_BITS], leaf, __ATOMIC_RELEASE );
+            }
+            __atomic_store_n( &leaf[page & ((1 << LEAF_BITS) - 1)], extent, __ATOMIC_RELEASE );
         }
     }
+
+    inline Extent *
+    page_owner( void *object ) {
+        uintptr_t page = (uintptr_t)object >> PAGE_SHIFT;
+        if ( (page >> (ADDRESS_BITS - PAGE_SHIFT)) != 0 )  return NULL;
+
+        Extent **leaf = __atomic_load_n( &page_map[page >> LEAF_BITS], __ATOMIC_ACQUIRE );
+        if ( leaf == NULL )  return NULL;
+        return __atomic_load_n( &leaf[page & ((1 << LEAF_BITS) - 1)], __ATOMIC_ACQUIRE );
+    }
+}
+
+/**
+ * Byte counts for one tier, filled in by Heap::usage.
+ */
+struct TierUsage {
+    size_t reserved;
+    size_t resident;
+    size_t allocated;
+    unsigned long objects;
+};
+
+/**
+ * The slabs for each size class, the medium arenas and the large
+ * objects.  All members are zero initialized statics, so the heap is
+ * usable before any constructor has run.
+ */
+class Heap {
+    MemPool *partial[CLASSES];
+    MemPool *pools;
+    MemPool *last;
+    Arena *arenas;
+    LargeObject *large;
+    unsigned long outstanding[ROWS];
+    unsigned long peak[ROWS];
+    void taken( int row ) {
+        if ( ++outstanding[row] > peak[row] )  peak[row] = outstanding[row];
+    }
+    MemPool *create( size_t, int );
+    void *allocate_medium( size_t );
+public:
+    void *allocate( size_t );
+    void *allocate_large( size_t, size_t );
+    void free( void * );
+    void usage( TierUsage * );
+    unsigned long peak_objects( int row ) { return peak[row]; }
+    MemPool *owner( void *object ) {
+        Extent *extent = page_owner( object );
+        if ( (extent == NULL) or (extent->tier != Extent::SMALL) )  return NULL;
+        return (MemPool *)extent;
+    }
+    MemPool *first_pool() { return __atomic_load_n( &pools, __ATOMIC_ACQUIRE ); }
+};
+
+/**
+ * Build a new slab and make it visible to the page map and to the
+ * lock free walk in Allocator::inject.
+ */
+MemPool *
+Heap::create( size_t size, int klass ) {
     if ( debug ) {
-        fprintf( stderr, "this table is full, looking for another\n" );
+        fprintf( stderr, "Creating new mempool\n" );
+    }
+    MemPool *pool = new MemPool( size, klass );
+    map_pages( pool->start, pool->length, pool );
+
+    if ( last == NULL ) {
+        __atomic_store_n( &pools, pool, __ATOMIC_RELEASE );
+    } else {
+        __atomic_store_n( &(last->next), pool, __ATOMIC_RELEASE );
+    }
+    last = pool;
+    return pool;
+}
+
+/**
+ */
+void *
+Heap::allocate_medium( size_t size ) {
+    int count = page_round( size ) / PAGE_SIZE;
+
+    void *address = NULL;
+    for ( Arena *arena = arenas ; arena != NULL ; arena = arena->next ) {
+        address = arena->allocate( count );
+        if ( address != NULL )  break;
+    }
+
+    if ( address == NULL ) {
+        Arena *arena = new Arena;
+        map_pages( arena->start, arena->length, arena );
+        arena->next = arenas;
+        arenas = arena;
+        address = arena->allocate( count );
+    }
+    taken( MEDIUM_ROW );
+    return address;
+}
+
+/**
+ */
+void *
+Heap::allocate_large( size_t size, size_t alignment ) {
+    LargeObject *object = new LargeObject( size, alignment );
+    map_pages( object->start, PAGE_SIZE, object );
+
+    object->next = large;
+    if ( large != NULL )  large->previous = object;
+    large = object;
+    taken( LARGE_ROW );
+    return object->start;
+}
+
+/**
+ */
+void *
+Heap::allocate( size_t size ) {
+    if ( size > LARGEST_MEDIUM )  return allocate_large( size, PAGE_SIZE );
+    if ( size > LARGEST_CLASS )  return allocate_medium( size );
+
+    int klass = class_index( size );
+    MemPool *pool = partial[klass];
+    if ( pool == NULL ) {
+        pool = create( class_size(klass), klass );
+        pool->partial = true;
+        partial[klass] = pool;
     }
 
-    return next->allocate( object_size );
+    void *address = pool->allocate();
+    taken( klass );
+    if ( pool->full() ) {
+        partial[klass] = pool->next_partial;
+        pool->next_partial = NULL;
+        pool->partial = false;
+    }
+    return address;
 }
 
 /**
+ * A slab that empties out is released unless it is the one its class
+ * is currently allocating from, so a single object bouncing in and out
+ * does not keep faulting pages back in.
  */
 void
-MemPool::free( void *object ) {
-    uint32_t length = count * size;
-    uint8_t *end = (start + length) - 1;
+Heap::free( void *object ) {
+    Extent *extent = page_owner( object );
+    if ( extent == NULL ) {
+        fprintf( stderr, "MemPool: 0x%p was not allocated from the heap\n", object );
+        throw invalid_object();
+    }
 
-    if ( (object < start) || (object > end) ) {
-        if ( next == 0 )  throw invalid_object();
-        next->free( object );
-        return;
+    switch ( extent->tier ) {
+    case Extent::SMALL: {
+        MemPool *pool = (MemPool *)extent;
+        pool->free( object );
+        outstanding[pool->klass]--;
+        if ( pool->partial == false ) {
+            pool->partial = true;
+            pool->next_partial = partial[pool->klass];
+            partial[pool->klass] = pool;
+        }
+        if ( pool->empty() and (partial[pool->klass] != pool) ) {
+            pool->release();
+        }
+        break;
+    }
+    case Extent::MEDIUM:
+        ((Arena *)extent)->free( object );
+        outstanding[MEDIUM_ROW]--;
+        break;
+    case Extent::LARGE: {
+        LargeObject *large_object = (LargeObject *)extent;
+        if ( large_object->start != object ) {
+            fprintf( stderr, "MemPool: 0x%p is not the start of a large object\n", object );
+            throw invalid_object();
+        }
+        map_pages( large_object->start, PAGE_SIZE, NULL );
+        if ( large_object->previous != NULL ) {
+            large_object->previous->next = large_object->next;
+        } else {
+            large = large_object->next;
+        }
+        if ( large_object->next != NULL )  large_object->next->previous = large_object->previous;
+        delete large_object;
+        outstanding[LARGE_ROW]--;
+        break;
+    }
     }
+}
 
-    uint8_t *address = (uint8_t*)object;
-    uint32_t offset = address - start;
-    int entry = offset / size;
-    int word  = entry / 32;
-    int bit   = entry % 32;
-    uint32_t mask = (1<<bit);
+/**
+ * Fill in reserved, resident, allocated and object counts for each
+ * tier.  Called with the heap lock held.
+ */
+void
+Heap::usage( TierUsage *tiers ) {
+    for ( int i = 0 ; i < 3 ; ++i ) {
+        tiers[i].reserved = tiers[i].resident = tiers[i].allocated = 0;
+        tiers[i].objects = 0;
+    }
 
-    if ( map[word] & mask ) {
-        fprintf( stderr, "MemPool: map[%d] is 0x%08x\n", word, map[word] );
-        fprintf( stderr, "MemPool: object 0x%p already freed\n", object );
-        throw double_free();
+    for ( MemPool *pool = pools ; pool != NULL ; pool = pool->next ) {
+        TierUsage &tier = tiers[Extent::SMALL];
+        tier.reserved += pool->length;
+        if ( pool->released == false )  tier.resident += resident( pool->start, pool->length );
+        tier.allocated += (pool->count - pool->available) * pool->size;
+        tier.objects += pool->count - pool->available;
     }
 
-    if ( debug ) {
-        fprintf( stderr, "free entry %d from %lu size table\n", entry, size );
+    for ( Arena *arena = arenas ; arena != NULL ; arena = arena->next ) {
+        TierUsage &tier = tiers[Extent::MEDIUM];
+        tier.reserved += arena->length;
+        tier.resident += resident( arena->start, arena->length );
+        tier.allocated += arena->in_use() * PAGE_SIZE;
+        tier.objects += arena->objects();
     }
-    map[word] |= mask;
+
+    for ( LargeObject *object = large ; object != NULL ; object = object->next ) {
+        TierUsage &tier = tiers[Extent::LARGE];
+        tier.reserved += object->mapped;
+        tier.resident += resident( object->mapping, object->mapped );
+        tier.allocated += object->size;
+        tier.objects++;
+    }
+}
+
+/**
+ * Which statistics row an object is counted in.
+ */
+static int
+stat_row( void *object ) {
+    Extent *extent = page_owner( object );
+    if ( extent == NULL )  return -1;
+    switch ( extent->tier ) {
+    case Extent::SMALL:  return ((MemPool *)extent)->size_class();
+    case Extent::MEDIUM: return MEDIUM_ROW;
+    case Extent::LARGE:  return LARGE_ROW;
+    }
+    return -1;
 }
-
-/** \brief the static primary MemPool object used by the
- * global allocators.
+
+static int
+stat_row( size_t size ) {
+    if ( size > LARGEST_MEDIUM )  return LARGE_ROW;
+    if ( size > LARGEST_CLASS )  return MEDIUM_ROW;
+    return class_index( size );
+}
+
+/** \brief the static primary heap used by the global allocators.
  */
-MemPool heap;
+Heap heap;
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * Heap lock accounting.  The lock is tried first, and only when that
+ * fails is the wait timed, so the uncontended path costs nothing but
+ * the counter.  All counters are updated with the lock held.
+ */
+namespace {
+    struct Counters {
+        unsigned long allocations;
+        unsigned long frees;
+    };
+
+    /* allocations and frees that went straight to the heap */
+    Counters direct[ROWS];
+
+    unsigned long acquisitions = 0;
+    unsigned long contentions = 0;
+    uint64_t contended_nsec = 0;
+    uint64_t longest_wait_nsec = 0;
+
+    uint64_t
+    now_nsec() {
+        struct timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        return ((uint64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+    }
+
+    void
+    lock_heap() {
+        if ( pthread_mutex_trylock(&mutex) != 0 ) {
+            uint64_t start = now_nsec();
+            pthread_mutex_lock( &mutex );
+            uint64_t wait = now_nsec() - start;
+            contended_nsec += wait;
+            if ( wait > longest_wait_nsec )  longest_wait_nsec = wait;
+            contentions++;
+        }
+        acquisitions++;
+    }
+}
+
+/*
+ * Allocation sampling.
+ *
+ * When enabled, one allocation in every sample_every per thread has
+ * its call stack recorded.  Stacks are hashed into a fixed table, so
+ * the cost is bounded no matter how long sampling is left on; a stack
+ * that finds no room is counted as dropped.
+ */
+namespace {
+    const int SAMPLE_DEPTH = 12;
+    const int SAMPLE_SKIP = 2;
+    const int SAMPLE_SLOTS = 256;
+    const int SAMPLE_PROBES = 8;
+
+    struct Sample {
+        unsigned long count;
+        size_t bytes;
+        int depth;
+        void *frames[SAMPLE_DEPTH];
+    };
+
+    Sample samples[SAMPLE_SLOTS];
+    unsigned long samples_dropped = 0;
+    pthread_mutex_t sample_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    int sample_every = 0;
+    __thread int sample_countdown = 0;
+    __thread bool sampling_now = false;
+
+    void __attribute__((noinline))
+    sample( size_t size ) {
+        if ( sampling_now )  return;
+        sampling_now = true;
+
+        void *frames[SAMPLE_DEPTH + SAMPLE_SKIP];
+        int depth = backtrace( frames, SAMPLE_DEPTH + SAMPLE_SKIP ) - SAMPLE_SKIP;
+        if ( depth < 0 )  depth = 0;
+        void **stack = frames + SAMPLE_SKIP;
+
+        uintptr_t hash = depth;
+        for ( int i = 0 ; i < depth ; ++i ) {
+            hash = (hash * 31) ^ ((uintptr_t)stack[i] >> 4);
+        }
+
+        pthread_mutex_lock( &sample_mutex );
+        bool recorded = false;
+        for ( int probe = 0 ; probe < SAMPLE_PROBES ; ++probe ) {
+            Sample *slot = &samples[(hash + probe) % SAMPLE_SLOTS];
+            if ( slot->count == 0 ) {
+                slot->depth = depth;
+                memcpy( slot->frames, stack, depth * sizeof(void *) );
+            } else if ( (slot->depth != depth) or (memcmp(slot->frames, stack, depth * sizeof(void *)) != 0) ) {
+                continue;
+            }
+            slot->count++;
+            slot->bytes += size;
+            recorded = true;
+            break;
+        }
+        if ( recorded == false )  samples_dropped++;
+        pthread_mutex_unlock( &sample_mutex );
+
+        sampling_now = false;
+    }
+}
+
+/*
+ * Per-thread magazines.
+ *
+ * Each thread keeps a small magazine of free slots for each size
+ * class.  Allocation and free are served from the magazine without
+ * touching the heap lock; only when a magazine runs empty or fills up
+ * does the thread take the lock, and then it moves a whole batch of
+ * slots between the magazine and the shared pools at once.  Sizes
+ * above the largest class are not cached.
+ *
+ * The caches themselves are mmap'd so creating one never recurses
+ * into operator new, and they are kept on a list so Allocator::usage
+ * can report what each thread is holding.  When a thread exits its
+ * magazines are spilled back to the pools.
+ */
+namespace {
+    const int MAGAZINE_SLOTS = 64;
+    const int MAGAZINE_BATCH = MAGAZINE_SLOTS / 2;
+
+    struct Magazine {
+        size_t size;
+        int count;
+        unsigned long allocations;
+        unsigned long frees;
+        void *slot[MAGAZINE_SLOTS];
+    };
+
+    struct ThreadCache {
+        ThreadCache *next;
+        pid_t thread;
+        Magazine magazine[CLASSES];
+    };
+
+    /* marks a thread whose cache has already been torn down */
+    ThreadCache * const RETIRED = (ThreadCache *)-1;
+
+    __thread ThreadCache *thread_cache = NULL;
+    ThreadCache *caches = NULL;
+    bool caching = true;
+
+    pthread_key_t cache_key;
+    pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+    /**
+     * Return a batch of slots from the top of the magazine to the
+     * shared pools.  Called with the heap lock held.
+     */
+    void
+    spill( Magazine *magazine, int slots ) {
+        while ( (slots-- > 0) and (magazine->count > 0) ) {
+            heap.free( magazine->slot[--magazine->count] );
+        }
+    }
+
+    /**
+     * Runs at thread exit -- hand everything back to the shared pools.
+     * The cache stays on the list, marked unowned, for the next thread
+     * to pick up; that way the list never shrinks and can be walked
+     * without the lock.
+     */
+    void
+    release_cache( void *data ) {
+        ThreadCache *cache = (ThreadCache *)data;
+
+        lock_heap();
+        for ( int i = 0 ; i < CLASSES ; ++i ) {
+            spill( &(cache->magazine[i]), MAGAZINE_SLOTS );
+        }
+        cache->thread = 0;
+        pthread_mutex_unlock( &mutex );
+
+        thread_cache = RETIRED;
+    }
+
+    void
+    create_cache_key() {
+        pthread_key_create( &cache_key, release_cache );
+    }
+
+    /**
+     * Find (or create) the calling thread's cache.  Returns NULL when
+     * caching is off or the thread is already exiting, in which case
+     * the caller goes straight to the shared pools.
+     */
+    ThreadCache *
+    current_cache() {
+        if ( caching == false )  return NULL;
+
+        ThreadCache *cache = thread_cache;
+        if ( cache == RETIRED )  return NULL;
+        if ( cache != NULL )  return cache;
+
+        pthread_once( &cache_key_once, create_cache_key );
+
+        lock_heap();
+        for ( cache = caches ; cache != NULL ; cache = cache->next ) {
+            if ( cache->thread == 0 )  break;
+        }
+        if ( cache == NULL ) {
+            void *address = mmap( 0, sizeof(ThreadCache), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+            if ( address == MAP_FAILED ) {
+                pthread_mutex_unlock( &mutex );
+                return NULL;
+            }
+            cache = (ThreadCache *)address;
+            for ( int i = 0 ; i < CLASSES ; ++i ) {
+                cache->magazine[i].size = class_size( i );
+            }
+            cache->next = caches;
+            __atomic_store_n( &caches, cache, __ATOMIC_RELEASE );
+        }
+        cache->thread = syscall( SYS_gettid );
+        pthread_mutex_unlock( &mutex );
+
+        pthread_setspecific( cache_key, cache );
+        thread_cache = cache;
+        return cache;
+    }
+
+    /**
+     * Pull a batch of slots from the shared pools into an empty
+     * magazine.  If the pools run dry part way through, keep what
+     * was obtained and only fail when nothing was.
+     */
+    void
+    refill( Magazine *magazine ) {
+        lock_heap();
+        try {
+            while ( magazine->count < MAGAZINE_BATCH ) {
+                magazine->slot[magazine->count] = heap.allocate( magazine->size );
+                magazine->count++;
+            }
+        } catch ( ... ) {
+            pthread_mutex_unlock( &mutex );
+            if ( magazine->count == 0 )  throw;
+            return;
+        }
+        pthread_mutex_unlock( &mutex );
+    }
+}
+
 /**
  * The exception was necessary at one point... now it appears
  * the std committee has removed them !?!?
@@ -265,67 +1012,350 @@ static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
  */
 // void* operator new (size_t size) throw(std::bad_alloc) {
 void* operator new (size_t size) {
-    pthread_mutex_lock( &mutex );
-    void *address = heap.allocate( size );
+    if ( (sample_every != 0) and (--sample_countdown <= 0) ) {
+        sample_countdown = sample_every;
+        sample( size );
+    }
+
+    if ( size <= LARGEST_CLASS ) {
+        ThreadCache *cache = current_cache();
+        if ( cache != NULL ) {
+            Magazine *magazine = &(cache->magazine[class_index(size)]);
+            if ( magazine->count == 0 )  refill( magazine );
+            magazine->allocations++;
+            return magazine->slot[--magazine->count];
+        }
+    }
+
+    lock_heap();
+    void *address;
+    try {
+        address = heap.allocate( size );
+    } catch ( ... ) {
+        pthread_mutex_unlock( &mutex );
+        throw;
+    }
+    direct[stat_row(size)].allocations++;
     pthread_mutex_unlock( &mutex );
     return address;
 }
 
+namespace {
+    /**
+     * Put a small object into the calling thread's magazine for its
+     * class.  A double free is caught here if the object is still
+     * sitting in the magazine, and by the pool bitmap once it has been
+     * spilled.
+     */
+    void
+    cache_free( ThreadCache *cache, int klass, void *address ) {
+        Magazine *magazine = &(cache->magazine[klass]);
+        for ( int i = 0 ; i < magazine->count ; ++i ) {
+            if ( magazine->slot[i] == address ) {
+                fprintf( stderr, "MemPool: object 0x%p already freed\n", address );
+                throw double_free();
+            }
+        }
+        if ( magazine->count == MAGAZINE_SLOTS ) {
+            lock_heap();
+            spill( magazine, MAGAZINE_BATCH );
+            pthread_mutex_unlock( &mutex );
+        }
+        magazine->slot[magazine->count++] = address;
+        magazine->frees++;
+    }
+}
+
 /**
+ * Freed small objects go to the calling thread's magazine, whichever
+ * thread allocated them.  Everything else goes back to its tier.
  */
 void operator delete ( void *address ) throw() {
-    pthread_mutex_lock( &mutex );
+    if ( address == NULL )  return;
+
+    ThreadCache *cache = current_cache();
+    if ( cache != NULL ) {
+        MemPool *pool = heap.owner( address );
+        if ( pool != NULL ) {
+            cache_free( cache, pool->size_class(), address );
+            return;
+        }
+    }
+
+    lock_heap();
+    int row = stat_row( address );
     heap.free( address );
+    direct[row].frees++;
     pthread_mutex_unlock( &mutex );
 }
-
+
 /**
+ * With the size in hand a small object's class is known without
+ * looking at the page map.
  */
-static int
-stats_cmd( ClientData data, Tcl_Interp *interp,
-             int objc, Tcl_Obj * CONST *objv )
-{
-    if ( objc != 1 ) {
-        Tcl_ResetResult( interp );
-        Tcl_WrongNumArgs( interp, 1, objv, "" );
-        return TCL_ERROR;
+void operator delete ( void *address, size_t size ) throw() {
+    if ( address == NULL )  return;
+
+    if ( size <= LARGEST_CLASS ) {
+        ThreadCache *cache = current_cache();
+        if ( cache != NULL ) {
+            int klass = class_index( size );
+            if ( debug ) {
+                MemPool *pool = heap.owner( address );
+                if ( (pool == NULL) or (pool->size_class() != klass) ) {
+                    fprintf( stderr, "MemPool: 0x%p deleted with wrong size %lu\n", address, size );
+                    print_stack();
+                    abort();
+                }
+            }
+            cache_free( cache, klass, address );
+            return;
+        }
     }
+    operator delete( address );
+}
+
+/**
+ */
+void* operator new[] ( size_t size ) {
+    return operator new( size );
+}
 
-    Tcl_ResetResult( interp );
-    return TCL_OK;
+/**
+ */
+void operator delete[] ( void *address ) throw() {
+    operator delete( address );
 }
 
 /**
  */
-static int
-usage_cmd( ClientData data, Tcl_Interp *interp,
-             int objc, Tcl_Obj * CONST *objv )
-{
-    if ( objc != 1 ) {
-        Tcl_ResetResult( interp );
-        Tcl_WrongNumArgs( interp, 1, objv, "" );
-        return TCL_ERROR;
+void operator delete[] ( void *address, size_t size ) throw() {
+    operator delete( address, size );
+}
+
+/**
+ * Every small class is a multiple of 16 bytes in a page aligned slab,
+ * so that much alignment is free.  Up to a page, the request is rounded
+ * to a power of two class, whose slots are naturally aligned, or to a
+ * page run.  Anything more strictly aligned gets its own mapping.
+ */
+void* operator new ( size_t size, std::align_val_t alignment ) {
+    size_t align = (size_t)alignment;
+    if ( align <= 16 )  return operator new( size );
+
+    if ( align <= PAGE_SIZE ) {
+        if ( size < align )  size = align;
+        if ( size <= LARGEST_CLASS )  size = (size_t)1 << (64 - __builtin_clzl(size - 1));
+        return operator new( size );
     }
 
-    Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
-    heap.usage( interp, result );
+    lock_heap();
+    void *address;
+    try {
+        address = heap.allocate_large( size, align );
+    } catch ( ... ) {
+        pthread_mutex_unlock( &mutex );
+        throw;
+    }
+    direct[LARGE_ROW].allocations++;
+    pthread_mutex_unlock( &mutex );
+    return address;
+}
 
-    Tcl_SetObjResult( interp, result );
-    return TCL_OK;
+/**
+ * The size given to an aligned delete is the size before rounding, so
+ * these always go by the page map.
+ */
+void operator delete ( void *address, std::align_val_t ) throw() {
+    operator delete( address );
 }
-
+
+void operator delete ( void *address, size_t, std::align_val_t ) throw() {
+    operator delete( address );
+}
+
+void* operator new[] ( size_t size, std::align_val_t alignment ) {
+    return operator new( size, alignment );
+}
+
+void operator delete[] ( void *address, std::align_val_t ) throw() {
+    operator delete( address );
+}
+
+void operator delete[] ( void *address, size_t, std::align_val_t ) throw() {
+    operator delete( address );
+}
+
 /**
+ * Slabs are never unmapped and are appended with a release store,
+ * so this walks them without the lock.
  */
 void
 Allocator::inject( Allocator::Injector *injector ) {
     Allocator::Injector &f = *injector;
-    MemPool *pool = &heap;
+    MemPool *pool = heap.first_pool();
 
     while ( pool != NULL ) {
-        if ( pool->get_size() == 0 ) return;
-        f( pool->get_size(), pool->get_count(), pool-> available_slots() );
+        f( pool->get_size(), pool->get_count(), pool->available_slots() );
         pool = pool->next_pool();
     }
 }
 
+/**
+ */
+void
+Allocator::inject( Allocator::CacheInjector *injector ) {
+    Allocator::CacheInjector &f = *injector;
+
+    /*
+     * Caches are never unlinked, so this walks the list without the
+     * lock.  The counts are a snapshot of other threads' private state
+     * and may be slightly stale by the time they are reported.
+     */
+    ThreadCache *cache = __atomic_load_n( &caches, __ATOMIC_ACQUIRE );
+    for ( ; cache != NULL ; cache = cache->next ) {
+        pid_t thread = cache->thread;
+        if ( thread == 0 )  continue;
+        for ( int i = 0 ; i < CLASSES ; ++i ) {
+            Magazine *magazine = &(cache->magazine[i]);
+            int count = __atomic_load_n( &(magazine->count), __ATOMIC_RELAXED );
+            if ( count == 0 )  continue;
+            f( thread, magazine->size, count );
+        }
+    }
+}
+
+/**
+ * The tier totals are gathered under the heap lock, and reported
+ * after it is dropped so the injector is free to allocate.
+ */
+void
+Allocator::inject( Allocator::TierInjector *injector ) {
+    Allocator::TierInjector &f = *injector;
+    static const char *names[] = { "small", "medium", "large" };
+    TierUsage tiers[3];
+
+    lock_heap();
+    heap.usage( tiers );
+    pthread_mutex_unlock( &mutex );
+
+    for ( int i = 0 ; i < 3 ; ++i ) {
+        f( names[i], tiers[i].reserved, tiers[i].resident, tiers[i].allocated, tiers[i].objects );
+    }
+}
+
+/**
+ * Allocation and free counts per size class, then medium and large.
+ * The counts in each thread's magazines are read without the lock,
+ * so a busy thread's numbers may be a few operations behind.  Peaks
+ * are taken at the shared pools, so they include slots sitting in
+ * magazines as well as live objects.
+ */
+void
+Allocator::inject( Allocator::StatsInjector *injector ) {
+    Allocator::StatsInjector &f = *injector;
+    Counters rows[ROWS];
+    unsigned long peaks[ROWS];
+
+    lock_heap();
+    for ( int i = 0 ; i < ROWS ; ++i ) {
+        rows[i] = direct[i];
+        peaks[i] = heap.peak_objects( i );
+    }
+    pthread_mutex_unlock( &mutex );
+
+    ThreadCache *cache = __atomic_load_n( &caches, __ATOMIC_ACQUIRE );
+    for ( ; cache != NULL ; cache = cache->next ) {
+        for ( int i = 0 ; i < CLASSES ; ++i ) {
+            Magazine *magazine = &(cache->magazine[i]);
+            rows[i].allocations += __atomic_load_n( &(magazine->allocations), __ATOMIC_RELAXED );
+            rows[i].frees += __atomic_load_n( &(magazine->frees), __ATOMIC_RELAXED );
+        }
+    }
+
+    for ( int i = 0 ; i < ROWS ; ++i ) {
+        const char *tier = "small";
+        size_t size = 0;
+        if ( i < CLASSES )  size = class_size( i );
+        if ( i == MEDIUM_ROW )  tier = "medium";
+        if ( i == LARGE_ROW )  tier = "large";
+        f( tier, size, rows[i].allocations, rows[i].frees, peaks[i] );
+    }
+}
+
+/**
+ * Sampled stacks, in table order.  The table is copied out under the
+ * sample lock so the injector can take its time symbolizing.
+ */
+void
+Allocator::inject( Allocator::SampleInjector *injector ) {
+    Allocator::SampleInjector &f = *injector;
+    static Sample snapshot[SAMPLE_SLOTS];
+    static pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    pthread_mutex_lock( &snapshot_mutex );
+    pthread_mutex_lock( &sample_mutex );
+    memcpy( snapshot, samples, sizeof(samples) );
+    pthread_mutex_unlock( &sample_mutex );
+
+    for ( int i = 0 ; i < SAMPLE_SLOTS ; ++i ) {
+        if ( snapshot[i].count == 0 )  continue;
+        f( snapshot[i].count, snapshot[i].bytes, snapshot[i].frames, snapshot[i].depth );
+    }
+    pthread_mutex_unlock( &snapshot_mutex );
+}
+
+/**
+ */
+void
+Allocator::lock_statistics( Allocator::LockStatistics *statistics ) {
+    lock_heap();
+    statistics->acquisitions = acquisitions;
+    statistics->contentions = contentions;
+    statistics->contended_nsec = contended_nsec;
+    statistics->longest_wait_nsec = longest_wait_nsec;
+    pthread_mutex_unlock( &mutex );
+}
+
+/**
+ * Sample one allocation in every `every' per thread, or stop sampling
+ * with 0.  Changing the rate starts a fresh table.
+ */
+void
+Allocator::sampling( int every ) {
+    if ( every < 0 )  every = 0;
+
+    pthread_mutex_lock( &sample_mutex );
+    if ( every != sample_every ) {
+        memset( samples, 0, sizeof(samples) );
+        samples_dropped = 0;
+    }
+    sample_every = every;
+    pthread_mutex_unlock( &sample_mutex );
+}
+
+int
+Allocator::sampling() {
+    return sample_every;
+}
+
+unsigned long
+Allocator::dropped_samples() {
+    return samples_dropped;
+}
+
+/**
+ * Turn the per-thread magazines on or off.  Slots already cached
+ * stay where they are and are used again if caching is turned back on.
+ */
+void
+Allocator::thread_caches( bool enabled ) {
+    caching = enabled;
+}
+
+bool
+Allocator::thread_caches() {
+    return caching;
+}
+
 /* vim: set autoindent expandtab sw=4 : */
@@ -7,6 +7,7 @@
 #ifndef _ALLOCATOR_H_
 #define _ALLOCATOR_H_
 
+#include <sys/types.h>
 #include <stdint.h>
 
 namespace Allocator {
@@ -22,7 +23,76 @@ namespace Allocator {
         virtual void operator () ( size_t objsize, int allocated, uint32_t available ) = 0;
     };
 
+    /**
+     * The CacheInjector object will be called once for each object size
+     * held in each thread's magazine cache, with the number of free
+     * slots that thread currently holds for that size.
+     */
+    class CacheInjector {
+    public:
+        CacheInjector() {}
+        virtual ~CacheInjector() {}
+        virtual void operator () ( pid_t thread, size_t objsize, int cached ) = 0;
+    };
+
+    /**
+     * The TierInjector object will be called once for each tier of the
+     * heap ("small", "medium" and "large") with the address space it
+     * has reserved, how much of that is resident, and how much is
+     * handed out to live objects.
+     */
+    class TierInjector {
+    public:
+        TierInjector() {}
+        virtual ~TierInjector() {}
+        virtual void operator () ( const char *tier, size_t reserved, size_t resident, size_t allocated, unsigned long objects ) = 0;
+    };
+
+    /**
+     * The StatsInjector object will be called once for each small size
+     * class (tier "small"), and once each for all "medium" and all
+     * "large" objects (with objsize 0), with the number of allocations
+     * and frees so far and the most objects ever out at once.
+     */
+    class StatsInjector {
+    public:
+        StatsInjector() {}
+        virtual ~StatsInjector() {}
+        virtual void operator () ( const char *tier, size_t objsize, unsigned long allocations, unsigned long frees, unsigned long peak ) = 0;
+    };
+
+    /**
+     * The SampleInjector object will be called once for each distinct
+     * call stack recorded by allocation sampling.
+     */
+    class SampleInjector {
+    public:
+        SampleInjector() {}
+        virtual ~SampleInjector() {}
+        virtual void operator () ( unsigned long count, size_t bytes, void **frames, int depth ) = 0;
+    };
+
+    struct LockStatistics {
+        unsigned long acquisitions;
+        unsigned long contentions;
+        uint64_t contended_nsec;
+        uint64_t longest_wait_nsec;
+    };
+
     void inject( Injector * );
+    void inject( CacheInjector * );
+    void inject( TierInjector * );
+    void inject( StatsInjector * );
+    void inject( SampleInjector * );
+
+    void lock_statistics( LockStatistics * );
+
+    void sampling( int );
+    int sampling();
+    unsigned long dropped_samples();
+
+    void thread_caches( bool );
+    bool thread_caches();
 }
 
 #endif
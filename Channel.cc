@@ -24,6 +24,13 @@
 /** \file Channel.cc
  * \brief 
  *
+ * The SEQPACKET transport listens on a Unix domain socket named for
+ * the service (in the abstract namespace on Linux).  Every message
+ * is one or more frames, each a channel_frame header and up to
+ * FRAME_PAYLOAD bytes; MORE is set on all but the last.  Frames of
+ * different requests on one connection may interleave, so both ends
+ * reassemble by request id.
+ *
  * The problem with SYSV message queues for bidirectional messages, is that
  * if the message is read it is deleted.  If the process reading the message
  * fails in some manner, then the message is not processed and the sender
@@ -37,6 +44,12 @@
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/msg.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/file.h>
+
+#include <stddef.h>
+#include <fcntl.h>
 
 #include <unistd.h>
 #include <stdlib.h>
@@ -44,9 +57,11 @@
 #include <errno.h>
 #include <string.h>
 #include <syslog.h>
-#include <glob.h>
+#include <signal.h>
+#include <poll.h>
 
 #include "string_util.h"
+#include "PlatformThread.h"
 #include "Channel.h"
 #include "Service.h"
 
@@ -66,38 +81,234 @@ struct channel_message {
 #define MESSAGE_ERROR     1
 #define MESSAGE_EXCEPTION 2
 
-/** 
- * Look through list of processes to see if the named service is
- * alive.  We check by looking a process that has its executable
- * as /usr/sbin/[service_name].
- *
- * Note: readlink does not NULL terminate the strings it reads, so
- *   we must do it explicitly.
- */
-static int
-is_alive( char *service_name ) {
-    int result = 0;
-    glob_t processes;
-    size_t i;
-    char exe[256], path[80];
-
-    sprintf( path, "/usr/sbin/%s", service_name );
-
-    memset( &processes, 0, sizeof(processes) );
-    glob( "/proc/*/exe", GLOB_NOSORT, NULL, &processes );
-
-    for ( i = 0 ; i < processes.gl_pathc ; i++ ) {
-        int count = readlink( processes.gl_pathv[i], exe, sizeof(exe) );
-        if ( count == -1 ) continue;
-        exe[count] = '\0';
-        if ( strcmp(exe, path) == 0 ) {
-            result = 1;
-            break;
+struct channel_frame {
+    uint32_t magic;
+    uint32_t flags;
+    uint64_t id;
+    int32_t error;
+    uint32_t length;
+};
+#define FRAME_MAGIC   0x52584348        /* "RXCH" */
+#define FRAME_MORE    0x1
+#define FRAME_PAYLOAD (32 * 1024)
+
+/**
+ * One client connection on the service side.  A connection that has
+ * hung up stays allocated until the responses to its outstanding
+ * requests have been sent (and dropped).
+ */
+struct Channel::Connection {
+    int fd;
+    bool closed;
+    int outstanding;
+    pthread_mutex_t send_lock;
+    std::map<uint64_t, std::vector<char> > partials;
+    size_t partial_bytes;
+    std::deque<std::vector<char> > outbox;
+    size_t queued;
+};
+
+/*
+ * What one client may have in flight on the service side: requests
+ * still being reassembled, and responses it has not read yet.  A
+ * client over either limit is dropped.
+ */
+#define MAX_PARTIAL_BYTES (16 * 1024 * 1024)
+#define MAX_QUEUED_BYTES  (16 * 1024 * 1024)
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+namespace {
+
+    /**
+     * The socket address of a service's channel.
+     */
+    socklen_t channel_address( const char *service_name, struct sockaddr_un *address ) {
+        memset( address, 0, sizeof(*address) );
+        address->sun_family = AF_UNIX;
+#if defined(__APPLE__) || defined(__darwin__)
+        snprintf( address->sun_path, sizeof(address->sun_path), "/var/run/%s.channel", service_name );
+        return sizeof(*address);
+#else
+        // abstract: leading NUL, nothing left behind on the filesystem
+        int length = snprintf( address->sun_path + 1, sizeof(address->sun_path) - 1,
+                               "redx.channel.%s", service_name );
+        return offsetof(struct sockaddr_un, sun_path) + 1 + length;
+#endif
+    }
+
+    /**
+     * Where there is no MSG_NOSIGNAL the socket itself is told not to
+     * raise SIGPIPE.
+     */
+    void no_sigpipe( int fd ) {
+#ifdef SO_NOSIGPIPE
+        int on = 1;
+        setsockopt( fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on) );
+#endif
+    }
+
+    /**
+     * A close on exec SEQPACKET socket.
+     */
+    int channel_socket() {
+#ifdef SOCK_CLOEXEC
+        int fd = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 );
+#else
+        int fd = socket( AF_UNIX, SOCK_SEQPACKET, 0 );
+        if ( fd >= 0 )  fcntl( fd, F_SETFD, FD_CLOEXEC );
+#endif
+        if ( fd >= 0 )  no_sigpipe( fd );
+        return fd;
+    }
+
+    /**
+     * Send one frame.  SEQPACKET keeps each frame whole, so it either
+     * goes or (with MSG_DONTWAIT in flags) fails with EAGAIN.
+     */
+    ssize_t send_frame( int fd, uint64_t id, int error, bool more,
+                        const char *data, size_t chunk, int flags ) {
+        struct channel_frame frame;
+        frame.magic = FRAME_MAGIC;
+        frame.flags = more ? FRAME_MORE : 0;
+        frame.id = id;
+        frame.error = error;
+        frame.length = chunk;
+
+        struct iovec iov[2];
+        iov[0].iov_base = &frame;
+        iov[0].iov_len = sizeof(frame);
+        iov[1].iov_base = (void *)data;
+        iov[1].iov_len = chunk;
+        struct msghdr message;
+        memset( &message, 0, sizeof(message) );
+        message.msg_iov = iov;
+        message.msg_iovlen = 2;
+
+        ssize_t bytes;
+        do {
+            bytes = sendmsg( fd, &message, SEND_FLAGS | flags );
+        } while ( (bytes < 0) and (errno == EINTR) );
+        return bytes;
+    }
+
+    /**
+     * A frame as it goes on the wire, for the outbox.
+     */
+    void queue_frame( std::deque<std::vector<char> >& outbox, uint64_t id, int error, bool more,
+                      const char *data, size_t chunk ) {
+        struct channel_frame frame;
+        frame.magic = FRAME_MAGIC;
+        frame.flags = more ? FRAME_MORE : 0;
+        frame.id = id;
+        frame.error = error;
+        frame.length = chunk;
+
+        outbox.push_back( std::vector<char>() );
+        std::vector<char>& wire = outbox.back();
+        wire.reserve( sizeof(frame) + chunk );
+        wire.insert( wire.end(), (char *)&frame, (char *)&frame + sizeof(frame) );
+        wire.insert( wire.end(), data, data + chunk );
+    }
+
+    /**
+     * Read one frame into buffer (FRAME_PAYLOAD + header).  Returns
+     * the bytes read, 0 on hang up, -1 on error or a malformed frame.
+     */
+    ssize_t read_frame( int fd, char *buffer, size_t size ) {
+        ssize_t bytes;
+        do {
+            bytes = recv( fd, buffer, size, MSG_TRUNC );
+        } while ( (bytes < 0) and (errno == EINTR) );
+        if ( bytes <= 0 )  return bytes;
+        if ( (size_t)bytes > size )  return -1;
+        if ( (size_t)bytes < sizeof(struct channel_frame) )  return -1;
+        struct channel_frame *frame = (struct channel_frame *)buffer;
+        if ( frame->magic != FRAME_MAGIC )  return -1;
+        if ( frame->length != bytes - sizeof(struct channel_frame) )  return -1;
+        return bytes;
+    }
+
+    const size_t FRAME_BUFFER = sizeof(struct channel_frame) + FRAME_PAYLOAD;
+
+    void pid_path( const char *service_name, char *path, size_t length ) {
+        snprintf( path, length, "/var/run/%s/service.pid", service_name );
+    }
+
+    pid_t read_pid( int fd ) {
+        char buffer[32];
+        ssize_t bytes = pread( fd, buffer, sizeof(buffer) - 1, 0 );
+        if ( bytes <= 0 )  return -1;
+        buffer[bytes] = '\0';
+        return atoi( buffer );
+    }
+
+    /**
+     * The running service holds a lock on its pid file.  Where there
+     * are open file description locks, clients can test for it without
+     * taking a lock of their own.  Elsewhere a client's probe briefly
+     * holds a shared flock, so the service retries for a second before
+     * deciding another copy is running.
+     */
+    bool lock_pid_file( int fd ) {
+#ifdef F_OFD_SETLK
+        struct flock lock;
+        memset( &lock, 0, sizeof(lock) );
+        lock.l_type = F_WRLCK;
+        lock.l_whence = SEEK_SET;
+        return fcntl( fd, F_OFD_SETLK, &lock ) == 0;
+#else
+        for ( int attempt = 0 ; attempt < 20 ; ++attempt ) {
+            if ( flock(fd, LOCK_EX | LOCK_NB) == 0 )  return true;
+            if ( errno != EWOULDBLOCK )  return false;
+            usleep( 50000 );
         }
+        return false;
+#endif
     }
 
-    globfree( &processes );
-    return result;
+    bool pid_file_locked( int fd ) {
+#ifdef F_OFD_GETLK
+        struct flock lock;
+        memset( &lock, 0, sizeof(lock) );
+        lock.l_type = F_RDLCK;
+        lock.l_whence = SEEK_SET;
+        if ( fcntl(fd, F_OFD_GETLK, &lock) < 0 )  return false;
+        return lock.l_type != F_UNLCK;
+#else
+        if ( flock(fd, LOCK_SH | LOCK_NB) == 0 ) {
+            flock( fd, LOCK_UN );
+            return false;
+        }
+        return errno == EWOULDBLOCK;
+#endif
+    }
+}
+
+/**
+ */
+bool
+Channel::transport_named( const char *name, Transport *transport ) {
+    if ( strcmp(name, "msgq") == 0 ) {
+        *transport = MESSAGE_QUEUE;
+        return true;
+    }
+    if ( strcmp(name, "seqpacket") == 0 ) {
+        *transport = SEQPACKET;
+        return true;
+    }
+    return false;
+}
+
+/**
+ */
+const char *
+Channel::transport_name( Transport transport ) {
+    return (transport == SEQPACKET) ? "seqpacket" : "msgq";
 }
 
 /**
@@ -134,8 +345,41 @@ key_t service_key( const char *service_name ) {
  * so neither could start.  So, the client needs to be able to
  * create the server's directory also.
  */
-Channel::Channel( Service *service )
-: service(service) {
+Channel::Channel( Service *service, Transport transport )
+: service(service),
+  q(-1),
+  transport(transport),
+  listener(-1),
+  pid_fd(-1),
+  next_sender(1)
+{
+    wake[0] = wake[1] = -1;
+    pthread_mutex_init( &lock, NULL );
+    register_service();
+
+    if ( transport == SEQPACKET ) {
+        struct sockaddr_un address;
+        socklen_t length = channel_address( service->name(), &address );
+        listener = channel_socket();
+        if ( (listener < 0) or (pipe(wake) < 0) ) {
+            syslog( LOG_ERR, "could not create a channel socket for '%s'", service->name() );
+            exit( 1 );
+        }
+        if ( address.sun_path[0] != '\0' )  unlink( address.sun_path );
+        if ( (bind(listener, (struct sockaddr *)&address, length) < 0) or
+             (listen(listener, 64) < 0) ) {
+            syslog( LOG_ERR, "could not listen on the channel for '%s': %s",
+                    service->name(), strerror(errno) );
+            exit( 1 );
+        }
+        for ( int i = 0 ; i < 2 ; ++i ) {
+            fcntl( wake[i], F_SETFD, FD_CLOEXEC );
+            fcntl( wake[i], F_SETFL, fcntl(wake[i], F_GETFL) | O_NONBLOCK );
+        }
+        syslog( LOG_NOTICE, "channel socket for '%s'", service->name() );
+        return;
+    }
+
     key_t key = service_key( service->name() );
     syslog( LOG_NOTICE, "msgQ id = 0x%08x", key );
 
@@ -147,48 +391,408 @@ Channel::Channel( Service *service )
     }
 }
 
+/**
+ * Take the service's pid file lock and write our pid into it.  The
+ * lock goes with the process, so a client that finds it held knows
+ * the pid in the file is live, and not a reused one.
+ */
+void
+Channel::register_service() {
+    char path[256];
+    snprintf( path, sizeof(path), "/var/run/%s", service->name() );
+    mkdir( path, 0755 );
+    pid_path( service->name(), path, sizeof(path) );
+
+    pid_fd = open( path, O_RDWR | O_CREAT | O_CLOEXEC, 0644 );
+    if ( pid_fd < 0 ) {
+        syslog( LOG_WARNING, "cannot create '%s': %s", path, strerror(errno) );
+        return;
+    }
+    if ( lock_pid_file(pid_fd) == false ) {
+        syslog( LOG_ERR, "'%s' is already running as %d", service->name(), read_pid(pid_fd) );
+        exit( 1 );
+    }
+
+    char buffer[32];
+    int length = snprintf( buffer, sizeof(buffer), "%d\n", getpid() );
+    if ( (ftruncate(pid_fd, 0) < 0) or (pwrite(pid_fd, buffer, length, 0) != length) ) {
+        syslog( LOG_WARNING, "cannot write '%s': %s", path, strerror(errno) );
+    }
+}
+
+/**
+ */
+void
+Channel::send( long dst, int result, const char *message ) {
+    send( dst, result, message, strlen(message) );
+}
+
 /**
  * \todo should use IPC_NOWAIT -- and try again if EAGAIN
  * \todo fix message length calculation
+ *
+ * On a socket the whole response goes back, on the connection and
+ * under the id it came in with.  Responses for a client that has
+ * gone away are dropped.
  */
 void
-Channel::send( long dst, int result, char *message ) {
+Channel::send( long dst, int result, const char *message, size_t length ) {
+    if ( transport == SEQPACKET ) {
+        pthread_mutex_lock( &lock );
+        std::map<long, Pending>::iterator entry = pending.find( dst );
+        if ( entry == pending.end() ) {
+            pthread_mutex_unlock( &lock );
+            syslog( LOG_WARNING, "no request %ld to respond to", dst );
+            return;
+        }
+        Pending request = entry->second;
+        pending.erase( entry );
+        bool closed = request.connection->closed;
+        pthread_mutex_unlock( &lock );
+
+        Connection *connection = request.connection;
+        if ( closed == false )  respond( connection, request.request, result, message, length );
+        release( connection );
+        return;
+    }
+
     int flags = 0; // IPC_NOWAIT | MSG_NOERROR
     struct channel_message m;
     m.dst = dst;
     m.src = 1;
     m.error = result;
-    int bytes = strlcpy( m.body, message, sizeof(m.body) );
-    if ( bytes > sizeof(m.body) ) {
+    size_t bytes = length;
+    if ( bytes >= sizeof(m.body) ) {
         syslog( LOG_WARNING, "message body truncated" );
         bytes = sizeof(m.body) - 1;
     }
+    memcpy( m.body, message, bytes );
+    m.body[bytes] = '\0';
     if ( msgsnd(q, &m, bytes + sizeof(char) + sizeof(long) + sizeof(long), flags) < 0 ) {
         syslog( LOG_ERR, "failed to msgsnd" );
     }
 }
 
+/**
+ * Send a response without blocking.  What the client is not ready to
+ * take waits in the connection's outbox, behind anything already
+ * there, and receive() sends it as the socket drains; a client that
+ * lets too much pile up is disconnected.
+ */
+void
+Channel::respond( Connection *connection, uint64_t id, int result, const char *message, size_t length ) {
+    pthread_mutex_lock( &(connection->send_lock) );
+    bool was_empty = connection->outbox.empty();
+    bool failed = false;
+    size_t offset = 0;
+    do {
+        size_t chunk = length - offset;
+        if ( chunk > FRAME_PAYLOAD )  chunk = FRAME_PAYLOAD;
+        bool more = (offset + chunk < length);
+
+        if ( connection->outbox.empty() ) {
+            ssize_t bytes = send_frame( connection->fd, id, result, more, message + offset, chunk, MSG_DONTWAIT );
+            if ( bytes >= 0 ) {
+                offset += chunk;
+                continue;
+            }
+            if ( (errno != EAGAIN) and (errno != EWOULDBLOCK) ) {
+                syslog( LOG_ERR, "failed to send channel response: %s", strerror(errno) );
+                failed = true;
+                break;
+            }
+        }
+        if ( connection->queued + chunk > MAX_QUEUED_BYTES ) {
+            syslog( LOG_WARNING, "dropping channel client: %zu bytes of responses unread", connection->queued );
+            failed = true;
+            break;
+        }
+        queue_frame( connection->outbox, id, result, more, message + offset, chunk );
+        connection->queued += sizeof(struct channel_frame) + chunk;
+        offset += chunk;
+    } while ( offset < length );
+
+    if ( failed ) {
+        connection->outbox.clear();
+        connection->queued = 0;
+        // the service thread sees the hang up and drops the client
+        shutdown( connection->fd, SHUT_RDWR );
+    }
+    bool waiting = was_empty and not connection->outbox.empty();
+    pthread_mutex_unlock( &(connection->send_lock) );
+
+    // have receive() poll for the socket to drain
+    if ( waiting and (write(wake[1], "", 1) < 0) and (errno != EAGAIN) ) {
+        syslog( LOG_ERR, "cannot wake channel: %s", strerror(errno) );
+    }
+}
+
+/**
+ * Send what the outbox holds until the socket is full again.
+ */
+void
+Channel::flush( Connection *connection ) {
+    pthread_mutex_lock( &(connection->send_lock) );
+    while ( connection->outbox.empty() == false ) {
+        std::vector<char>& wire = connection->outbox.front();
+        ssize_t bytes;
+        do {
+            bytes = ::send( connection->fd, &wire[0], wire.size(), SEND_FLAGS | MSG_DONTWAIT );
+        } while ( (bytes < 0) and (errno == EINTR) );
+        if ( bytes < 0 ) {
+            if ( (errno == EAGAIN) or (errno == EWOULDBLOCK) )  break;
+            connection->outbox.clear();
+            connection->queued = 0;
+            break;
+        }
+        connection->queued -= wire.size();
+        connection->outbox.pop_front();
+    }
+    pthread_mutex_unlock( &(connection->send_lock) );
+}
+
+/**
+ * Drop one outstanding request's hold on a connection, and free the
+ * connection if it has hung up and nothing else refers to it.
+ */
+void
+Channel::release( Connection *connection ) {
+    pthread_mutex_lock( &lock );
+    connection->outstanding--;
+    bool done = connection->closed and (connection->outstanding == 0);
+    pthread_mutex_unlock( &lock );
+    if ( done ) {
+        close( connection->fd );
+        pthread_mutex_destroy( &(connection->send_lock) );
+        delete connection;
+    }
+}
+
+/**
+ * Whether the client that sent a request is still there to take the
+ * response.  A request from a client that is gone is forgotten, and
+ * must not be responded to.
+ */
+bool
+Channel::alive( long sender ) {
+    if ( transport == SEQPACKET ) {
+        pthread_mutex_lock( &lock );
+        std::map<long, Pending>::iterator entry = pending.find( sender );
+        if ( entry == pending.end() ) {
+            pthread_mutex_unlock( &lock );
+            return false;
+        }
+        Connection *connection = entry->second.connection;
+        if ( connection->closed == false ) {
+            pthread_mutex_unlock( &lock );
+            return true;
+        }
+        pending.erase( entry );
+        pthread_mutex_unlock( &lock );
+        release( connection );
+        return false;
+    }
+    return ::kill( sender, 0 ) == 0;
+}
+
 /**
  * block ... read from Q and process msg
- * \todo add retry logic when we get a msgrcv err on Channel
+ * The request is copied, and truncated, into the caller's buffer.
  */
 long
 Channel::receive( char *buffer, int length ) {
+    char *request;
+    size_t request_length;
+    long sender = receive( &request, &request_length );
+    strlcpy( buffer, request, length );
+    free( request );
+    return sender;
+}
+
+/**
+ * Wait for the next request.  The request is returned, NUL
+ * terminated, in a buffer from malloc() for the caller to free.
+ */
+long
+Channel::receive( char **request, size_t *length ) {
+    if ( transport == SEQPACKET )  return receive_socket( request, length );
+    return receive_queue( request, length );
+}
+
+/**
+ * \todo add retry logic when we get a msgrcv err on Channel
+ */
+long
+Channel::receive_queue( char **buffer, size_t *length ) {
     int flags = 0; // IPC_NOWAIT | MSG_NOERROR
     struct channel_message request;
     int bytes = msgrcv( q, &request, sizeof(request), 1, flags );
     if ( bytes < 0 ) {
         // how to handle error
         syslog( LOG_ERR, "Error receiving Channel request" );
+        request.body[0] = '\0';
+        request.src = 0;
     }
+    request.body[sizeof(request.body) - 1] = '\0';
     if ( debug > 0 ) syslog( LOG_NOTICE, "request '%s'", request.body );
-    strlcpy( buffer, request.body, length );
+    *buffer = strdup( request.body );
+    *length = strlen( request.body );
     return request.src;
 }
-
+
 /**
+ * Poll the listener and every open connection until a request is
+ * complete.  Requests completed together are queued in ready and
+ * handed out one per call.
  */
-ChannelClient::ChannelClient( char *service_name ) {
+long
+Channel::receive_socket( char **buffer, size_t *length ) {
+    std::vector<struct pollfd> fds;
+    std::vector<Connection *> polled;
+
+    while ( ready.empty() ) {
+        fds.clear();
+        polled.clear();
+        struct pollfd entry;
+        entry.fd = listener;
+        entry.events = POLLIN;
+        entry.revents = 0;
+        fds.push_back( entry );
+        entry.fd = wake[0];
+        fds.push_back( entry );
+        for ( size_t i = 0 ; i < connections.size() ; ++i ) {
+            Connection *connection = connections[i];
+            entry.fd = connection->fd;
+            pthread_mutex_lock( &(connection->send_lock) );
+            entry.events = connection->outbox.empty() ? POLLIN : (POLLIN | POLLOUT);
+            pthread_mutex_unlock( &(connection->send_lock) );
+            fds.push_back( entry );
+            polled.push_back( connection );
+        }
+
+        if ( poll(&fds[0], fds.size(), -1) < 0 ) {
+            if ( errno == EINTR )  continue;
+            syslog( LOG_ERR, "channel poll failed: %s", strerror(errno) );
+            sleep( 1 );
+            continue;
+        }
+        if ( fds[1].revents & POLLIN ) {
+            char drain[64];
+            while ( read(wake[0], drain, sizeof(drain)) > 0 ) ;
+        }
+        for ( size_t i = 0 ; i < polled.size() ; ++i ) {
+            short revents = fds[i + 2].revents;
+            if ( revents & POLLOUT )  flush( polled[i] );
+            if ( revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL) )  read_connection( polled[i] );
+        }
+        if ( fds[0].revents & POLLIN )  accept_connection();
+    }
+
+    Request request = ready.front();
+    ready.pop_front();
+    *buffer = request.body;
+    *length = request.length;
+    return request.sender;
+}
+
+/**
+ */
+void
+Channel::accept_connection() {
+    int fd = accept( listener, NULL, NULL );
+    if ( fd < 0 ) {
+        if ( debug > 0 ) syslog( LOG_NOTICE, "channel accept failed: %s", strerror(errno) );
+        return;
+    }
+    fcntl( fd, F_SETFD, FD_CLOEXEC );
+    no_sigpipe( fd );
+
+    Connection *connection = new Connection;
+    connection->fd = fd;
+    connection->closed = false;
+    connection->partial_bytes = 0;
+    connection->queued = 0;
+    // the receiving side's own hold, dropped when the client hangs up
+    connection->outstanding = 1;
+    pthread_mutex_init( &(connection->send_lock), NULL );
+    connections.push_back( connection );
+}
+
+/**
+ * Stop reading a connection that has hung up or misbehaved.  Requests
+ * still being served keep it allocated, and their responses are
+ * dropped.
+ */
+void
+Channel::drop_connection( Connection *connection ) {
+    for ( size_t i = 0 ; i < connections.size() ; ++i ) {
+        if ( connections[i] == connection ) {
+            connections.erase( connections.begin() + i );
+            break;
+        }
+    }
+    pthread_mutex_lock( &lock );
+    connection->closed = true;
+    pthread_mutex_unlock( &lock );
+    connection->partials.clear();
+    shutdown( connection->fd, SHUT_RDWR );
+    release( connection );
+}
+
+/**
+ * Take one frame from a connection.  A completed request gets a
+ * sender id of its own and goes on the ready queue.  On hang up or a
+ * malformed frame the connection is closed; requests still being
+ * served keep it allocated until they respond.
+ */
+void
+Channel::read_connection( Connection *connection ) {
+    char frame_buffer[FRAME_BUFFER];
+    ssize_t bytes = read_frame( connection->fd, frame_buffer, sizeof(frame_buffer) );
+    if ( bytes <= 0 ) {
+        if ( bytes < 0 )  syslog( LOG_WARNING, "dropping channel client: bad frame" );
+        drop_connection( connection );
+        return;
+    }
+
+    struct channel_frame *frame = (struct channel_frame *)frame_buffer;
+    connection->partial_bytes += frame->length;
+    if ( connection->partial_bytes > MAX_PARTIAL_BYTES ) {
+        syslog( LOG_WARNING, "dropping channel client: %zu bytes of requests incomplete",
+                connection->partial_bytes );
+        drop_connection( connection );
+        return;
+    }
+    std::vector<char>& body = connection->partials[frame->id];
+    body.insert( body.end(), frame_buffer + sizeof(*frame), frame_buffer + bytes );
+    if ( frame->flags & FRAME_MORE )  return;
+    connection->partial_bytes -= body.size();
+
+    Request request;
+    request.length = body.size();
+    request.body = (char *)malloc( request.length + 1 );
+    if ( request.length > 0 )  memcpy( request.body, &body[0], request.length );
+    request.body[request.length] = '\0';
+    connection->partials.erase( frame->id );
+
+    pthread_mutex_lock( &lock );
+    request.sender = next_sender++;
+    Pending entry;
+    entry.connection = connection;
+    entry.request = frame->id;
+    pending[request.sender] = entry;
+    connection->outstanding++;
+    pthread_mutex_unlock( &lock );
+
+    if ( debug > 0 ) syslog( LOG_NOTICE, "request %ld (%zu bytes)", request.sender, request.length );
+    ready.push_back( request );
+}
+
+/**
+ */
+ChannelClient::ChannelClient( char *service_name )
+: q(-1), transport(Channel::MESSAGE_QUEUE), fd(-1), broken(false), service_handle(-1), next_id(1)
+{
     strlcpy( service, service_name, sizeof(service) );
     key_t key = service_key( service_name );
     // Eventually change this so only root can send...
@@ -199,25 +803,339 @@ ChannelClient::ChannelClient( char *service_name ) {
     }
 }
 
+/**
+ * A client on the given transport.  A socket client connects when it
+ * first sends, so it may be made before the service is up.
+ */
+ChannelClient::ChannelClient( char *service_name, Channel::Transport transport )
+: q(-1), transport(transport), fd(-1), broken(false), service_handle(-1), next_id(1)
+{
+    strlcpy( service, service_name, sizeof(service) );
+    if ( transport == Channel::SEQPACKET )  return;
+
+    key_t key = service_key( service_name );
+    q = msgget( key, IPC_CREAT | 0777 );
+    if ( q < 0 ) {
+        syslog( LOG_ERR, "could not create a msgQ for '%s'", service_name );
+        exit( 1 );
+    }
+}
+
+/**
+ */
+ChannelClient::~ChannelClient() {
+    if ( fd != -1 )  close( fd );
+    if ( service_handle != -1 )  close( service_handle );
+    std::map<uint64_t, Reply>::iterator reply = replies.begin();
+    for ( ; reply != replies.end() ; ++reply )  free( reply->second.body );
+    std::map<uint64_t, Partial>::iterator partial = partials.begin();
+    for ( ; partial != partials.end() ; ++partial )  free( partial->second.body );
+}
+
+/**
+ */
+bool
+ChannelClient::connect_socket() {
+    if ( (fd != -1) and not broken )  return true;
+    if ( fd != -1 )  close( fd );
+    broken = false;
+    struct sockaddr_un address;
+    socklen_t length = channel_address( service, &address );
+    fd = channel_socket();
+    if ( fd < 0 )  return false;
+    if ( connect(fd, (struct sockaddr *)&address, length) < 0 ) {
+        syslog( LOG_ERR, "could not connect to the '%s' channel: %s", service, strerror(errno) );
+        close( fd );
+        fd = -1;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Find the running service from its pid file and open a handle on
+ * it.  The file lock is checked again after the handle is open: if
+ * it is still held and the pid has not changed, the handle is on the
+ * live service.
+ */
+bool
+ChannelClient::resolve_service() {
+    char path[256];
+    pid_path( service, path, sizeof(path) );
+    int pid_fd = open( path, O_RDONLY | O_CLOEXEC );
+    if ( pid_fd < 0 )  return false;
+
+    bool result = false;
+    if ( pid_file_locked(pid_fd) ) {
+        pid_t pid = read_pid( pid_fd );
+        int handle = (pid > 0) ? process_handle( pid ) : -1;
+        if ( handle != -1 ) {
+            if ( pid_file_locked(pid_fd) and (read_pid(pid_fd) == pid) ) {
+                service_handle = handle;
+                result = true;
+            } else {
+                close( handle );
+            }
+        }
+    }
+    close( pid_fd );
+    return result;
+}
+
+/**
+ * Whether the service is running.  Once the service has been found
+ * this is a poll() on its process handle; when that reports the
+ * service has exited, look again in case it was restarted.
+ */
+bool
+ChannelClient::alive() {
+    if ( service_handle != -1 ) {
+        struct pollfd entry;
+        entry.fd = service_handle;
+        entry.events = POLLIN;
+        entry.revents = 0;
+        if ( poll(&entry, 1, 0) == 0 )  return true;
+        close( service_handle );
+        service_handle = -1;
+    }
+    return resolve_service();
+}
+
 /**
  * \todo should use IPC_NOWAIT -- and try again if EAGAIN
  * \todo fix message length calculation
  */
 void
 ChannelClient::send( char *message ) {
+    submit( message, strlen(message) );
+}
+
+/**
+ * Send a request and return its id, to wait() on later.  A socket
+ * request that cannot be sent is answered locally with
+ * MESSAGE_EXCEPTION, so wait() does not block on it.
+ */
+uint64_t
+ChannelClient::submit( const char *message, size_t length ) {
+    uint64_t id = next_id++;
+    outstanding.insert( id );
+
+    if ( transport == Channel::SEQPACKET ) {
+        if ( (connect_socket() == false) or (transmit(id, message, length) == false) ) {
+            if ( fd != -1 )  broken = true;
+            Reply failed;
+            failed.error = MESSAGE_EXCEPTION;
+            failed.body = strdup( "channel unavailable" );
+            failed.length = strlen( failed.body );
+            replies[id] = failed;
+        }
+        return id;
+    }
+
     int flags = 0; // IPC_NOWAIT | MSG_NOERROR
     struct channel_message m;
     m.dst = 1;
     m.src = getpid();
     m.error = 0;
-    int bytes = strlcpy( m.body, message, sizeof(m.body) );
-    if ( bytes > sizeof(m.body) ) {
+    size_t bytes = length;
+    if ( bytes >= sizeof(m.body) ) {
         syslog( LOG_WARNING, "message body truncated" );
         bytes = sizeof(m.body) - 1;
     }
+    memcpy( m.body, message, bytes );
+    m.body[bytes] = '\0';
     if ( msgsnd(q, &m, bytes + sizeof(char) + sizeof(long) + sizeof(long), flags) < 0 ) {
         syslog( LOG_ERR, "failed to msgsnd" );
     }
+    return id;
+}
+
+/**
+ * Read one frame from the service, waiting at most timeout ms (-1
+ * for ever).  Returns false on timeout or if the connection is lost,
+ * in which case every outstanding request is answered with
+ * MESSAGE_EXCEPTION.
+ */
+bool
+ChannelClient::read_reply( int timeout ) {
+    struct pollfd entry;
+    entry.fd = fd;
+    entry.events = POLLIN;
+    entry.revents = 0;
+    int count = poll( &entry, 1, timeout );
+    if ( count == 0 )  return false;
+    if ( (count < 0) and (errno == EINTR) )  return true;
+
+    char buffer[FRAME_BUFFER];
+    ssize_t bytes = (count < 0) ? -1 : read_frame( fd, buffer, sizeof(buffer) );
+    if ( bytes <= 0 ) {
+        broken = true;
+        std::set<uint64_t>::iterator request = outstanding.begin();
+        for ( ; request != outstanding.end() ; ++request ) {
+            if ( replies.count(*request) > 0 )  continue;
+            Reply lost;
+            lost.error = MESSAGE_EXCEPTION;
+            lost.body = strdup( "channel closed" );
+            lost.length = strlen( lost.body );
+            replies[*request] = lost;
+        }
+        std::map<uint64_t, Partial>::iterator partial = partials.begin();
+        for ( ; partial != partials.end() ; ++partial )  free( partial->second.body );
+        partials.clear();
+        return false;
+    }
+
+    struct channel_frame *frame = (struct channel_frame *)buffer;
+    Partial& part = partials[frame->id];
+    char *grown = (char *)realloc( part.body, part.length + frame->length + 1 );
+    if ( grown == NULL )  return false;
+    part.body = grown;
+    memcpy( part.body + part.length, buffer + sizeof(*frame), frame->length );
+    part.length += frame->length;
+    part.body[part.length] = '\0';
+    if ( frame->flags & FRAME_MORE )  return true;
+
+    if ( outstanding.count(frame->id) == 0 ) {
+        // nobody is waiting any more (the wait timed out)
+        free( part.body );
+        partials.erase( frame->id );
+        return true;
+    }
+
+    Reply reply;
+    reply.error = frame->error;
+    reply.body = part.body;
+    reply.length = part.length;
+    replies[frame->id] = reply;
+    partials.erase( frame->id );
+    return true;
+}
+
+/**
+ * Write a request as frames.  Replies already on their way are read
+ * while the socket is full and again once the request is sent, so a
+ * long batch never leaves the service waiting for us to read.
+ */
+bool
+ChannelClient::transmit( uint64_t id, const char *message, size_t length ) {
+    size_t offset = 0;
+    do {
+        size_t chunk = length - offset;
+        if ( chunk > FRAME_PAYLOAD )  chunk = FRAME_PAYLOAD;
+        bool more = (offset + chunk < length);
+        if ( send_frame(fd, id, 0, more, message + offset, chunk, MSG_DONTWAIT) < 0 ) {
+            if ( (errno != EAGAIN) and (errno != EWOULDBLOCK) )  return false;
+            struct pollfd entry;
+            entry.fd = fd;
+            entry.events = POLLIN | POLLOUT;
+            entry.revents = 0;
+            if ( (poll(&entry, 1, -1) < 0) and (errno != EINTR) )  return false;
+            if ( entry.revents & (POLLIN | POLLHUP | POLLERR) ) {
+                read_reply( 0 );
+                if ( broken )  return false;
+            }
+            continue;
+        }
+        offset += chunk;
+    } while ( offset < length );
+
+    // take what has arrived, so replies do not pile up in the service
+    while ( read_reply(0) and not broken ) ;
+    return true;
+}
+
+/**
+ * The first request after the given id that is still unanswered by
+ * wait(), or 0 when there is none.
+ */
+uint64_t
+ChannelClient::next_outstanding( uint64_t after ) const {
+    std::set<uint64_t>::const_iterator request = outstanding.upper_bound( after );
+    return (request == outstanding.end()) ? 0 : *request;
+}
+
+/**
+ * Read every frame that has already arrived, without blocking.
+ * Returns the number of requests answered (or failed by the
+ * connection closing) as a result.
+ */
+int
+ChannelClient::collect() {
+    size_t before = replies.size();
+    while ( (fd != -1) and not broken ) {
+        if ( read_reply(0) == false )  break;
+    }
+    return replies.size() - before;
+}
+
+/**
+ * Wait for the response to request id, at most time_limit seconds (0
+ * for ever).  The response is returned in a buffer from malloc() for
+ * the caller to free.  On the message queue responses cannot be told
+ * apart, so this takes the next one.
+ */
+int
+ChannelClient::wait( uint64_t id, char **body, size_t *length, time_t time_limit ) {
+    if ( transport == Channel::MESSAGE_QUEUE ) {
+        outstanding.erase( id );
+        char buffer[sizeof(((struct channel_message *)0)->body)];
+        int result = (time_limit == 0) ? receive( buffer, sizeof(buffer) )
+                                       : receive( buffer, sizeof(buffer), time_limit );
+        *body = strdup( buffer );
+        *length = strlen( buffer );
+        return result;
+    }
+
+    time_t deadline = time(0) + time_limit;
+    while ( replies.count(id) == 0 ) {
+        if ( outstanding.count(id) == 0 ) {
+            *body = strdup( "no such request" );
+            *length = strlen( *body );
+            return MESSAGE_EXCEPTION;
+        }
+        if ( (fd == -1) or broken ) {
+            outstanding.erase( id );
+            *body = strdup( "channel closed" );
+            *length = strlen( *body );
+            return MESSAGE_EXCEPTION;
+        }
+        int timeout = -1;
+        if ( time_limit > 0 ) {
+            time_t left = deadline - time(0);
+            if ( left <= 0 ) {
+                // a response that comes later is dropped
+                outstanding.erase( id );
+                syslog( LOG_ERR, "ERROR channel recv timed out" );
+                *body = strdup( "channel timed out" );
+                *length = strlen( *body );
+                return MESSAGE_EXCEPTION;
+            }
+            timeout = left * 1000;
+        }
+        read_reply( timeout );
+    }
+
+    outstanding.erase( id );
+    Reply reply = replies[id];
+    replies.erase( id );
+    *body = reply.body;
+    *length = reply.length;
+    return reply.error;
+}
+
+/**
+ * The response to the oldest request still outstanding, in a buffer
+ * from malloc() for the caller to free.
+ */
+int
+ChannelClient::receive( char **body, size_t *length, time_t time_limit ) {
+    if ( (transport == Channel::SEQPACKET) and outstanding.empty() ) {
+        *body = strdup( "no request outstanding" );
+        *length = strlen( *body );
+        return MESSAGE_EXCEPTION;
+    }
+    uint64_t id = outstanding.empty() ? 0 : *(outstanding.begin());
+    return wait( id, body, length, time_limit );
 }
 
 /**
@@ -225,6 +1143,15 @@ ChannelClient::send( char *message ) {
  */
 int
 ChannelClient::receive( char *buffer, int length ) {
+    if ( transport == Channel::SEQPACKET ) {
+        char *body;
+        size_t body_length;
+        int result = receive( &body, &body_length );
+        strlcpy( buffer, body, length );
+        free( body );
+        return result;
+    }
+
     int flags = 0; // IPC_NOWAIT | MSG_NOERROR
     struct channel_message request;
 
@@ -240,11 +1167,26 @@ ChannelClient::receive( char *buffer, int length ) {
  */
 int
 ChannelClient::receive( char *buffer, int length, time_t time_limit ) {
+    if ( transport == Channel::SEQPACKET ) {
+        char *body;
+        size_t body_length;
+        int result = receive( &body, &body_length, time_limit );
+        strlcpy( buffer, body, length );
+        free( body );
+        return result;
+    }
+
     struct channel_message request;
     time_t elapsed = 0;
     struct timespec delay = { 1, 0 };
     pid_t pid = getpid();
 
+    /**
+     * While the service is running, wait on its process handle rather
+     * than sleeping, so its death ends the wait at once.  A service
+     * that is not up yet may still start and answer from the queue.
+     */
+    bool watching = alive();
     do {
         int bytes = msgrcv( q, &request, sizeof(request), pid, IPC_NOWAIT );
 
@@ -253,18 +1195,26 @@ ChannelClient::receive( char *buffer, int length, time_t time_limit ) {
             return request.error;
         }
 
-#if 0 // where is valgrind on OSX
-        /**
-         * We only want this error correction when we are not running under
-         * valgrind, since valgrind changes the name of the program that is
-         * running and all messaging would fail since we can not detect process
-         * liveness after the program name change.
-         */
-        if ( RUNNING_ON_VALGRIND == 0 ) {
-            if ( is_alive(service) == false ) return MESSAGE_EXCEPTION;
+        if ( watching == false ) {
+            nanosleep( &delay, NULL );
+            watching = alive();
+            continue;
+        }
+
+        struct pollfd entry;
+        entry.fd = service_handle;
+        entry.events = POLLIN;
+        entry.revents = 0;
+        if ( poll(&entry, 1, delay.tv_sec * 1000) > 0 ) {
+            // it may have answered just before it went
+            if ( msgrcv(q, &request, sizeof(request), pid, IPC_NOWAIT) > 0 ) {
+                strlcpy( buffer, request.body, length );
+                return request.error;
+            }
+            syslog( LOG_ERR, "ERROR channel service '%s' exited", service );
+            strlcpy( buffer, "service exited", length );
+            return MESSAGE_EXCEPTION;
         }
-#endif
-        nanosleep( &delay, NULL );
     } while ( ++elapsed < time_limit );
 
     syslog( LOG_ERR, "ERROR channel recv timed out" );
@@ -29,8 +29,16 @@
 #ifndef _CHANNEL_H_
 #define _CHANNEL_H_
 
+#include <stdint.h>
 #include <time.h>
+#include <pthread.h>
 #include <tcl.h>
+
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+
 #include "Thread.h"
 
 class Service;
@@ -41,16 +49,71 @@ class Service;
  * accepts requests from a client and populates a buffer with
  * the request.  The return value is the id of the client.
  * The response is sent to this id.
+ *
+ * There are two transports.  MESSAGE_QUEUE is the original SysV
+ * message queue: bodies are limited to 1012 bytes and the id is the
+ * client's pid.  SEQPACKET is a Unix domain SOCK_SEQPACKET socket,
+ * carrying requests and responses of any length as a sequence of
+ * frames tagged with a request id; a client may have many requests
+ * in flight, and the id returned by receive() names one of them.
+ *
+ * Responses on a socket never block the service: what a client is
+ * not ready to read is queued on its connection and sent as it
+ * drains.  A client that lets too much pile up, in unread responses
+ * or in unfinished requests, is disconnected.
+ *
+ * Either way the channel registers the service as alive by holding
+ * a lock on its pid file, /var/run/<service>/service.pid, for as
+ * long as the process lives.  Clients test that lock without taking
+ * it, so a check made while the service starts cannot turn it away.
  */
 class Channel {
+public:
+    enum Transport { MESSAGE_QUEUE, SEQPACKET };
+    static bool transport_named( const char *, Transport * );
+    static const char *transport_name( Transport );
 private:
+    struct Connection;
+    struct Pending {
+        Connection *connection;
+        uint64_t request;
+    };
+    struct Request {
+        long sender;
+        char *body;
+        size_t length;
+    };
+
     Service *service;
     long id;
     int q;
+    Transport transport;
+    int listener;
+    int wake[2];
+    int pid_fd;
+    pthread_mutex_t lock;
+    std::vector<Connection *> connections;
+    std::map<long, Pending> pending;
+    std::deque<Request> ready;
+    long next_sender;
+
+    void register_service();
+    long receive_queue( char **, size_t * );
+    long receive_socket( char **, size_t * );
+    void accept_connection();
+    void read_connection( Connection * );
+    void drop_connection( Connection * );
+    void respond( Connection *, uint64_t, int, const char *, size_t );
+    void flush( Connection * );
+    void release( Connection * );
 public:
-    Channel( Service * );
-    void send( long, int, char * );
+    Channel( Service *, Transport = MESSAGE_QUEUE );
+    Transport kind() const { return transport; }
+    void send( long, int, const char * );
+    void send( long, int, const char *, size_t );
     long receive( char *, int );
+    long receive( char **, size_t * );
+    bool alive( long );
 };
 
 /**
@@ -59,16 +122,69 @@ public:
  * to this service.  The receive method is passed a buffer to
  * populate with the response, and return an int error value.
  * 0 means no error.
+ *
+ * send() and receive() keep the old one-at-a-time behaviour:
+ * receive() returns the response to the oldest request sent.
+ * submit() and wait() expose the request ids, so responses can be
+ * collected in any order (on the SEQPACKET transport).
+ *
+ * alive() says whether the service is running.  The first check
+ * opens a handle on the service process (a pidfd on Linux); after
+ * that a check is one poll() of the handle, and liveness() returns
+ * it for callers that want to wait for the service to die.
+ *
+ * For an event loop, watch descriptor() for reading and call
+ * collect() when it is ready; it reads what has arrived without
+ * blocking, and ready() then says which requests wait() can return
+ * at once.  A connection that is lost stays open, unread, until the
+ * next submit() reconnects, so the descriptor is never closed under
+ * a watcher that still expects answers.
  */
 class ChannelClient {
 private:
+    struct Reply {
+        int error;
+        char *body;
+        size_t length;
+    };
+    struct Partial {
+        char *body;
+        size_t length;
+    };
+
     int q;
     char service[80];
+    Channel::Transport transport;
+    int fd;
+    bool broken;
+    int service_handle;
+    uint64_t next_id;
+    std::set<uint64_t> outstanding;
+    std::map<uint64_t, Reply> replies;
+    std::map<uint64_t, Partial> partials;
+
+    bool connect_socket();
+    bool resolve_service();
+    bool read_reply( int );
+    bool transmit( uint64_t, const char *, size_t );
 public:
     ChannelClient( char * );
+    ChannelClient( char *, Channel::Transport );
+    ~ChannelClient();
+    Channel::Transport kind() const { return transport; }
     void send( char * );
     int receive( char *, int );
     int receive( char *, int, time_t );
+    int receive( char **, size_t *, time_t = 0 );
+    uint64_t submit( const char *, size_t );
+    int wait( uint64_t, char **, size_t *, time_t = 0 );
+    int descriptor() const { return fd; }
+    bool connected() const { return (fd != -1) and not broken; }
+    int collect();
+    bool ready( uint64_t id ) const { return replies.count(id) > 0; }
+    uint64_t next_outstanding( uint64_t ) const;
+    bool alive();
+    int liveness() const { return service_handle; }
 };
 
 bool Channel_Initialize( Tcl_Interp * );
@@ -213,86 +213,6 @@ Network::DarwinNetworkMonitor::bring_up( Network::Interface *interface ) {
     listener->thread()->start();
 }
 
-/**
- */
-class WriteHostsForNeighbors : public Network::NeighborIterator {
-    int fd;
-public:
-    WriteHostsForNeighbors( int fd ) : fd(fd) {}
-    virtual ~WriteHostsForNeighbors() {}
-    virtual int operator() ( Network::Peer& neighbor ) {
-        struct host_entry entry;
-        memset( &entry, 0, sizeof(entry) );
-
-        Network::Node *node = neighbor.node();
-        if ( node == NULL ) {
-            return 0;
-        }
-        if ( node->not_partner() ) {
-            return 0;
-        }
-
-        entry.flags.valid = 1;
-        entry.flags.partner = neighbor.is_partner();
-        entry.node.ordinal = node->ordinal();
-        entry.interface.ordinal = neighbor.ordinal();
-        entry.flags.is_private = 0 /* neighbor.is_private() */ ;
-        neighbor.copy_address( &(entry.primary_address) );
-
-        if ( debug > 1 ) log_notice( "write host entry for peer" );
-        // populate entry for the interface itself
-        ssize_t bytes = write( fd, &entry, sizeof(entry) );
-        if ( (size_t)bytes < sizeof(entry) ) {
-            log_err( "write failed creating hosts entry peer" );
-        }
-
-        return 0;
-    }
-};
-/**
- */
-class WriteHostsForInterface : public Network::InterfaceIterator {
-    int fd;
-public:
-    WriteHostsForInterface( int fd ) : fd(fd) {}
-    virtual ~WriteHostsForInterface() {}
-    virtual int operator() ( Network::Interface * interface ) {
-        struct host_entry entry;
-        memset( &entry, 0, sizeof(entry) );
-
-        entry.flags.valid = 1;
-        entry.flags.partner = 0;
-        entry.node.ordinal = gethostid();
-        entry.flags.is_private = 0 /* interface->is_private() */ ;
-        entry.interface.ordinal = interface->ordinal();
-        interface->lladdr( &entry.primary_address );
-
-        unsigned char *mac = interface->mac();
-        entry.mac[0] = mac[0];
-        entry.mac[1] = mac[1];
-        entry.mac[2] = mac[2];
-        entry.mac[3] = mac[3];
-        entry.mac[4] = mac[4];
-        entry.mac[5] = mac[5];
-
-        if ( interface->not_bridge() /* and interface->not_private() */ ) {
-            return 0;
-        }
-        if ( debug > 1 ) log_notice( "write host entry for %s", interface->name() );
-        // populate entry for the interface itself
-        ssize_t bytes = write( fd, &entry, sizeof(entry) );
-        if ( (size_t)bytes < sizeof(entry) ) {
-            log_err( "write failed creating hosts entry" );
-        }
-
-        // call iterator for each neighbor
-        WriteHostsForNeighbors callback(fd);
-        interface->each_neighbor( callback );
-
-        return 0;
-    }
-};
-
 /**
  * When an event occurs, this needs to trigger some other action.
  * The action will be either a TCL script, or a TCL assembled AST.
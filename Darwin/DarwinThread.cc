@@ -25,7 +25,13 @@
  * \brief 
  */
 
+#include <sys/types.h>
+#include <sys/event.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include "Thread.h"
 
@@ -41,4 +47,41 @@ void
 set_thread_name( const char *newname ) {
 }
 
+/**
+ * No public futex here -- poll briefly instead.  The callers loop on
+ * their own condition, so an early return is harmless.
+ */
+void
+wait_on_address( uint32_t *address, uint32_t value ) {
+    struct timespec pause = { 0, 1000000 };
+    if ( __atomic_load_n(address, __ATOMIC_ACQUIRE) == value ) {
+        nanosleep( &pause, NULL );
+    }
+}
+
+/**
+ */
+void
+wake_address( uint32_t *address ) {
+}
+
+/**
+ * A kqueue watching for the exit of pid; it polls readable when the
+ * NOTE_EXIT event is pending.
+ */
+int
+process_handle( pid_t pid ) {
+    int kq = kqueue();
+    if ( kq < 0 )  return -1;
+    fcntl( kq, F_SETFD, FD_CLOEXEC );
+
+    struct kevent change;
+    EV_SET( &change, pid, EVFILT_PROC, EV_ADD | EV_ONESHOT, NOTE_EXIT, 0, NULL );
+    if ( kevent(kq, &change, 1, NULL, 0, NULL) < 0 ) {
+        close( kq );
+        return -1;
+    }
+    return kq;
+}
+
 /* vim: set autoindent expandtab sw=4 : */
@@ -3,6 +3,8 @@ CFLAGS += -IDarwin
 CXXFLAGS += -IDarwin
 LDFLAGS += -rdynamic
 
+THREAD_PLATFORM_OBJS = Darwin/DarwinThread.o
+
 PLATFORM_OBJS  = Darwin/DarwinKernel.o
 PLATFORM_OBJS  = Darwin/DarwinThread.o
 PLATFORM_OBJS += Darwin/DarwinKernel.o
@@ -0,0 +1,356 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** \file Executor.cc
+ * \brief Work stealing executor.
+ *
+ * The deque is the fixed size Chase-Lev deque, with the memory ordering
+ * from Le, Pop, Cohen and Zappa Nardelli, "Correct and Efficient
+ * Work-Stealing for Weak Memory Models".  A worker never lets its deque
+ * fill: it only refills from its inbox when the deque is empty, and a
+ * task spawned on a full deque runs inline instead.
+ */
+
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "Executor.h"
+#include "PlatformThread.h"
+
+namespace {
+    int debug = 0;
+
+    const int DEQUE_SIZE = 1024;
+    const int INBOX_BATCH = 32;
+
+    uint64_t now_nsec() {
+        struct timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        return ((uint64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+    }
+}
+
+/**
+ * The owner pushes and pops at the bottom, thieves take from the top.
+ */
+class Deque {
+    int64_t top;
+    char pad[64];
+    int64_t bottom;
+    Task *tasks[DEQUE_SIZE];
+public:
+    Deque() : top(0), bottom(0) {}
+
+    bool push( Task *task ) {
+        int64_t b = __atomic_load_n( &bottom, __ATOMIC_RELAXED );
+        int64_t t = __atomic_load_n( &top, __ATOMIC_ACQUIRE );
+        if ( b - t >= DEQUE_SIZE )  return false;
+        __atomic_store_n( &tasks[b % DEQUE_SIZE], task, __ATOMIC_RELAXED );
+        __atomic_thread_fence( __ATOMIC_RELEASE );
+        __atomic_store_n( &bottom, b + 1, __ATOMIC_RELAXED );
+        return true;
+    }
+
+    Task *pop() {
+        int64_t b = __atomic_load_n( &bottom, __ATOMIC_RELAXED ) - 1;
+        __atomic_store_n( &bottom, b, __ATOMIC_RELAXED );
+        __atomic_thread_fence( __ATOMIC_SEQ_CST );
+        int64_t t = __atomic_load_n( &top, __ATOMIC_RELAXED );
+
+        if ( t > b ) {
+            __atomic_store_n( &bottom, b + 1, __ATOMIC_RELAXED );
+            return NULL;
+        }
+        Task *task = __atomic_load_n( &tasks[b % DEQUE_SIZE], __ATOMIC_RELAXED );
+        if ( t == b ) {
+            // last one -- race any thief for it
+            if ( __atomic_compare_exchange_n(&top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED) == false ) {
+                task = NULL;
+            }
+            __atomic_store_n( &bottom, b + 1, __ATOMIC_RELAXED );
+        }
+        return task;
+    }
+
+    Task *steal() {
+        int64_t t = __atomic_load_n( &top, __ATOMIC_ACQUIRE );
+        __atomic_thread_fence( __ATOMIC_SEQ_CST );
+        int64_t b = __atomic_load_n( &bottom, __ATOMIC_ACQUIRE );
+        if ( t >= b )  return NULL;
+
+        Task *task = __atomic_load_n( &tasks[t % DEQUE_SIZE], __ATOMIC_RELAXED );
+        if ( __atomic_compare_exchange_n(&top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED) == false ) {
+            return NULL;
+        }
+        return task;
+    }
+
+    int size() {
+        int64_t b = __atomic_load_n( &bottom, __ATOMIC_RELAXED );
+        int64_t t = __atomic_load_n( &top, __ATOMIC_RELAXED );
+        return (b > t) ? (int)(b - t) : 0;
+    }
+};
+
+/**
+ */
+class Executor::Worker : public Thread {
+public:
+    Executor *executor;
+    int index;
+    Deque deque;
+    Queue inbox;
+    pid_t thread;
+    unsigned long executed;
+    unsigned long stolen;
+    unsigned long sleeps;
+    uint64_t busy_nsec;
+
+    Worker( Executor *, int, const char * );
+    virtual ~Worker() {}
+    virtual void run();
+    Task *find_work();
+    void idle();
+};
+
+namespace {
+    __thread Executor::Worker *current_worker = NULL;
+}
+
+Executor *Executor::_instance = NULL;
+
+/**
+ */
+Executor::Worker::Worker( Executor *executor, int index, const char *name )
+: Thread(name), executor(executor), index(index), thread(0),
+  executed(0), stolen(0), sleeps(0), busy_nsec(0)
+{
+}
+
+/**
+ * Own deque first, then a batch from the inbox, then someone else's
+ * deque.
+ */
+Task *
+Executor::Worker::find_work() {
+    Task *task = deque.pop();
+    if ( task != NULL )  return task;
+
+    void *batch[INBOX_BATCH];
+    int count = inbox.dequeue( batch, INBOX_BATCH );
+    if ( count > 0 ) {
+        for ( int i = 1 ; i < count ; ++i ) {
+            deque.push( (Task *)batch[i] );
+        }
+        if ( count > 1 )  executor->wake();
+        return (Task *)batch[0];
+    }
+
+    return executor->steal( this );
+}
+
+/**
+ * Announce that this worker is about to sleep, then look for work once
+ * more before actually sleeping.  A submitter publishes its task and
+ * then checks for sleepers, so one of the two always sees the other.
+ */
+void
+Executor::Worker::idle() {
+    __atomic_add_fetch( &(executor->sleepers), 1, __ATOMIC_SEQ_CST );
+    uint32_t seen = __atomic_load_n( &(executor->wakeups), __ATOMIC_SEQ_CST );
+    if ( executor->work_pending() == false ) {
+        __atomic_store_n( &sleeps, sleeps + 1, __ATOMIC_RELAXED );
+        wait_on_address( &(executor->wakeups), seen );
+    }
+    __atomic_sub_fetch( &(executor->sleepers), 1, __ATOMIC_SEQ_CST );
+}
+
+/**
+ */
+void
+Executor::Worker::run() {
+    current_worker = this;
+    thread = syscall( SYS_gettid );
+
+    for (;;) {
+        Task *task = find_work();
+        if ( task == NULL ) {
+            idle();
+            continue;
+        }
+
+        uint64_t start = now_nsec();
+        task->execute();
+        __atomic_store_n( &busy_nsec, busy_nsec + (now_nsec() - start), __ATOMIC_RELAXED );
+        __atomic_store_n( &executed, executed + 1, __ATOMIC_RELAXED );
+    }
+}
+
+/**
+ * Build the workers now, so they are registered with Tcl from the
+ * thread that created the executor; start them on first use.
+ */
+Executor::Executor( int count )
+: worker_count(0), next_inbox(0), started(0), wakeups(0), sleepers(0), rejected(0)
+{
+    if ( count < 1 )  count = 1;
+    if ( count > MAX_WORKERS )  count = MAX_WORKERS;
+
+    for ( int i = 0 ; i < count ; ++i ) {
+        char name[32];
+        snprintf( name, sizeof(name), "executor.%d", i );
+        workers[i] = new Worker( this, i, name );
+    }
+    worker_count = count;
+}
+
+/**
+ * The process wide executor, one worker per online processor.
+ */
+Executor *
+Executor::instance() {
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    Executor *executor = __atomic_load_n( &_instance, __ATOMIC_ACQUIRE );
+    if ( executor != NULL )  return executor;
+
+    pthread_mutex_lock( &lock );
+    if ( _instance == NULL ) {
+        executor = new Executor( sysconf(_SC_NPROCESSORS_ONLN) );
+        __atomic_store_n( &_instance, executor, __ATOMIC_RELEASE );
+    }
+    pthread_mutex_unlock( &lock );
+    return _instance;
+}
+
+/**
+ */
+void
+Executor::start() {
+    uint32_t expected = 0;
+    if ( __atomic_compare_exchange_n(&started, &expected, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) == false ) {
+        return;
+    }
+    for ( int i = 0 ; i < worker_count ; ++i ) {
+        workers[i]->start();
+    }
+}
+
+/**
+ */
+void
+Executor::wake() {
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n(&sleepers, __ATOMIC_SEQ_CST) == 0 )  return;
+    __atomic_add_fetch( &wakeups, 1, __ATOMIC_SEQ_CST );
+    wake_address( &wakeups );
+}
+
+/**
+ * Try every other worker once, starting just past the thief.
+ */
+Task *
+Executor::steal( Worker *thief ) {
+    for ( int i = 1 ; i < worker_count ; ++i ) {
+        Worker *victim = workers[(thief->index + i) % worker_count];
+        Task *task = victim->deque.steal();
+        if ( task != NULL ) {
+            __atomic_store_n( &(thief->stolen), thief->stolen + 1, __ATOMIC_RELAXED );
+            return task;
+        }
+    }
+    return NULL;
+}
+
+/**
+ */
+bool
+Executor::work_pending() {
+    for ( int i = 0 ; i < worker_count ; ++i ) {
+        if ( workers[i]->deque.size() > 0 )  return true;
+        if ( workers[i]->inbox.depth() > 0 )  return true;
+    }
+    return false;
+}
+
+/**
+ * Tasks submitted by a worker go on its own deque, where they are
+ * cheapest to run and easiest to steal.  Anyone else's go to an inbox.
+ * Returns false only if every inbox is full.
+ */
+bool
+Executor::submit( Task *task ) {
+    if ( __atomic_load_n(&started, __ATOMIC_ACQUIRE) == 0 )  start();
+
+    Worker *worker = current_worker;
+    if ( (worker != NULL) and (worker->executor == this) ) {
+        if ( worker->deque.push(task) == false ) {
+            task->execute();
+            return true;
+        }
+        wake();
+        return true;
+    }
+
+    uint32_t first = __atomic_fetch_add( &next_inbox, 1, __ATOMIC_RELAXED );
+    for ( int i = 0 ; i < worker_count ; ++i ) {
+        Worker *target = workers[(first + i) % worker_count];
+        if ( target->inbox.enqueue(task) ) {
+            wake();
+            return true;
+        }
+    }
+
+    if ( debug ) {
+        fprintf( stderr, "executor: all %d inboxes full, task rejected\n", worker_count );
+    }
+    __atomic_add_fetch( &rejected, 1, __ATOMIC_RELAXED );
+    return false;
+}
+
+/**
+ */
+void
+Executor::statistics( int index, WorkerStatistics *statistics ) {
+    Worker *worker = workers[index];
+    statistics->thread = worker->thread;
+    statistics->depth = worker->deque.size();
+    statistics->inbox = worker->inbox.depth();
+    statistics->executed = __atomic_load_n( &(worker->executed), __ATOMIC_RELAXED );
+    statistics->stolen = __atomic_load_n( &(worker->stolen), __ATOMIC_RELAXED );
+    statistics->sleeps = __atomic_load_n( &(worker->sleeps), __ATOMIC_RELAXED );
+    statistics->busy_nsec = __atomic_load_n( &(worker->busy_nsec), __ATOMIC_RELAXED );
+}
+
+/**
+ * Hand a short piece of work to the shared executor rather than
+ * doing it on this thread.
+ */
+bool
+Thread::submit( Task *task ) {
+    return Executor::instance()->submit( task );
+}
+
+/* vim: set autoindent expandtab sw=4 : */
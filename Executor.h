@@ -0,0 +1,105 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** \file Executor.h
+ * \brief A work stealing pool of worker threads for short tasks.
+ *
+ * The pool has one worker per processor.  Each worker owns a deque of
+ * tasks: it pushes and pops at the bottom, and idle workers steal from
+ * the top of other workers' deques.  Tasks submitted from outside the
+ * pool land in a worker's inbox (a lock free Queue) chosen round robin,
+ * and the worker moves them to its deque in batches.  Idle workers
+ * sleep on a shared word that is only poked when someone is asleep.
+ *
+ * Tasks must not block for long -- anything that waits on a socket
+ * or a lock held across I/O belongs on its own Thread.
+ */
+
+#ifndef _EXECUTOR_H_
+#define _EXECUTOR_H_
+
+#include <stdint.h>
+#include "Thread.h"
+#include "Queue.h"
+
+/**
+ * A chunk of work for the Executor.  The executor calls execute() once
+ * on some worker thread and then forgets the task; a task that should
+ * be freed afterwards deletes itself.
+ */
+class Task {
+public:
+    Task() {}
+    virtual ~Task() {}
+    virtual void execute() = 0;
+};
+
+/**
+ * Per-worker counters, as reported by Executor::statistics().
+ */
+struct WorkerStatistics {
+    pid_t thread;
+    int depth;
+    int inbox;
+    unsigned long executed;
+    unsigned long stolen;
+    unsigned long sleeps;
+    uint64_t busy_nsec;
+};
+
+class Executor {
+public:
+    class Worker;
+    static const int MAX_WORKERS = 64;
+private:
+    Worker *workers[MAX_WORKERS];
+    int worker_count;
+    uint32_t next_inbox;
+    uint32_t started;
+    uint32_t wakeups;
+    uint32_t sleepers;
+    unsigned long rejected;
+
+    static Executor *_instance;
+
+    void start();
+    void wake();
+    Task *steal( Worker * );
+    bool work_pending();
+
+    friend class Worker;
+public:
+    Executor( int );
+    ~Executor() {}
+
+    static Executor *instance();
+
+    bool submit( Task * );
+    int workers_count() const { return worker_count; }
+    unsigned long rejected_tasks() const { return rejected; }
+    void statistics( int, WorkerStatistics * );
+};
+
+#endif
+
+/* vim: set autoindent expandtab sw=4 : */
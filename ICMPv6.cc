@@ -42,8 +42,10 @@
 
 namespace {
     typedef ICMPv6::PDU *(*PDUFactory)( struct icmp6_hdr * );
+    typedef bool (*PDUDelivery)( struct icmp6_hdr *, size_t, ICMPv6::ReceiveCallbackInterface * );
     static const int MAX_FACTORY = 256; // ICMP type is 8 bits
     PDUFactory factories[ MAX_FACTORY ];
+    PDUDelivery deliveries[ MAX_FACTORY ];
     int debug = 0;
 }
 
@@ -55,11 +57,33 @@ ICMPv6::PDU::Factory( struct icmp6_hdr *hdr ) {
     return new PDU( hdr->icmp6_type );
 }
 
+/**
+ * Each Deliver builds its message on the stack, over the received
+ * bytes, and hands it to the callback.  They return false if the
+ * packet is too short to be that message.
+ */
+bool
+ICMPv6::PDU::Deliver( struct icmp6_hdr *hdr, size_t length, ICMPv6::ReceiveCallbackInterface *callback ) {
+    ICMPv6::PDU message( hdr );
+    return message.deliver( callback );
+}
+
+/**
+ * Deliver one received ICMPv6 packet without allocating.  Returns
+ * false if it was malformed and not delivered.
+ */
+bool
+ICMPv6::PDU::dispatch( struct icmp6_hdr *hdr, size_t length, ICMPv6::ReceiveCallbackInterface *callback ) {
+    if ( length < sizeof(struct icmp6_hdr) )  return false;
+    return deliveries[ hdr->icmp6_type ]( hdr, length, callback );
+}
+
 /**
  * \todo change ICMPv6 socket to accept address/port/...
  */
-ICMPv6::Socket::Socket() : bind_completed(false), binds_attempted(0) {
+ICMPv6::Socket::Socket() : bind_completed(false), binds_attempted(0), queued_count(0), unreported(0) {
     pthread_mutex_init( &lock, NULL );
+    memset( &send_stats, 0, sizeof(send_stats) );
     memset( &binding, 0, sizeof(binding) );
     binding.sin6_family = AF_INET6;
 
@@ -193,6 +217,99 @@ bool ICMPv6::Socket::send( struct in6_addr *address, void *message, int length )
     return true;
 }
 
+/**
+ * Add a message for this recipient to the next batch.  Messages too
+ * large to queue are sent immediately.
+ */
+bool ICMPv6::Socket::queue( struct in6_addr *address, void *message, int length ) {
+    if ( length > MAX_QUEUED_LENGTH )  return send( address, message, length );
+
+    pthread_mutex_lock( &lock );
+    // the caller hears of these failures from its next flush()
+    if ( queued_count == MAX_QUEUED )  unreported += flush_locked();
+
+    Queued& entry = queued[queued_count++];
+    memset( &entry.recipient, 0, sizeof entry.recipient );
+    entry.recipient.sin6_family = AF_INET6;
+    entry.recipient.sin6_addr = *address;
+    entry.recipient.sin6_port = htons(0);
+    entry.recipient.sin6_scope_id = binding.sin6_scope_id;
+    entry.length = length;
+    memcpy( entry.message, message, length );
+    pthread_mutex_unlock( &lock );
+
+    return true;
+}
+
+/**
+ * Send everything queued.  When sendmmsg stops short, the message it
+ * stopped at is the one that failed: it is counted, logged and skipped,
+ * and the rest are sent with another call.  Returns the number of
+ * messages that could not be sent.
+ */
+int ICMPv6::Socket::flush_locked() {
+    if ( queued_count == 0 )  return 0;
+
+    int failed = 0;
+    send_stats.batches++;
+
+#if defined(__APPLE__) || defined(__darwin__)
+    for ( int i = 0 ; i < queued_count ; ++i ) {
+        Queued& entry = queued[i];
+        send_stats.syscalls++;
+        if ( sendto(socket, entry.message, entry.length, 0, (struct sockaddr *)&entry.recipient, sizeof(entry.recipient)) < 0 ) {
+            failed++;
+        }
+    }
+#else
+    struct mmsghdr messages[MAX_QUEUED];
+    struct iovec vectors[MAX_QUEUED];
+    memset( messages, 0, sizeof(struct mmsghdr) * queued_count );
+    for ( int i = 0 ; i < queued_count ; ++i ) {
+        vectors[i].iov_base = queued[i].message;
+        vectors[i].iov_len = queued[i].length;
+        messages[i].msg_hdr.msg_name = &queued[i].recipient;
+        messages[i].msg_hdr.msg_namelen = sizeof(queued[i].recipient);
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int next = 0;
+    while ( next < queued_count ) {
+        send_stats.syscalls++;
+        int count = sendmmsg( socket, &messages[next], queued_count - next, 0 );
+        if ( count < 0 ) {
+            if ( errno == EINTR )  continue;
+            char e[128], s[80];
+            int err = posix_strerror( errno, e, sizeof(e) );
+            const char *addr = inet_ntop(AF_INET6, &queued[next].recipient.sin6_addr, s, sizeof s);
+            if ( debug > 0 ) log_err( "ICMPv6::Socket::flush(\"%s\"): %s", addr, e );
+            failed++;
+            next++;
+            continue;
+        }
+        next += count;
+    }
+#endif
+
+    send_stats.sent += queued_count - failed;
+    send_stats.failed += failed;
+    queued_count = 0;
+    return failed;
+}
+
+/**
+ * Returns the messages that failed since the last flush(), including
+ * those of batches queue() sent when the queue filled.
+ */
+int ICMPv6::Socket::flush() {
+    pthread_mutex_lock( &lock );
+    int failed = flush_locked() + unreported;
+    unreported = 0;
+    pthread_mutex_unlock( &lock );
+    return failed;
+}
+
 /**
  * This should probably be a send to the broadcast address
  */
@@ -227,18 +344,9 @@ void ICMPv6::Socket::receive( ICMPv6::ReceiveCallbackInterface *callback ) {
         }
         if ( n == 0 ) continue;
 
-        // construct a message and deliver it
-        struct icmp6_hdr *header = (struct icmp6_hdr *)buffer;
-
-        using namespace ICMPv6;
-        PDUFactory factory = factories[ header->icmp6_type ];
-        if ( factory == NULL ) {
-            log_err( "ICMPv6::Socket: No FACTORY for ICMPv6 message" );
-            continue;
+        if ( ICMPv6::PDU::dispatch((struct icmp6_hdr *)buffer, n, callback) == false ) {
+            if ( debug > 0 ) log_err( "ICMPv6::Socket: malformed ICMPv6 message (%d bytes)", n );
         }
-        PDU *pdu = factory( header );
-        pdu->deliver( callback );
-        delete pdu;
     }
 }
 
@@ -264,6 +372,12 @@ ICMPv6::PDU::deliver( ICMPv6::ReceiveCallbackInterface *callback ) {
     return true;
 }
 
+/**
+ */
+bool ICMPv6::PDU::queue( ICMPv6::Socket &socket, struct in6_addr *recipient ) {
+    return socket.queue( recipient, &header, sizeof header );
+}
+
 /**
  */
 bool ICMPv6::PDU::send( ICMPv6::Socket &socket, struct in6_addr *recipient ) {
@@ -306,6 +420,14 @@ ICMPv6::EchoRequest::Factory( struct icmp6_hdr *hdr ) {
     return message;
 }
 
+/**
+ */
+bool
+ICMPv6::EchoRequest::Deliver( struct icmp6_hdr *hdr, size_t length, ICMPv6::ReceiveCallbackInterface *callback ) {
+    ICMPv6::EchoRequest message( hdr );
+    return message.deliver( callback );
+}
+
 /**
  */
 ICMPv6::EchoReply::EchoReply() : PDU(ICMP6_ECHO_REPLY) {
@@ -341,6 +463,14 @@ ICMPv6::EchoReply::Factory( struct icmp6_hdr *hdr ) {
     return message;
 }
 
+/**
+ */
+bool
+ICMPv6::EchoReply::Deliver( struct icmp6_hdr *hdr, size_t length, ICMPv6::ReceiveCallbackInterface *callback ) {
+    ICMPv6::EchoReply message( hdr );
+    return message.deliver( callback );
+}
+
 /**
  */
 ICMPv6::NeighborSolicitation::NeighborSolicitation() : PDU(ND_NEIGHBOR_SOLICIT) {
@@ -389,6 +519,15 @@ ICMPv6::NeighborSolicitation::Factory( struct icmp6_hdr *hdr ) {
     return message;
 }
 
+/**
+ */
+bool
+ICMPv6::NeighborSolicitation::Deliver( struct icmp6_hdr *hdr, size_t length, ICMPv6::ReceiveCallbackInterface *callback ) {
+    if ( length < sizeof(struct nd_neighbor_solicit) )  return false;
+    ICMPv6::NeighborSolicitation message( hdr );
+    return message.deliver( callback );
+}
+
 /**
  */
 ICMPv6::NeighborAdvertisement::NeighborAdvertisement( struct in6_addr *target, unsigned char *mac )
@@ -434,6 +573,13 @@ ICMPv6::NeighborAdvertisement::send( ICMPv6::Socket& socket, struct in6_addr *re
     return socket.send( recipient, &pdu, sizeof pdu );
 }
 
+/**
+ */
+bool
+ICMPv6::NeighborAdvertisement::queue( ICMPv6::Socket& socket, struct in6_addr *recipient ) {
+    return socket.queue( recipient, &pdu, sizeof pdu );
+}
+
 /**
  */
 bool
@@ -451,6 +597,15 @@ ICMPv6::NeighborAdvertisement::Factory( struct icmp6_hdr *hdr ) {
     // populate with hdr info... and RTAs
     return message;
 }
+
+/**
+ */
+bool
+ICMPv6::NeighborAdvertisement::Deliver( struct icmp6_hdr *hdr, size_t length, ICMPv6::ReceiveCallbackInterface *callback ) {
+    if ( length < sizeof(struct nd_neighbor_advert) )  return false;
+    ICMPv6::NeighborAdvertisement message( hdr );
+    return message.deliver( callback );
+}
 
 /**
  * The constructor attribute causes this function to execute
@@ -468,6 +623,14 @@ init_factories() {
     factories[ICMP6_ECHO_REPLY]    = ICMPv6::EchoReply::Factory;
     factories[ND_NEIGHBOR_SOLICIT] = ICMPv6::NeighborSolicitation::Factory;
     factories[ND_NEIGHBOR_ADVERT]  = ICMPv6::NeighborAdvertisement::Factory;
+
+    for ( int i = 0 ; i < MAX_FACTORY ; i++ ) {
+        deliveries[i] = ICMPv6::PDU::Deliver;
+    }
+    deliveries[ICMP6_ECHO_REQUEST]  = ICMPv6::EchoRequest::Deliver;
+    deliveries[ICMP6_ECHO_REPLY]    = ICMPv6::EchoReply::Deliver;
+    deliveries[ND_NEIGHBOR_SOLICIT] = ICMPv6::NeighborSolicitation::Deliver;
+    deliveries[ND_NEIGHBOR_ADVERT]  = ICMPv6::NeighborAdvertisement::Deliver;
 }
 
 /* vim: set autoindent expandtab sw=4 : */
@@ -61,7 +61,10 @@ namespace ICMPv6 {
         virtual ~PDU() {}
         virtual bool deliver( ReceiveCallbackInterface * );
         virtual bool send( Socket&, struct in6_addr * );
+        virtual bool queue( Socket&, struct in6_addr * );
         static PDU * Factory( struct icmp6_hdr * );
+        static bool Deliver( struct icmp6_hdr *, size_t, ReceiveCallbackInterface * );
+        static bool dispatch( struct icmp6_hdr *, size_t, ReceiveCallbackInterface * );
     };
 
     /**
@@ -75,6 +78,7 @@ namespace ICMPv6 {
         virtual bool send( Socket&, struct in6_addr * );
         virtual bool deliver( ReceiveCallbackInterface * );
         static PDU * Factory( struct icmp6_hdr * );
+        static bool Deliver( struct icmp6_hdr *, size_t, ReceiveCallbackInterface * );
     };
 
     /**
@@ -88,6 +92,7 @@ namespace ICMPv6 {
         virtual bool send( Socket&, struct in6_addr * );
         virtual bool deliver( ReceiveCallbackInterface * );
         static PDU * Factory( struct icmp6_hdr * );
+        static bool Deliver( struct icmp6_hdr *, size_t, ReceiveCallbackInterface * );
     };
 
     /**
@@ -103,6 +108,7 @@ namespace ICMPv6 {
         virtual bool deliver( ReceiveCallbackInterface * );
         const struct in6_addr * target() const;
         static PDU * Factory( struct icmp6_hdr * );
+        static bool Deliver( struct icmp6_hdr *, size_t, ReceiveCallbackInterface * );
     };
 
     /**
@@ -119,10 +125,12 @@ namespace ICMPv6 {
         NeighborAdvertisement( struct icmp6_hdr * );
         virtual ~NeighborAdvertisement() {}
         virtual bool send( Socket&, struct in6_addr * );
+        virtual bool queue( Socket&, struct in6_addr * );
         virtual bool deliver( ReceiveCallbackInterface * );
         struct in6_addr *target();
         void target( struct in6_addr * );
         static PDU * Factory( struct icmp6_hdr * );
+        static bool Deliver( struct icmp6_hdr *, size_t, ReceiveCallbackInterface * );
     };
 
     /**
@@ -139,7 +147,21 @@ namespace ICMPv6 {
     };
 
     /**
-     * 
+     * Counters for the batched transmit path.  A batch is one flush();
+     * it may take more than one syscall if a message in it fails.
+     */
+    struct SendStatistics {
+        unsigned long batches;
+        unsigned long syscalls;
+        unsigned long sent;
+        unsigned long failed;
+    };
+
+    /**
+     * Messages passed to queue() are copied, along with their recipient,
+     * and go out together on the next flush() -- in one sendmmsg where
+     * the platform has it.  The queue flushes itself when it fills,
+     * and the failures of that batch are reported by the next flush().
      */
     class Socket {
     protected:
@@ -148,6 +170,19 @@ namespace ICMPv6 {
         struct sockaddr_in6 binding;
         bool bind_completed;
         int binds_attempted;
+
+        static const int MAX_QUEUED = 64;
+        static const int MAX_QUEUED_LENGTH = 128;
+        struct Queued {
+            struct sockaddr_in6 recipient;
+            int length;
+            uint8_t message[MAX_QUEUED_LENGTH];
+        };
+        Queued queued[MAX_QUEUED];
+        int queued_count;
+        int unreported;
+        SendStatistics send_stats;
+        int flush_locked();
     public:
         Socket();
         ~Socket();
@@ -156,6 +191,10 @@ namespace ICMPv6 {
         void receive( ReceiveCallbackInterface * );
         bool send( void *, int );
         bool send( struct in6_addr *, void *, int );
+        bool queue( struct in6_addr *, void *, int );
+        int flush();
+        int descriptor() const { return socket; }
+        const SendStatistics& send_statistics() const { return send_stats; }
         inline bool bound() const { return bind_completed; }
         inline bool not_bound() const { return bind_completed == false; }
     };
@@ -118,16 +118,13 @@ Network::Interface::Interface( Tcl_Interp *interp, int index )
 : interp(interp), _index(index), 
   last_sendto(0),
   last_no_peer_report(0),
-  table_warning_reported(false),
-  table_error_reported(false),
   advertise_errors(0),
   _removed(false)
 {
     _name = NULL;
     platform_init();
     get_settings();
-    pthread_mutex_init( &neighbor_table_lock, NULL );
-    neighbors = NULL;
+    init_neighbor_table();
 }
 
 /**
@@ -140,16 +137,13 @@ Network::Interface::Interface( Tcl_Interp *interp, char *initname )
   type(0), 
   last_sendto(0),
   last_no_peer_report(0),
-  table_warning_reported(false),
-  table_error_reported(false),
   advertise_errors(0),
   _removed(false)
 {
     _name = strdup(initname);
     platform_init();
     get_settings();
-    pthread_mutex_init( &neighbor_table_lock, NULL );
-    neighbors = NULL;
+    init_neighbor_table();
 }
 
 /**
@@ -168,8 +162,7 @@ Network::Interface::Interface( Tcl_Interp *interp )
   outbound(0), _icmp_socket(0),
   last_sendto(0), last_no_peer_report(0), last_bounce(0),
   bounce_attempts(0), last_bounce_reattempt(0),
-  last_negotiation(0), table_warning_reported(false),
-  table_error_reported(false),
+  last_negotiation(0),
   advertise_errors(0), _removed(false) {
 
 #if 0
@@ -223,13 +216,17 @@ Network::Interface::Interface( Tcl_Interp *interp )
     char buffer[80];
     const char *llname = inet_ntop( AF_INET6, &primary_address, buffer, sizeof(buffer) );
 
-    pthread_mutex_init( &neighbor_table_lock, NULL );
-    neighbors = NULL;
+    init_neighbor_table();
 }
 
 /**
  */
 Network::Interface::~Interface() {
+    free( neighbor_keys );
+    free( neighbor_index );
+    for ( size_t i = 0 ; i < neighbor_chunks.size() ; ++i ) {
+        munmap( neighbor_chunks[i], sizeof(Peer) * NEIGHBOR_CHUNK_SIZE );
+    }
 }
 
 /**
@@ -619,31 +616,36 @@ Network::Interface::advertise() {
     // printf( "advertise on '%s'\n", _name );
     ICMPv6::NeighborAdvertisement na( &primary_address, MAC );
     int peers_sent = 0;
-    struct in6_addr recipient;
 
+    /*
+     * Partnership belongs to the Node and can change at any time, so
+     * the recipients are collected afresh each round -- but only the
+     * addresses, and the lock is dropped before anything is sent.
+     */
     pthread_mutex_lock( &neighbor_table_lock );
-    if ( neighbors != NULL) {
-        for ( int i = 0 ; i < NEIGHBOR_TABLE_SIZE ; ++i ) {
-            Network::Peer& peer = neighbors[i];
-
-            if ( peer.is_invalid() ) continue;
-            if ( peer.node() == NULL ) continue;
-            if ( peer.node()->not_partner() ) continue;
-
-            peer.copy_address( &recipient );
-            if ( na.send( *_icmp_socket, &recipient ) == false ) {
-                if ( (debug > 0) or (advertise_errors < 1) ) {
-                    log_warn( "failed to send neighbor advertisement out '%s'", _name );
-                }
-                ++advertise_errors;
-            } else {
-                advertise_errors = 0;
-            }
-            peers_sent++;
-        }
+    recipients.clear();
+    for ( size_t i = 0 ; i < live_neighbors.size() ; ++i ) {
+        Network::Peer *peer = live_neighbors[i];
+        if ( peer->node() == NULL ) continue;
+        if ( peer->node()->not_partner() ) continue;
+        recipients.push_back( peer->address() );
     }
     pthread_mutex_unlock( &neighbor_table_lock );
 
+    for ( size_t i = 0 ; i < recipients.size() ; ++i ) {
+        na.queue( *_icmp_socket, &recipients[i] );
+        peers_sent++;
+    }
+    int failed = _icmp_socket->flush();
+    if ( failed > 0 ) {
+        if ( (debug > 0) or (advertise_errors < 1) ) {
+            log_warn( "failed to send %d of %d neighbor advertisements out '%s'", failed, peers_sent, _name );
+        }
+        advertise_errors += failed;
+    } else {
+        advertise_errors = 0;
+    }
+
     if ( peers_sent == 0 ) {
         long delta = ::time(0) - last_no_peer_report;
         if ( delta > 120 ) {
@@ -794,69 +796,181 @@ Network::Interface::preferred_name() const {
     return strdup( new_name );
 }
 
+namespace {
+    const uint32_t INITIAL_NEIGHBOR_SLOTS = 64;
+
+    inline uint32_t neighbor_hash( struct in6_addr& address ) {
+        uint64_t hi, lo;
+        memcpy( &hi, &address.s6_addr[0], sizeof(hi) );
+        memcpy( &lo, &address.s6_addr[8], sizeof(lo) );
+        uint64_t h = lo ^ (hi * 0x9e3779b97f4a7c15ULL);
+        h ^= h >> 32;
+        h *= 0xd6e8feb86659fd93ULL;
+        h ^= h >> 32;
+        return (uint32_t)h;
+    }
+
+    inline bool same_address( struct in6_addr& a, struct in6_addr& b ) {
+        return memcmp( &a, &b, sizeof(a) ) == 0;
+    }
+}
+
+/**
+ */
+void
+Network::Interface::init_neighbor_table() {
+    pthread_mutex_init( &neighbor_table_lock, NULL );
+    neighbor_mask = INITIAL_NEIGHBOR_SLOTS - 1;
+    neighbor_keys = (struct in6_addr *)calloc( INITIAL_NEIGHBOR_SLOTS, sizeof(struct in6_addr) );
+    neighbor_index = (Peer **)calloc( INITIAL_NEIGHBOR_SLOTS, sizeof(Peer *) );
+    aging_time = ::time(0);
+}
+
+/**
+ * Take a peer from the free list, mapping another chunk of them if
+ * there are none.  Called with the neighbor table lock held.
+ */
+Network::Peer*
+Network::Interface::allocate_neighbor() {
+    if ( free_neighbors.empty() ) {
+        size_t size = sizeof(Peer) * NEIGHBOR_CHUNK_SIZE;
+        Peer *chunk = (Peer *)mmap( 0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, 0, 0 );
+        if ( chunk == MAP_FAILED ) {
+            log_err( "ERROR: %s(%d) neighbor table alloc failed", name(), index() );
+            return NULL;
+        }
+        for ( int i = NEIGHBOR_CHUNK_SIZE - 1 ; i >= 0 ; --i ) {
+            chunk[i].invalidate();
+            free_neighbors.push_back( &chunk[i] );
+        }
+        neighbor_chunks.push_back( chunk );
+    }
+
+    Peer *peer = free_neighbors.back();
+    free_neighbors.pop_back();
+    return peer;
+}
+
+/**
+ * Return the index slot holding this address, or -1.
+ */
+int
+Network::Interface::probe_neighbor( struct in6_addr& address ) {
+    uint32_t slot = neighbor_hash( address ) & neighbor_mask;
+    while ( neighbor_index[slot] != NULL ) {
+        if ( same_address(neighbor_keys[slot], address) )  return slot;
+        slot = (slot + 1) & neighbor_mask;
+    }
+    return -1;
+}
+
+/**
+ */
+void
+Network::Interface::index_neighbor( Peer *peer ) {
+    uint32_t slot = neighbor_hash( peer->address() ) & neighbor_mask;
+    while ( neighbor_index[slot] != NULL ) {
+        slot = (slot + 1) & neighbor_mask;
+    }
+    neighbor_keys[slot] = peer->address();
+    neighbor_index[slot] = peer;
+}
+
+/**
+ * Double the index, keeping it under 75% full.
+ */
+void
+Network::Interface::grow_neighbor_index() {
+    uint32_t old_mask = neighbor_mask;
+    struct in6_addr *old_keys = neighbor_keys;
+    Peer **old_index = neighbor_index;
+
+    neighbor_mask = (old_mask + 1) * 2 - 1;
+    neighbor_keys = (struct in6_addr *)calloc( neighbor_mask + 1, sizeof(struct in6_addr) );
+    neighbor_index = (Peer **)calloc( neighbor_mask + 1, sizeof(Peer *) );
+    for ( uint32_t slot = 0 ; slot <= old_mask ; ++slot ) {
+        if ( old_index[slot] != NULL )  index_neighbor( old_index[slot] );
+    }
+
+    free( old_keys );
+    free( old_index );
+    if ( debug > 0 ) log_notice( "%s(%d) neighbor index grown to %u slots", name(), index(), neighbor_mask + 1 );
+}
+
+/**
+ * Drop the peer in this index slot from the table.  Later entries in
+ * the probe run are shifted back over the hole, and the last live peer
+ * is moved into its place in the packed list.
+ */
+void
+Network::Interface::unlink_neighbor( int hole ) {
+    Peer *peer = neighbor_index[hole];
+    neighbor_index[hole] = NULL;
+
+    uint32_t slot = hole;
+    for (;;) {
+        slot = (slot + 1) & neighbor_mask;
+        if ( neighbor_index[slot] == NULL ) break;
+        uint32_t home = neighbor_hash( neighbor_keys[slot] ) & neighbor_mask;
+        // leave it if its home is cyclically within (hole, slot]
+        if ( ((slot - home) & neighbor_mask) < ((slot - hole) & neighbor_mask) ) continue;
+        neighbor_keys[hole] = neighbor_keys[slot];
+        neighbor_index[hole] = neighbor_index[slot];
+        neighbor_index[slot] = NULL;
+        hole = slot;
+    }
+
+    Peer *last = live_neighbors.back();
+    live_neighbors[peer->table_position] = last;
+    last->table_position = peer->table_position;
+    live_neighbors.pop_back();
+
+    peer->invalidate();
+    peer->aging_slot = -1;
+    free_neighbors.push_back( peer );
+}
+
+/**
+ * File the peer in the wheel slot for the second it becomes due.
+ */
+void
+Network::Interface::age_neighbor( Peer *peer, time_t due ) {
+    if ( due <= aging_time )  due = aging_time + 1;
+    if ( due - aging_time >= NEIGHBOR_WHEEL_SLOTS )  due = aging_time + NEIGHBOR_WHEEL_SLOTS - 1;
+    int slot = due % NEIGHBOR_WHEEL_SLOTS;
+    peer->aging_slot = slot;
+    aging_wheel[slot].push_back( peer->address() );
+}
+
 /** Add peer to neighbor list.
  *
- * Allocate a neighbor table if this interface does not have one.
  * Either find the neighbor that has this address or add one
- * with this address if it is not already present.
- * If the peer already exists in the neighbor table, then do
- * not add it a second time.
+ * with this address if it is not already present.  Either way the
+ * peer has just been heard from, so its age starts over.
  */
 Network::Peer*
 Network::Interface::intern_neighbor( struct in6_addr& address ) {
-    int in_use_count = 0;
     Network::Peer *result = NULL;
-    Network::Peer *available = NULL;
-    bool new_entry = false;
 
     pthread_mutex_lock( &neighbor_table_lock );
-    if ( neighbors == NULL ) {
-        size_t size = sizeof(Peer) * NEIGHBOR_TABLE_SIZE;
-        neighbors = (Peer *)mmap( 0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, 0, 0 );
-        for ( int i = 0 ; i < NEIGHBOR_TABLE_SIZE ; ++i ) {
-            neighbors[i].invalidate();
-        }
-    }
-    int i = 0;
-    for ( ; i < NEIGHBOR_TABLE_SIZE ; ++i ) {
-        Network::Peer& peer = neighbors[i];
-        if ( peer.is_invalid() ) {
-            available = &peer;
-            continue;
-        }
-        in_use_count += 1;
-        if ( peer != address ) continue;
-        result = &peer;
-        break;
-    }
-    if ( in_use_count > 256 ) {
-        if ( table_warning_reported == false ) {
-            log_warn( "WARNING: %s(%d) neighbor table exceeds 256 entries", name(), index() );
-            table_warning_reported = true;
-        }
-    }
-    if ( result == NULL ) {
-        if ( available == NULL ) {	// EDM ??? wasn't this set above ???
-            for ( ; i < NEIGHBOR_TABLE_SIZE ; ++i ) {
-                Network::Peer& peer = neighbors[i];
-                if ( peer.is_valid() ) continue;
-                available = &peer;
-                break;
-            }
-        }
-
-        if ( available != NULL ) {
-            available->set_interface_name( NULL );
-            available->address( &address );
-            result = available;
-            new_entry = true;
-        } else {
-	    if ( table_error_reported == false ) {
-                log_err( "ERROR: %s(%d) neighbor table is full", name(), index() );
-                table_error_reported = true;
+    int slot = probe_neighbor( address );
+    if ( slot >= 0 ) {
+        result = neighbor_index[slot];
+    } else {
+        result = allocate_neighbor();
+        if ( result != NULL ) {
+            result->set_interface_name( NULL );
+            result->address( &address );
+            if ( (live_neighbors.size() + 1) * 4 > (neighbor_mask + 1) * 3 ) {
+                grow_neighbor_index();
             }
+            index_neighbor( result );
+            result->table_position = live_neighbors.size();
+            live_neighbors.push_back( result );
+            age_neighbor( result, ::time(0) + NEIGHBOR_TIMEOUT );
         }
     }
+    if ( result != NULL )  result->touch();
     pthread_mutex_unlock( &neighbor_table_lock );
 
 #if 0
@@ -872,20 +986,14 @@ Network::Interface::intern_neighbor( struct in6_addr& address ) {
 }
 
 /**
- * Remove all Peer objects from this interface's neighbor list
- * whose address matches the argument.
+ * Remove the Peer object with this address from this interface's
+ * neighbor list.
  */
 bool
 Network::Interface::remove_neighbor( struct in6_addr& address ) {
     pthread_mutex_lock( &neighbor_table_lock );
-    if ( neighbors != NULL ) {
-        for ( int i = 0 ; i < NEIGHBOR_TABLE_SIZE ; ++i ) {
-            Network::Peer& peer = neighbors[i];
-            if ( peer.is_invalid() ) continue;
-            if ( peer != address ) continue;
-            peer.invalidate();
-        }
-    }
+    int slot = probe_neighbor( address );
+    if ( slot >= 0 )  unlink_neighbor( slot );
     pthread_mutex_unlock( &neighbor_table_lock );
 
     return true;
@@ -901,15 +1009,8 @@ Network::Interface::find_neighbor( struct in6_addr& address ) {
     Network::Peer *result = NULL;
 
     pthread_mutex_lock( &neighbor_table_lock );
-    if ( neighbors != NULL ) {
-        for ( int i = 0 ; i < NEIGHBOR_TABLE_SIZE ; ++i ) {
-            Network::Peer& peer = neighbors[i];
-            if ( peer.is_invalid() ) continue;
-            if ( peer != address ) continue;
-            result = &peer;
-            break;
-        }
-    }
+    int slot = probe_neighbor( address );
+    if ( slot >= 0 )  result = neighbor_index[slot];
     pthread_mutex_unlock( &neighbor_table_lock );
 
     return result;
@@ -922,18 +1023,64 @@ Network::Interface::each_neighbor( NeighborIterator& callback ) {
     int result = 0;
 
     pthread_mutex_lock( &neighbor_table_lock );
-    if ( neighbors != NULL ) {
-        for ( int i = 0 ; i < NEIGHBOR_TABLE_SIZE ; ++i ) {
-            Network::Peer& peer = neighbors[i];
-            if ( peer.is_invalid() ) continue;
-            result += callback( peer );
-        }
+    for ( size_t i = 0 ; i < live_neighbors.size() ; ++i ) {
+        result += callback( *live_neighbors[i] );
     }
     pthread_mutex_unlock( &neighbor_table_lock );
 
     return result;
 }
-
+
+/** Turn the aging wheel up to the current second.
+ *
+ * Only the peers filed in the slots passed over are looked at.  A peer
+ * that has been heard from since it was filed goes back on the wheel
+ * for when it will next be due; one that has not is removed.  Entries
+ * for peers that were removed or refiled meanwhile are just dropped.
+ * Returns the number of peers expired.
+ */
+int
+Network::Interface::expire_neighbors() {
+    int expired = 0;
+    time_t now = ::time(0);
+
+    pthread_mutex_lock( &neighbor_table_lock );
+    std::vector<struct in6_addr> due;
+    int turns = 0;
+    while ( (aging_time < now) and (turns < NEIGHBOR_WHEEL_SLOTS) ) {
+        aging_time++;
+        turns++;
+        int slot = aging_time % NEIGHBOR_WHEEL_SLOTS;
+        due.swap( aging_wheel[slot] );
+        aging_wheel[slot].clear();
+
+        for ( size_t i = 0 ; i < due.size() ; ++i ) {
+            int position = probe_neighbor( due[i] );
+            if ( position < 0 ) continue;
+            Peer *peer = neighbor_index[position];
+            if ( peer->aging_slot != slot ) continue;
+
+            int age = peer->seconds_since_last_update();
+            if ( age >= NEIGHBOR_TIMEOUT ) {
+                if ( debug > 0 ) {
+                    char buffer[80];
+                    const char *address_string = inet_ntop( AF_INET6, &due[i], buffer, sizeof buffer );
+                    log_notice( "%s(%d) neighbor %s expired", name(), index(), address_string );
+                }
+                unlink_neighbor( position );
+                expired++;
+            } else {
+                age_neighbor( peer, aging_time + (NEIGHBOR_TIMEOUT - age) );
+            }
+        }
+        due.clear();
+    }
+    aging_time = now;
+    pthread_mutex_unlock( &neighbor_table_lock );
+
+    return expired;
+}
+
 /**
  */
 bool
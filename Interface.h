@@ -47,6 +47,7 @@
 
 #include <list>
 #include <map>
+#include <vector>
 
 #include "KernelEvent.h"
 
@@ -98,11 +99,35 @@ namespace Network {
         time_t last_bounce_reattempt;
         time_t last_negotiation;
 
+        /*
+         * Peers live in fixed chunks so a Peer* stays valid, and are
+         * found through an open addressing index on the link local
+         * address.  The live ones are also kept packed together for
+         * iteration.  Each live peer is filed in one slot of the aging
+         * wheel (one slot per second); when its slot comes round it is
+         * either expired or filed again where it will next be due.
+         */
         pthread_mutex_t neighbor_table_lock;
-        static const int NEIGHBOR_TABLE_SIZE = 4096;
-        Peer *neighbors;
-        bool table_warning_reported;
-	bool table_error_reported;
+        static const int NEIGHBOR_CHUNK_SIZE = 256;
+        static const int NEIGHBOR_WHEEL_SLOTS = 64;
+        static const int NEIGHBOR_TIMEOUT = 60;
+        std::vector<Peer *> neighbor_chunks;
+        std::vector<Peer *> free_neighbors;
+        std::vector<Peer *> live_neighbors;
+        uint32_t neighbor_mask;
+        struct in6_addr *neighbor_keys;
+        Peer **neighbor_index;
+        std::vector<struct in6_addr> aging_wheel[NEIGHBOR_WHEEL_SLOTS];
+        time_t aging_time;
+        std::vector<struct in6_addr> recipients;
+
+        void init_neighbor_table();
+        Peer *allocate_neighbor();
+        int probe_neighbor( struct in6_addr& );
+        void index_neighbor( Peer * );
+        void grow_neighbor_index();
+        void unlink_neighbor( int );
+        void age_neighbor( Peer *, time_t );
 
         int advertise_errors;
 
@@ -164,6 +189,7 @@ namespace Network {
         bool remove_neighbor( struct in6_addr & );
         Peer* find_neighbor( struct in6_addr & );
         int each_neighbor( NeighborIterator& );
+        int expire_neighbors();
 
         void accept_ra( bool );
         bool accept_ra();
@@ -0,0 +1,334 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** \file BPF.cc
+ * \brief Classic BPF socket filters.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <netinet/icmp6.h>
+#include <arpa/inet.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "logger.h"
+#include "BPF.h"
+
+namespace {
+    int debug = 0;
+
+    // classic BPF can only jump forward this far from a conditional
+    const int MAX_CONDITIONAL_JUMP = 255;
+    // the kernel's limit on a classic program
+    const int MAX_INSTRUCTIONS = BPF_MAXINSNS;
+
+    /**
+     * What a BPF halfword load (always big endian) reads from a field
+     * stored in host order.
+     */
+    inline uint32_t host_u16( uint16_t value ) {
+        return ntohs( value );
+    }
+}
+
+/**
+ */
+BPF::Program::Program() : finished(false), broken(false) {
+    _error[0] = '\0';
+}
+
+/**
+ */
+void
+BPF::Program::emit( uint16_t code_, uint8_t jt, uint8_t jf, uint32_t k ) {
+    struct sock_filter instruction = { code_, jt, jf, k };
+    code.push_back( instruction );
+}
+
+/**
+ * Load 1, 2 or 4 bytes from an absolute offset into A.
+ */
+void
+BPF::Program::load( int size, uint32_t offset ) {
+    uint16_t width = BPF_W;
+    if ( size == 1 )  width = BPF_B;
+    if ( size == 2 )  width = BPF_H;
+    emit( BPF_LD | width | BPF_ABS, 0, 0, offset );
+}
+
+/**
+ */
+void
+BPF::Program::load_length() {
+    emit( BPF_LD | BPF_W | BPF_LEN, 0, 0, 0 );
+}
+
+/**
+ */
+void
+BPF::Program::load_immediate( uint32_t value ) {
+    emit( BPF_LD | BPF_IMM, 0, 0, value );
+}
+
+/**
+ * A = A op value, where op is one of BPF_ADD, BPF_SUB, BPF_AND ...
+ */
+void
+BPF::Program::alu( uint16_t op, uint32_t value ) {
+    emit( BPF_ALU | op | BPF_K, 0, 0, value );
+}
+
+/**
+ * Compare A with value (op is BPF_JEQ, BPF_JGT, BPF_JGE or BPF_JSET)
+ * and go to on_true or on_false.  Either label may be NULL, meaning
+ * the next instruction.
+ */
+void
+BPF::Program::jump( uint16_t op, uint32_t value, const char *on_true, const char *on_false ) {
+    Fixup fixup;
+    fixup.at = code.size();
+    fixup.on_true[0] = fixup.on_false[0] = '\0';
+    if ( on_true != NULL )  copy_label( fixup.on_true, on_true );
+    if ( on_false != NULL )  copy_label( fixup.on_false, on_false );
+    fixups.push_back( fixup );
+    emit( BPF_JMP | op | BPF_K, 0, 0, value );
+}
+
+/**
+ * Unconditional jump.
+ */
+void
+BPF::Program::jump( const char *to ) {
+    Fixup fixup;
+    fixup.at = code.size();
+    copy_label( fixup.on_true, to );
+    fixup.on_false[0] = '\0';
+    fixups.push_back( fixup );
+    emit( BPF_JMP | BPF_JA, 0, 0, 0 );
+}
+
+/**
+ * Return value bytes of the packet to the socket; 0 drops it.
+ */
+void
+BPF::Program::ret( uint32_t value ) {
+    emit( BPF_RET | BPF_K, 0, 0, value );
+}
+
+/**
+ * Name the next instruction.
+ */
+bool
+BPF::Program::label( const char *name ) {
+    if ( find_label(name) >= 0 ) {
+        snprintf( _error, sizeof(_error), "label '%s' defined twice", name );
+        return false;
+    }
+    Label label;
+    if ( copy_label(label.name, name) == false )  return false;
+    label.at = code.size();
+    labels.push_back( label );
+    return true;
+}
+
+/**
+ * A name that does not fit would be cut short, and two long names
+ * could then meet, so it is refused and the program cannot finish.
+ */
+bool
+BPF::Program::copy_label( char *to, const char *name ) {
+    if ( strlen(name) >= (size_t)LABEL_SIZE ) {
+        snprintf( _error, sizeof(_error), "label '%s' is longer than %d characters", name, LABEL_SIZE - 1 );
+        to[0] = '\0';
+        broken = true;
+        return false;
+    }
+    strcpy( to, name );
+    return true;
+}
+
+/**
+ */
+int
+BPF::Program::find_label( const char *name ) const {
+    for ( size_t i = 0 ; i < labels.size() ; ++i ) {
+        if ( strcmp(labels[i].name, name) == 0 )  return labels[i].at;
+    }
+    return -1;
+}
+
+/**
+ * Resolve the jumps and check the program will be accepted: it must
+ * end in a return, and every jump must be forward and in range.
+ */
+bool
+BPF::Program::finish() {
+    if ( broken )  return false;
+    if ( code.empty() or (BPF_CLASS(code.back().code) != BPF_RET) ) {
+        snprintf( _error, sizeof(_error), "program must end with ret" );
+        return false;
+    }
+    if ( code.size() > (size_t)MAX_INSTRUCTIONS ) {
+        snprintf( _error, sizeof(_error), "program has %zu instructions, limit is %d", code.size(), MAX_INSTRUCTIONS );
+        return false;
+    }
+
+    for ( size_t i = 0 ; i < fixups.size() ; ++i ) {
+        Fixup& fixup = fixups[i];
+        struct sock_filter& instruction = code[fixup.at];
+        const char *names[2] = { fixup.on_true, fixup.on_false };
+        int offsets[2] = { 0, 0 };
+
+        for ( int n = 0 ; n < 2 ; ++n ) {
+            if ( names[n][0] == '\0' )  continue;
+            int target = find_label( names[n] );
+            if ( target < 0 ) {
+                snprintf( _error, sizeof(_error), "undefined label '%s'", names[n] );
+                return false;
+            }
+            if ( target <= fixup.at ) {
+                snprintf( _error, sizeof(_error), "jump to '%s' is not forward", names[n] );
+                return false;
+            }
+            offsets[n] = target - fixup.at - 1;
+        }
+
+        if ( BPF_OP(instruction.code) == BPF_JA ) {
+            instruction.k = offsets[0];
+            continue;
+        }
+        if ( (offsets[0] > MAX_CONDITIONAL_JUMP) or (offsets[1] > MAX_CONDITIONAL_JUMP) ) {
+            snprintf( _error, sizeof(_error), "conditional jump at %d is too far", fixup.at );
+            return false;
+        }
+        instruction.jt = offsets[0];
+        instruction.jf = offsets[1];
+    }
+
+    finished = true;
+    return true;
+}
+
+/**
+ * Replaces any filter already on the socket.
+ */
+bool
+BPF::Program::attach( int fd ) {
+    if ( finished == false ) {
+        snprintf( _error, sizeof(_error), "program is not finished" );
+        return false;
+    }
+    struct sock_fprog program;
+    program.len = code.size();
+    program.filter = &code[0];
+    if ( setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) < 0 ) {
+        snprintf( _error, sizeof(_error), "SO_ATTACH_FILTER: %s", strerror(errno) );
+        return false;
+    }
+    if ( debug > 0 ) log_notice( "attached %zu instruction filter to %d", code.size(), fd );
+    return true;
+}
+
+/**
+ */
+bool
+BPF::Program::detach( int fd ) {
+    int unused = 0;
+    return setsockopt( fd, SOL_SOCKET, SO_DETACH_FILTER, &unused, sizeof(unused) ) == 0;
+}
+
+/**
+ * The kernel's drop count for the socket (SK_MEMINFO_DROPS): packets
+ * lost to a full receive buffer.  Packets the filter rejects are not
+ * counted here -- that is the point of filtering.  Returns -1 if the
+ * kernel will not say.
+ */
+long
+BPF::Program::drops( int fd ) {
+    uint32_t meminfo[SK_MEMINFO_VARS];
+    socklen_t length = sizeof(meminfo);
+    if ( getsockopt(fd, SOL_SOCKET, SO_MEMINFO, meminfo, &length) < 0 )  return -1;
+    if ( length <= SK_MEMINFO_DROPS * sizeof(uint32_t) )  return -1;
+    return meminfo[SK_MEMINFO_DROPS];
+}
+
+/**
+ * Accept only the listed ICMPv6 types.  Returns NULL if the program
+ * cannot be built -- each type is one conditional jump to the end,
+ * so a list much over 250 types puts the first jump out of range.
+ */
+BPF::Program *
+BPF::Program::icmpv6( const uint8_t *types, int count ) {
+    Program *program = new Program();
+    program->load( 1, offsetof(struct icmp6_hdr, icmp6_type) );
+    for ( int i = 0 ; i < count ; ++i ) {
+        program->jump( BPF_JEQ, types[i], "accept", NULL );
+    }
+    program->ret( 0 );
+    program->label( "accept" );
+    program->ret( 0xffffffff );
+    if ( program->finish() == false ) {
+        log_err( "BPF: cannot build filter: %s", program->error() );
+        delete program;
+        return NULL;
+    }
+    return program;
+}
+
+/**
+ * Accept only datagrams whose first message is one of the listed
+ * types.  Dump responses (NLM_F_MULTI), NLMSG_DONE and NLMSG_ERROR
+ * always get through, since a dump or a request would never finish
+ * without them -- so in effect this filters the notifications.
+ * Returns NULL if the program cannot be built, as for icmpv6().
+ */
+BPF::Program *
+BPF::Program::netlink( const uint16_t *types, int count ) {
+    Program *program = new Program();
+    program->load( 2, offsetof(struct nlmsghdr, nlmsg_flags) );
+    program->jump( BPF_JSET, host_u16(NLM_F_MULTI), "accept", NULL );
+    program->load( 2, offsetof(struct nlmsghdr, nlmsg_type) );
+    program->jump( BPF_JEQ, host_u16(NLMSG_DONE), "accept", NULL );
+    program->jump( BPF_JEQ, host_u16(NLMSG_ERROR), "accept", NULL );
+    for ( int i = 0 ; i < count ; ++i ) {
+        program->jump( BPF_JEQ, host_u16(types[i]), "accept", NULL );
+    }
+    program->ret( 0 );
+    program->label( "accept" );
+    program->ret( 0xffffffff );
+    if ( program->finish() == false ) {
+        log_err( "BPF: cannot build filter: %s", program->error() );
+        delete program;
+        return NULL;
+    }
+    return program;
+}
+
+/* vim: set autoindent expandtab sw=4 : */
@@ -0,0 +1,101 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** \file BPF.h
+ * \brief Classic BPF socket filters.
+ *
+ * A Program is built one instruction at a time, with jumps naming
+ * labels that are defined further on; finish() resolves them.  The
+ * result is attached to a socket with SO_ATTACH_FILTER so packets the
+ * filter rejects never wake the reader.
+ *
+ * On an IPv6 raw socket the filter sees the ICMPv6 header at offset 0.
+ * On a netlink socket it sees the first nlmsghdr of each datagram, in
+ * host byte order -- the icmpv6() and netlink() builders allow for that.
+ * NetLink::Monitor and ICMPv6::Receiver put these canned filters on
+ * their sockets, so only the messages they handle wake them.
+ */
+
+#ifndef _BPF_H_
+#define _BPF_H_
+
+#include <stdint.h>
+#include <linux/filter.h>
+
+#include <vector>
+
+namespace BPF {
+
+    class Program {
+    private:
+        static const int LABEL_SIZE = 32;
+        struct Label {
+            char name[LABEL_SIZE];
+            int at;
+        };
+        struct Fixup {
+            int at;
+            char on_true[LABEL_SIZE];
+            char on_false[LABEL_SIZE];
+        };
+        std::vector<struct sock_filter> code;
+        std::vector<Label> labels;
+        std::vector<Fixup> fixups;
+        bool finished;
+        bool broken;
+        char _error[128];
+
+        void emit( uint16_t, uint8_t, uint8_t, uint32_t );
+        bool copy_label( char *, const char * );
+        int find_label( const char * ) const;
+    public:
+        Program();
+        ~Program() {}
+
+        void load( int, uint32_t );
+        void load_length();
+        void load_immediate( uint32_t );
+        void alu( uint16_t, uint32_t );
+        void jump( uint16_t, uint32_t, const char *, const char * );
+        void jump( const char * );
+        void ret( uint32_t );
+        bool label( const char * );
+        bool finish();
+
+        int length() const { return code.size(); }
+        const struct sock_filter *instructions() const { return &code[0]; }
+        const char *error() const { return _error; }
+
+        bool attach( int );
+        static bool detach( int );
+        static long drops( int );
+
+        static Program *icmpv6( const uint8_t *, int );
+        static Program *netlink( const uint16_t *, int );
+    };
+
+}
+
+#endif
+
+/* vim: set autoindent expandtab sw=4 : */
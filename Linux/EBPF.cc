@@ -0,0 +1,772 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** \file EBPF.cc
+ * \brief Loader for pre-compiled eBPF objects.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "logger.h"
+#include "EBPF.h"
+
+#ifndef EM_BPF
+#define EM_BPF 247
+#endif
+
+#ifndef SO_ATTACH_BPF
+#define SO_ATTACH_BPF 50
+#endif
+
+#ifndef SO_DETACH_BPF
+#define SO_DETACH_BPF SO_DETACH_FILTER
+#endif
+
+namespace {
+    int debug = 0;
+
+    // tcx attach points, newer than the uapi headers we build against
+    const uint32_t ATTACH_TCX_INGRESS = 46;
+    const uint32_t ATTACH_TCX_EGRESS  = 47;
+
+    // the kernel's internal "operation not supported" for batch ops
+    const int ENOTSUPP_ = 524;
+
+    const int BATCH_SIZE = 64;
+    const int LOG_SIZE = 256 * 1024;
+
+    inline long bpf( int command, union bpf_attr *attr ) {
+        return syscall( __NR_bpf, command, attr, sizeof(*attr) );
+    }
+
+    inline uint64_t pointer( const void *p ) {
+        return (uint64_t)(unsigned long)p;
+    }
+
+    /**
+     * Object and program names are limited to 15 characters from
+     * [A-Za-z0-9_.]; anything else is dropped.
+     */
+    void object_name( char *to, const char *from ) {
+        size_t n = 0;
+        for ( const char *p = from ; (*p != '\0') and (n < BPF_OBJ_NAME_LEN - 1) ; ++p ) {
+            char c = *p;
+            bool ok = ((c >= 'a') and (c <= 'z')) or ((c >= 'A') and (c <= 'Z')) or
+                      ((c >= '0') and (c <= '9')) or (c == '_') or (c == '.');
+            if ( ok )  to[n++] = c;
+        }
+        to[n] = '\0';
+    }
+
+    bool prefix( const char *name, const char *with ) {
+        return strncmp( name, with, strlen(with) ) == 0;
+    }
+
+    /**
+     * The program type for an executable section, or 0 if the section
+     * is not a program this loader knows how to attach.
+     */
+    uint32_t section_type( const char *name ) {
+        if ( prefix(name, "socket") )      return BPF_PROG_TYPE_SOCKET_FILTER;
+        if ( prefix(name, "xdp") )         return BPF_PROG_TYPE_XDP;
+        if ( prefix(name, "tc") )          return BPF_PROG_TYPE_SCHED_CLS;
+        if ( prefix(name, "classifier") )  return BPF_PROG_TYPE_SCHED_CLS;
+        return 0;
+    }
+
+    /**
+     * Bounds checked view of the ELF image.
+     */
+    class Image {
+    public:
+        std::vector<char> data;
+        const Elf64_Ehdr *header;
+        const Elf64_Shdr *sections;
+        const char *section_names;
+
+        Image() : header(NULL), sections(NULL), section_names(NULL) {}
+
+        bool contains( uint64_t offset, uint64_t size ) const {
+            return (offset <= data.size()) and (size <= data.size() - offset);
+        }
+        const char *at( uint64_t offset ) const { return &data[0] + offset; }
+
+        const char *section_name( int i ) const {
+            return section_names + sections[i].sh_name;
+        }
+        const char *content( int i ) const {
+            return at( sections[i].sh_offset );
+        }
+    };
+}
+
+/**
+ */
+BPF::Map::Map( const char *name, const MapDefinition *definition )
+: fd(-1),
+  _type(definition->type),
+  _key_size(definition->key_size),
+  _value_size(definition->value_size),
+  _max_entries(definition->max_entries),
+  _flags(definition->map_flags),
+  _syscalls(0)
+{
+    object_name( _name, name );
+}
+
+/**
+ */
+BPF::Map::~Map() {
+    if ( fd != -1 )  close( fd );
+}
+
+/**
+ */
+bool
+BPF::Map::create() {
+    union bpf_attr attr;
+    memset( &attr, 0, sizeof(attr) );
+    attr.map_type = _type;
+    attr.key_size = _key_size;
+    attr.value_size = _value_size;
+    attr.max_entries = _max_entries;
+    attr.map_flags = _flags;
+    memcpy( attr.map_name, _name, sizeof(attr.map_name) );
+
+    fd = bpf( BPF_MAP_CREATE, &attr );
+    if ( fd < 0 ) {
+        // older kernels reject map names
+        memset( attr.map_name, 0, sizeof(attr.map_name) );
+        fd = bpf( BPF_MAP_CREATE, &attr );
+    }
+    return fd >= 0;
+}
+
+/**
+ */
+bool
+BPF::Map::per_cpu() const {
+    switch ( _type ) {
+    case BPF_MAP_TYPE_PERCPU_HASH:
+    case BPF_MAP_TYPE_PERCPU_ARRAY:
+    case BPF_MAP_TYPE_LRU_PERCPU_HASH:
+    case BPF_MAP_TYPE_PERCPU_CGROUP_STORAGE:
+        return true;
+    }
+    return false;
+}
+
+/**
+ * The number of value slots a per-cpu lookup returns, which is the
+ * number of possible CPUs and not the number online.
+ */
+int
+BPF::Map::cpus() const {
+    static int possible = 0;
+    if ( per_cpu() == false )  return 1;
+    if ( possible > 0 )  return possible;
+
+    int count = 0;
+    FILE *f = fopen( "/sys/devices/system/cpu/possible", "r" );
+    if ( f != NULL ) {
+        int low, high;
+        while ( fscanf(f, "%d", &low) == 1 ) {
+            high = low;
+            if ( fscanf(f, "-%d", &high) != 1 )  high = low;
+            count += high - low + 1;
+            if ( fgetc(f) != ',' )  break;
+        }
+        fclose( f );
+    }
+    if ( count < 1 )  count = sysconf( _SC_NPROCESSORS_CONF );
+    possible = count;
+    return possible;
+}
+
+/**
+ * The size of the buffer a lookup fills -- per-cpu values are each
+ * rounded up to 8 bytes.
+ */
+size_t
+BPF::Map::value_length() const {
+    if ( per_cpu() == false )  return _value_size;
+    return ((_value_size + 7) & ~7) * cpus();
+}
+
+/**
+ */
+bool
+BPF::Map::lookup( const void *key, void *value ) {
+    union bpf_attr attr;
+    memset( &attr, 0, sizeof(attr) );
+    attr.map_fd = fd;
+    attr.key = pointer( key );
+    attr.value = pointer( value );
+    _syscalls++;
+    return bpf( BPF_MAP_LOOKUP_ELEM, &attr ) == 0;
+}
+
+/**
+ */
+bool
+BPF::Map::update( const void *key, const void *value, uint64_t flags ) {
+    union bpf_attr attr;
+    memset( &attr, 0, sizeof(attr) );
+    attr.map_fd = fd;
+    attr.key = pointer( key );
+    attr.value = pointer( value );
+    attr.flags = flags;
+    _syscalls++;
+    return bpf( BPF_MAP_UPDATE_ELEM, &attr ) == 0;
+}
+
+/**
+ */
+bool
+BPF::Map::remove( const void *key ) {
+    union bpf_attr attr;
+    memset( &attr, 0, sizeof(attr) );
+    attr.map_fd = fd;
+    attr.key = pointer( key );
+    _syscalls++;
+    return bpf( BPF_MAP_DELETE_ELEM, &attr ) == 0;
+}
+
+/**
+ * Walk the map BATCH_SIZE entries per syscall with
+ * BPF_MAP_LOOKUP_BATCH.  Map types (and kernels) without batch
+ * support fall back to one GET_NEXT_KEY and one LOOKUP per entry.
+ * A hash bucket with more entries than the batch holds doubles the
+ * batch.
+ *
+ * Returns the number of entries visited, or -1 on error.  The walk
+ * stops early if the callback returns non-zero.
+ */
+int
+BPF::Map::each( MapIterator& callback ) {
+    size_t length = value_length();
+    // the batch cursor is a key for arrays and a bucket for hashes
+    size_t cursor_size = (_key_size > 8) ? _key_size : 8;
+    uint32_t batch = BATCH_SIZE;
+    std::vector<char> keys( _key_size * batch );
+    std::vector<char> values( length * batch );
+    std::vector<char> in_batch( cursor_size ), out_batch( cursor_size );
+
+    int visited = 0;
+    bool first = true;
+    for (;;) {
+        union bpf_attr attr;
+        memset( &attr, 0, sizeof(attr) );
+        attr.batch.in_batch = first ? 0 : pointer( &in_batch[0] );
+        attr.batch.out_batch = pointer( &out_batch[0] );
+        attr.batch.keys = pointer( &keys[0] );
+        attr.batch.values = pointer( &values[0] );
+        attr.batch.count = batch;
+        attr.batch.map_fd = fd;
+        _syscalls++;
+
+        bool finished = false;
+        if ( bpf(BPF_MAP_LOOKUP_BATCH, &attr) < 0 ) {
+            int error = errno;
+            if ( error == ENOENT ) {
+                finished = true;
+            } else if ( error == ENOSPC ) {
+                // a hash bucket bigger than the batch: nothing was copied,
+                // so make room for it and ask again from the same place
+                batch *= 2;
+                keys.resize( _key_size * batch );
+                values.resize( length * batch );
+                continue;
+            } else if ( first and ((error == EINVAL) or (error == ENOTSUPP_) or (error == EOPNOTSUPP)) ) {
+                if ( debug > 0 )  log_notice( "map %s has no batch ops, walking keys", _name );
+                return each_key( callback );
+            } else {
+                return -1;
+            }
+        }
+
+        for ( uint32_t i = 0 ; i < attr.batch.count ; ++i ) {
+            visited++;
+            if ( callback(&keys[i * _key_size], &values[i * length]) != 0 )  return visited;
+        }
+        if ( finished )  break;
+        in_batch.swap( out_batch );
+        first = false;
+    }
+    return visited;
+}
+
+/**
+ */
+int
+BPF::Map::each_key( MapIterator& callback ) {
+    std::vector<char> key( _key_size ), next( _key_size );
+    std::vector<char> value( value_length() );
+
+    int visited = 0;
+    bool first = true;
+    for (;;) {
+        union bpf_attr attr;
+        memset( &attr, 0, sizeof(attr) );
+        attr.map_fd = fd;
+        attr.key = first ? 0 : pointer( &key[0] );
+        attr.next_key = pointer( &next[0] );
+        _syscalls++;
+        if ( bpf(BPF_MAP_GET_NEXT_KEY, &attr) < 0 ) {
+            if ( errno == ENOENT )  break;
+            return -1;
+        }
+        key.swap( next );
+        first = false;
+        // an entry deleted between the two calls is skipped
+        if ( lookup(&key[0], &value[0]) == false )  continue;
+        visited++;
+        if ( callback(&key[0], &value[0]) != 0 )  break;
+    }
+    return visited;
+}
+
+/**
+ */
+BPF::Object::Object() {
+    _error[0] = '\0';
+}
+
+/**
+ * Detach everything still attached, then drop the programs and maps.
+ */
+BPF::Object::~Object() {
+    for ( size_t i = 0 ; i < _sections.size() ; ++i ) {
+        Section& section = _sections[i];
+        if ( section.hook != Section::NONE )  detach( section.name );
+        if ( section.fd != -1 )  close( section.fd );
+    }
+    for ( size_t i = 0 ; i < _maps.size() ; ++i ) {
+        delete _maps[i];
+    }
+}
+
+/**
+ */
+bool
+BPF::Object::fail( const char *format, ... ) {
+    va_list ap;
+    va_start( ap, format );
+    vsnprintf( _error, sizeof(_error), format, ap );
+    va_end( ap );
+    return false;
+}
+
+/**
+ */
+BPF::Map *
+BPF::Object::map( const char *name ) const {
+    for ( size_t i = 0 ; i < _maps.size() ; ++i ) {
+        if ( strcmp(_maps[i]->name(), name) == 0 )  return _maps[i];
+    }
+    return NULL;
+}
+
+/**
+ * Load one program.  The first attempt is made without a verifier
+ * log; if it fails the load is repeated with one so the reason can
+ * be reported.
+ */
+bool
+BPF::Object::load_program( Section& section, struct bpf_insn *code, int count, const char *license ) {
+    union bpf_attr attr;
+    memset( &attr, 0, sizeof(attr) );
+    attr.prog_type = section.type;
+    attr.insns = pointer( code );
+    attr.insn_cnt = count;
+    attr.license = pointer( license );
+    if ( section.type == BPF_PROG_TYPE_XDP )  attr.expected_attach_type = BPF_XDP;
+    object_name( attr.prog_name, section.symbol );
+
+    section.fd = bpf( BPF_PROG_LOAD, &attr );
+    if ( section.fd >= 0 )  return true;
+
+    int error = errno;
+    char *log = (char *)malloc( LOG_SIZE );
+    if ( log == NULL ) {
+        return fail( "cannot load %s: %s", section.name, strerror(error) );
+    }
+    log[0] = '\0';
+    attr.log_buf = pointer( log );
+    attr.log_size = LOG_SIZE;
+    attr.log_level = 1;
+    section.fd = bpf( BPF_PROG_LOAD, &attr );
+    if ( section.fd >= 0 ) {
+        free( log );
+        return true;
+    }
+
+    // the verifier's conclusion is at the end of its log
+    size_t length = strlen( log );
+    while ( (length > 0) and (log[length - 1] == '\n') )  log[--length] = '\0';
+    const char *tail = log;
+    int lines = 0;
+    for ( size_t i = length ; i > 0 ; --i ) {
+        if ( (log[i - 1] == '\n') and (++lines == 3) ) {
+            tail = log + i;
+            break;
+        }
+    }
+    fail( "cannot load %s: %s%s%s", section.name, strerror(error), (*tail != '\0') ? "\n" : "", tail );
+    free( log );
+    return false;
+}
+
+/**
+ * Read the ELF object, create its maps, resolve the map references
+ * in each program and load the programs.
+ */
+bool
+BPF::Object::load( const char *path ) {
+    Image image;
+
+    int fd = open( path, O_RDONLY );
+    if ( fd < 0 )  return fail( "cannot open %s: %s", path, strerror(errno) );
+    struct stat st;
+    if ( fstat(fd, &st) < 0 ) {
+        close( fd );
+        return fail( "cannot stat %s: %s", path, strerror(errno) );
+    }
+    image.data.resize( st.st_size );
+    size_t got = 0;
+    while ( got < image.data.size() ) {
+        ssize_t bytes = read( fd, &image.data[got], image.data.size() - got );
+        if ( bytes < 0 and errno == EINTR )  continue;
+        if ( bytes <= 0 )  break;
+        got += bytes;
+    }
+    close( fd );
+    if ( got != image.data.size() )  return fail( "short read of %s", path );
+
+    if ( image.contains(0, sizeof(Elf64_Ehdr)) == false ) {
+        return fail( "%s is not an ELF object", path );
+    }
+    image.header = (const Elf64_Ehdr *)image.at( 0 );
+    const Elf64_Ehdr *header = image.header;
+    if ( (memcmp(header->e_ident, ELFMAG, SELFMAG) != 0) or
+         (header->e_ident[EI_CLASS] != ELFCLASS64) ) {
+        return fail( "%s is not a 64 bit ELF object", path );
+    }
+    if ( header->e_machine != EM_BPF ) {
+        return fail( "%s is not a BPF object (machine %d)", path, header->e_machine );
+    }
+    if ( (header->e_shentsize != sizeof(Elf64_Shdr)) or
+         (image.contains(header->e_shoff, (uint64_t)header->e_shnum * sizeof(Elf64_Shdr)) == false) or
+         (header->e_shstrndx >= header->e_shnum) ) {
+        return fail( "%s has a corrupt section table", path );
+    }
+    image.sections = (const Elf64_Shdr *)image.at( header->e_shoff );
+    int section_count = header->e_shnum;
+    for ( int i = 0 ; i < section_count ; ++i ) {
+        const Elf64_Shdr& s = image.sections[i];
+        if ( (s.sh_type != SHT_NOBITS) and (image.contains(s.sh_offset, s.sh_size) == false) ) {
+            return fail( "%s: section %d is outside the file", path, i );
+        }
+    }
+    const Elf64_Shdr& names = image.sections[header->e_shstrndx];
+    if ( (names.sh_size == 0) or (image.at(names.sh_offset)[names.sh_size - 1] != '\0') ) {
+        return fail( "%s has a corrupt section name table", path );
+    }
+    image.section_names = image.at( names.sh_offset );
+    for ( int i = 0 ; i < section_count ; ++i ) {
+        if ( image.sections[i].sh_name >= names.sh_size ) {
+            return fail( "%s has a corrupt section name table", path );
+        }
+    }
+
+    int symtab = -1, maps_index = -1;
+    const char *license = "GPL";
+    for ( int i = 0 ; i < section_count ; ++i ) {
+        const Elf64_Shdr& s = image.sections[i];
+        const char *name = image.section_name( i );
+        if ( s.sh_type == SHT_SYMTAB )  symtab = i;
+        if ( strcmp(name, "maps") == 0 )  maps_index = i;
+        if ( strcmp(name, "license") == 0 ) {
+            if ( (s.sh_size == 0) or (image.content(i)[s.sh_size - 1] != '\0') ) {
+                return fail( "%s: license is not a string", path );
+            }
+            license = image.content( i );
+        }
+        if ( strcmp(name, ".maps") == 0 ) {
+            return fail( "%s: BTF defined maps (.maps) are not supported", path );
+        }
+    }
+    if ( symtab == -1 )  return fail( "%s has no symbol table", path );
+
+    const Elf64_Shdr& symbols_header = image.sections[symtab];
+    if ( (symbols_header.sh_link >= (unsigned)section_count) or
+         (symbols_header.sh_entsize != sizeof(Elf64_Sym)) ) {
+        return fail( "%s has a corrupt symbol table", path );
+    }
+    const Elf64_Sym *symbols = (const Elf64_Sym *)image.content( symtab );
+    int symbol_count = symbols_header.sh_size / sizeof(Elf64_Sym);
+    const Elf64_Shdr& strings_header = image.sections[symbols_header.sh_link];
+    const char *strings = image.content( symbols_header.sh_link );
+    if ( (strings_header.sh_size == 0) or (strings[strings_header.sh_size - 1] != '\0') ) {
+        return fail( "%s has a corrupt string table", path );
+    }
+    for ( int i = 0 ; i < symbol_count ; ++i ) {
+        if ( symbols[i].st_name >= strings_header.sh_size ) {
+            return fail( "%s has a corrupt symbol table", path );
+        }
+    }
+
+    /**
+     * Every symbol in the maps section is one map definition; its
+     * value is the offset that relocations refer to.
+     */
+    std::vector<uint64_t> map_offsets;
+    if ( maps_index != -1 ) {
+        const Elf64_Shdr& s = image.sections[maps_index];
+        for ( int i = 0 ; i < symbol_count ; ++i ) {
+            const Elf64_Sym& symbol = symbols[i];
+            if ( symbol.st_shndx != maps_index )  continue;
+            if ( ELF64_ST_TYPE(symbol.st_info) == STT_SECTION )  continue;
+            if ( (symbol.st_value > s.sh_size) or
+                 (s.sh_size - symbol.st_value < sizeof(MapDefinition)) ) {
+                return fail( "%s: map %s is truncated", path, strings + symbol.st_name );
+            }
+            MapDefinition definition;
+            memcpy( &definition, image.content(maps_index) + symbol.st_value, sizeof(definition) );
+            Map *map = new Map( strings + symbol.st_name, &definition );
+            if ( map->create() == false ) {
+                int error = errno;
+                delete map;
+                return fail( "cannot create map %s: %s", strings + symbol.st_name, strerror(error) );
+            }
+            _maps.push_back( map );
+            map_offsets.push_back( symbol.st_value );
+        }
+    }
+
+    for ( int i = 0 ; i < section_count ; ++i ) {
+        const Elf64_Shdr& s = image.sections[i];
+        if ( (s.sh_type != SHT_PROGBITS) or ((s.sh_flags & SHF_EXECINSTR) == 0) )  continue;
+        if ( s.sh_size == 0 )  continue;
+
+        Section section;
+        section.type = section_type( image.section_name(i) );
+        if ( section.type == 0 ) {
+            if ( debug > 0 )  log_notice( "%s: skipping section %s", path, image.section_name(i) );
+            continue;
+        }
+        snprintf( section.name, sizeof(section.name), "%s", image.section_name(i) );
+        snprintf( section.symbol, sizeof(section.symbol), "%s", image.section_name(i) );
+        for ( int j = 0 ; j < symbol_count ; ++j ) {
+            const Elf64_Sym& symbol = symbols[j];
+            if ( (symbol.st_shndx == i) and (symbol.st_value == 0) and
+                 (ELF64_ST_TYPE(symbol.st_info) == STT_FUNC) ) {
+                snprintf( section.symbol, sizeof(section.symbol), "%s", strings + symbol.st_name );
+                break;
+            }
+        }
+
+        int count = s.sh_size / sizeof(struct bpf_insn);
+        std::vector<struct bpf_insn> code( count );
+        memcpy( &code[0], image.content(i), count * sizeof(struct bpf_insn) );
+
+        for ( int r = 0 ; r < section_count ; ++r ) {
+            const Elf64_Shdr& relocations = image.sections[r];
+            if ( (relocations.sh_type != SHT_REL) or (relocations.sh_info != (unsigned)i) )  continue;
+            if ( relocations.sh_entsize != sizeof(Elf64_Rel) ) {
+                return fail( "%s: corrupt relocations for %s", path, section.name );
+            }
+            const Elf64_Rel *rel = (const Elf64_Rel *)image.content( r );
+            int rel_count = relocations.sh_size / sizeof(Elf64_Rel);
+            for ( int k = 0 ; k < rel_count ; ++k ) {
+                uint64_t symbol_index = ELF64_R_SYM( rel[k].r_info );
+                uint64_t at = rel[k].r_offset / sizeof(struct bpf_insn);
+                if ( (symbol_index >= (uint64_t)symbol_count) or (at >= (uint64_t)count) ) {
+                    return fail( "%s: corrupt relocation in %s", path, section.name );
+                }
+                const Elf64_Sym& symbol = symbols[symbol_index];
+                const char *symbol_name = strings + symbol.st_name;
+                if ( (maps_index == -1) or (symbol.st_shndx != maps_index) ) {
+                    return fail( "%s: %s refers to %s, only map relocations are supported",
+                                 path, section.name, symbol_name );
+                }
+                if ( code[at].code != (BPF_LD | BPF_IMM | BPF_DW) ) {
+                    return fail( "%s: relocation for %s is not a 64 bit load", path, symbol_name );
+                }
+                size_t m;
+                for ( m = 0 ; m < map_offsets.size() ; ++m ) {
+                    if ( map_offsets[m] == symbol.st_value )  break;
+                }
+                if ( m == map_offsets.size() ) {
+                    return fail( "%s: %s refers to unknown map %s", path, section.name, symbol_name );
+                }
+                code[at].src_reg = BPF_PSEUDO_MAP_FD;
+                code[at].imm = _maps[m]->descriptor();
+            }
+        }
+
+        if ( load_program(section, &code[0], count, license) == false )  return false;
+        _sections.push_back( section );
+        if ( debug > 0 ) {
+            log_notice( "%s: loaded %s (%s) as %s, %d instructions", path,
+                        section.name, section.symbol, type_name(section.type), count );
+        }
+    }
+
+    if ( _sections.empty() )  return fail( "%s has no programs", path );
+    return true;
+}
+
+/**
+ * Attach the program in a section (named by section or function) to
+ * an interface index, or for SOCKET hooks to a socket descriptor.
+ */
+bool
+BPF::Object::attach( const char *name, Section::Hook hook, int target ) {
+    Section *section = NULL;
+    for ( size_t i = 0 ; i < _sections.size() ; ++i ) {
+        if ( (strcmp(_sections[i].name, name) == 0) or (strcmp(_sections[i].symbol, name) == 0) ) {
+            section = &_sections[i];
+            break;
+        }
+    }
+    if ( section == NULL )  return fail( "no program %s", name );
+    if ( section->hook != Section::NONE ) {
+        return fail( "%s is already attached (%s)", name, hook_name(section->hook) );
+    }
+
+    uint32_t wanted = (hook == Section::XDP) ? BPF_PROG_TYPE_XDP :
+                      (hook == Section::SOCKET) ? BPF_PROG_TYPE_SOCKET_FILTER : BPF_PROG_TYPE_SCHED_CLS;
+    if ( section->type != wanted ) {
+        return fail( "%s is a %s program, it cannot attach to %s", name,
+                     type_name(section->type), hook_name(hook) );
+    }
+
+    /**
+     * A socket filter has no link, so hold a duplicate of the socket
+     * in its place.  The socket then outlives the caller's descriptor,
+     * and detach always reaches the socket the filter went on, even
+     * if the caller's descriptor number has since been reused.
+     */
+    if ( hook == Section::SOCKET ) {
+        int held = fcntl( target, F_DUPFD_CLOEXEC, 0 );
+        if ( held < 0 ) {
+            return fail( "cannot hold socket %d: %s", target, strerror(errno) );
+        }
+        if ( setsockopt(held, SOL_SOCKET, SO_ATTACH_BPF, &section->fd, sizeof(section->fd)) < 0 ) {
+            fail( "cannot attach %s to socket: %s", name, strerror(errno) );
+            close( held );
+            return false;
+        }
+        section->hook = hook;
+        section->link = held;
+        section->target = target;
+        return true;
+    }
+
+    union bpf_attr attr;
+    memset( &attr, 0, sizeof(attr) );
+    attr.link_create.prog_fd = section->fd;
+    attr.link_create.target_ifindex = target;
+    switch ( hook ) {
+    case Section::XDP:        attr.link_create.attach_type = BPF_XDP; break;
+    case Section::TC_INGRESS: attr.link_create.attach_type = ATTACH_TCX_INGRESS; break;
+    case Section::TC_EGRESS:  attr.link_create.attach_type = ATTACH_TCX_EGRESS; break;
+    default: return fail( "bad hook" );
+    }
+
+    int link = bpf( BPF_LINK_CREATE, &attr );
+    if ( link < 0 ) {
+        return fail( "cannot attach %s to %s of interface %d: %s", name,
+                     hook_name(hook), target, strerror(errno) );
+    }
+    section->hook = hook;
+    section->link = link;
+    section->target = target;
+    return true;
+}
+
+/**
+ */
+bool
+BPF::Object::detach( const char *name ) {
+    for ( size_t i = 0 ; i < _sections.size() ; ++i ) {
+        Section& section = _sections[i];
+        if ( (strcmp(section.name, name) != 0) and (strcmp(section.symbol, name) != 0) )  continue;
+        if ( section.hook == Section::NONE )  return fail( "%s is not attached", name );
+
+        bool result = true;
+        if ( section.hook == Section::SOCKET ) {
+            int unused = 0;
+            if ( setsockopt(section.link, SOL_SOCKET, SO_DETACH_BPF, &unused, sizeof(unused)) < 0 ) {
+                result = fail( "cannot detach %s: %s", name, strerror(errno) );
+            }
+        }
+        close( section.link );
+        section.hook = Section::NONE;
+        section.link = -1;
+        section.target = -1;
+        return result;
+    }
+    return fail( "no program %s", name );
+}
+
+/**
+ */
+const char *
+BPF::Object::type_name( uint32_t type ) {
+    switch ( type ) {
+    case BPF_PROG_TYPE_SOCKET_FILTER: return "socket";
+    case BPF_PROG_TYPE_XDP:           return "xdp";
+    case BPF_PROG_TYPE_SCHED_CLS:     return "tc";
+    }
+    return "unknown";
+}
+
+/**
+ */
+const char *
+BPF::Object::hook_name( Section::Hook hook ) {
+    switch ( hook ) {
+    case Section::NONE:       return "none";
+    case Section::XDP:        return "xdp";
+    case Section::TC_INGRESS: return "ingress";
+    case Section::TC_EGRESS:  return "egress";
+    case Section::SOCKET:     return "socket";
+    }
+    return "unknown";
+}
+
+/* vim: set autoindent expandtab sw=4 : */
@@ -0,0 +1,165 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** \file EBPF.h
+ * \brief Loader for pre-compiled eBPF objects.
+ *
+ * An Object is an ELF file as clang -target bpf writes it.  Each
+ * executable section holds one program, whose type comes from the
+ * section name:
+ *
+ *   socket...            BPF_PROG_TYPE_SOCKET_FILTER
+ *   xdp...               BPF_PROG_TYPE_XDP
+ *   tc... classifier...  BPF_PROG_TYPE_SCHED_CLS
+ *
+ * Maps are declared the legacy way, as struct bpf_map_def in a "maps"
+ * section; BTF defined ".maps" are not understood.  Map references in
+ * the code are patched to the descriptors of the maps created here
+ * before the programs are loaded.
+ *
+ * Programs are attached to interfaces by index through bpf links (XDP
+ * and tcx), or to a socket with SO_ATTACH_BPF.  Closing the link
+ * detaches the program, so nothing is left behind when an Object is
+ * deleted.  For a socket the Object holds a duplicate descriptor in
+ * place of the link, which keeps the socket open until the program
+ * is detached.
+ */
+
+#ifndef _EBPF_H_
+#define _EBPF_H_
+
+#include <stdint.h>
+#include <linux/bpf.h>
+
+#include <vector>
+
+namespace BPF {
+
+    /**
+     * The legacy map declaration, as libbpf's bpf_helpers.h has it.
+     */
+    struct MapDefinition {
+        uint32_t type;
+        uint32_t key_size;
+        uint32_t value_size;
+        uint32_t max_entries;
+        uint32_t map_flags;
+    };
+
+    /**
+     * Called for each entry of a Map, with the value as the kernel
+     * returns it (one slot per possible CPU for the per-cpu maps).
+     */
+    class MapIterator {
+    public:
+        MapIterator() {}
+        virtual ~MapIterator() {}
+        virtual int operator() ( const void *key, const void *value ) = 0;
+    };
+
+    /**
+     */
+    class Map {
+    private:
+        int fd;
+        uint32_t _type;
+        uint32_t _key_size;
+        uint32_t _value_size;
+        uint32_t _max_entries;
+        uint32_t _flags;
+        char _name[BPF_OBJ_NAME_LEN];
+        unsigned long _syscalls;
+        int each_key( MapIterator& );
+    public:
+        Map( const char *, const MapDefinition * );
+        ~Map();
+        bool create();
+
+        const char *name()   const { return _name; }
+        int descriptor()     const { return fd; }
+        uint32_t type()      const { return _type; }
+        uint32_t key_size()  const { return _key_size; }
+        uint32_t value_size() const { return _value_size; }
+        uint32_t max_entries() const { return _max_entries; }
+        unsigned long syscalls() const { return _syscalls; }
+        bool per_cpu() const;
+        int cpus() const;
+        size_t value_length() const;
+
+        bool lookup( const void *, void * );
+        bool update( const void *, const void *, uint64_t = BPF_ANY );
+        bool remove( const void * );
+        int each( MapIterator& );
+    };
+
+    /**
+     * One program of an Object, and where it is attached.
+     */
+    class Section {
+    public:
+        enum Hook { NONE, XDP, TC_INGRESS, TC_EGRESS, SOCKET };
+        char name[64];
+        char symbol[64];
+        uint32_t type;
+        int fd;
+        Hook hook;
+        int link;
+        int target;
+        Section() : type(0), fd(-1), hook(NONE), link(-1), target(-1) {
+            name[0] = symbol[0] = '\0';
+        }
+    };
+
+    /**
+     */
+    class Object {
+    private:
+        std::vector<Map *> _maps;
+        std::vector<Section> _sections;
+        char _error[512];
+        bool fail( const char *, ... );
+        bool load_program( Section&, struct bpf_insn *, int, const char * );
+    public:
+        Object();
+        ~Object();
+        bool load( const char * );
+        const char *error() const { return _error; }
+
+        int maps() const { return _maps.size(); }
+        Map *map( int i ) const { return _maps[i]; }
+        Map *map( const char * ) const;
+        int sections() const { return _sections.size(); }
+        const Section& section( int i ) const { return _sections[i]; }
+
+        bool attach( const char *, Section::Hook, int );
+        bool detach( const char * );
+
+        static const char *type_name( uint32_t );
+        static const char *hook_name( Section::Hook );
+    };
+
+}
+
+#endif
+
+/* vim: set autoindent expandtab sw=4 : */
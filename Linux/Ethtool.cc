@@ -0,0 +1,694 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+/** \file Ethtool.cc
+ * \brief Interface settings from the ethtool generic netlink family.
+ *
+ * Requests go out on one socket that is kept for the life of the
+ * process; notifications arrive on a second socket that is a member
+ * of the "monitor" group, and are read without blocking whenever the
+ * cache is consulted.  Bitsets are asked for compact, which is also
+ * how notifications carry them; feature bits are matched to names
+ * through the kernel's feature string set, read once at open.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/ethtool.h>
+#include <linux/ethtool_netlink.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "logger.h"
+#include "Ethtool.h"
+
+#ifndef SOL_NETLINK
+#define SOL_NETLINK 270
+#endif
+
+namespace {
+    int debug = 0;
+
+    const int MAX_ATTRIBUTES = 64;
+
+    /**
+     * The offload bits and the kernel feature names that make them up.
+     * The legacy ioctls report a bit as on if any of its features are.
+     */
+    struct FeatureName {
+        const char *name;
+        int feature;
+    } offload_names[] = {
+        { "rx-checksum",                  Ethtool::RX_CHECKSUM },
+        { "tx-checksum-ipv4",             Ethtool::TX_CHECKSUM },
+        { "tx-checksum-ipv6",             Ethtool::TX_CHECKSUM },
+        { "tx-checksum-ip-generic",       Ethtool::TX_CHECKSUM },
+        { "tx-scatter-gather",            Ethtool::SCATTER_GATHER },
+        { "tx-tcp-segmentation",          Ethtool::TSO },
+        { "tx-tcp6-segmentation",         Ethtool::TSO },
+        { "tx-tcp-ecn-segmentation",      Ethtool::TSO },
+        { "tx-tcp-mangleid-segmentation", Ethtool::TSO },
+        { "tx-udp-fragmentation",         Ethtool::UFO },
+        { "tx-generic-segmentation",      Ethtool::GSO },
+        { "rx-gro",                       Ethtool::GRO },
+        { "rx-lro",                       Ethtool::LRO },
+        { NULL, 0 }
+    };
+
+    /**
+     * Index the attributes of one level.  Types above max are skipped.
+     */
+    void parse( struct nlattr *attribute, int length, struct nlattr **table, int max ) {
+        memset( table, 0, sizeof(*table) * (max + 1) );
+        while ( length >= (int)sizeof(struct nlattr) ) {
+            int size = attribute->nla_len;
+            if ( (size < (int)sizeof(struct nlattr)) or (size > length) )  break;
+            int type = attribute->nla_type & NLA_TYPE_MASK;
+            if ( type <= max )  table[type] = attribute;
+            length -= NLA_ALIGN( size );
+            attribute = (struct nlattr *)((char *)attribute + NLA_ALIGN(size));
+        }
+    }
+
+    void *payload( struct nlattr *attribute ) {
+        return (char *)attribute + NLA_HDRLEN;
+    }
+
+    int payload_length( struct nlattr *attribute ) {
+        return attribute->nla_len - NLA_HDRLEN;
+    }
+
+    void parse_nested( struct nlattr *attribute, struct nlattr **table, int max ) {
+        parse( (struct nlattr *)payload(attribute), payload_length(attribute), table, max );
+    }
+
+    uint32_t get_u32( struct nlattr *attribute ) {
+        uint32_t value = 0;
+        if ( payload_length(attribute) >= (int)sizeof(value) ) {
+            memcpy( &value, payload(attribute), sizeof(value) );
+        }
+        return value;
+    }
+
+    uint8_t get_u8( struct nlattr *attribute ) {
+        return *(uint8_t *)payload( attribute );
+    }
+
+    /**
+     * A request being built: attributes are appended after the
+     * generic netlink header, and nests are closed by fixing up their
+     * length.
+     */
+    struct Request {
+        union {
+            struct nlmsghdr header;
+            char data[512];
+        };
+
+        Request( uint16_t family, uint16_t flags, uint8_t command, uint8_t version ) {
+            memset( data, 0, sizeof(data) );
+            header.nlmsg_len = NLMSG_LENGTH( GENL_HDRLEN );
+            header.nlmsg_type = family;
+            header.nlmsg_flags = NLM_F_REQUEST | flags;
+            struct genlmsghdr *genl = (struct genlmsghdr *)NLMSG_DATA( &header );
+            genl->cmd = command;
+            genl->version = version;
+        }
+
+        struct nlattr *add( uint16_t type, const void *value, size_t length ) {
+            struct nlattr *attribute = (struct nlattr *)(data + NLMSG_ALIGN(header.nlmsg_len));
+            attribute->nla_type = type;
+            attribute->nla_len = NLA_HDRLEN + length;
+            if ( length > 0 )  memcpy( payload(attribute), value, length );
+            header.nlmsg_len = NLMSG_ALIGN(header.nlmsg_len) + NLA_ALIGN(attribute->nla_len);
+            return attribute;
+        }
+
+        void end( struct nlattr *nest ) {
+            nest->nla_len = (data + header.nlmsg_len) - (char *)nest;
+        }
+    };
+
+    /**
+     * The kinds that are cached.  Link modes are not: the kernel only
+     * notifies when they are set, not when a carrier change moves the
+     * negotiated speed, so they are always asked for.
+     */
+    struct Kind {
+        uint8_t command;
+        unsigned int valid;
+    } kinds[] = {
+        { ETHTOOL_MSG_LINKINFO_GET, Ethtool::Settings::LINK_INFO },
+        { ETHTOOL_MSG_FEATURES_GET, Ethtool::Settings::FEATURES },
+        { ETHTOOL_MSG_RINGS_GET,    Ethtool::Settings::RINGS },
+    };
+    const int KINDS = sizeof(kinds) / sizeof(kinds[0]);
+
+    // how long a device's settings are trusted without the monitor
+    const time_t CACHE_SECONDS = 5;
+
+    pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+    Ethtool::Cache *shared_cache = NULL;
+}
+
+/**
+ */
+const char *
+Ethtool::feature_name( int feature ) {
+    switch ( feature ) {
+    case RX_CHECKSUM:    return "rx";
+    case TX_CHECKSUM:    return "tx";
+    case SCATTER_GATHER: return "sg";
+    case TSO:            return "tso";
+    case UFO:            return "ufo";
+    case GSO:            return "gso";
+    case GRO:            return "gro";
+    case LRO:            return "lro";
+    }
+    return "unknown";
+}
+
+/**
+ * The cache for the process.  The sockets are opened on first use.
+ */
+Ethtool::Cache *
+Ethtool::Cache::shared() {
+    pthread_mutex_lock( &shared_lock );
+    if ( shared_cache == NULL )  shared_cache = new Cache();
+    pthread_mutex_unlock( &shared_lock );
+    return shared_cache;
+}
+
+/**
+ */
+Ethtool::Cache::Cache()
+: request_fd(-1),
+  monitor_fd(-1),
+  family(0),
+  sequence(0),
+  opened(false),
+  complete(false),
+  named(false),
+  buffer(NULL)
+{
+    pthread_mutex_init( &lock, NULL );
+    memset( &stats, 0, sizeof(stats) );
+    memset( feature_map, 0, sizeof(feature_map) );
+}
+
+/**
+ * Look up the ethtool family id and its monitor group through the
+ * generic netlink controller.
+ */
+bool
+Ethtool::Cache::resolve( uint32_t *group ) {
+    Request request( GENL_ID_CTRL, 0, CTRL_CMD_GETFAMILY, 1 );
+    request.add( CTRL_ATTR_FAMILY_NAME, ETHTOOL_GENL_NAME, strlen(ETHTOOL_GENL_NAME) + 1 );
+    request.header.nlmsg_seq = ++sequence;
+    if ( send(request_fd, request.data, request.header.nlmsg_len, 0) < 0 )  return false;
+
+    ssize_t bytes = recv( request_fd, buffer, BUFFER_SIZE, 0 );
+    if ( bytes <= 0 )  return false;
+    struct nlmsghdr *h = (struct nlmsghdr *)buffer;
+    if ( (NLMSG_OK(h, (unsigned int)bytes) == false) or (h->nlmsg_type != GENL_ID_CTRL) ) {
+        return false;
+    }
+
+    struct nlattr *table[MAX_ATTRIBUTES];
+    struct nlattr *first = (struct nlattr *)((char *)NLMSG_DATA(h) + GENL_HDRLEN);
+    parse( first, h->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN), table, CTRL_ATTR_MAX );
+    if ( table[CTRL_ATTR_FAMILY_ID] == NULL )  return false;
+    family = *(uint16_t *)payload( table[CTRL_ATTR_FAMILY_ID] );
+
+    *group = 0;
+    if ( table[CTRL_ATTR_MCAST_GROUPS] == NULL )  return true;
+    struct nlattr *entry = (struct nlattr *)payload( table[CTRL_ATTR_MCAST_GROUPS] );
+    int remaining = payload_length( table[CTRL_ATTR_MCAST_GROUPS] );
+    while ( remaining >= (int)sizeof(struct nlattr) ) {
+        int size = entry->nla_len;
+        if ( (size < (int)sizeof(struct nlattr)) or (size > remaining) )  break;
+        struct nlattr *fields[MAX_ATTRIBUTES];
+        parse_nested( entry, fields, CTRL_ATTR_MCAST_GRP_MAX );
+        if ( (fields[CTRL_ATTR_MCAST_GRP_NAME] != NULL) and (fields[CTRL_ATTR_MCAST_GRP_ID] != NULL) ) {
+            const char *name = (const char *)payload( fields[CTRL_ATTR_MCAST_GRP_NAME] );
+            if ( strcmp(name, ETHTOOL_MCGRP_MONITOR_NAME) == 0 ) {
+                *group = get_u32( fields[CTRL_ATTR_MCAST_GRP_ID] );
+            }
+        }
+        remaining -= NLA_ALIGN( size );
+        entry = (struct nlattr *)((char *)entry + NLA_ALIGN(size));
+    }
+    return true;
+}
+
+/**
+ * Read the names of the netdev feature bits, and note which of the
+ * legacy offload bits each one counts toward.
+ */
+bool
+Ethtool::Cache::feature_names() {
+    Request request( family, 0, ETHTOOL_MSG_STRSET_GET, ETHTOOL_GENL_VERSION );
+    struct nlattr *header = request.add( ETHTOOL_A_STRSET_HEADER | NLA_F_NESTED, NULL, 0 );
+    request.end( header );
+    struct nlattr *sets = request.add( ETHTOOL_A_STRSET_STRINGSETS | NLA_F_NESTED, NULL, 0 );
+    struct nlattr *set = request.add( ETHTOOL_A_STRINGSETS_STRINGSET | NLA_F_NESTED, NULL, 0 );
+    uint32_t id = ETH_SS_FEATURES;
+    request.add( ETHTOOL_A_STRINGSET_ID, &id, sizeof(id) );
+    request.end( set );
+    request.end( sets );
+    request.header.nlmsg_seq = ++sequence;
+    if ( send(request_fd, request.data, request.header.nlmsg_len, 0) < 0 )  return false;
+
+    ssize_t bytes = recv( request_fd, buffer, BUFFER_SIZE, 0 );
+    if ( bytes <= 0 )  return false;
+    struct nlmsghdr *h = (struct nlmsghdr *)buffer;
+    if ( (NLMSG_OK(h, (unsigned int)bytes) == false) or (h->nlmsg_type != family) )  return false;
+
+    struct nlattr *table[MAX_ATTRIBUTES];
+    struct nlattr *first = (struct nlattr *)((char *)NLMSG_DATA(h) + GENL_HDRLEN);
+    parse( first, h->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN), table, ETHTOOL_A_STRSET_MAX );
+    if ( table[ETHTOOL_A_STRSET_STRINGSETS] == NULL )  return false;
+
+    struct nlattr *level[MAX_ATTRIBUTES];
+    parse_nested( table[ETHTOOL_A_STRSET_STRINGSETS], level, ETHTOOL_A_STRINGSETS_MAX );
+    if ( level[ETHTOOL_A_STRINGSETS_STRINGSET] == NULL )  return false;
+    parse_nested( level[ETHTOOL_A_STRINGSETS_STRINGSET], level, ETHTOOL_A_STRINGSET_MAX );
+    if ( level[ETHTOOL_A_STRINGSET_STRINGS] == NULL )  return false;
+
+    struct nlattr *string = (struct nlattr *)payload( level[ETHTOOL_A_STRINGSET_STRINGS] );
+    int remaining = payload_length( level[ETHTOOL_A_STRINGSET_STRINGS] );
+    while ( remaining >= (int)sizeof(struct nlattr) ) {
+        int size = string->nla_len;
+        if ( (size < (int)sizeof(struct nlattr)) or (size > remaining) )  break;
+        struct nlattr *fields[MAX_ATTRIBUTES];
+        parse_nested( string, fields, ETHTOOL_A_STRING_MAX );
+        if ( (fields[ETHTOOL_A_STRING_INDEX] != NULL) and (fields[ETHTOOL_A_STRING_VALUE] != NULL) ) {
+            uint32_t bit = get_u32( fields[ETHTOOL_A_STRING_INDEX] );
+            const char *name = (const char *)payload( fields[ETHTOOL_A_STRING_VALUE] );
+            for ( int i = 0 ; (bit < FEATURE_BITS) and (offload_names[i].name != NULL) ; ++i ) {
+                if ( strcmp(name, offload_names[i].name) == 0 )  feature_map[bit] = offload_names[i].feature;
+            }
+        }
+        remaining -= NLA_ALIGN( size );
+        string = (struct nlattr *)((char *)string + NLA_ALIGN(size));
+    }
+    return true;
+}
+
+/**
+ * The legacy offload bits of a compact bitset: a bit counts if any of
+ * the features behind it is set.
+ */
+uint32_t
+Ethtool::Cache::active_features( struct nlattr *bitset ) {
+    struct nlattr *table[MAX_ATTRIBUTES];
+    parse_nested( bitset, table, ETHTOOL_A_BITSET_MAX );
+    if ( (table[ETHTOOL_A_BITSET_SIZE] == NULL) or (table[ETHTOOL_A_BITSET_VALUE] == NULL) )  return 0;
+
+    int bits = get_u32( table[ETHTOOL_A_BITSET_SIZE] );
+    int words = payload_length( table[ETHTOOL_A_BITSET_VALUE] ) / sizeof(uint32_t);
+    if ( bits > words * 32 )  bits = words * 32;
+    if ( bits > FEATURE_BITS )  bits = FEATURE_BITS;
+
+    uint32_t value[FEATURE_BITS / 32];
+    memcpy( value, payload(table[ETHTOOL_A_BITSET_VALUE]), ((bits + 31) / 32) * sizeof(uint32_t) );
+
+    uint32_t result = 0;
+    for ( int bit = 0 ; bit < bits ; ++bit ) {
+        if ( value[bit / 32] & (1U << (bit % 32)) )  result |= feature_map[bit];
+    }
+    return result;
+}
+
+/**
+ * Open the request socket, find the family, and join the monitor
+ * group.  The monitor is joined before anything is dumped, so no
+ * change can fall between the dump and the first notification.
+ * Without the monitor nothing is cached.
+ */
+bool
+Ethtool::Cache::open() {
+    if ( opened )  return family != 0;
+    opened = true;
+
+    buffer = (char *)malloc( BUFFER_SIZE );
+    request_fd = socket( AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC );
+    if ( (buffer == NULL) or (request_fd < 0) ) {
+        log_err( "Ethtool: cannot open a generic netlink socket: %s", strerror(errno) );
+        return false;
+    }
+
+    uint32_t group;
+    if ( resolve(&group) == false ) {
+        log_notice( "Ethtool: no ethtool netlink family, using ioctls" );
+        family = 0;
+        return false;
+    }
+
+    named = feature_names();
+    if ( named == false ) {
+        log_warn( "Ethtool: cannot read the feature names, offloads will not be cached" );
+    }
+
+    if ( group != 0 ) {
+        // multicast is only delivered to a bound socket
+        struct sockaddr_nl address;
+        memset( &address, 0, sizeof(address) );
+        address.nl_family = AF_NETLINK;
+        monitor_fd = socket( AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC );
+        if ( (monitor_fd >= 0) and
+             ((bind(monitor_fd, (struct sockaddr *)&address, sizeof(address)) < 0) or
+              (setsockopt(monitor_fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) < 0)) ) {
+            log_warn( "Ethtool: cannot join the monitor group: %s", strerror(errno) );
+            close( monitor_fd );
+            monitor_fd = -1;
+        }
+    }
+    if ( debug > 0 )  log_notice( "Ethtool: family %d monitor group %u", family, group );
+    return true;
+}
+
+/**
+ * Take one reply or notification into the cache.
+ */
+void
+Ethtool::Cache::apply( struct nlmsghdr *h ) {
+    struct genlmsghdr *genl = (struct genlmsghdr *)NLMSG_DATA( h );
+    struct nlattr *table[MAX_ATTRIBUTES];
+    struct nlattr *first = (struct nlattr *)((char *)genl + GENL_HDRLEN);
+    parse( first, h->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN), table, MAX_ATTRIBUTES - 1 );
+
+    // every reply and notification leads with the device header
+    if ( table[1] == NULL )  return;
+    struct nlattr *header[MAX_ATTRIBUTES];
+    parse_nested( table[1], header, ETHTOOL_A_HEADER_MAX );
+    if ( header[ETHTOOL_A_HEADER_DEV_INDEX] == NULL )  return;
+    int index = get_u32( header[ETHTOOL_A_HEADER_DEV_INDEX] );
+
+    Settings& entry = entries[index];
+    if ( entry.index != index ) {
+        memset( &entry, 0, sizeof(entry) );
+        entry.index = index;
+    }
+    if ( header[ETHTOOL_A_HEADER_DEV_NAME] != NULL ) {
+        strncpy( entry.name, (const char *)payload(header[ETHTOOL_A_HEADER_DEV_NAME]), sizeof(entry.name) - 1 );
+    }
+
+    switch ( genl->cmd ) {
+    case ETHTOOL_MSG_LINKMODES_GET_REPLY:
+    case ETHTOOL_MSG_LINKMODES_NTF:
+        if ( table[ETHTOOL_A_LINKMODES_SPEED] )   entry.speed = get_u32( table[ETHTOOL_A_LINKMODES_SPEED] );
+        if ( table[ETHTOOL_A_LINKMODES_DUPLEX] )  entry.duplex = get_u8( table[ETHTOOL_A_LINKMODES_DUPLEX] );
+        if ( table[ETHTOOL_A_LINKMODES_AUTONEG] ) entry.autoneg = get_u8( table[ETHTOOL_A_LINKMODES_AUTONEG] );
+        entry.valid |= Settings::LINK_MODES;
+        break;
+    case ETHTOOL_MSG_LINKINFO_GET_REPLY:
+    case ETHTOOL_MSG_LINKINFO_NTF:
+        if ( table[ETHTOOL_A_LINKINFO_PORT] )  entry.port = get_u8( table[ETHTOOL_A_LINKINFO_PORT] );
+        entry.valid |= Settings::LINK_INFO;
+        break;
+    case ETHTOOL_MSG_FEATURES_GET_REPLY:
+    case ETHTOOL_MSG_FEATURES_NTF:
+        if ( named == false )  break;
+        if ( table[ETHTOOL_A_FEATURES_ACTIVE] )  entry.features = active_features( table[ETHTOOL_A_FEATURES_ACTIVE] );
+        entry.valid |= Settings::FEATURES;
+        break;
+    case ETHTOOL_MSG_RINGS_GET_REPLY:
+    case ETHTOOL_MSG_RINGS_NTF:
+        if ( table[ETHTOOL_A_RINGS_RX_MAX] )  entry.rx_max = get_u32( table[ETHTOOL_A_RINGS_RX_MAX] );
+        if ( table[ETHTOOL_A_RINGS_RX] )      entry.rx = get_u32( table[ETHTOOL_A_RINGS_RX] );
+        if ( table[ETHTOOL_A_RINGS_TX_MAX] )  entry.tx_max = get_u32( table[ETHTOOL_A_RINGS_TX_MAX] );
+        if ( table[ETHTOOL_A_RINGS_TX] )      entry.tx = get_u32( table[ETHTOOL_A_RINGS_TX] );
+        entry.valid |= Settings::RINGS;
+        break;
+    }
+}
+
+/**
+ * Send one GET, for a single device or (index 0) a dump of all of
+ * them, and apply every reply.  Returns false if the kernel refused
+ * it -- a driver without ring settings, say.
+ */
+bool
+Ethtool::Cache::query( uint8_t command, int index ) {
+    bool dump = (index == 0);
+    Request request( family, dump ? NLM_F_DUMP : 0, command, ETHTOOL_GENL_VERSION );
+    struct nlattr *nest = request.add( ETHTOOL_A_LINKMODES_HEADER | NLA_F_NESTED, NULL, 0 );
+    if ( index != 0 ) {
+        uint32_t device = index;
+        request.add( ETHTOOL_A_HEADER_DEV_INDEX, &device, sizeof(device) );
+    }
+    uint32_t flags = ETHTOOL_FLAG_COMPACT_BITSETS;
+    request.add( ETHTOOL_A_HEADER_FLAGS, &flags, sizeof(flags) );
+    request.end( nest );
+    request.header.nlmsg_seq = ++sequence;
+
+    stats.requests++;
+    if ( dump )  stats.dumps++;
+    if ( send(request_fd, request.data, request.header.nlmsg_len, 0) < 0 ) {
+        log_err( "Ethtool: request failed: %s", strerror(errno) );
+        return false;
+    }
+
+    for (;;) {
+        ssize_t bytes = recv( request_fd, buffer, BUFFER_SIZE, 0 );
+        if ( bytes < 0 ) {
+            if ( errno == EINTR )  continue;
+            log_err( "Ethtool: receive failed: %s", strerror(errno) );
+            return false;
+        }
+
+        unsigned int remaining = bytes;
+        struct nlmsghdr *h = (struct nlmsghdr *)buffer;
+        for ( ; NLMSG_OK(h, remaining) ; h = NLMSG_NEXT(h, remaining) ) {
+            if ( h->nlmsg_seq != sequence )  continue;
+            if ( h->nlmsg_type == NLMSG_DONE )  return true;
+            if ( h->nlmsg_type == NLMSG_ERROR ) {
+                struct nlmsgerr *error = (struct nlmsgerr *)NLMSG_DATA( h );
+                if ( (debug > 0) and (error->error != 0) ) {
+                    log_notice( "Ethtool: command %d for %d: %s", command, index, strerror(-error->error) );
+                }
+                return error->error == 0;
+            }
+            apply( h );
+            stats.replies++;
+            if ( dump == false )  return true;
+        }
+    }
+}
+
+/**
+ * Apply every notification that has arrived.  If some were lost the
+ * whole cache is dumped again on next use.
+ */
+void
+Ethtool::Cache::sync() {
+    if ( monitor_fd < 0 )  return;
+    for (;;) {
+        ssize_t bytes = recv( monitor_fd, buffer, BUFFER_SIZE, MSG_DONTWAIT );
+        if ( bytes < 0 ) {
+            if ( errno == EINTR )  continue;
+            if ( errno == ENOBUFS ) {
+                stats.overruns++;
+                complete = false;
+                continue;
+            }
+            return;
+        }
+        unsigned int remaining = bytes;
+        struct nlmsghdr *h = (struct nlmsghdr *)buffer;
+        for ( ; NLMSG_OK(h, remaining) ; h = NLMSG_NEXT(h, remaining) ) {
+            if ( h->nlmsg_type != family )  continue;
+            apply( h );
+            stats.notifications++;
+        }
+    }
+}
+
+/**
+ * Dump every cached kind of setting for every device.
+ */
+bool
+Ethtool::Cache::fill() {
+    entries.clear();
+    fetched.clear();
+    for ( int i = 0 ; i < KINDS ; ++i )  query( kinds[i].command, 0 );
+    complete = (monitor_fd >= 0);
+    if ( complete )  return true;
+
+    Fetched dumped;
+    dumped.when = time( 0 );
+    dumped.asked = Settings::ALL;
+    std::map<int, Settings>::iterator entry = entries.begin();
+    for ( ; entry != entries.end() ; ++entry )  fetched[entry->first] = dumped;
+    return true;
+}
+
+/**
+ * Ask for the current link modes of one device, or (index 0) all of
+ * them.
+ */
+void
+Ethtool::Cache::link_modes( int index ) {
+    if ( index != 0 ) {
+        std::map<int, Settings>::iterator entry = entries.find( index );
+        if ( entry != entries.end() )  entry->second.valid &= ~Settings::LINK_MODES;
+    } else {
+        std::map<int, Settings>::iterator entry = entries.begin();
+        for ( ; entry != entries.end() ; ++entry )  entry->second.valid &= ~Settings::LINK_MODES;
+    }
+    query( ETHTOOL_MSG_LINKMODES_GET, index );
+}
+
+/**
+ */
+bool
+Ethtool::Cache::available() {
+    pthread_mutex_lock( &lock );
+    bool result = open();
+    pthread_mutex_unlock( &lock );
+    return result;
+}
+
+/**
+ * The wanted settings of one device.  Link modes are always asked for.
+ * The other kinds come from the cache while the monitor keeps it
+ * current; a device that was not in the last dump is asked for
+ * directly.  Without the monitor what was asked for is kept a few
+ * seconds, and only the kinds wanted are asked for.  Returns false if
+ * ethtool netlink is not available or the device reports nothing.
+ */
+bool
+Ethtool::Cache::lookup( int index, Settings& result, unsigned int wanted ) {
+    if ( index <= 0 )  return false;
+    pthread_mutex_lock( &lock );
+    if ( open() == false ) {
+        pthread_mutex_unlock( &lock );
+        return false;
+    }
+
+    sync();
+    if ( (complete == false) and (monitor_fd >= 0) )  fill();
+
+    std::map<int, Settings>::iterator entry = entries.find( index );
+    unsigned int missing = 0;
+    if ( complete ) {
+        if ( entry == entries.end() )  missing = wanted;
+    } else {
+        time_t now = time( 0 );
+        Fetched& last = fetched[index];
+        if ( now - last.when >= CACHE_SECONDS ) {
+            last.when = now;
+            last.asked = 0;
+            if ( entry != entries.end() )  entry->second.valid &= Settings::LINK_MODES;
+        }
+        missing = wanted & ~last.asked;
+        last.asked |= wanted;
+    }
+
+    missing &= ~Settings::LINK_MODES;
+    if ( missing == 0 ) {
+        stats.hits++;
+    } else {
+        stats.misses++;
+        for ( int i = 0 ; i < KINDS ; ++i ) {
+            if ( missing & kinds[i].valid )  query( kinds[i].command, index );
+        }
+    }
+    if ( wanted & Settings::LINK_MODES )  link_modes( index );
+    entry = entries.find( index );
+
+    bool found = entry != entries.end();
+    if ( found )  result = entry->second;
+    pthread_mutex_unlock( &lock );
+    return found;
+}
+
+/**
+ * Throw the cache away and dump it again.  Returns the number of
+ * devices, or -1 without ethtool netlink.
+ */
+int
+Ethtool::Cache::refresh() {
+    pthread_mutex_lock( &lock );
+    if ( open() == false ) {
+        pthread_mutex_unlock( &lock );
+        return -1;
+    }
+    sync();
+    fill();
+    int result = entries.size();
+    pthread_mutex_unlock( &lock );
+    return result;
+}
+
+/**
+ * Drop what is known about one device, after it was changed or
+ * removed.  It is asked for again on next lookup.
+ */
+void
+Ethtool::Cache::forget( int index ) {
+    pthread_mutex_lock( &lock );
+    entries.erase( index );
+    fetched.erase( index );
+    pthread_mutex_unlock( &lock );
+}
+
+/**
+ */
+int
+Ethtool::Cache::each( SettingsIterator& callback ) {
+    pthread_mutex_lock( &lock );
+    if ( open() == false ) {
+        pthread_mutex_unlock( &lock );
+        return 0;
+    }
+    sync();
+    if ( complete == false )  fill();
+    link_modes( 0 );
+
+    int result = 0;
+    std::map<int, Settings>::iterator entry = entries.begin();
+    for ( ; entry != entries.end() ; ++entry ) {
+        result += callback( entry->second );
+    }
+    pthread_mutex_unlock( &lock );
+    return result;
+}
+
+/**
+ */
+void
+Ethtool::Cache::statistics( CacheStatistics& result ) {
+    pthread_mutex_lock( &lock );
+    result = stats;
+    pthread_mutex_unlock( &lock );
+}
+
+/* vim: set autoindent expandtab sw=4 : */
@@ -0,0 +1,156 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+/** \file Ethtool.h
+ * \brief Interface settings from the ethtool generic netlink family.
+ *
+ * One process wide cache holds link info, offload features and ring
+ * sizes for every interface.  It is filled by one dump of each kind,
+ * and kept current by the ethtool "monitor" multicast group:
+ * notifications carry the same attributes as the replies, and are
+ * applied before each lookup, so nothing is polled.  If the
+ * notification socket overruns the cache is dumped again.  Without
+ * the monitor group a device's settings are kept for a few seconds.
+ *
+ * Link modes (speed, duplex, autoneg) are always asked for: the
+ * kernel notifies when they are set, but not when a carrier change
+ * renegotiates them.
+ */
+
+#ifndef _ETHTOOL_H_
+#define _ETHTOOL_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <linux/if.h>
+#include <linux/netlink.h>
+
+#include <map>
+
+namespace Ethtool {
+
+    /**
+     * The offload features the legacy ETHTOOL_G* ioctls report.
+     */
+    enum Feature {
+        RX_CHECKSUM    = 0x01,
+        TX_CHECKSUM    = 0x02,
+        SCATTER_GATHER = 0x04,
+        TSO            = 0x08,
+        UFO            = 0x10,
+        GSO            = 0x20,
+        GRO            = 0x40,
+        LRO            = 0x80,
+    };
+    const char *feature_name( int );
+
+    /**
+     * valid says which kinds of reply have been seen for the device;
+     * a driver may not support them all.
+     */
+    struct Settings {
+        enum { LINK_MODES = 0x1, LINK_INFO = 0x2, FEATURES = 0x4, RINGS = 0x8, ALL = 0xf };
+        int index;
+        char name[IFNAMSIZ];
+        unsigned int valid;
+        uint32_t speed;
+        uint8_t duplex;
+        uint8_t autoneg;
+        uint8_t port;
+        uint32_t features;
+        uint32_t rx_max;
+        uint32_t rx;
+        uint32_t tx_max;
+        uint32_t tx;
+    };
+
+    struct CacheStatistics {
+        unsigned long requests;
+        unsigned long dumps;
+        unsigned long replies;
+        unsigned long notifications;
+        unsigned long overruns;
+        unsigned long hits;
+        unsigned long misses;
+    };
+
+    /**
+     */
+    class SettingsIterator {
+    public:
+        SettingsIterator() {}
+        virtual ~SettingsIterator() {}
+        virtual int operator() ( const Settings& ) = 0;
+    };
+
+    /**
+     */
+    class Cache {
+    private:
+        static const size_t BUFFER_SIZE = 64 * 1024;
+        static const int FEATURE_BITS = 128;
+
+        struct Fetched {
+            time_t when;
+            unsigned int asked;
+        };
+
+        int request_fd;
+        int monitor_fd;
+        uint16_t family;
+        uint32_t sequence;
+        bool opened;
+        bool complete;
+        bool named;
+        pthread_mutex_t lock;
+        std::map<int, Settings> entries;
+        std::map<int, Fetched> fetched;
+        CacheStatistics stats;
+        char *buffer;
+        uint8_t feature_map[FEATURE_BITS];
+
+        Cache();
+        bool open();
+        bool resolve( uint32_t * );
+        bool feature_names();
+        uint32_t active_features( struct nlattr * );
+        bool query( uint8_t, int );
+        void apply( struct nlmsghdr * );
+        void sync();
+        bool fill();
+        void link_modes( int );
+    public:
+        static Cache *shared();
+        bool available();
+        bool lookup( int, Settings&, unsigned int = Settings::ALL );
+        int refresh();
+        void forget( int );
+        int each( SettingsIterator& );
+        void statistics( CacheStatistics& );
+    };
+
+}
+
+#endif
+
+/* vim: set autoindent expandtab sw=4 : */
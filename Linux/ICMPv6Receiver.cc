@@ -0,0 +1,282 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** \file ICMPv6Receiver.cc
+ * \brief One thread receiving ICMPv6 for every interface socket.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "logger.h"
+#include "BPF.h"
+#include "ICMPv6Receiver.h"
+
+namespace {
+    int debug = 0;
+
+    uint64_t timespec_usec( const struct timespec *t ) {
+        return ((uint64_t)t->tv_sec * 1000000) + (t->tv_nsec / 1000);
+    }
+
+    /**
+     * Leave everything but neighbor discovery, and the echo the
+     * callbacks also decode, in the kernel.  A socket that already
+     * has a filter of its own keeps it.
+     */
+    void filter_socket( int fd ) {
+        socklen_t installed = 0;
+        if ( (getsockopt(fd, SOL_SOCKET, SO_GET_FILTER, NULL, &installed) == 0) and (installed > 0) ) {
+            return;
+        }
+
+        static const uint8_t types[] = {
+            ND_ROUTER_SOLICIT, ND_ROUTER_ADVERT, ND_NEIGHBOR_SOLICIT, ND_NEIGHBOR_ADVERT,
+            ND_REDIRECT, ICMP6_ECHO_REQUEST, ICMP6_ECHO_REPLY,
+        };
+        BPF::Program *filter = BPF::Program::icmpv6( types, sizeof(types) / sizeof(types[0]) );
+        if ( filter == NULL )  return;
+        if ( filter->attach(fd) == false ) {
+            log_warn( "ICMPv6::Receiver: cannot filter socket %d: %s", fd, filter->error() );
+        }
+        delete filter;
+    }
+}
+
+/**
+ */
+ICMPv6::Receiver::Receiver( const char *name )
+: Thread(name) {
+    pthread_mutex_init( &lock, NULL );
+    epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+    if ( epoll_fd < 0 ) {
+        log_err( "ICMPv6::Receiver: epoll_create1 failed: %s", strerror(errno) );
+    }
+
+    memset( messages, 0, sizeof(messages) );
+    for ( int i = 0 ; i < RECEIVE_BATCH ; ++i ) {
+        vectors[i].iov_base = buffers[i];
+        vectors[i].iov_len = RECEIVE_SIZE;
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+/**
+ */
+ICMPv6::Receiver::~Receiver() {
+    std::map<int, Binding *>::iterator iter = bindings.begin();
+    while ( iter != bindings.end() ) {
+        delete iter->second;
+        iter++;
+    }
+    if ( epoll_fd >= 0 )  close( epoll_fd );
+}
+
+/**
+ * Start delivering packets from this socket to the callback.  The
+ * index is only used to label the socket's counters -- normally it is
+ * the interface index the socket is bound to.
+ */
+bool
+ICMPv6::Receiver::add( Socket *socket, ReceiveCallbackInterface *callback, int index ) {
+    int fd = socket->descriptor();
+
+    int on = 1;
+    if ( setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) < 0 ) {
+        log_warn( "ICMPv6::Receiver: cannot count drops on socket %d", fd );
+    }
+    if ( setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0 ) {
+        log_warn( "ICMPv6::Receiver: cannot timestamp socket %d", fd );
+    }
+    filter_socket( fd );
+
+    Binding *binding = new Binding;
+    memset( binding, 0, sizeof(*binding) );
+    binding->socket = socket;
+    binding->callback = callback;
+    binding->index = index;
+
+    struct epoll_event event;
+    memset( &event, 0, sizeof(event) );
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+
+    pthread_mutex_lock( &lock );
+    if ( bindings.find(fd) != bindings.end() ) {
+        pthread_mutex_unlock( &lock );
+        delete binding;
+        return false;
+    }
+    if ( epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0 ) {
+        pthread_mutex_unlock( &lock );
+        log_err( "ICMPv6::Receiver: cannot watch socket %d: %s", fd, strerror(errno) );
+        delete binding;
+        return false;
+    }
+    bindings[fd] = binding;
+    pthread_mutex_unlock( &lock );
+
+    return true;
+}
+
+/**
+ */
+bool
+ICMPv6::Receiver::remove( Socket *socket ) {
+    int fd = socket->descriptor();
+
+    pthread_mutex_lock( &lock );
+    std::map<int, Binding *>::iterator iter = bindings.find( fd );
+    if ( iter == bindings.end() ) {
+        pthread_mutex_unlock( &lock );
+        return false;
+    }
+    epoll_ctl( epoll_fd, EPOLL_CTL_DEL, fd, NULL );
+    delete iter->second;
+    bindings.erase( iter );
+    pthread_mutex_unlock( &lock );
+
+    return true;
+}
+
+/**
+ */
+int
+ICMPv6::Receiver::each_binding( ReceiverIterator& callback ) {
+    int result = 0;
+
+    pthread_mutex_lock( &lock );
+    std::map<int, Binding *>::const_iterator iter = bindings.begin();
+    while ( iter != bindings.end() ) {
+        Binding *binding = iter->second;
+        result += callback( binding->socket, binding->index, binding->stats );
+        iter++;
+    }
+    pthread_mutex_unlock( &lock );
+
+    return result;
+}
+
+/**
+ * Read the socket until it would block, a batch at a time.  Called
+ * with the lock held.
+ */
+void
+ICMPv6::Receiver::drain( Binding *binding ) {
+    int fd = binding->socket->descriptor();
+    ReceiverStatistics& stats = binding->stats;
+
+    for (;;) {
+        for ( int i = 0 ; i < RECEIVE_BATCH ; ++i ) {
+            messages[i].msg_hdr.msg_name = &senders[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(senders[i]);
+            messages[i].msg_hdr.msg_control = controls[i];
+            messages[i].msg_hdr.msg_controllen = CONTROL_SIZE;
+            messages[i].msg_hdr.msg_flags = 0;
+        }
+
+        int count = recvmmsg( fd, messages, RECEIVE_BATCH, MSG_DONTWAIT, NULL );
+        if ( count < 0 ) {
+            if ( errno == EINTR )  continue;
+            if ( (errno != EAGAIN) and (errno != EWOULDBLOCK) ) {
+                log_err( "ICMPv6::Receiver: recvmmsg on socket %d failed: %s", fd, strerror(errno) );
+            }
+            return;
+        }
+        stats.batches++;
+
+        for ( int i = 0 ; i < count ; ++i ) {
+            struct msghdr *header = &messages[i].msg_hdr;
+            struct timespec arrival;
+            memset( &arrival, 0, sizeof(arrival) );
+
+            struct cmsghdr *control;
+            for ( control = CMSG_FIRSTHDR(header) ; control != NULL ; control = CMSG_NXTHDR(header, control) ) {
+                if ( control->cmsg_level != SOL_SOCKET ) continue;
+                if ( control->cmsg_type == SO_RXQ_OVFL ) {
+                    uint32_t drops;
+                    memcpy( &drops, CMSG_DATA(control), sizeof(drops) );
+                    stats.drops = drops;
+                } else if ( control->cmsg_type == SCM_TIMESTAMPNS ) {
+                    memcpy( &arrival, CMSG_DATA(control), sizeof(arrival) );
+                }
+            }
+
+            size_t length = messages[i].msg_len;
+            if ( header->msg_flags & MSG_TRUNC ) {
+                stats.malformed++;
+                continue;
+            }
+            if ( ICMPv6::PDU::dispatch((struct icmp6_hdr *)buffers[i], length, binding->callback) == false ) {
+                if ( debug > 0 ) log_notice( "ICMPv6::Receiver: malformed packet (%zu bytes)", length );
+                stats.malformed++;
+                continue;
+            }
+            stats.packets++;
+            stats.bytes += length;
+
+            if ( arrival.tv_sec != 0 ) {
+                struct timespec now;
+                clock_gettime( CLOCK_REALTIME, &now );
+                uint64_t latency = timespec_usec(&now) - timespec_usec(&arrival);
+                stats.last_usec = latency;
+                stats.total_usec += latency;
+                if ( latency > stats.max_usec )  stats.max_usec = latency;
+            }
+        }
+
+        if ( count < RECEIVE_BATCH )  return;
+    }
+}
+
+/**
+ */
+void
+ICMPv6::Receiver::run() {
+    struct epoll_event ready[MAX_READY];
+
+    for (;;) {
+        int count = epoll_wait( epoll_fd, ready, MAX_READY, -1 );
+        if ( count < 0 ) {
+            if ( errno == EINTR )  continue;
+            log_err( "ICMPv6::Receiver: epoll_wait failed: %s", strerror(errno) );
+            return;
+        }
+
+        for ( int i = 0 ; i < count ; ++i ) {
+            pthread_mutex_lock( &lock );
+            std::map<int, Binding *>::iterator iter = bindings.find( ready[i].data.fd );
+            if ( iter != bindings.end() )  drain( iter->second );
+            pthread_mutex_unlock( &lock );
+        }
+    }
+}
+
+/* vim: set autoindent expandtab sw=4 : */
@@ -0,0 +1,118 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** \file ICMPv6Receiver.h
+ * \brief One thread receiving ICMPv6 for every interface socket.
+ *
+ * Sockets are added with the callback their packets go to.  The thread
+ * waits on all of them with epoll, drains a ready socket in recvmmsg
+ * batches, and decodes each packet in place with PDU::dispatch().
+ * Callbacks run on the receiver thread with its lock held, so they
+ * must not add or remove sockets.
+ */
+
+#ifndef _ICMPV6_RECEIVER_H_
+#define _ICMPV6_RECEIVER_H_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <map>
+
+#include "Thread.h"
+#include "ICMPv6.h"
+
+namespace ICMPv6 {
+
+    /**
+     * Per-socket counters.  drops is the kernel's count of packets
+     * lost because the socket buffer was full; malformed counts
+     * packets that were truncated or too short to decode.  Latency is
+     * from the kernel timestamping the packet until its callback
+     * returned, in microseconds.
+     */
+    struct ReceiverStatistics {
+        unsigned long packets;
+        unsigned long bytes;
+        unsigned long batches;
+        unsigned long drops;
+        unsigned long malformed;
+        uint64_t last_usec;
+        uint64_t max_usec;
+        uint64_t total_usec;
+    };
+
+    /**
+     */
+    class ReceiverIterator {
+    public:
+        ReceiverIterator() {}
+        virtual ~ReceiverIterator() {}
+        virtual int operator() ( Socket *, int, const ReceiverStatistics& ) = 0;
+    };
+
+    /**
+     */
+    class Receiver : public Thread {
+    private:
+        static const int MAX_READY = 16;
+        static const int RECEIVE_BATCH = 32;
+        static const int RECEIVE_SIZE = 2048;
+        static const int CONTROL_SIZE = 128;
+
+        struct Binding {
+            Socket *socket;
+            ReceiveCallbackInterface *callback;
+            int index;
+            ReceiverStatistics stats;
+        };
+
+        int epoll_fd;
+        pthread_mutex_t lock;
+        std::map<int, Binding *> bindings;
+
+        struct mmsghdr messages[RECEIVE_BATCH];
+        struct iovec vectors[RECEIVE_BATCH];
+        struct sockaddr_in6 senders[RECEIVE_BATCH];
+        uint8_t buffers[RECEIVE_BATCH][RECEIVE_SIZE];
+        uint64_t controls[RECEIVE_BATCH][CONTROL_SIZE / sizeof(uint64_t)];
+
+        void drain( Binding * );
+    public:
+        Receiver( const char * );
+        virtual ~Receiver();
+        virtual void run();
+
+        bool add( Socket *, ReceiveCallbackInterface *, int );
+        bool remove( Socket * );
+        int each_binding( ReceiverIterator& );
+    };
+
+}
+
+#endif
+
+/* vim: set autoindent expandtab sw=4 : */
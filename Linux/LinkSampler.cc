@@ -0,0 +1,301 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+/** \file LinkSampler.cc
+ * \brief Interface counter history sampled from rtnetlink.
+ *
+ * Each tick is one RTM_GETLINK dump on the sampler's own RouteSocket,
+ * so the cost per tick is a few recvmmsg calls however many
+ * interfaces there are.  Interfaces that drop out of the dump have
+ * their history removed at the end of the tick.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "logger.h"
+#include "LinkSampler.h"
+
+namespace {
+    int debug = 0;
+
+    uint64_t now_usec() {
+        struct timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+    }
+
+    const char *counter_names[] = {
+        "rx_packets", "tx_packets", "rx_bytes", "tx_bytes",
+        "rx_errors", "tx_errors", "rx_dropped", "tx_dropped",
+    };
+
+    /**
+     * A counter that went backwards was reset (the device was
+     * recreated, or the driver cleared it); count from zero.
+     */
+    uint64_t delta( uint64_t current, uint64_t previous ) {
+        if ( current < previous )  return current;
+        return current - previous;
+    }
+}
+
+/**
+ */
+const char *
+NetLink::LinkSample::counter_name( int counter ) {
+    if ( (counter < 0) or (counter >= COUNTERS) )  return "unknown";
+    return counter_names[counter];
+}
+
+/**
+ */
+void
+NetLink::LinkSampler::Collector::receive( NetLink::NewLink *message ) {
+    sampler->record( message );
+}
+
+/**
+ * interval is in microseconds; depth is the number of samples kept
+ * for each interface.
+ */
+NetLink::LinkSampler::LinkSampler( const char *name, uint64_t interval, int depth )
+: Thread(name),
+  socket(NULL),
+  interval_usec(interval),
+  depth(depth),
+  now(0)
+{
+    pthread_mutex_init( &lock, NULL );
+    memset( &stats, 0, sizeof(stats) );
+    if ( interval_usec < 1000 )  interval_usec = 1000;
+    if ( this->depth < 2 )  this->depth = 2;
+}
+
+/**
+ */
+NetLink::LinkSampler::~LinkSampler() {
+    std::map<int, History *>::iterator iter = histories.begin();
+    for ( ; iter != histories.end() ; ++iter ) {
+        delete [] iter->second->ring;
+        delete iter->second;
+    }
+    if ( socket != NULL )  delete socket;
+}
+
+/**
+ * Called for each link in the dump, on the sampler thread.  The first
+ * time an interface is seen only its counters are remembered.  The
+ * sample is written before head is advanced, so a reader that sees
+ * the new head sees the whole sample.
+ */
+void
+NetLink::LinkSampler::record( NetLink::NewLink *message ) {
+    struct rtnl_link_stats64 current;
+    if ( message->stats64(&current) == false )  return;
+
+    int index = message->index();
+    History *history;
+    std::map<int, History *>::iterator found = histories.find( index );
+    if ( found == histories.end() ) {
+        history = new History;
+        history->index = index;
+        strncpy( history->name, message->name(), sizeof(history->name) - 1 );
+        history->name[sizeof(history->name) - 1] = '\0';
+        history->head = 0;
+        history->ring = new LinkSample[depth];
+        history->last = current;
+        history->last_usec = now;
+        history->tick = stats.ticks;
+        pthread_mutex_lock( &lock );
+        histories[index] = history;
+        pthread_mutex_unlock( &lock );
+        return;
+    }
+    history = found->second;
+
+    // renamed in place
+    if ( strncmp(history->name, message->name(), sizeof(history->name)) != 0 ) {
+        pthread_mutex_lock( &lock );
+        strncpy( history->name, message->name(), sizeof(history->name) - 1 );
+        pthread_mutex_unlock( &lock );
+    }
+
+    uint64_t head = history->head;
+    LinkSample& sample = history->ring[ head % depth ];
+    sample.usec = now;
+    sample.interval = now - history->last_usec;
+    sample.counter[LinkSample::RX_PACKETS] = delta( current.rx_packets, history->last.rx_packets );
+    sample.counter[LinkSample::TX_PACKETS] = delta( current.tx_packets, history->last.tx_packets );
+    sample.counter[LinkSample::RX_BYTES]   = delta( current.rx_bytes,   history->last.rx_bytes );
+    sample.counter[LinkSample::TX_BYTES]   = delta( current.tx_bytes,   history->last.tx_bytes );
+    sample.counter[LinkSample::RX_ERRORS]  = delta( current.rx_errors,  history->last.rx_errors );
+    sample.counter[LinkSample::TX_ERRORS]  = delta( current.tx_errors,  history->last.tx_errors );
+    sample.counter[LinkSample::RX_DROPPED] = delta( current.rx_dropped, history->last.rx_dropped );
+    sample.counter[LinkSample::TX_DROPPED] = delta( current.tx_dropped, history->last.tx_dropped );
+    __atomic_store_n( &(history->head), head + 1, __ATOMIC_RELEASE );
+
+    history->last = current;
+    history->last_usec = now;
+    history->tick = stats.ticks;
+}
+
+/**
+ * One tick: dump the link table, then drop interfaces that were not
+ * in it.
+ */
+void
+NetLink::LinkSampler::sample() {
+    Collector collector( this );
+    now = now_usec();
+    unsigned long tick = stats.ticks + 1;
+    __atomic_store_n( &(stats.ticks), tick, __ATOMIC_RELAXED );
+
+    if ( socket->dump(RTM_GETLINK, AF_UNSPEC, &collector) < 0 ) {
+        __atomic_add_fetch( &(stats.failures), 1, __ATOMIC_RELAXED );
+        return;
+    }
+
+    pthread_mutex_lock( &lock );
+    std::map<int, History *>::iterator iter = histories.begin();
+    while ( iter != histories.end() ) {
+        History *history = iter->second;
+        if ( history->tick == tick ) {
+            ++iter;
+            continue;
+        }
+        if ( debug > 0 )  log_notice( "LinkSampler: %s is gone", history->name );
+        histories.erase( iter++ );
+        delete [] history->ring;
+        delete history;
+    }
+    __atomic_store_n( &(stats.interfaces), histories.size(), __ATOMIC_RELAXED );
+    pthread_mutex_unlock( &lock );
+
+    uint64_t elapsed = now_usec() - now;
+    __atomic_store_n( &(stats.last_usec), elapsed, __ATOMIC_RELAXED );
+    __atomic_add_fetch( &(stats.total_usec), elapsed, __ATOMIC_RELAXED );
+    if ( elapsed > stats.max_usec )  __atomic_store_n( &(stats.max_usec), elapsed, __ATOMIC_RELAXED );
+}
+
+/**
+ * Ticks are on absolute times, so the rate does not drift with the
+ * cost of a dump.  Ticks that have already passed are skipped.
+ */
+void
+NetLink::LinkSampler::run() {
+    socket = new RouteSocket();
+
+    struct timespec next;
+    clock_gettime( CLOCK_MONOTONIC, &next );
+    for (;;) {
+        sample();
+
+        uint64_t when = ((uint64_t)next.tv_sec * 1000000) + (next.tv_nsec / 1000) + interval_usec;
+        uint64_t current = now_usec();
+        if ( when <= current ) {
+            unsigned long skipped = ((current - when) / interval_usec) + 1;
+            __atomic_add_fetch( &(stats.missed), skipped, __ATOMIC_RELAXED );
+            when += skipped * interval_usec;
+        }
+        next.tv_sec = when / 1000000;
+        next.tv_nsec = (when % 1000000) * 1000;
+        while ( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR ) ;
+    }
+}
+
+/**
+ * Copy up to max of the newest samples for the named interface into
+ * result, oldest first.  Returns the number copied, or -1 if the
+ * interface is not known.
+ *
+ * The ring is copied without stopping the sampler.  Slot i is being
+ * rewritten once head has reached i + depth, so after the copy any
+ * slot older than the new head - depth + 1 is discarded.
+ */
+int
+NetLink::LinkSampler::samples( const char *name, LinkSample *result, int max ) {
+    pthread_mutex_lock( &lock );
+    History *history = NULL;
+    std::map<int, History *>::iterator iter = histories.begin();
+    for ( ; iter != histories.end() ; ++iter ) {
+        if ( strcmp(iter->second->name, name) == 0 ) {
+            history = iter->second;
+            break;
+        }
+    }
+    if ( history == NULL ) {
+        pthread_mutex_unlock( &lock );
+        return -1;
+    }
+
+    uint64_t head = __atomic_load_n( &(history->head), __ATOMIC_ACQUIRE );
+    uint64_t available = head < (uint64_t)(depth - 1) ? head : (uint64_t)(depth - 1);
+    if ( available > (uint64_t)max )  available = max;
+    uint64_t first = head - available;
+    for ( uint64_t i = first ; i < head ; ++i ) {
+        result[i - first] = history->ring[ i % depth ];
+    }
+
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    uint64_t now_head = __atomic_load_n( &(history->head), __ATOMIC_ACQUIRE );
+    pthread_mutex_unlock( &lock );
+
+    uint64_t oldest = (now_head + 1 > (uint64_t)depth) ? now_head + 1 - depth : 0;
+    if ( first >= oldest )  return available;
+    uint64_t stale = oldest - first;
+    if ( stale >= available )  return 0;
+    memmove( result, result + stale, (available - stale) * sizeof(LinkSample) );
+    return available - stale;
+}
+
+/**
+ */
+int
+NetLink::LinkSampler::each_interface( LinkHistoryIterator& callback ) {
+    int result = 0;
+    pthread_mutex_lock( &lock );
+    std::map<int, History *>::iterator iter = histories.begin();
+    for ( ; iter != histories.end() ; ++iter ) {
+        result += callback( iter->second->index, iter->second->name );
+    }
+    pthread_mutex_unlock( &lock );
+    return result;
+}
+
+/**
+ */
+void
+NetLink::LinkSampler::statistics( LinkSamplerStatistics& result ) {
+    result.ticks = __atomic_load_n( &(stats.ticks), __ATOMIC_RELAXED );
+    result.missed = __atomic_load_n( &(stats.missed), __ATOMIC_RELAXED );
+    result.failures = __atomic_load_n( &(stats.failures), __ATOMIC_RELAXED );
+    result.interfaces = __atomic_load_n( &(stats.interfaces), __ATOMIC_RELAXED );
+    result.last_usec = __atomic_load_n( &(stats.last_usec), __ATOMIC_RELAXED );
+    result.max_usec = __atomic_load_n( &(stats.max_usec), __ATOMIC_RELAXED );
+    result.total_usec = __atomic_load_n( &(stats.total_usec), __ATOMIC_RELAXED );
+}
+
+/* vim: set autoindent expandtab sw=4 : */
@@ -0,0 +1,135 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+/** \file LinkSampler.h
+ * \brief Interface counter history sampled from rtnetlink.
+ *
+ * A thread dumps the link table once per tick and keeps the change in
+ * each interface's IFLA_STATS64 counters in a ring per interface.
+ * Only the sampler thread writes a ring; readers copy it without
+ * taking a lock and throw away any slot that was rewritten while they
+ * were copying.
+ */
+
+#ifndef _LINK_SAMPLER_H_
+#define _LINK_SAMPLER_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <linux/if.h>
+
+#include <map>
+
+#include "Thread.h"
+#include "NetLink.h"
+
+namespace NetLink {
+
+    /**
+     * The change in an interface's counters over one tick, and how
+     * long the tick actually was, in microseconds.
+     */
+    struct LinkSample {
+        enum Counter {
+            RX_PACKETS, TX_PACKETS, RX_BYTES, TX_BYTES,
+            RX_ERRORS, TX_ERRORS, RX_DROPPED, TX_DROPPED,
+            COUNTERS
+        };
+        static const char *counter_name( int );
+
+        uint64_t usec;
+        uint64_t interval;
+        uint64_t counter[COUNTERS];
+    };
+
+    /**
+     * Counters for the sampler itself.  missed counts ticks skipped
+     * because a dump ran past the next tick.
+     */
+    struct LinkSamplerStatistics {
+        unsigned long ticks;
+        unsigned long missed;
+        unsigned long failures;
+        unsigned long interfaces;
+        uint64_t last_usec;
+        uint64_t max_usec;
+        uint64_t total_usec;
+    };
+
+    /**
+     */
+    class LinkHistoryIterator {
+    public:
+        LinkHistoryIterator() {}
+        virtual ~LinkHistoryIterator() {}
+        virtual int operator() ( int, const char * ) = 0;
+    };
+
+    /**
+     */
+    class LinkSampler : public Thread {
+    private:
+        struct History {
+            int index;
+            char name[IFNAMSIZ];
+            unsigned long tick;
+            uint64_t last_usec;
+            struct rtnl_link_stats64 last;
+            uint64_t head;
+            LinkSample *ring;
+        };
+
+        class Collector : public RouteResponseHandler {
+            LinkSampler *sampler;
+        public:
+            Collector( LinkSampler *sampler ) : sampler(sampler) {}
+            virtual ~Collector() {}
+            virtual void receive( NewLink * );
+        };
+
+        RouteSocket *socket;
+        uint64_t interval_usec;
+        int depth;
+        pthread_mutex_t lock;
+        std::map<int, History *> histories;
+        LinkSamplerStatistics stats;
+        uint64_t now;
+
+        void record( NewLink * );
+        void sample();
+    public:
+        LinkSampler( const char *, uint64_t, int );
+        virtual ~LinkSampler();
+        virtual void run();
+
+        uint64_t interval() const { return interval_usec; }
+        int capacity() const { return depth; }
+        int samples( const char *, LinkSample *, int );
+        int each_interface( LinkHistoryIterator& );
+        void statistics( LinkSamplerStatistics& );
+    };
+
+}
+
+#endif
+
+/* vim: set autoindent expandtab sw=4 : */
@@ -73,21 +73,26 @@ Network::Bridge::create() {
     int result = ioctl(sock, SIOCBRADDBR, _name);
     int error = errno;
 
-    close( sock );
-    if ( result < 0 ) {
-        if ( error == EEXIST ) goto bring_up;
+    if ( (result < 0) and (error != EEXIST) ) {
+        close( sock );
         log_err( "Bridge: create '%s'", strerror(error) );
         return "failed to create bridge";
     }
 
-bring_up:
-
-    char buffer[128];
-    sprintf( buffer, "/sbin/ip link set %s up", _name );
-    if ( system(buffer) < 0 ) {
-        log_notice( "%s: bridge refused to bring up link", _name );
+    // bring the link up before returning, so callers can use it at once
+    struct ifreq request;
+    memset( &request, 0, sizeof(request) );
+    strncpy( request.ifr_name, _name, sizeof(request.ifr_name) - 1 );
+    result = ioctl( sock, SIOCGIFFLAGS, &request );
+    if ( (result == 0) and ((request.ifr_flags & IFF_UP) == 0) ) {
+        request.ifr_flags |= IFF_UP;
+        result = ioctl( sock, SIOCSIFFLAGS, &request );
+    }
+    if ( result < 0 ) {
+        log_notice( "%s: bridge refused to bring up link: %s", _name, strerror(errno) );
     }
 
+    close( sock );
     return NULL;
 }
 
@@ -59,6 +59,7 @@
 
 #include "NetLink.h"
 #include "Interface.h"
+#include "Ethtool.h"
 #include "logger.h"
 
 int
@@ -139,25 +140,54 @@ Network::Interface::platform_init() {
     }
 }
 
+/**
+ * One socket for every ethtool ioctl in the process.  The ioctls are
+ * only used for changes, and for reads when ethtool netlink is not
+ * there.
+ */
+static int
+ethtool_socket() {
+    static int shared = -1;
+    int fd = __atomic_load_n( &shared, __ATOMIC_ACQUIRE );
+    if ( fd != -1 )  return fd;
+
+    fd = ::socket( AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0 );
+    int expected = -1;
+    if ( __atomic_compare_exchange_n(&shared, &expected, fd, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) == false ) {
+        close( fd );
+        fd = expected;
+    }
+    return fd;
+}
+
 /**
  */
 void
 Network::Interface::get_settings() {
+    Ethtool::Settings settings;
+    unsigned int wanted = Ethtool::Settings::LINK_MODES | Ethtool::Settings::LINK_INFO;
+    if ( Ethtool::Cache::shared()->lookup(_index, settings, wanted) and
+         (settings.valid & Ethtool::Settings::LINK_MODES) ) {
+        _speed  = settings.speed;
+        _duplex = settings.duplex;
+        _port   = (settings.valid & Ethtool::Settings::LINK_INFO) ? settings.port : PORT_OTHER;
+        return;
+    }
+
     struct ifreq request;
     struct ethtool_cmd data;
 
     memset( &request, 0, sizeof(request) );
+    memset( &data, 0, sizeof(data) );
     strcpy( request.ifr_name, name() );
-    int ethtool = ::socket( AF_INET, SOCK_DGRAM, 0 );
 
     data.cmd = ETHTOOL_GSET;
     request.ifr_data = (caddr_t)&data;
-    int error = ::ioctl( ethtool, SIOCETHTOOL, &request );
+    int error = ::ioctl( ethtool_socket(), SIOCETHTOOL, &request );
 
     if ( error < 0 ) {
         log_err( "failed to get ethtool settings for '%s'", name() );
     }
-    close( ethtool );
 
     _speed  = data.speed;
     _duplex = data.duplex;
@@ -165,20 +195,25 @@ Network::Interface::get_settings() {
 }
 
 /**
+ * The cached feature bits when there are any, otherwise the ioctl.
  */
 static int
-get_offload( char *name, int command ) {
+get_offload( int index, char *name, int feature, int command ) {
+    Ethtool::Settings settings;
+    if ( Ethtool::Cache::shared()->lookup(index, settings, Ethtool::Settings::FEATURES) and
+         (settings.valid & Ethtool::Settings::FEATURES) ) {
+        return (settings.features & feature) ? 1 : 0;
+    }
+
     struct ifreq request;
     struct ethtool_value eval;
 
     memset( &request, 0, sizeof(request) );
     strcpy( request.ifr_name, name );
-    int ethtool = ::socket( AF_INET, SOCK_DGRAM, 0 );
 
     eval.cmd = command;
     request.ifr_data = (caddr_t)&eval;
-    int result = ioctl(ethtool, SIOCETHTOOL, &request);
-    close( ethtool );
+    int result = ioctl( ethtool_socket(), SIOCETHTOOL, &request );
 
     if (result != 0) {
         return -1;
@@ -191,108 +226,107 @@ get_offload( char *name, int command ) {
  */
 int
 Network::Interface::rx_offload() const {
-    return get_offload( name(), ETHTOOL_GRXCSUM );
+    return get_offload( index(), name(), Ethtool::RX_CHECKSUM, ETHTOOL_GRXCSUM );
 }
 
 /**
  */
 int
 Network::Interface::tx_offload() const {
-    return get_offload( name(), ETHTOOL_GTXCSUM );
+    return get_offload( index(), name(), Ethtool::TX_CHECKSUM, ETHTOOL_GTXCSUM );
 }
 
 /**
  */
 int
 Network::Interface::sg_offload() const {
-    return get_offload( name(), ETHTOOL_GSG );
+    return get_offload( index(), name(), Ethtool::SCATTER_GATHER, ETHTOOL_GSG );
 }
 
 /**
  */
 int
 Network::Interface::tso_offload() const {
-    return get_offload( name(), ETHTOOL_GTSO );
+    return get_offload( index(), name(), Ethtool::TSO, ETHTOOL_GTSO );
 }
 
 /**
  */
 int
 Network::Interface::ufo_offload() const {
-    return get_offload( name(), ETHTOOL_GUFO );
+    return get_offload( index(), name(), Ethtool::UFO, ETHTOOL_GUFO );
 }
 
 /**
  */
 int
 Network::Interface::gso_offload() const {
-    return get_offload( name(), ETHTOOL_GGSO );
+    return get_offload( index(), name(), Ethtool::GSO, ETHTOOL_GGSO );
 }
 
 /**
  */
 static void
-set_offload( char *name, int command, int value ) {
+set_offload( int index, char *name, int command, int value ) {
     struct ifreq request;
     struct ethtool_value eval;
 
     memset( &request, 0, sizeof(request) );
     strcpy( request.ifr_name, name );
-    int ethtool = ::socket( AF_INET, SOCK_DGRAM, 0 );
 
     eval.cmd = command;
     eval.data = value;
     request.ifr_data = (caddr_t)&eval;
-    int result = ioctl(ethtool, SIOCETHTOOL, &request);
-    close( ethtool );
+    int result = ioctl( ethtool_socket(), SIOCETHTOOL, &request );
 
     if (result != 0) {
         char *err, e[128];
         err = strerror_r( errno, e, sizeof(e) );
         log_err( "failed to set ethtool offload settings for '%s': %s", name, err );
     }
+    Ethtool::Cache::shared()->forget( index );
 }
 
 /**
  */
 void
 Network::Interface::rx_offload( int value ) const {
-    set_offload( name(), ETHTOOL_SRXCSUM, value );
+    set_offload( index(), name(), ETHTOOL_SRXCSUM, value );
 }
 
 /**
  */
 void
 Network::Interface::tx_offload( int value ) const {
-    set_offload( name(), ETHTOOL_STXCSUM, value );
+    set_offload( index(), name(), ETHTOOL_STXCSUM, value );
 }
 
 /**
  */
 void
 Network::Interface::sg_offload( int value ) const {
-    set_offload( name(), ETHTOOL_SSG, value );
+    set_offload( index(), name(), ETHTOOL_SSG, value );
 }
 
 /**
  */
 void
 Network::Interface::tso_offload( int value ) const {
-    set_offload( name(), ETHTOOL_STSO, value );
+    set_offload( index(), name(), ETHTOOL_STSO, value );
 }
 
 /**
  */
 void
 Network::Interface::ufo_offload( int value ) const {
-    set_offload( name(), ETHTOOL_SUFO, value );
+    set_offload( index(), name(), ETHTOOL_SUFO, value );
 }
 
 /**
  */
 void
 Network::Interface::gso_offload( int value ) const {
-    set_offload( name(), ETHTOOL_SGSO, value );
+    set_offload( index(), name(), ETHTOOL_SGSO, value );
 }
 
 /**
@@ -317,18 +351,16 @@ Network::Interface::negotiate() {
 
     memset( &request, 0, sizeof(request) );
     strcpy( request.ifr_name, name() );
-    int ethtool = ::socket( AF_INET, SOCK_DGRAM, 0 );
 
     data.cmd = ETHTOOL_NWAY_RST;
     request.ifr_data = (caddr_t)&data;
-    int error = ioctl( ethtool, SIOCETHTOOL, &request );
+    int error = ioctl( ethtool_socket(), SIOCETHTOOL, &request );
 
     bool result = true;
     if ( error < 0 ) {
         log_err( "%s(%d): failed to negotiate link", name(), index() );
         result = false;
     }
-    close( ethtool );
 
     ::time( &last_negotiation );
     return result;
@@ -32,6 +32,8 @@
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <arpa/inet.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
@@ -56,15 +58,64 @@
 #include "NetworkMonitor.h"
 #include "NetLinkMonitor.h"
 #include "LinuxNetworkMonitor.h"
+#include "TopologyNotifier.h"
+#include "ProcessManager.h"
+#include "Ethtool.h"
 
 namespace { int debug = 0; }
 namespace {
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-result"
-    void shell( const char *command ) {
-        system( command );
+    /**
+     * Monotonic clock in microseconds, for measuring batch latency.
+     */
+    uint64_t now_usec() {
+        struct timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
     }
-#pragma GCC diagnostic pop
+
+    /**
+     * Arm (or re-arm) the periodic timer to fire every interval seconds.
+     */
+    bool arm_timer( int fd, int interval ) {
+        struct itimerspec spec;
+        memset( &spec, 0, sizeof(spec) );
+        spec.it_interval.tv_sec = interval;
+        spec.it_value.tv_sec = interval;
+        return timerfd_settime( fd, 0, &spec, NULL ) == 0;
+    }
+
+    /**
+     * Restart ntpd through the process manager; the monitor thread
+     * does not wait for it.  Several events can each find ntpd deaf
+     * in quick succession, and a restart that is still running
+     * covers them all.
+     */
+    class NtpRestart : public Process::Completion {
+        pthread_mutex_t lock;
+        bool running;
+    public:
+        NtpRestart() : running(false) { pthread_mutex_init( &lock, NULL ); }
+        void start() {
+            pthread_mutex_lock( &lock );
+            bool busy = running;
+            running = true;
+            pthread_mutex_unlock( &lock );
+            if ( busy ) {
+                if ( debug > 0 )  log_notice( "ntpd restart already running" );
+                return;
+            }
+            if ( Process::Manager::shared()->shell("/usr/bin/config_ntpd --restart",
+                                                   Process::Manager::SHELL_TIMEOUT, this) < 0 ) {
+                finish();
+            }
+        }
+        void finish() {
+            pthread_mutex_lock( &lock );
+            running = false;
+            pthread_mutex_unlock( &lock );
+        }
+        virtual void operator() ( const Process::Result& ) { finish(); }
+    } ntp_restart;
 }
 
 /**
@@ -133,6 +184,8 @@ Network::LinuxNetworkMonitor::receive( NetLink::NewLink *message ) {
             return;
         }
 
+        Network::TopologyNotifier::notify( "NewLink" );
+
         bool is_bridge = interface->is_bridge();
         bool is_physical = interface->is_physical();
 
@@ -155,7 +208,7 @@ Network::LinuxNetworkMonitor::receive( NetLink::NewLink *message ) {
         if ( interface->is_up() and interface->not_listening_to("udp6", 123) ) { // NTP
             log_notice( "%s is not listening to port 123 on its primary address, restart ntpd",
                                 interface->name() );
-            shell( "/usr/bin/config_ntpd --restart" );
+            ntp_restart.start();
         }
 
     } else { // if we do have it ... look for state changes
@@ -176,7 +229,7 @@ Network::LinuxNetworkMonitor::receive( NetLink::NewLink *message ) {
                 if ( interface->is_up() and interface->not_listening_to("udp6", 123) ) { // NTP
                     log_notice( "%s is not listening to port 123 on its primary address, restart ntpd",
                                         interface->name() );
-                    shell( "/usr/bin/config_ntpd --restart" );
+                    ntp_restart.start();
                 }
 
             } else {
@@ -186,6 +239,7 @@ Network::LinuxNetworkMonitor::receive( NetLink::NewLink *message ) {
                 // interface->clean_topology();
             }
             report_required = true;
+            Network::TopologyNotifier::notify( "NewLink" );
         }
 
         if ( ( interface->has_link() == false ) and interface->bounce_expired() ) {
@@ -220,6 +274,7 @@ Network::LinuxNetworkMonitor::receive( NetLink::NewLink *message ) {
             }
             log_notice( "%s(%d): added to bridge '%s'",
                                 interface->name(), interface->index(), bridge_name );
+            Network::TopologyNotifier::notify( "NewLink" );
         }
     }
 
@@ -270,6 +325,7 @@ void Network::LinuxNetworkMonitor::receive( NetLink::DelLink *message ) {
             link_message = ", link down";
         }
         report_required = true;
+        Network::TopologyNotifier::notify( "DelLink" );
     }
 
     if ( interface->up_changed() ) {
@@ -299,6 +355,7 @@ void Network::LinuxNetworkMonitor::receive( NetLink::DelLink *message ) {
         if ( interface->is_captured() ) {
             log_notice( "%s(%d): removed from bridge '%s'",
                                 interface->name(), interface->index(), bridge_name );
+            Network::TopologyNotifier::notify( "DelLink" );
         } else {
             log_notice( "%s(%d): DelLink message from bridge '%s' -- but not removed",
                                 interface->name(), interface->index(), bridge_name );
@@ -311,6 +368,8 @@ void Network::LinuxNetworkMonitor::receive( NetLink::DelLink *message ) {
         // stop listener thread
         //   need Network::Interface to have a handle on its listener thread
         interface->remove();
+        Ethtool::Cache::shared()->forget( message->index() );
+        Network::TopologyNotifier::notify( "DelLink" );
     }
 
 }
@@ -343,7 +402,7 @@ Network::LinuxNetworkMonitor::receive( NetLink::NewAddress *message ) {
         if ( interface->not_listening_to("udp6", 123) ) { // NTP
             log_notice( "%s is not listening to port 123 on its primary address, restart ntpd",
                                 interface->name() );
-            shell( "/usr/bin/config_ntpd --restart" );
+            ntp_restart.start();
         }
     } else {
         if ( debug > 0 ) {
@@ -517,86 +576,6 @@ Network::LinuxNetworkMonitor::bring_up( Network::Interface *interface ) {
     listener->thread()->start();
 }
 
-/**
- */
-class WriteHostsForNeighbors : public Network::NeighborIterator {
-    int fd;
-public:
-    WriteHostsForNeighbors( int fd ) : fd(fd) {}
-    virtual ~WriteHostsForNeighbors() {}
-    virtual int operator() ( Network::Peer& neighbor ) {
-        struct host_entry entry;
-        memset( &entry, 0, sizeof(entry) );
-
-        Network::Node *node = neighbor.node();
-        if ( node == NULL ) {
-            return 0;
-        }
-        if ( node->not_partner() ) {
-            return 0;
-        }
-
-        entry.flags.valid = 1;
-        entry.flags.partner = neighbor.is_partner();
-        entry.node.ordinal = node->ordinal();
-        entry.interface.ordinal = neighbor.ordinal();
-        entry.flags.is_private = 0 /* neighbor.is_private() */ ;
-        neighbor.copy_address( &(entry.primary_address) );
-
-        if ( debug > 1 ) log_notice( "write host entry for peer" );
-        // populate entry for the interface itself
-        ssize_t bytes = write( fd, &entry, sizeof(entry) );
-        if ( (size_t)bytes < sizeof(entry) ) {
-            log_err( "write failed creating hosts entry peer" );
-        }
-
-        return 0;
-    }
-};
-/**
- */
-class WriteHostsForInterface : public Network::InterfaceIterator {
-    int fd;
-public:
-    WriteHostsForInterface( int fd ) : fd(fd) {}
-    virtual ~WriteHostsForInterface() {}
-    virtual int operator() ( Network::Interface * interface ) {
-        struct host_entry entry;
-        memset( &entry, 0, sizeof(entry) );
-
-        entry.flags.valid = 1;
-        entry.flags.partner = 0;
-        entry.node.ordinal = gethostid();
-        entry.flags.is_private = 0 /* interface->is_private() */ ;
-        entry.interface.ordinal = interface->ordinal();
-        interface->lladdr( &entry.primary_address );
-
-        unsigned char *mac = interface->mac();
-        entry.mac[0] = mac[0];
-        entry.mac[1] = mac[1];
-        entry.mac[2] = mac[2];
-        entry.mac[3] = mac[3];
-        entry.mac[4] = mac[4];
-        entry.mac[5] = mac[5];
-
-        if ( interface->not_bridge() /* and interface->not_private() */ ) {
-            return 0;
-        }
-        if ( debug > 1 ) log_notice( "write host entry for %s", interface->name() );
-        // populate entry for the interface itself
-        ssize_t bytes = write( fd, &entry, sizeof(entry) );
-        if ( (size_t)bytes < sizeof(entry) ) {
-            log_err( "write failed creating hosts entry" );
-        }
-
-        // call iterator for each neighbor
-        WriteHostsForNeighbors callback(fd);
-        interface->each_neighbor( callback );
-
-        return 0;
-    }
-};
-
 /**
  * This thread connects a netlink socket and listens for broadcast
  * messages from the kernel.  This should inform us of the network
@@ -623,18 +602,84 @@ public:
  * For each interface -- ping/ICMP NUD and multicast svc
  * 
  * ZeroConf specific interfaces
+ *
+ * The loop waits in epoll on the route socket and an interval timer.
+ * Every wakeup drains all queued netlink datagrams, and each timer
+ * expiration runs the periodic advertise/update_hosts work.
  */
 void
 Network::LinuxNetworkMonitor::run() {
     load_cache();
     probe();
 
+    int poller = epoll_create1( EPOLL_CLOEXEC );
+    if ( poller < 0 ) {
+        log_err( "network monitor could not create epoll set: %s", strerror(errno) );
+        return;
+    }
+
+    int timer = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+    if ( timer < 0 ) {
+        log_err( "network monitor could not create interval timer: %s", strerror(errno) );
+        close( poller );
+        return;
+    }
+    int armed_interval = interval();
+    arm_timer( timer, armed_interval );
+
+    struct epoll_event event;
+    memset( &event, 0, sizeof(event) );
+    event.events = EPOLLIN;
+    event.data.fd = event_descriptor();
+    epoll_ctl( poller, EPOLL_CTL_ADD, event.data.fd, &event );
+    event.data.fd = timer;
+    epoll_ctl( poller, EPOLL_CTL_ADD, timer, &event );
+
+    unsigned long overruns = event_overruns();
+
     if ( debug > 0 ) log_notice( "network monitor started" );
     for (;;) {
-        // This should block - we should not need the sleep
-        process_one_event();
-        sleep( 1 );
+        struct epoll_event ready[2];
+        int count = epoll_wait( poller, ready, 2, -1 );
+        if ( count < 0 ) {
+            if ( errno == EINTR ) continue;
+            log_err( "network monitor epoll_wait failed: %s", strerror(errno) );
+            break;
+        }
+
+        for ( int i = 0 ; i < count ; ++i ) {
+            if ( ready[i].data.fd == timer ) {
+                uint64_t expirations;
+                if ( read(timer, &expirations, sizeof(expirations)) > 0 ) {
+                    tick();
+                }
+                continue;
+            }
+
+            uint64_t start = now_usec();
+            int events = process_pending_events();
+            record_batch( events, now_usec() - start );
+        }
+
+        /*
+         * The kernel dropped events when the socket overflowed, so
+         * our view of the links is stale.  Ask for a full dump.
+         */
+        if ( event_overruns() != overruns ) {
+            stats.overruns += event_overruns() - overruns;
+            overruns = event_overruns();
+            log_warn( "netlink events lost, re-probing interfaces" );
+            probe();
+        }
+
+        if ( interval() != armed_interval ) {
+            armed_interval = interval();
+            arm_timer( timer, armed_interval );
+        }
     }
+
+    close( timer );
+    close( poller );
 }
 
 /* vim: set autoindent expandtab sw=4 : */
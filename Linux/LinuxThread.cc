@@ -26,8 +26,15 @@
  */
 
 #include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 
+#include "PlatformThread.h"
+
 /**
  */
 void
@@ -46,4 +53,30 @@ set_thread_name( const char *newname ) {
     prctl( PR_SET_NAME, newname );
 }
 
+/**
+ */
+void
+wait_on_address( uint32_t *address, uint32_t value ) {
+    syscall( SYS_futex, address, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0 );
+}
+
+/**
+ */
+void
+wake_address( uint32_t *address ) {
+    syscall( SYS_futex, address, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0 );
+}
+
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
+
+/**
+ * A pidfd (Linux 5.3).  Opened close-on-exec, which pidfds always are.
+ */
+int
+process_handle( pid_t pid ) {
+    return syscall( __NR_pidfd_open, pid, 0 );
+}
+
 /* vim: set autoindent expandtab sw=4 : */
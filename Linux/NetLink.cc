@@ -43,6 +43,9 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
+
+#include <new>
 
 #include "logger.h"
 #include "NetLink.h"
@@ -56,9 +59,69 @@
 namespace {
     typedef NetLink::Message *(*MessageFactory)( struct nlmsghdr * );
     typedef NetLink::RouteMessage *(*RouteMessageFactory)( struct nlmsghdr * );
+    typedef bool (*RouteMessageDelivery)( struct nlmsghdr *, NetLink::RouteReceiveCallbackInterface * );
     static const int MAX_RTFACTORY = 1024;
     RouteMessageFactory routeFactories[ MAX_RTFACTORY ];
+    RouteMessageDelivery routeDeliveries[ MAX_RTFACTORY ];
     int debug = 0;
+
+    // datagrams read by one recvmmsg call during a dump
+    static const int DUMP_BATCH = 8;
+    // largest datagram the kernel builds for a dump, unless a peek says otherwise
+    static const size_t DUMP_SLOT_SIZE = 32 * 1024;
+    // give up on a consistent dump after this many NLM_F_DUMP_INTR restarts
+    static const int DUMP_RESTARTS = 8;
+
+    uint64_t now_usec() {
+        struct timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+    }
+}
+
+/**
+ * Point the view at the attributes of a received message.  Attribute
+ * types above the highest one of interest are ignored.
+ */
+void
+NetLink::Attributes::bind( struct rtattr *attributes, int bytes, int highest ) {
+    first = attributes;
+    length = bytes;
+    max = highest;
+    if ( max > IFLA_MAX )  max = IFLA_MAX;
+    indexed = false;
+}
+
+/**
+ * Walk the attributes once and remember where each type is.
+ */
+void
+NetLink::Attributes::index() const {
+    memset( table, 0, sizeof(table[0]) * (max + 1) );
+
+    int remaining = length;
+    struct rtattr *ra = first;
+    while ( RTA_OK(ra, remaining) ) {
+        int type = ra->rta_type & NLA_TYPE_MASK;
+        if ( type <= max ) {
+            table[ type ] = ra;
+        }
+        ra = RTA_NEXT( ra, remaining );
+    }
+
+    if ( (remaining > 0) and (debug > 0) ) {
+        printf( " attributes remnant=%d\n", remaining );
+    }
+    indexed = true;
+}
+
+/**
+ */
+struct rtattr *
+NetLink::Attributes::operator [] ( int type ) const {
+    if ( (type < 0) or (type > max) )  return NULL;
+    if ( indexed == false )  index();
+    return table[ type ];
 }
 
 /**
@@ -88,6 +151,14 @@ NetLink::RouteMessage::Factory( struct nlmsghdr *hdr ) {
     // need to gather RT info in RT msgs
     return new RouteMessage( hdr->nlmsg_type );
 }
+
+/**
+ */
+bool
+NetLink::RouteMessage::Deliver( struct nlmsghdr *hdr, NetLink::RouteReceiveCallbackInterface *callback ) {
+    NetLink::RouteMessage message( hdr );
+    return message.deliver( callback );
+}
 
 /**
  */
@@ -192,6 +263,48 @@ void NetLink::Socket::receive( NetLink::ReceiveCallbackInterface *callback ) {
  * Linux socket.
  */
 NetLink::RouteSocket::~RouteSocket() {
+    free( dump_buffer );
+}
+
+/**
+ * Deliver each netlink message in one datagram to the callback.
+ *
+ * Returns false when the datagram ends a request -- either NLMSG_DONE
+ * at the end of a dump or an NLMSG_ERROR (which is also how the kernel
+ * acks a request).
+ */
+bool
+NetLink::RouteSocket::dispatch( struct nlmsghdr *h, unsigned int message_length,
+                                NetLink::RouteReceiveCallbackInterface *callback ) {
+    while ( NLMSG_OK(h, message_length) ) {
+        if ( h->nlmsg_type == NLMSG_DONE ) {
+            if ( debug ) printf( "NLMSG_DONE\n" );
+            return false;
+        }
+
+        if ( h->nlmsg_type == NLMSG_ERROR ) {
+            NetLink::RouteError error( (struct nlmsgerr *)NLMSG_DATA(h) );
+            error.deliver( callback );
+            return false;
+        }
+
+        if ( debug > 1 ) {
+            printf( "process nlmsg type=%d flags=0x%08x pid=%d seq=%d\n",
+                    h->nlmsg_type, h->nlmsg_flags, h->nlmsg_pid, h->nlmsg_seq );
+        }
+
+        if ( h->nlmsg_type < MAX_RTFACTORY ) {
+            RouteMessageDelivery deliver = routeDeliveries[ h->nlmsg_type ];
+            if ( deliver != NULL )  deliver( h, callback );
+        }
+
+        h = NLMSG_NEXT( h, message_length );
+    }
+
+    if ( message_length != 0 ) {
+        printf( "remnant\n" );
+    }
+    return true;
 }
 
 /**
@@ -216,7 +329,6 @@ void NetLink::RouteSocket::receive( NetLink::RouteReceiveCallbackInterface *call
 
     for (;;) {
         ssize_t status;
-        struct nlmsghdr *h;
 
         iov.iov_len = sizeof(buffer);  // size of the iovec buffer
         status = recvmsg( socket, &msg, 0 );
@@ -226,17 +338,13 @@ void NetLink::RouteSocket::receive( NetLink::RouteReceiveCallbackInterface *call
                 printf( "interupted recvmsg\n" );
             } else if ( errno == ENOBUFS ) {
                 log_err( "%%BUG recvmsg returned ENOBUFS" );
+                _overruns++;
             } else {
                 perror("NetLink::recvmsg");
             }
             continue;
         }
 
-        if ( status == -1 ) {
-            perror( "NetLink::RouteSocket::recvmsg" );
-            return;
-        }
-
         if ( status == 0 ) {
             if ( debug ) printf( "finished nlmsgs\n" );
             break;
@@ -244,69 +352,355 @@ void NetLink::RouteSocket::receive( NetLink::RouteReceiveCallbackInterface *call
             if ( debug ) printf( "status=%zd\n", status );
         }
 
-        h = (struct nlmsghdr *)buffer;
-        unsigned int message_length = status;
-        while ( NLMSG_OK(h, message_length) ) {
-            if ( h->nlmsg_type == NLMSG_DONE ) {
-                printf( "NLMSG_DONE\n" );
-                goto finish;
+        if ( dispatch((struct nlmsghdr *)buffer, status, callback) == false ) {
+            break;
+        }
+
+        if ( debug > 1 )  printf( "finished with this message (notOK)\n" );
+        if ( msg.msg_flags & MSG_TRUNC ) {
+            printf( "msg truncated" );
+            continue;
+        }
+    }
+}
+
+/**
+ * Read and deliver every datagram that is already queued on the
+ * socket, stopping when the socket would block.  This never sleeps,
+ * so it is meant to be called when poll/epoll reports the socket
+ * readable.
+ *
+ * An ENOBUFS means the kernel dropped notifications because the
+ * receive buffer overflowed.  The overrun count is bumped so the
+ * caller can resynchronize (ie. send a new GetLink), and draining
+ * continues since the socket is usable again after the error.
+ *
+ * Returns the number of datagrams read.
+ */
+int NetLink::RouteSocket::drain( NetLink::RouteReceiveCallbackInterface *callback ) {
+    struct sockaddr_nl address;
+    struct iovec iov;
+    char buffer[16 * 1024];
+    iov.iov_base = buffer;
+
+    struct msghdr msg;
+    memset( &msg, 0, sizeof(msg) );
+    msg.msg_name = &address;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    int datagrams = 0;
+
+    for (;;) {
+        iov.iov_len = sizeof(buffer);
+        msg.msg_namelen = sizeof(address);
+
+        ssize_t status = recvmsg( socket, &msg, MSG_DONTWAIT );
+        if ( status < 0 ) {
+            if ( errno == EINTR ) continue;
+            if ( (errno == EAGAIN) or (errno == EWOULDBLOCK) ) break;
+            if ( errno == ENOBUFS ) {
+                log_warn( "netlink socket overrun, events were dropped" );
+                _overruns++;
+                continue;
             }
+            log_err( "NetLink::RouteSocket::drain recvmsg failed: %s", strerror(errno) );
+            break;
+        }
+
+        if ( status == 0 )  break;
+
+        datagrams++;
+        if ( msg.msg_flags & MSG_TRUNC ) {
+            log_warn( "netlink datagram truncated (%zd bytes)", status );
+        }
+        dispatch( (struct nlmsghdr *)buffer, status, callback );
+    }
+
+    return datagrams;
+}
+
+/**
+ * Make sure the dump buffer can hold at least size bytes.  The buffer
+ * is never shrunk, so steady state dumps do not allocate.
+ */
+void
+NetLink::RouteSocket::reserve( size_t size ) {
+    if ( size <= dump_capacity )  return;
+
+    size_t capacity = (dump_capacity == 0) ? (DUMP_SLOT_SIZE * DUMP_BATCH) : dump_capacity;
+    while ( capacity < size )  capacity *= 2;
+
+    char *buffer = (char *)realloc( dump_buffer, capacity );
+    if ( buffer == NULL ) {
+        log_err( "NetLink dump buffer could not grow to %zu bytes", capacity );
+        throw std::bad_alloc();
+    }
+    dump_buffer = buffer;
+    dump_capacity = capacity;
+}
 
-            if ( h->nlmsg_type == NLMSG_ERROR ) {
-                NetLink::RouteError error( (struct nlmsgerr *)NLMSG_DATA(h) );
-                error.deliver( callback );
-                goto finish;
+/**
+ * Read the response to dump request 'sequence' into the dump buffer,
+ * packing the datagrams end to end so the result can be walked as one
+ * run of nlmsgs.  Stops at the NLMSG_DONE (or NLMSG_ERROR) for the
+ * request.
+ *
+ * *length is the number of bytes already in the buffer to keep --
+ * notifications carried over from an abandoned attempt -- and is set
+ * to the number of bytes in the buffer on return, whatever the
+ * result.  Notifications that arrive during the dump are kept along
+ * with it; parts of earlier dumps are dropped.
+ *
+ * Returns 1 if the dump is complete, 0 if it must be restarted
+ * (interrupted or truncated), and -1 on a socket error.
+ */
+int
+NetLink::RouteSocket::read_dump( uint32_t sequence, size_t *length ) {
+    size_t used = *length;
+    bool restart = false;
+    bool truncated = false;
+    bool finished = false;
+
+    /*
+     * Size the first datagram without consuming it.  For netlink, a
+     * MSG_TRUNC peek returns the real length of the datagram.
+     */
+    for (;;) {
+        ssize_t peek = recv( socket, NULL, 0, MSG_PEEK | MSG_TRUNC );
+        dump_stats.syscalls++;
+        if ( peek >= 0 ) {
+            if ( (size_t)peek > slot_size )  slot_size = NLMSG_ALIGN( peek );
+            break;
+        }
+        if ( errno == EINTR )  continue;
+        if ( errno == ENOBUFS ) {
+            _overruns++;
+            continue;
+        }
+        log_err( "NetLink dump peek failed: %s", strerror(errno) );
+        *length = used;
+        return -1;
+    }
+
+    while ( finished == false ) {
+        reserve( used + (slot_size * DUMP_BATCH) );
+
+        struct iovec iov[DUMP_BATCH];
+        struct mmsghdr batch[DUMP_BATCH];
+        memset( batch, 0, sizeof(batch) );
+        for ( int i = 0 ; i < DUMP_BATCH ; ++i ) {
+            iov[i].iov_base = dump_buffer + used + (i * slot_size);
+            iov[i].iov_len = slot_size;
+            batch[i].msg_hdr.msg_iov = &iov[i];
+            batch[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int count = recvmmsg( socket, batch, DUMP_BATCH, MSG_WAITFORONE, NULL );
+        dump_stats.syscalls++;
+        if ( count < 0 ) {
+            if ( errno == EINTR )  continue;
+            if ( errno == ENOBUFS ) {
+                _overruns++;
+                continue;
             }
+            log_err( "NetLink dump recvmmsg failed: %s", strerror(errno) );
+            *length = used;
+            return -1;
+        }
+
+        for ( int i = 0 ; i < count ; ++i ) {
+            unsigned int bytes = batch[i].msg_len;
+            dump_stats.datagrams++;
+            dump_stats.bytes += bytes;
 
             /*
-            if ( h->nlmsg_flags & NLM_F_MULTI ) {
-                printf( "NLM_F_MULTI\n" );
-            } else {
-                printf( "not:NLM_F_MULTI\n" );
+             * A cut off datagram is not kept at all, so the buffer
+             * stays a run of whole nlmsgs.
+             */
+            if ( batch[i].msg_hdr.msg_flags & MSG_TRUNC ) {
+                log_warn( "NetLink dump datagram truncated at %zu bytes, restarting", slot_size );
+                truncated = true;
+                continue;
             }
-            */
 
-            if ( debug > 1 ) {
-                printf( "process nlmsg type=%d flags=0x%08x pid=%d seq=%d\n",
-                        h->nlmsg_type, h->nlmsg_flags, h->nlmsg_pid, h->nlmsg_seq );
+            struct nlmsghdr *h = (struct nlmsghdr *)iov[i].iov_base;
+            if ( (bytes >= sizeof(*h)) and (h->nlmsg_seq != 0) and (h->nlmsg_seq != sequence) ) {
+                continue;
             }
 
-            { // type is in linux/if_arp.h -- flags are in linux/if.h
-                // struct ifinfomsg *ifi = (struct ifinfomsg *)( NLMSG_DATA(h) );
-                // int length = h->nlmsg_len - NLMSG_LENGTH( sizeof(*ifi) );
-                // Network::Interface *ii = new Network::Interface( ifi, length );
+            char *datagram = (char *)iov[i].iov_base;
+            if ( datagram != (dump_buffer + used) ) {
+                memmove( dump_buffer + used, datagram, bytes );
+            }
 
-                using namespace NetLink;
-                RouteMessageFactory factory = routeFactories[ h->nlmsg_type ];
-                if ( factory == NULL ) {
-                    // print an error?
-                    return;
+            h = (struct nlmsghdr *)(dump_buffer + used);
+            unsigned int remaining = bytes;
+            while ( NLMSG_OK(h, remaining) ) {
+                if ( h->nlmsg_seq == sequence ) {
+                    if ( h->nlmsg_flags & NLM_F_DUMP_INTR )  restart = true;
+                    if ( h->nlmsg_type == NLMSG_DONE )  finished = true;
+                    if ( h->nlmsg_type == NLMSG_ERROR )  finished = true;
                 }
-                RouteMessage *message = factory( h );
-                message->deliver( callback );
-                delete message;
+                h = NLMSG_NEXT( h, remaining );
             }
 
-            h = NLMSG_NEXT( h, message_length );
+            used += NLMSG_ALIGN( bytes );
         }
-        if ( debug > 1 )  printf( "finished with this message (notOK)\n" );
-        if ( msg.msg_flags & MSG_TRUNC ) {
-            printf( "msg truncated" );
+
+        if ( truncated ) {
+            slot_size *= 2;
+            used = keep_notifications( sequence, used );
+            if ( finished == false )  used = drain_dump( sequence, used );
+            *length = used;
+            return 0;
+        }
+    }
+
+    if ( restart )  used = keep_notifications( sequence, used );
+    *length = used;
+    return restart ? 0 : 1;
+}
+
+/**
+ * Squeeze the messages of dump 'sequence' out of the first 'used'
+ * bytes of the dump buffer, leaving only notifications.  Returns the
+ * bytes left.
+ */
+size_t
+NetLink::RouteSocket::keep_notifications( uint32_t sequence, size_t used ) {
+    size_t kept = 0;
+    struct nlmsghdr *h = (struct nlmsghdr *)dump_buffer;
+    unsigned int remaining = used;
+    while ( NLMSG_OK(h, remaining) ) {
+        struct nlmsghdr *next = NLMSG_NEXT( h, remaining );
+        if ( h->nlmsg_seq != sequence ) {
+            size_t size = NLMSG_ALIGN( h->nlmsg_len );
+            memmove( dump_buffer + kept, h, size );
+            kept += size;
+        }
+        h = next;
+    }
+    return kept;
+}
+
+/**
+ * The end of an abandoned dump may still be on its way, so read its
+ * datagrams until its NLMSG_DONE or until the socket runs dry.  The
+ * kernel builds the next part of a dump as each one is read, so this
+ * consumes the rest of it.  Notifications read on the way are kept
+ * after the first 'used' bytes of the buffer.  Returns the new length.
+ */
+size_t
+NetLink::RouteSocket::drain_dump( uint32_t sequence, size_t used ) {
+    for (;;) {
+        ssize_t size = recv( socket, NULL, 0, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT );
+        dump_stats.syscalls++;
+        if ( size < 0 ) {
+            if ( errno == EINTR )  continue;
+            if ( errno == ENOBUFS ) {
+                _overruns++;
+                continue;
+            }
+            return used;
+        }
+
+        reserve( used + NLMSG_ALIGN(size) );
+        ssize_t bytes = recv( socket, dump_buffer + used, size, MSG_DONTWAIT );
+        dump_stats.syscalls++;
+        if ( bytes < 0 )  return used;
+
+        struct nlmsghdr *h = (struct nlmsghdr *)(dump_buffer + used);
+        if ( (bytes >= (ssize_t)sizeof(*h)) and (h->nlmsg_seq == 0) ) {
+            used += NLMSG_ALIGN( bytes );
             continue;
         }
-        if ( message_length != 0 ) {
-            printf( "remnant\n" );
+
+        bool done = false;
+        unsigned int remaining = bytes;
+        while ( NLMSG_OK(h, remaining) ) {
+            if ( (h->nlmsg_seq == sequence) and
+                 ((h->nlmsg_type == NLMSG_DONE) or (h->nlmsg_type == NLMSG_ERROR)) ) {
+                done = true;
+            }
+            h = NLMSG_NEXT( h, remaining );
+        }
+        if ( done )  return used;
+    }
+}
+
+/**
+ * Request a full dump of one rtnetlink table (RTM_GETLINK, RTM_GETADDR,
+ * RTM_GETROUTE, RTM_GETNEIGH, ...) for an address family, and deliver
+ * each entry to the callback once the whole table has been read.
+ * Notifications that arrived during the dump are delivered with it.
+ *
+ * Returns the number of messages delivered, or -1 on error.
+ */
+int
+NetLink::RouteSocket::dump( uint16_t type, unsigned char family,
+                            NetLink::RouteReceiveCallbackInterface *callback ) {
+    uint64_t start = now_usec();
+    size_t length = 0;
+    int attempt = 0;
+
+    for (;;) {
+        struct {
+            struct nlmsghdr n;
+            struct rtgenmsg g;
+        } request;
+        memset( &request, 0, sizeof(request) );
+        request.n.nlmsg_len = sizeof(request);
+        request.n.nlmsg_type = type;
+        request.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+        request.n.nlmsg_seq = ++dump_sequence;
+        request.g.rtgen_family = family;
+
+        send( &request, sizeof(request) );
+        dump_stats.syscalls++;
+
+        int result = read_dump( request.n.nlmsg_seq, &length );
+        if ( result < 0 )  return -1;
+        if ( result > 0 )  break;
+
+        dump_stats.restarts++;
+        if ( ++attempt >= DUMP_RESTARTS ) {
+            log_err( "NetLink dump of type %d still incomplete after %d attempts", type, attempt );
+            return -1;
         }
+        if ( debug > 0 )  log_notice( "NetLink dump of type %d interrupted, restarting", type );
+    }
+
+    /*
+     * Notifications read along with the last part of the dump sit
+     * after its NLMSG_DONE, so each message is dispatched on its own
+     * rather than stopping at the end of the dump.
+     */
+    int messages = 0;
+    struct nlmsghdr *h = (struct nlmsghdr *)dump_buffer;
+    unsigned int remaining = length;
+    while ( NLMSG_OK(h, remaining) ) {
+        if ( (h->nlmsg_type != NLMSG_DONE) and (h->nlmsg_type != NLMSG_ERROR) )  messages++;
+        dispatch( h, NLMSG_ALIGN(h->nlmsg_len), callback );
+        h = NLMSG_NEXT( h, remaining );
     }
 
-finish:
-    ; // normally this would close the socket ...
+    uint64_t elapsed = now_usec() - start;
+    dump_stats.dumps++;
+    dump_stats.messages += messages;
+    dump_stats.last_usec = elapsed;
+    dump_stats.total_usec += elapsed;
+    if ( elapsed > dump_stats.max_usec )  dump_stats.max_usec = elapsed;
+
+    return messages;
 }
 
 /**
  */
 NetLink::RouteSocket::RouteSocket( uint32_t group )
-: NetLink::Socket(NETLINK_ROUTE) {
+: NetLink::Socket(NETLINK_ROUTE), _overruns(0), dump_sequence(0),
+  dump_buffer(NULL), dump_capacity(0), slot_size(DUMP_SLOT_SIZE) {
+    memset( &dump_stats, 0, sizeof(dump_stats) );
     bind(group);
 }
 
@@ -417,24 +811,7 @@ NetLink::LinkMessage::LinkMessage( struct nlmsghdr *hdr )
     memcpy( &(request.ifi), info, sizeof request.ifi );
 
     int length = hdr->nlmsg_len - NLMSG_LENGTH( sizeof(*info) );
-
-    memset( attr, 0, sizeof(attr) );
-
-    // can't I get this from the header directly??
-    struct rtattr *ra = IFLA_RTA(info);
-    while ( RTA_OK(ra, length) ) {
-        if ( ra->rta_type <= IFLA_MAX ) {
-            attr[ ra->rta_type ] = ra;
-        }
-        ra = RTA_NEXT( ra, length );
-    }
-
-    if ( length > 0 ) {
-        printf( " LM! remnant=%d\n", length );
-    }
-
-    if ( attr[IFA_LOCAL]   == 0 ) attr[IFA_LOCAL]   = attr[IFA_ADDRESS];
-    if ( attr[IFA_ADDRESS] == 0 ) attr[IFA_ADDRESS] = attr[IFA_LOCAL];
+    attr.bind( IFLA_RTA(info), length, IFLA_MAX );
 }
 
 /**
@@ -614,9 +991,42 @@ NetLink::NewLink::MAC() const {
  */
 struct rtnl_link_stats *
 NetLink::NewLink::stats() const {
+    if ( attr[IFLA_STATS] == NULL ) return NULL;
     return (struct rtnl_link_stats *)RTA_DATA( attr[IFLA_STATS] );
 }
 
+/**
+ * Copy out the 64 bit counters.  The attribute is only 4 byte
+ * aligned in the message, so it is copied rather than pointed at.
+ * Kernels (or drivers) without IFLA_STATS64 get the 32 bit counters
+ * widened; the fields they lack are left zero.
+ */
+bool
+NetLink::NewLink::stats64( struct rtnl_link_stats64 *result ) const {
+    memset( result, 0, sizeof(*result) );
+    struct rtattr *attribute = attr[IFLA_STATS64];
+    if ( attribute != NULL ) {
+        size_t length = RTA_PAYLOAD( attribute );
+        if ( length > sizeof(*result) )  length = sizeof(*result);
+        memcpy( result, RTA_DATA(attribute), length );
+        return true;
+    }
+
+    struct rtnl_link_stats *narrow = stats();
+    if ( narrow == NULL )  return false;
+    result->rx_packets = narrow->rx_packets;
+    result->tx_packets = narrow->tx_packets;
+    result->rx_bytes = narrow->rx_bytes;
+    result->tx_bytes = narrow->tx_bytes;
+    result->rx_errors = narrow->rx_errors;
+    result->tx_errors = narrow->tx_errors;
+    result->rx_dropped = narrow->rx_dropped;
+    result->tx_dropped = narrow->tx_dropped;
+    result->multicast = narrow->multicast;
+    result->collisions = narrow->collisions;
+    return true;
+}
+
 /**
  */
 NetLink::RouteMessage *
@@ -626,6 +1036,14 @@ NetLink::NewLink::Factory( struct nlmsghdr *hdr ) {
     return message;
 }
 
+/**
+ */
+bool
+NetLink::NewLink::Deliver( struct nlmsghdr *hdr, NetLink::RouteReceiveCallbackInterface *callback ) {
+    NetLink::NewLink message( hdr );
+    return message.deliver( callback );
+}
+
 /**
  */
 NetLink::DelLink::DelLink() : LinkMessage(RTM_DELLINK) {
@@ -656,6 +1074,9 @@ NetLink::DelLink::deliver( NetLink::RouteReceiveCallbackInterface *callback ) {
  */
 unsigned char *
 NetLink::DelLink::MAC() const {
+    if ( attr[IFLA_ADDRESS] == 0 ) {
+        return (unsigned char *)"\0\0\0\0\0\0\0";
+    }
     return (unsigned char *)RTA_DATA( attr[IFLA_ADDRESS] );
 }
 
@@ -669,6 +1090,14 @@ NetLink::DelLink::Factory( struct nlmsghdr *hdr ) {
     // populate with hdr info... and RTAs
     return message;
 }
+
+/**
+ */
+bool
+NetLink::DelLink::Deliver( struct nlmsghdr *hdr, NetLink::RouteReceiveCallbackInterface *callback ) {
+    NetLink::DelLink message( hdr );
+    return message.deliver( callback );
+}
 
 /**
  * This is only called when generating a request into the kernel.  Messages
@@ -694,24 +1123,7 @@ NetLink::AddressMessage::AddressMessage( struct nlmsghdr *hdr )
     memcpy( &(request.ifa), addr, sizeof request.ifa );
 
     int length = hdr->nlmsg_len - NLMSG_LENGTH( sizeof(*addr) );
-
-    memset( attr, 0, sizeof(attr) );
-
-    // can't I get this from the header directly??
-    struct rtattr *ra = IFA_RTA(addr);
-    while ( RTA_OK(ra, length) ) {
-        if ( ra->rta_type <= RTA_MAX ) {
-            attr[ ra->rta_type ] = ra;
-        }
-        ra = RTA_NEXT( ra, length );
-    }
-
-    if ( length > 0 ) {
-        printf( " AM! remnant=%d\n", length );
-    }
-
-    if ( attr[IFA_LOCAL]   == 0 ) attr[IFA_LOCAL]   = attr[IFA_ADDRESS];
-    if ( attr[IFA_ADDRESS] == 0 ) attr[IFA_ADDRESS] = attr[IFA_LOCAL];
+    attr.bind( IFA_RTA(addr), length, IFA_MAX );
 }
 
 /**
@@ -746,8 +1158,10 @@ void NetLink::AddressMessage::index(  int intf           ) { request.ifa.ifa_ind
 struct in6_addr *
 NetLink::AddressMessage::in6_addr() {
     if ( family() != AF_INET6 ) return NULL;
-    if ( attr[IFA_ADDRESS] == 0 ) return NULL;
-    struct in6_addr *address = (struct in6_addr *)RTA_DATA( attr[IFA_ADDRESS] );
+    struct rtattr *ra = attr[IFA_ADDRESS];
+    if ( ra == NULL )  ra = attr[IFA_LOCAL];
+    if ( ra == NULL )  return NULL;
+    struct in6_addr *address = (struct in6_addr *)RTA_DATA( ra );
     return address;
 }
 
@@ -809,13 +1223,6 @@ NetLink::NewAddress::NewAddress( int interface_index, struct in6_addr *address )
  */
 NetLink::NewAddress::NewAddress( struct nlmsghdr *hdr )
 : AddressMessage(hdr) {
-    const char *link_name = (attr[IFA_LABEL] == NULL)
-                            ? "NOT PROVIDED"
-                            : (const char *)RTA_DATA( attr[IFA_LABEL] );
-
-    char address_buffer[80];
-    char *address_string = (char *)inet_ntop( request.ifa.ifa_family, RTA_DATA(attr[IFA_ADDRESS]),
-                                      address_buffer, sizeof address_buffer );
 
     /*
      switch (address_family) {
@@ -832,6 +1239,19 @@ NetLink::NewAddress::NewAddress( struct nlmsghdr *hdr )
      */
 
     if ( debug > 1 ) {
+        const char *link_name = (attr[IFA_LABEL] == NULL)
+                                ? "NOT PROVIDED"
+                                : (const char *)RTA_DATA( attr[IFA_LABEL] );
+
+        struct rtattr *ra = attr[IFA_ADDRESS];
+        if ( ra == NULL )  ra = attr[IFA_LOCAL];
+
+        char address_buffer[80];
+        const char *address_string = "NONE";
+        if ( ra != NULL ) {
+            address_string = inet_ntop( request.ifa.ifa_family, RTA_DATA(ra),
+                                        address_buffer, sizeof address_buffer );
+        }
         log_notice( "%s(%d) NewAddress: %s/%d\n", link_name, request.ifa.ifa_index,
                                                  address_string, request.ifa.ifa_prefixlen );
     }
@@ -854,6 +1274,14 @@ NetLink::NewAddress::Factory( struct nlmsghdr *hdr ) {
     return message;
 }
 
+/**
+ */
+bool
+NetLink::NewAddress::Deliver( struct nlmsghdr *hdr, NetLink::RouteReceiveCallbackInterface *callback ) {
+    NetLink::NewAddress message( hdr );
+    return message.deliver( callback );
+}
+
 /**
  */
 NetLink::DelAddress::DelAddress() : AddressMessage(RTM_DELADDR) {
@@ -885,6 +1313,14 @@ NetLink::DelAddress::Factory( struct nlmsghdr *hdr ) {
     return message;
 }
 
+/**
+ */
+bool
+NetLink::DelAddress::Deliver( struct nlmsghdr *hdr, NetLink::RouteReceiveCallbackInterface *callback ) {
+    NetLink::DelAddress message( hdr );
+    return message.deliver( callback );
+}
+
 /**
  */
 NetLink::GetAddress::GetAddress() : AddressMessage(RTM_GETADDR) { }
@@ -930,20 +1366,7 @@ NetLink::NewRoute::NewRoute( struct nlmsghdr *hdr )
 : RouteMessage(hdr) {
     rtm = (struct rtmsg *)NLMSG_DATA(hdr);
     int length = hdr->nlmsg_len - NLMSG_LENGTH( sizeof(*rtm) );
-
-    memset( attr, 0, sizeof(attr) );
-    // can't I get this from the header directly??
-    struct rtattr *ra = RTM_RTA(rtm);
-    while ( RTA_OK(ra, length) ) {
-        if ( ra->rta_type <= RTA_MAX ) {
-            attr[ ra->rta_type ] = ra;
-        }
-        ra = RTA_NEXT( ra, length );
-    }
-
-    if ( length > 0 ) {
-        printf( " NR! remnant=%d\n", length );
-    }
+    attr.bind( RTM_RTA(rtm), length, RTA_MAX );
 
     /*
      * RTA_IIF and RTA_OIF are actually (int) - according to the man pages
@@ -1009,6 +1432,14 @@ NetLink::NewRoute::Factory( struct nlmsghdr *hdr ) {
     return message;
 }
 
+/**
+ */
+bool
+NetLink::NewRoute::Deliver( struct nlmsghdr *hdr, NetLink::RouteReceiveCallbackInterface *callback ) {
+    NetLink::NewRoute message( hdr );
+    return message.deliver( callback );
+}
+
 /**
  */
 NetLink::DelRoute::DelRoute() : RouteMessage(RTM_DELROUTE) {
@@ -1026,20 +1457,7 @@ NetLink::DelRoute::DelRoute( struct nlmsghdr *hdr )
 : RouteMessage(hdr) {
     rtm = (struct rtmsg *)NLMSG_DATA(hdr);
     int length = hdr->nlmsg_len - NLMSG_LENGTH( sizeof(*rtm) );
-
-    memset( attr, 0, sizeof(attr) );
-    // can't I get this from the header directly??
-    struct rtattr *ra = RTM_RTA(rtm);
-    while ( RTA_OK(ra, length) ) {
-        if ( ra->rta_type <= RTA_MAX ) {
-            attr[ ra->rta_type ] = ra;
-        }
-        ra = RTA_NEXT( ra, length );
-    }
-
-    if ( length > 0 ) {
-        printf( " DR! remnant=%d\n", length );
-    }
+    attr.bind( RTM_RTA(rtm), length, RTA_MAX );
 
     if ( debug > 1 ) {
         printf( "DelRoute: => type=%d scope=%d family=%d : iif=%ld oif=%ld\n",
@@ -1118,6 +1536,14 @@ NetLink::DelRoute::Factory( struct nlmsghdr *hdr ) {
     // populate with hdr info... and RTAs
     return message;
 }
+
+/**
+ */
+bool
+NetLink::DelRoute::Deliver( struct nlmsghdr *hdr, NetLink::RouteReceiveCallbackInterface *callback ) {
+    NetLink::DelRoute message( hdr );
+    return message.deliver( callback );
+}
 
 /**
  */
@@ -1129,20 +1555,7 @@ NetLink::NeighborMessage::NeighborMessage( struct nlmsghdr *hdr )
 : RouteMessage(hdr) {
     message = (struct ndmsg *)NLMSG_DATA(hdr);
     int length = hdr->nlmsg_len - NLMSG_LENGTH( sizeof(*message) );
-
-    memset( attr, 0, sizeof(attr) );
-    // can't I get this from the header directly??
-    struct rtattr *ra = NDA_RTA(message);
-    while ( RTA_OK(ra, length) ) {
-        if ( ra->rta_type <= RTA_MAX ) {
-            attr[ ra->rta_type ] = ra;
-        }
-        ra = RTA_NEXT( ra, length );
-    }
-
-    if ( length > 0 ) {
-        printf( " !!! remnant=%d\n", length );
-    }
+    attr.bind( NDA_RTA(message), length, NDA_MAX );
 
     if ( debug > 1 ) {
         printf( "NeighborMessage: => type=%d ifindex=%d family=%d\n",
@@ -1182,6 +1595,14 @@ NetLink::NewNeighbor::Factory( struct nlmsghdr *hdr ) {
     return message;
 }
 
+/**
+ */
+bool
+NetLink::NewNeighbor::Deliver( struct nlmsghdr *hdr, NetLink::RouteReceiveCallbackInterface *callback ) {
+    NetLink::NewNeighbor message( hdr );
+    return message.deliver( callback );
+}
+
 /**
  */
 NetLink::DelNeighbor::DelNeighbor() : NeighborMessage(RTM_DELNEIGH) {
@@ -1213,6 +1634,14 @@ NetLink::DelNeighbor::Factory( struct nlmsghdr *hdr ) {
     return message;
 }
 
+/**
+ */
+bool
+NetLink::DelNeighbor::Deliver( struct nlmsghdr *hdr, NetLink::RouteReceiveCallbackInterface *callback ) {
+    NetLink::DelNeighbor message( hdr );
+    return message.deliver( callback );
+}
+
 /**
  */
 NetLink::GetNeighbor::GetNeighbor() : NeighborMessage(RTM_GETNEIGH) {
@@ -1292,4 +1721,43 @@ void NetLink::RouteResponseHandler::receive( NetLink::RouteError *message ) {
  */
 int NetLink::RouteResponseHandler::error() const { return _error; }
 
+/**
+ * Populate the route message factory and delivery tables before main()
+ * runs, so every RouteSocket can construct messages whether or not the
+ * Tcl NetLink module has been initialized.
+ */
+static void __attribute__ ((constructor))
+register_route_factories() {
+    for ( int i = 0 ; i < MAX_RTFACTORY ; i++ ) {
+        // This should be a generic route factory, not a simple netlink message
+        routeFactories[i] = NetLink::RouteMessage::Factory;
+    }
+    // set specific message factories
+    routeFactories[RTM_NEWLINK]  = NetLink::NewLink::Factory;
+    routeFactories[RTM_DELLINK]  = NetLink::DelLink::Factory;
+    routeFactories[RTM_GETLINK]  = NetLink::GetLink::Factory;
+    routeFactories[RTM_NEWADDR]  = NetLink::NewAddress::Factory;
+    routeFactories[RTM_DELADDR]  = NetLink::DelAddress::Factory;
+    routeFactories[RTM_GETADDR]  = NetLink::GetAddress::Factory;
+    routeFactories[RTM_NEWROUTE] = NetLink::NewRoute::Factory;
+    routeFactories[RTM_DELROUTE] = NetLink::DelRoute::Factory;
+    routeFactories[RTM_GETROUTE] = NetLink::GetRoute::Factory;
+    routeFactories[RTM_NEWNEIGH]  = NetLink::NewNeighbor::Factory;
+    routeFactories[RTM_DELNEIGH]  = NetLink::DelNeighbor::Factory;
+    routeFactories[RTM_GETNEIGH]  = NetLink::GetNeighbor::Factory;
+
+    for ( int i = 0 ; i < MAX_RTFACTORY ; i++ ) {
+        routeDeliveries[i] = NetLink::RouteMessage::Deliver;
+    }
+    // only messages the kernel sends have a Deliver
+    routeDeliveries[RTM_NEWLINK]  = NetLink::NewLink::Deliver;
+    routeDeliveries[RTM_DELLINK]  = NetLink::DelLink::Deliver;
+    routeDeliveries[RTM_NEWADDR]  = NetLink::NewAddress::Deliver;
+    routeDeliveries[RTM_DELADDR]  = NetLink::DelAddress::Deliver;
+    routeDeliveries[RTM_NEWROUTE] = NetLink::NewRoute::Deliver;
+    routeDeliveries[RTM_DELROUTE] = NetLink::DelRoute::Deliver;
+    routeDeliveries[RTM_NEWNEIGH] = NetLink::NewNeighbor::Deliver;
+    routeDeliveries[RTM_DELNEIGH] = NetLink::DelNeighbor::Deliver;
+}
+
 /* vim: set autoindent expandtab sw=4 : */
@@ -58,6 +58,27 @@ namespace NetLink {
     class ReceiveCallbackInterface;
     class RouteReceiveCallbackInterface;
 
+    /**
+     * A lazily built index of the route attributes (rtattrs) that follow
+     * the fixed part of a received message.  It points into the receive
+     * buffer and owns nothing.  The attributes are not walked until the
+     * first lookup, so messages whose attributes are never examined cost
+     * nothing beyond binding the view.
+     */
+    class Attributes {
+    private:
+        struct rtattr *first;
+        int length;
+        int max;
+        mutable bool indexed;
+        mutable struct rtattr *table[IFLA_MAX+1];
+        void index() const;
+    public:
+        Attributes() : first(NULL), length(0), max(-1), indexed(false) {}
+        void bind( struct rtattr *, int, int );
+        struct rtattr *operator [] ( int ) const;
+    };
+
     /**
      * netlink message classes contain data they need to send requests, but
      * the messages that are only expected to be received contain pointers into
@@ -69,6 +90,12 @@ namespace NetLink {
      * message is recycled, so it does not have an extended lifetime.  This
      * also means that the object can live on the stack and does not require
      * the malloc/free overhead.
+     *
+     * Each received message class has a static Deliver() that constructs
+     * the message on the stack over the receive buffer and hands it to the
+     * callback.  RouteSocket dispatches through these, so receiving does
+     * not touch the heap.  Factory() is kept for callers that need a
+     * message to outlive the buffer.
      */
     class Message {
     protected:
@@ -111,6 +138,7 @@ namespace NetLink {
         virtual bool deliver( RouteReceiveCallbackInterface * );
         virtual void send( Socket& );
         static RouteMessage * Factory( struct nlmsghdr * );
+        static bool Deliver( struct nlmsghdr *, RouteReceiveCallbackInterface * );
     };
 
     /**
@@ -139,7 +167,7 @@ namespace NetLink {
             struct ifinfomsg ifi;
         } request;
 
-        struct rtattr *attr[IFLA_MAX+1];
+        Attributes attr;
     public:
         LinkMessage( uint16_t );
         LinkMessage( struct nlmsghdr * );
@@ -186,8 +214,10 @@ namespace NetLink {
         virtual ~NewLink() {}
         virtual bool deliver( RouteReceiveCallbackInterface * );
         static RouteMessage * Factory( struct nlmsghdr * );
+        static bool Deliver( struct nlmsghdr *, RouteReceiveCallbackInterface * );
         unsigned char *MAC() const;
         struct rtnl_link_stats *stats() const;
+        bool stats64( struct rtnl_link_stats64 * ) const;
 
         bool up_changed() const;
         bool running_changed() const;
@@ -215,6 +245,7 @@ namespace NetLink {
         virtual ~DelLink() {}
         virtual bool deliver( RouteReceiveCallbackInterface * );
         static RouteMessage * Factory( struct nlmsghdr * );
+        static bool Deliver( struct nlmsghdr *, RouteReceiveCallbackInterface * );
         unsigned char *MAC() const;
     };
 
@@ -246,7 +277,7 @@ namespace NetLink {
             char buffer[2048];
         } request;
 
-        struct rtattr *attr[IFA_MAX+1];
+        Attributes attr;
     public:
         AddressMessage( uint16_t );
         AddressMessage( struct nlmsghdr * );
@@ -282,6 +313,7 @@ namespace NetLink {
         virtual ~NewAddress() {}
         virtual bool deliver( RouteReceiveCallbackInterface * );
         static RouteMessage * Factory( struct nlmsghdr * );
+        static bool Deliver( struct nlmsghdr *, RouteReceiveCallbackInterface * );
     };
 
     /**
@@ -293,6 +325,7 @@ namespace NetLink {
         virtual ~DelAddress() {}
         virtual bool deliver( RouteReceiveCallbackInterface * );
         static RouteMessage * Factory( struct nlmsghdr * );
+        static bool Deliver( struct nlmsghdr *, RouteReceiveCallbackInterface * );
     };
 
     /**
@@ -312,7 +345,7 @@ namespace NetLink {
     class NewRoute : public RouteMessage {
     private:
         struct rtmsg *rtm;
-        struct rtattr *attr[RTA_MAX+1];
+        Attributes attr;
     public:
         NewRoute();
         NewRoute( struct nlmsghdr * );
@@ -323,6 +356,7 @@ namespace NetLink {
         int protocol() const;
         int scope() const;
         static RouteMessage * Factory( struct nlmsghdr * );
+        static bool Deliver( struct nlmsghdr *, RouteReceiveCallbackInterface * );
     };
 
     /**
@@ -330,7 +364,7 @@ namespace NetLink {
     class DelRoute : public RouteMessage {
     private:
         struct rtmsg *rtm;
-        struct rtattr *attr[RTA_MAX+1];
+        Attributes attr;
     public:
         DelRoute();
         DelRoute( struct nlmsghdr * );
@@ -341,7 +375,7 @@ namespace NetLink {
         int protocol() const;
         int scope() const;
         static RouteMessage * Factory( struct nlmsghdr * );
-        // static bool Deliver( struct nlmsghdr * );
+        static bool Deliver( struct nlmsghdr *, RouteReceiveCallbackInterface * );
     };
 
     /**
@@ -358,7 +392,7 @@ namespace NetLink {
     class NeighborMessage : public RouteMessage {
     protected:
         struct ndmsg *message;
-        struct rtattr *attr[NDA_MAX+1];
+        Attributes attr;
     public:
         NeighborMessage( uint16_t );
         NeighborMessage( struct nlmsghdr * );
@@ -374,6 +408,7 @@ namespace NetLink {
         virtual ~NewNeighbor() {}
         virtual bool deliver( RouteReceiveCallbackInterface * );
         static RouteMessage * Factory( struct nlmsghdr * );
+        static bool Deliver( struct nlmsghdr *, RouteReceiveCallbackInterface * );
     };
 
     /**
@@ -385,6 +420,7 @@ namespace NetLink {
         virtual ~DelNeighbor() {}
         virtual bool deliver( RouteReceiveCallbackInterface * );
         static RouteMessage * Factory( struct nlmsghdr * );
+        static bool Deliver( struct nlmsghdr *, RouteReceiveCallbackInterface * );
     };
 
     /**
@@ -459,17 +495,62 @@ namespace NetLink {
         bool bind( uint32_t );
         void receive( ReceiveCallbackInterface * );
         void send( void *, int );
+        int descriptor() const { return socket; }
+    };
+
+    /**
+     * Counters kept by RouteSocket::dump().  Times are in microseconds
+     * from sending the request until the last message was delivered.
+     */
+    struct DumpStatistics {
+        unsigned long dumps;
+        unsigned long restarts;
+        unsigned long syscalls;
+        unsigned long datagrams;
+        unsigned long bytes;
+        unsigned long messages;
+        uint64_t last_usec;
+        uint64_t total_usec;
+        uint64_t max_usec;
     };
 
     /**
      * A RouteSocket is a netlink socket that is bound to the
      * rtnetlink protocol.
+     *
+     * dump() requests a whole table (links, addresses, routes or
+     * neighbors) and reads the response in recvmmsg batches into a
+     * buffer that is kept and grown across dumps.  Nothing is delivered
+     * until the dump completes.  If the kernel flags the dump as
+     * interrupted (NLM_F_DUMP_INTR, the table changed while it was
+     * being walked) the partial result is thrown away and the dump is
+     * requested again, so callbacks only ever see a consistent table.
+     *
+     * receive() blocks until a dump completes.  drain() is for event
+     * driven callers -- it reads every datagram that is already queued
+     * on the socket and returns as soon as the socket would block.
      */
     class RouteSocket : public Socket {
+    private:
+        unsigned long _overruns;
+        uint32_t dump_sequence;
+        char *dump_buffer;
+        size_t dump_capacity;
+        size_t slot_size;
+        DumpStatistics dump_stats;
+        void reserve( size_t );
+        int read_dump( uint32_t, size_t * );
+        size_t keep_notifications( uint32_t, size_t );
+        size_t drain_dump( uint32_t, size_t );
     public:
+        static bool dispatch( struct nlmsghdr *, unsigned int, RouteReceiveCallbackInterface * );
         RouteSocket( uint32_t group=0 );
         virtual ~RouteSocket();
         void receive( RouteReceiveCallbackInterface * );
+        int drain( RouteReceiveCallbackInterface * );
+        int dump( uint16_t, unsigned char, RouteReceiveCallbackInterface * );
+        unsigned long overruns() const { return _overruns; }
+        const DumpStatistics& dump_statistics() const { return dump_stats; }
     };
 
 }
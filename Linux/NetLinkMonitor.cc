@@ -51,6 +51,7 @@
 #include "util.h"
 #include "host_table.h"
 #include "NetLink.h"
+#include "BPF.h"
 #include "NetLinkMonitor.h"
 
 namespace { int debug = 0; }
@@ -88,6 +89,33 @@ NetLink::Monitor::process_one_event() {
     rs.receive( this );
 }
 
+/**
+ * Deliver every event already queued on the route socket without
+ * blocking.  Returns the number of datagrams that were read.
+ */
+int
+NetLink::Monitor::process_pending_events() {
+    NetLink::RouteSocket &rs = *route_socket;
+    return rs.drain( this );
+}
+
+/**
+ * The route socket descriptor, for registering with poll/epoll.
+ */
+int
+NetLink::Monitor::event_descriptor() const {
+    return route_socket->descriptor();
+}
+
+/**
+ * Count of ENOBUFS overruns seen on the route socket.  When this
+ * changes, events were lost and the caller should probe again.
+ */
+unsigned long
+NetLink::Monitor::event_overruns() const {
+    return route_socket->overruns();
+}
+
 void
 NetLink::Monitor::probe() {
     if ( debug > 0 ) log_notice( "Monitor: sending probe" );
@@ -113,6 +141,19 @@ NetLink::Monitor::Monitor() {
                       RTMGRP_IPV6_IFINFO | RTMGRP_IPV6_PREFIX ;
 
     route_socket = new NetLink::RouteSocket( groups );
+
+    /*
+     * The IFINFO and PREFIX groups also carry messages no receive()
+     * here looks at; keep those in the kernel.
+     */
+    static const uint16_t types[] = { RTM_NEWLINK, RTM_DELLINK, RTM_NEWADDR, RTM_DELADDR };
+    BPF::Program *filter = BPF::Program::netlink( types, sizeof(types) / sizeof(types[0]) );
+    if ( filter != NULL ) {
+        if ( filter->attach(route_socket->descriptor()) == false ) {
+            log_warn( "NetLink::Monitor: cannot filter route socket: %s", filter->error() );
+        }
+        delete filter;
+    }
 }
 
 /**
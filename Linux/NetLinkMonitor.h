@@ -73,7 +73,10 @@ namespace NetLink {
         Monitor();
         virtual ~Monitor();
         virtual void process_one_event();
+        virtual int process_pending_events();
         virtual void probe();
+        int event_descriptor() const;
+        unsigned long event_overruns() const;
         virtual void receive( NetLink::NewLink* );
         virtual void receive( NetLink::DelLink* );
         virtual void receive( NetLink::NewRoute* );
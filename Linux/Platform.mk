@@ -4,6 +4,9 @@ CFLAGS += -std=c99 -rdynamic
 CXXFLAGS += -rdynamic
 
 # PLATFORM_OBJS := NetLink.o LinuxThread.o Bridge.o
+# the platform half of Thread/Queue, for the standalone benchmarks
+THREAD_PLATFORM_OBJS = Linux/LinuxThread.o
+
 PLATFORM_OBJS  = Linux/LinuxKernel.o
 PLATFORM_OBJS += Linux/LinuxThread.o
 PLATFORM_OBJS += syslog_logger.o
@@ -15,7 +18,27 @@ PLATFORM_OBJS += Linux/NetLink.o
 PLATFORM_OBJS += Linux/NetLinkMonitor.o
 PLATFORM_OBJS += Linux/TCL_NetLink.o
 PLATFORM_OBJS += Linux/Container.o
+PLATFORM_OBJS += Linux/ICMPv6Receiver.o
+PLATFORM_OBJS += Linux/TCL_ICMPv6Receiver.o
+PLATFORM_OBJS += Linux/BPF.o
+PLATFORM_OBJS += Linux/EBPF.o
+PLATFORM_OBJS += Linux/TCL_BPF.o
+PLATFORM_OBJS += Linux/LinkSampler.o
+PLATFORM_OBJS += Linux/TCL_LinkSampler.o
+PLATFORM_OBJS += Linux/Ethtool.o
+PLATFORM_OBJS += Linux/TCL_Ethtool.o
+PLATFORM_OBJS += Linux/TopologyNotifier.o
+PLATFORM_OBJS += Linux/TCL_TopologyNotifier.o
+PLATFORM_OBJS += Linux/ProcessManager.o
+PLATFORM_OBJS += Linux/TCL_ProcessManager.o
+PLATFORM_OBJS += Linux/ProcessTable.o
+PLATFORM_OBJS += Linux/TCL_ProcessTable.o
 
 NetLink.o :: NetLink.h
 LinuxThread.o :: PlatformThread.h
 Bridge.o :: Network.h
+
+# netlink decoder microbenchmark -- not part of the default build
+CLEANS += netlink-bench
+netlink-bench: Linux/netlink-bench.o Linux/NetLink.o syslog_logger.o Allocator.o
+	$(CXX) $(LDFLAGS) -o $@ $^ -lpthread -ltcl
@@ -0,0 +1,463 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+/** \file ProcessManager.cc
+ * \brief Child processes started and reaped without blocking the caller.
+ *
+ * spawn() runs on the caller's thread: posix_spawn is a vfork and an
+ * exec, so it costs the caller no more than the exec.  The job is then
+ * registered and its descriptors added to the manager's epoll set;
+ * the eventfd tells the manager to recompute its next deadline.
+ * Everything after that is the manager thread's.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <spawn.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+
+#include "logger.h"
+#include "PlatformThread.h"
+#include "ProcessManager.h"
+
+extern char **environ;
+
+namespace {
+    int debug = 0;
+
+    // children without a pidfd are polled this often (milliseconds)
+    const int POLL_INTERVAL = 100;
+
+    uint64_t now_usec() {
+        struct timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+    }
+
+    /**
+     * The argv as one string, for logs and job listings.
+     */
+    char *join( char * const argv[] ) {
+        size_t length = 1;
+        for ( int i = 0 ; argv[i] != NULL ; ++i )  length += strlen( argv[i] ) + 1;
+        char *result = (char *)malloc( length );
+        result[0] = '\0';
+        for ( int i = 0 ; argv[i] != NULL ; ++i ) {
+            if ( i > 0 )  strcat( result, " " );
+            strcat( result, argv[i] );
+        }
+        return result;
+    }
+
+    const char *state_names[] = { "exited", "signaled", "timeout", "failed" };
+
+    pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+}
+
+Process::Manager *Process::Manager::instance = NULL;
+
+/**
+ */
+const char *
+Process::Result::state_name( int state ) {
+    if ( (state < EXITED) or (state > FAILED) )  return "unknown";
+    return state_names[state];
+}
+
+/**
+ * The manager for the process.  The first call must be on the main
+ * thread, since constructing a Thread registers it with the
+ * interpreter; the Process module makes that call at startup.
+ */
+Process::Manager *
+Process::Manager::shared() {
+    pthread_mutex_lock( &shared_lock );
+    if ( instance == NULL ) {
+        instance = new Manager( "ProcessManager" );
+        instance->start();
+    }
+    pthread_mutex_unlock( &shared_lock );
+    return instance;
+}
+
+/**
+ */
+Process::Manager::Manager( const char *name )
+: Thread(name)
+{
+    pthread_mutex_init( &lock, NULL );
+    memset( &stats, 0, sizeof(stats) );
+    epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+    wake_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    if ( (epoll_fd < 0) or (wake_fd < 0) ) {
+        log_err( "%s: cannot create event descriptors: %s", name, strerror(errno) );
+        return;
+    }
+    struct epoll_event event;
+    memset( &event, 0, sizeof(event) );
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl( epoll_fd, EPOLL_CTL_ADD, wake_fd, &event );
+}
+
+/**
+ */
+Process::Manager::~Manager() {
+    if ( wake_fd != -1 )  close( wake_fd );
+    if ( epoll_fd != -1 )  close( epoll_fd );
+}
+
+/**
+ * Start argv[0] (found on PATH) with the process environment.  With
+ * CAPTURE its stdout and stderr are collected, up to MAX_OUTPUT
+ * bytes; otherwise they are the caller's.  stdin is /dev/null.  A
+ * child still running after timeout milliseconds (0 for never) is
+ * killed.  Returns the pid, or -1 with errno set if nothing started.
+ */
+pid_t
+Process::Manager::spawn( char * const argv[], int timeout, Completion *completion, int flags ) {
+    int fd[2] = { -1, -1 };
+    if ( (flags & CAPTURE) and (pipe2(fd, O_CLOEXEC) < 0) ) {
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init( &actions );
+    posix_spawn_file_actions_addopen( &actions, 0, "/dev/null", O_RDONLY, 0 );
+    if ( flags & CAPTURE ) {
+        posix_spawn_file_actions_adddup2( &actions, fd[1], 1 );
+        posix_spawn_file_actions_adddup2( &actions, fd[1], 2 );
+    }
+
+    // the caller's signal mask and handlers are not the child's
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init( &attributes );
+    sigset_t signals;
+    sigemptyset( &signals );
+    posix_spawnattr_setsigmask( &attributes, &signals );
+    sigfillset( &signals );
+    posix_spawnattr_setsigdefault( &attributes, &signals );
+    posix_spawnattr_setflags( &attributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF );
+
+    pid_t pid;
+    int error = posix_spawnp( &pid, argv[0], &actions, &attributes, argv, environ );
+    posix_spawn_file_actions_destroy( &actions );
+    posix_spawnattr_destroy( &attributes );
+    if ( fd[1] != -1 )  close( fd[1] );
+
+    if ( error != 0 ) {
+        if ( fd[0] != -1 )  close( fd[0] );
+        pthread_mutex_lock( &lock );
+        stats.failed++;
+        pthread_mutex_unlock( &lock );
+        errno = error;
+        return -1;
+    }
+
+    Job *job = new Job;
+    memset( job, 0, sizeof(*job) );
+    job->pid = pid;
+    job->pidfd = process_handle( pid );
+    job->output_fd = fd[0];
+    job->command = join( argv );
+    job->started = now_usec();
+    job->deadline = (timeout > 0) ? job->started + ((uint64_t)timeout * 1000) : 0;
+    job->completion = completion;
+    job->process_watch.job = job;
+    job->process_watch.output = false;
+    job->output_watch.job = job;
+    job->output_watch.output = true;
+    if ( job->output_fd != -1 )  fcntl( job->output_fd, F_SETFL, O_NONBLOCK );
+    if ( debug > 0 )  log_notice( "%s: started %d: %s", thread_name(), pid, job->command );
+
+    pthread_mutex_lock( &lock );
+    jobs[pid] = job;
+    stats.spawned++;
+    stats.running = jobs.size();
+
+    struct epoll_event event;
+    memset( &event, 0, sizeof(event) );
+    event.events = EPOLLIN;
+    if ( job->pidfd != -1 ) {
+        event.data.ptr = &job->process_watch;
+        epoll_ctl( epoll_fd, EPOLL_CTL_ADD, job->pidfd, &event );
+    }
+    if ( job->output_fd != -1 ) {
+        event.data.ptr = &job->output_watch;
+        epoll_ctl( epoll_fd, EPOLL_CTL_ADD, job->output_fd, &event );
+    }
+    pthread_mutex_unlock( &lock );
+
+    uint64_t one = 1;
+    if ( write(wake_fd, &one, sizeof(one)) < 0 ) {
+        log_err( "%s: cannot wake manager: %s", thread_name(), strerror(errno) );
+    }
+    return pid;
+}
+
+/**
+ * Run a command line through /bin/sh, as system() did, without
+ * waiting for it.  With no completion a failure is logged.
+ */
+pid_t
+Process::Manager::shell( const char *command, int timeout, Completion *completion ) {
+    char *argv[] = { const_cast<char*>("/bin/sh"), const_cast<char*>("-c"), const_cast<char*>(command), 0 };
+    pid_t pid = spawn( argv, timeout, completion );
+    if ( pid < 0 )  log_err( "failed to start '%s': %s", command, strerror(errno) );
+    return pid;
+}
+
+/**
+ * Read whatever output is waiting.  The buffer doubles as needed up
+ * to MAX_OUTPUT; past that output is read and dropped so the child
+ * never blocks on a full pipe.
+ */
+void
+Process::Manager::drain( Job *job ) {
+    if ( job->output_fd == -1 )  return;
+    for (;;) {
+        if ( job->length == job->capacity and job->capacity < MAX_OUTPUT ) {
+            size_t capacity = (job->capacity == 0) ? 4096 : job->capacity * 2;
+            if ( capacity > MAX_OUTPUT )  capacity = MAX_OUTPUT;
+            job->output = (char *)realloc( job->output, capacity );
+            job->capacity = capacity;
+        }
+
+        char discard[4096];
+        char *into = discard;
+        size_t room = sizeof(discard);
+        if ( job->length < job->capacity ) {
+            into = job->output + job->length;
+            room = job->capacity - job->length;
+        }
+
+        ssize_t bytes = read( job->output_fd, into, room );
+        if ( bytes > 0 ) {
+            if ( into == discard ) {
+                job->truncated = true;
+            } else {
+                job->length += bytes;
+            }
+            pthread_mutex_lock( &lock );
+            stats.output_bytes += bytes;
+            pthread_mutex_unlock( &lock );
+            continue;
+        }
+        if ( (bytes < 0) and (errno == EINTR) )  continue;
+        if ( (bytes < 0) and (errno == EAGAIN) )  return;
+
+        // end of file, or an error that will not go away
+        epoll_ctl( epoll_fd, EPOLL_CTL_DEL, job->output_fd, NULL );
+        close( job->output_fd );
+        job->output_fd = -1;
+        return;
+    }
+}
+
+/**
+ * Returns true once the child has been reaped, or once waitpid
+ * fails (someone else reaped it), in which case its status is not
+ * known and lost holds the error.
+ */
+bool
+Process::Manager::reap( Job *job ) {
+    if ( job->exited )  return true;
+    int status = 0;
+    pid_t result = waitpid( job->pid, &status, WNOHANG );
+    if ( result == 0 )  return false;
+    if ( (result < 0) and (errno == EINTR) )  return false;
+    job->exited = true;
+    job->status = status;
+    if ( result < 0 )  job->lost = errno;
+    return true;
+}
+
+/**
+ * The child has exited.  Its output is whatever is in the pipe now: a
+ * grandchild that kept the pipe open (a daemon it started, say) is
+ * not waited for.
+ */
+void
+Process::Manager::finish( Job *job ) {
+    drain( job );
+    if ( job->output_fd != -1 ) {
+        epoll_ctl( epoll_fd, EPOLL_CTL_DEL, job->output_fd, NULL );
+        close( job->output_fd );
+    }
+    if ( job->pidfd != -1 ) {
+        epoll_ctl( epoll_fd, EPOLL_CTL_DEL, job->pidfd, NULL );
+        close( job->pidfd );
+    }
+
+    Result result;
+    result.pid = job->pid;
+    result.elapsed = now_usec() - job->started;
+    result.output = (job->output == NULL) ? "" : job->output;
+    result.length = job->length;
+    result.truncated = job->truncated;
+    if ( job->timed_out ) {
+        result.state = Result::TIMED_OUT;
+        result.code = SIGKILL;
+    } else if ( job->lost != 0 ) {
+        result.state = Result::FAILED;
+        result.code = job->lost;
+    } else if ( WIFSIGNALED(job->status) ) {
+        result.state = Result::SIGNALED;
+        result.code = WTERMSIG( job->status );
+    } else {
+        result.state = Result::EXITED;
+        result.code = WEXITSTATUS( job->status );
+    }
+
+    pthread_mutex_lock( &lock );
+    jobs.erase( job->pid );
+    stats.completed++;
+    if ( job->timed_out )  stats.timeouts++;
+    stats.running = jobs.size();
+    pthread_mutex_unlock( &lock );
+
+    if ( job->completion != NULL ) {
+        Completion& completion = *(job->completion);
+        completion( result );
+    } else if ( result.succeeded() == false ) {
+        log_notice( "'%s' (%d) %s with %d after %lu ms", job->command, job->pid,
+                    Result::state_name(result.state), result.code,
+                    (unsigned long)(result.elapsed / 1000) );
+    }
+
+    free( job->output );
+    free( job->command );
+    delete job;
+}
+
+/**
+ * Milliseconds until the earliest deadline, for epoll_wait.
+ */
+int
+Process::Manager::next_timeout() {
+    uint64_t now = now_usec();
+    int result = -1;
+    pthread_mutex_lock( &lock );
+    std::map<pid_t, Job *>::iterator iter = jobs.begin();
+    for ( ; iter != jobs.end() ; ++iter ) {
+        Job *job = iter->second;
+        int timeout = -1;
+        if ( (job->deadline != 0) and (job->timed_out == false) ) {
+            timeout = (job->deadline <= now) ? 0 : (int)((job->deadline - now + 999) / 1000);
+        }
+        if ( (job->pidfd == -1) and ((timeout == -1) or (timeout > POLL_INTERVAL)) ) {
+            timeout = POLL_INTERVAL;
+        }
+        if ( (timeout != -1) and ((result == -1) or (timeout < result)) )  result = timeout;
+    }
+    pthread_mutex_unlock( &lock );
+    return result;
+}
+
+/**
+ */
+void
+Process::Manager::run() {
+    for (;;) {
+        struct epoll_event events[32];
+        int count = epoll_wait( epoll_fd, events, 32, next_timeout() );
+        if ( count < 0 ) {
+            if ( errno == EINTR )  continue;
+            log_err( "%s: epoll_wait failed: %s", thread_name(), strerror(errno) );
+            break;
+        }
+
+        for ( int i = 0 ; i < count ; ++i ) {
+            Watch *watch = (Watch *)events[i].data.ptr;
+            if ( watch == NULL ) {
+                uint64_t value;
+                if ( (read(wake_fd, &value, sizeof(value)) < 0) and (errno != EAGAIN) ) {
+                    log_err( "%s: cannot read wakeup: %s", thread_name(), strerror(errno) );
+                }
+                continue;
+            }
+            if ( watch->output ) {
+                drain( watch->job );
+            } else {
+                reap( watch->job );
+            }
+        }
+
+        // finish outside the event loop: a job may have had events on
+        // both of its descriptors
+        std::vector<Job *> done;
+        uint64_t now = now_usec();
+        pthread_mutex_lock( &lock );
+        std::map<pid_t, Job *>::iterator iter = jobs.begin();
+        for ( ; iter != jobs.end() ; ++iter ) {
+            Job *job = iter->second;
+            if ( (job->pidfd == -1) and (job->exited == false) )  reap( job );
+            if ( job->exited ) {
+                done.push_back( job );
+                continue;
+            }
+            if ( (job->deadline != 0) and (job->deadline <= now) and (job->timed_out == false) ) {
+                log_notice( "%s: '%s' (%d) timed out, killing it", thread_name(), job->command, job->pid );
+                ::kill( job->pid, SIGKILL );
+                job->timed_out = true;
+            }
+        }
+        pthread_mutex_unlock( &lock );
+
+        for ( size_t i = 0 ; i < done.size() ; ++i )  finish( done[i] );
+    }
+}
+
+/**
+ */
+int
+Process::Manager::each_job( JobIterator& callback ) {
+    int result = 0;
+    uint64_t now = now_usec();
+    pthread_mutex_lock( &lock );
+    std::map<pid_t, Job *>::iterator iter = jobs.begin();
+    for ( ; iter != jobs.end() ; ++iter ) {
+        result += callback( iter->first, iter->second->command, now - iter->second->started );
+    }
+    pthread_mutex_unlock( &lock );
+    return result;
+}
+
+/**
+ */
+void
+Process::Manager::statistics( ManagerStatistics& result ) {
+    pthread_mutex_lock( &lock );
+    result = stats;
+    pthread_mutex_unlock( &lock );
+}
+
+/* vim: set autoindent expandtab sw=4 : */
@@ -0,0 +1,155 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+/** \file ProcessManager.h
+ * \brief Child processes started and reaped without blocking the caller.
+ *
+ * spawn() starts a program with posix_spawn and returns at once.  One
+ * manager thread waits in epoll on a pidfd for each child and on the
+ * pipe its output goes to, kills children that outlive their timeout,
+ * reaps them, and hands the result to the caller's Completion.
+ */
+
+#ifndef _PROCESS_MANAGER_H_
+#define _PROCESS_MANAGER_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include <map>
+#include <vector>
+
+#include "Thread.h"
+
+namespace Process {
+
+    /**
+     * code is the exit status, the signal, or (FAILED) the errno.
+     * output is only valid during the Completion call.
+     */
+    struct Result {
+        enum State { EXITED, SIGNALED, TIMED_OUT, FAILED };
+        static const char *state_name( int );
+
+        pid_t pid;
+        State state;
+        int code;
+        uint64_t elapsed;
+        const char *output;
+        size_t length;
+        bool truncated;
+
+        bool succeeded() const { return (state == EXITED) and (code == 0); }
+    };
+
+    /**
+     * Called on the manager thread.  The manager does not delete it.
+     */
+    class Completion {
+    public:
+        Completion() {}
+        virtual ~Completion() {}
+        virtual void operator() ( const Result& ) = 0;
+    };
+
+    /**
+     */
+    class JobIterator {
+    public:
+        JobIterator() {}
+        virtual ~JobIterator() {}
+        virtual int operator() ( pid_t, const char *, uint64_t ) = 0;
+    };
+
+    struct ManagerStatistics {
+        unsigned long spawned;
+        unsigned long failed;
+        unsigned long completed;
+        unsigned long timeouts;
+        unsigned long running;
+        unsigned long output_bytes;
+    };
+
+    /**
+     */
+    class Manager : public Thread {
+    private:
+        struct Job;
+        struct Watch {
+            Job *job;
+            bool output;
+        };
+        struct Job {
+            pid_t pid;
+            int pidfd;
+            int output_fd;
+            char *command;
+            uint64_t started;
+            uint64_t deadline;
+            Completion *completion;
+            bool exited;
+            bool timed_out;
+            int status;
+            int lost;
+            char *output;
+            size_t length;
+            size_t capacity;
+            bool truncated;
+            Watch process_watch;
+            Watch output_watch;
+        };
+
+        static Manager *instance;
+
+        int epoll_fd;
+        int wake_fd;
+        pthread_mutex_t lock;
+        std::map<pid_t, Job *> jobs;
+        ManagerStatistics stats;
+
+        void drain( Job * );
+        bool reap( Job * );
+        void finish( Job * );
+        int next_timeout();
+    public:
+        enum { CAPTURE = 0x1 };
+        static const int SHELL_TIMEOUT = 60000;
+        static const size_t MAX_OUTPUT = 1024 * 1024;
+
+        static Manager *shared();
+
+        Manager( const char * );
+        virtual ~Manager();
+        virtual void run();
+
+        pid_t spawn( char * const [], int, Completion *, int = 0 );
+        pid_t shell( const char *, int = SHELL_TIMEOUT, Completion * = 0 );
+        int each_job( JobIterator& );
+        void statistics( ManagerStatistics& );
+    };
+
+}
+
+#endif
+
+/* vim: set autoindent expandtab sw=4 : */
@@ -0,0 +1,577 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+/** \file ProcessTable.cc
+ * \brief Snapshots of every process, read from /proc.
+ */
+
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "logger.h"
+#include "PlatformThread.h"
+#include "Executor.h"
+#include "ProcessTable.h"
+
+namespace {
+    int debug = 0;
+
+    /* big enough for stat and statm; status is cut short once VmSwap is seen */
+    static const size_t BUFFER_SIZE = 4096;
+
+    struct linux_dirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    };
+
+    uint64_t now_usec() {
+        struct timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+    }
+
+    /**
+     * Read "<pid>/<file>" relative to the /proc descriptor into buffer,
+     * NUL terminated.  Returns the length, or -1 when the process is
+     * gone (or was never readable).
+     */
+    ssize_t read_file( int proc_fd, pid_t pid, const char *file, char *buffer, size_t size ) {
+        char path[32];
+        char digits[12];
+        int n = 0;
+        do {
+            digits[n++] = '0' + (pid % 10);
+            pid /= 10;
+        } while ( pid > 0 );
+
+        char *p = path;
+        while ( n > 0 )  *p++ = digits[--n];
+        *p++ = '/';
+        while ( *file != '\0' )  *p++ = *file++;
+        *p = '\0';
+
+        int fd = openat( proc_fd, path, O_RDONLY | O_CLOEXEC );
+        if ( fd < 0 )  return -1;
+
+        size_t total = 0;
+        while ( total < size - 1 ) {
+            ssize_t bytes = read( fd, buffer + total, size - 1 - total );
+            if ( bytes < 0 ) {
+                if ( errno == EINTR )  continue;
+                break;
+            }
+            if ( bytes == 0 )  break;
+            total += bytes;
+        }
+        close( fd );
+
+        if ( total == 0 )  return -1;
+        buffer[total] = '\0';
+        return total;
+    }
+
+    /**
+     * The next whitespace separated number at p, which is left just
+     * past it.  Negative numbers (nice, priority) come back as 0 --
+     * none of the fields kept here can be negative.
+     */
+    uint64_t next_number( const char *&p ) {
+        while ( *p == ' ' or *p == '\t' )  p++;
+        bool negative = false;
+        if ( *p == '-' ) {
+            negative = true;
+            p++;
+        }
+        uint64_t value = 0;
+        while ( *p >= '0' and *p <= '9' ) {
+            value = (value * 10) + (*p - '0');
+            p++;
+        }
+        return negative ? 0 : value;
+    }
+
+    void skip_field( const char *&p ) {
+        while ( *p == ' ' )  p++;
+        while ( *p != ' ' and *p != '\0' and *p != '\n' )  p++;
+    }
+
+    /**
+     * The comm field is in parentheses and may itself hold spaces and
+     * parentheses, so the fields after it are found from the last ')'.
+     */
+    bool parse_stat( const char *buffer, size_t length, Process::Snapshot& s, size_t row ) {
+        const char *open = (const char *)memchr( buffer, '(', length );
+        const char *close = (const char *)memrchr( buffer, ')', length );
+        if ( open == NULL or close == NULL or close < open )  return false;
+
+        size_t name_length = close - open - 1;
+        if ( name_length > sizeof(s.name[row].text) - 1 )  name_length = sizeof(s.name[row].text) - 1;
+        memcpy( s.name[row].text, open + 1, name_length );
+        s.name[row].text[name_length] = '\0';
+
+        const char *p = close + 1;
+        while ( *p == ' ' )  p++;
+        s.state[row] = *p;
+        p++;
+
+        s.ppid[row] = next_number( p );                         // 4
+        for ( int field = 5 ; field < 14 ; ++field )  skip_field( p );
+        s.utime[row] = next_number( p );                        // 14
+        s.stime[row] = next_number( p );                        // 15
+        for ( int field = 16 ; field < 20 ; ++field )  skip_field( p );
+        s.threads[row] = next_number( p );                      // 20
+        skip_field( p );
+        s.start_time[row] = next_number( p );                   // 22
+        s.vsize[row] = next_number( p );                        // 23
+        s.rss[row] = next_number( p );                          // 24
+        return true;
+    }
+
+    void parse_statm( const char *buffer, Process::Snapshot& s, size_t row ) {
+        const char *p = buffer;
+        skip_field( p );
+        s.rss[row] = next_number( p );
+        s.shared[row] = next_number( p );
+    }
+
+    void parse_status( const char *buffer, Process::Snapshot& s, size_t row ) {
+        const char *p = buffer;
+        while ( *p != '\0' ) {
+            if ( strncmp(p, "Uid:", 4) == 0 ) {
+                p += 4;
+                s.uid[row] = next_number( p );
+            } else if ( strncmp(p, "VmSwap:", 7) == 0 ) {
+                p += 7;
+                s.swap[row] = next_number( p );
+                return;
+            }
+            const char *end = strchr( p, '\n' );
+            if ( end == NULL )  return;
+            p = end + 1;
+        }
+    }
+}
+
+/**
+ */
+void
+Process::Snapshot::resize( size_t rows ) {
+    pid.resize( rows );
+    ppid.resize( rows );
+    state.resize( rows );
+    name.resize( rows );
+    threads.resize( rows );
+    uid.resize( rows );
+    start_time.resize( rows );
+    utime.resize( rows );
+    stime.resize( rows );
+    cpu.resize( rows );
+    vsize.resize( rows );
+    rss.resize( rows );
+    shared.resize( rows );
+    swap.resize( rows );
+    count = rows;
+}
+
+/**
+ */
+void
+Process::Snapshot::move( size_t to, size_t from ) {
+    pid[to] = pid[from];
+    ppid[to] = ppid[from];
+    state[to] = state[from];
+    name[to] = name[from];
+    threads[to] = threads[from];
+    uid[to] = uid[from];
+    start_time[to] = start_time[from];
+    utime[to] = utime[from];
+    stime[to] = stime[from];
+    cpu[to] = cpu[from];
+    vsize[to] = vsize[from];
+    rss[to] = rss[from];
+    shared[to] = shared[from];
+    swap[to] = swap[from];
+}
+
+/**
+ * The row for pid, or -1.
+ */
+int
+Process::Snapshot::find( pid_t target ) const {
+    std::vector<pid_t>::const_iterator end = pid.begin() + count;
+    std::vector<pid_t>::const_iterator i = std::lower_bound( pid.begin(), end, target );
+    if ( i == end or *i != target )  return -1;
+    return i - pid.begin();
+}
+
+/**
+ * One range of rows of the snapshot being taken.  The readers are
+ * kept with the table and reused, along with their buffers.
+ */
+class Process::ProcessTable::Reader : public Task {
+public:
+    ProcessTable *table;
+    Snapshot *snapshot;
+    size_t begin;
+    size_t end;
+    int fields;
+    unsigned long vanished;
+    char buffer[BUFFER_SIZE];
+
+    Reader( ProcessTable *table ) : table(table), snapshot(NULL), begin(0), end(0), fields(0), vanished(0) {}
+    virtual ~Reader() {}
+    virtual void execute() {
+        table->read_rows( this );
+        if ( __atomic_sub_fetch(&table->remaining, 1, __ATOMIC_ACQ_REL) == 0 ) {
+            wake_address( &table->remaining );
+        }
+    }
+};
+
+/**
+ */
+Process::ProcessTable::ProcessTable()
+: proc_fd(-1), latest(0), primed(false), remaining(0) {
+    page_size = sysconf( _SC_PAGESIZE );
+    ticks = sysconf( _SC_CLK_TCK );
+    listing = (char *)malloc( LISTING_SIZE );
+    pthread_mutex_init( &lock, NULL );
+    memset( &stats, 0, sizeof(stats) );
+    snapshots[0].usec = snapshots[1].usec = 0;
+    snapshots[0].interval = snapshots[1].interval = 0;
+    snapshots[0].count = snapshots[1].count = 0;
+    snapshots[0].fields = snapshots[1].fields = 0;
+}
+
+/**
+ * Only to be destroyed between snapshots.
+ */
+Process::ProcessTable::~ProcessTable() {
+    for ( size_t i = 0 ; i < readers.size() ; ++i )  delete readers[i];
+    if ( proc_fd != -1 )  close( proc_fd );
+    free( listing );
+    pthread_mutex_destroy( &lock );
+}
+
+/**
+ */
+bool
+Process::ProcessTable::open() {
+    if ( proc_fd != -1 )  return true;
+    proc_fd = ::open( "/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+    if ( proc_fd < 0 ) {
+        log_err( "ProcessTable: cannot open /proc: %s", strerror(errno) );
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Fill pids with the numeric entries of /proc, in order.  The held
+ * descriptor is rewound rather than reopened.
+ */
+bool
+Process::ProcessTable::list() {
+    pids.clear();
+    if ( lseek(proc_fd, 0, SEEK_SET) < 0 ) {
+        log_err( "ProcessTable: cannot rewind /proc: %s", strerror(errno) );
+        return false;
+    }
+
+    for (;;) {
+        long bytes = syscall( SYS_getdents64, proc_fd, listing, LISTING_SIZE );
+        if ( bytes < 0 ) {
+            if ( errno == EINTR )  continue;
+            log_err( "ProcessTable: cannot list /proc: %s", strerror(errno) );
+            return false;
+        }
+        if ( bytes == 0 )  break;
+
+        long offset = 0;
+        while ( offset < bytes ) {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)(listing + offset);
+            offset += entry->d_reclen;
+
+            const char *p = entry->d_name;
+            if ( *p < '1' or *p > '9' )  continue;
+            pid_t pid = 0;
+            while ( *p >= '0' and *p <= '9' )  pid = (pid * 10) + (*p++ - '0');
+            if ( *p != '\0' )  continue;
+            pids.push_back( pid );
+        }
+    }
+
+    if ( std::is_sorted(pids.begin(), pids.end()) == false ) {
+        std::sort( pids.begin(), pids.end() );
+    }
+    return true;
+}
+
+/**
+ * A process that exits while it is being read leaves its row with a
+ * pid of 0, to be squeezed out by compact().
+ */
+void
+Process::ProcessTable::read_rows( Reader *reader ) {
+    Snapshot& s = *(reader->snapshot);
+    char *buffer = reader->buffer;
+
+    for ( size_t row = reader->begin ; row < reader->end ; ++row ) {
+        pid_t pid = pids[row];
+        s.pid[row] = 0;
+
+        ssize_t length = read_file( proc_fd, pid, "stat", buffer, BUFFER_SIZE );
+        if ( length < 0 or parse_stat(buffer, length, s, row) == false ) {
+            reader->vanished++;
+            continue;
+        }
+
+        s.shared[row] = 0;
+        if ( reader->fields & STATM ) {
+            if ( read_file(proc_fd, pid, "statm", buffer, BUFFER_SIZE) < 0 ) {
+                reader->vanished++;
+                continue;
+            }
+            parse_statm( buffer, s, row );
+        }
+
+        s.uid[row] = -1;
+        s.swap[row] = 0;
+        if ( reader->fields & STATUS ) {
+            if ( read_file(proc_fd, pid, "status", buffer, BUFFER_SIZE) < 0 ) {
+                reader->vanished++;
+                continue;
+            }
+            parse_status( buffer, s, row );
+        }
+
+        s.pid[row] = pid;
+    }
+}
+
+/**
+ */
+void
+Process::ProcessTable::compact( Snapshot& s ) {
+    size_t to = 0;
+    for ( size_t from = 0 ; from < s.count ; ++from ) {
+        if ( s.pid[from] == 0 )  continue;
+        if ( to != from )  s.move( to, from );
+        to++;
+    }
+    s.count = to;
+}
+
+/**
+ * Both snapshots are in pid order, so this is a merge.  A pid that
+ * has been reused (different start time) counts as a new process,
+ * charged with all the time it has used.
+ */
+void
+Process::ProcessTable::deltas( Snapshot& current, const Snapshot& previous ) {
+    size_t j = 0;
+    for ( size_t i = 0 ; i < current.count ; ++i ) {
+        uint64_t total = current.utime[i] + current.stime[i];
+        if ( primed == false ) {
+            current.cpu[i] = 0;
+            continue;
+        }
+        while ( j < previous.count and previous.pid[j] < current.pid[i] )  j++;
+        if ( j < previous.count and previous.pid[j] == current.pid[i] and
+             previous.start_time[j] == current.start_time[i] ) {
+            uint64_t before = previous.utime[j] + previous.stime[j];
+            current.cpu[i] = (total > before) ? (total - before) : 0;
+        } else {
+            current.cpu[i] = total;
+        }
+    }
+}
+
+/**
+ * fields is a mask of STATM and STATUS; stat is always read.
+ */
+const Process::Snapshot *
+Process::ProcessTable::take( int fields, int parallel ) {
+    pthread_mutex_lock( &lock );
+    if ( open() == false or list() == false ) {
+        pthread_mutex_unlock( &lock );
+        return NULL;
+    }
+
+    uint64_t start = now_usec();
+    int next = primed ? (1 - latest) : latest;
+    Snapshot& current = snapshots[next];
+    const Snapshot& previous = snapshots[latest];
+    current.resize( pids.size() );
+    current.fields = fields;
+
+    if ( parallel < 1 )  parallel = 1;
+    if ( (size_t)parallel > pids.size() / 64 + 1 )  parallel = pids.size() / 64 + 1;
+    while ( readers.size() < (size_t)parallel )  readers.push_back( new Reader(this) );
+
+    size_t per_reader = (pids.size() + parallel - 1) / parallel;
+    for ( int i = 0 ; i < parallel ; ++i ) {
+        Reader *reader = readers[i];
+        reader->snapshot = &current;
+        reader->fields = fields;
+        reader->vanished = 0;
+        reader->begin = std::min( pids.size(), i * per_reader );
+        reader->end = std::min( pids.size(), (i + 1) * per_reader );
+    }
+
+    remaining = parallel - 1;
+    for ( int i = 1 ; i < parallel ; ++i ) {
+        if ( Executor::instance()->submit(readers[i]) == false ) {
+            readers[i]->execute();
+        }
+    }
+    read_rows( readers[0] );
+    for (;;) {
+        uint32_t left = __atomic_load_n( &remaining, __ATOMIC_ACQUIRE );
+        if ( left == 0 )  break;
+        wait_on_address( &remaining, left );
+    }
+
+    unsigned long vanished = 0;
+    for ( int i = 0 ; i < parallel ; ++i )  vanished += readers[i]->vanished;
+    compact( current );
+    deltas( current, previous );
+
+    current.usec = now_usec();
+    current.interval = primed ? (current.usec - previous.usec) : 0;
+    latest = next;
+    primed = true;
+
+    uint64_t elapsed = current.usec - start;
+    stats.snapshots++;
+    stats.processes = current.count;
+    stats.vanished += vanished;
+    stats.tasks += parallel - 1;
+    stats.last_usec = elapsed;
+    stats.total_usec += elapsed;
+    if ( elapsed > stats.max_usec )  stats.max_usec = elapsed;
+
+    if ( debug > 0 ) {
+        log_notice( "ProcessTable: %zu processes in %llu usec (%d readers)",
+                    current.count, (unsigned long long)elapsed, parallel );
+    }
+    pthread_mutex_unlock( &lock );
+    return &current;
+}
+
+/**
+ * The latest snapshot, or NULL before the first.  It stays valid
+ * until the next take() but one.
+ */
+const Process::Snapshot *
+Process::ProcessTable::snapshot() const {
+    return primed ? &snapshots[latest] : NULL;
+}
+
+/**
+ */
+int
+Process::ProcessTable::column_named( const char *name ) {
+    if ( strcmp(name, "rss") == 0 )  return RSS;
+    if ( strcmp(name, "cpu") == 0 )  return CPU;
+    if ( strcmp(name, "vsize") == 0 )  return VSIZE;
+    if ( strcmp(name, "swap") == 0 )  return SWAP;
+    if ( strcmp(name, "threads") == 0 )  return THREADS;
+    return -1;
+}
+
+namespace {
+    /**
+     * Orders row numbers by one column, largest first.
+     */
+    class ByColumn {
+        const std::vector<uint64_t> *values;
+    public:
+        ByColumn( const std::vector<uint64_t> *values ) : values(values) {}
+        bool operator() ( size_t a, size_t b ) const {
+            return (*values)[a] > (*values)[b];
+        }
+    };
+}
+
+/**
+ * The rows of the n largest values in column, largest first.  Returns
+ * how many rows were filled in.
+ */
+int
+Process::ProcessTable::top( int column, int n, std::vector<size_t>& rows ) {
+    pthread_mutex_lock( &lock );
+    rows.clear();
+    if ( primed == false or n <= 0 ) {
+        pthread_mutex_unlock( &lock );
+        return 0;
+    }
+
+    const Snapshot& s = snapshots[latest];
+    const std::vector<uint64_t> *values = NULL;
+    switch ( column ) {
+    case RSS:   values = &s.rss; break;
+    case CPU:   values = &s.cpu; break;
+    case VSIZE: values = &s.vsize; break;
+    case SWAP:  values = &s.swap; break;
+    case THREADS:
+        widened.assign( s.threads.begin(), s.threads.begin() + s.count );
+        values = &widened;
+        break;
+    default:
+        pthread_mutex_unlock( &lock );
+        return 0;
+    }
+
+    rows.resize( s.count );
+    for ( size_t row = 0 ; row < s.count ; ++row )  rows[row] = row;
+
+    size_t wanted = std::min( (size_t)n, s.count );
+    std::partial_sort( rows.begin(), rows.begin() + wanted, rows.end(), ByColumn(values) );
+    rows.resize( wanted );
+    pthread_mutex_unlock( &lock );
+    return wanted;
+}
+
+/**
+ */
+void
+Process::ProcessTable::statistics( TableStatistics& result ) {
+    pthread_mutex_lock( &lock );
+    result = stats;
+    pthread_mutex_unlock( &lock );
+}
+
+/* vim: set autoindent expandtab sw=4 : */
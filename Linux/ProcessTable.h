@@ -0,0 +1,149 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+/** \file ProcessTable.h
+ * \brief Snapshots of every process, read from /proc.
+ *
+ * A snapshot is a table with one column per field and one row per
+ * process, in pid order, so ranking or summing a column touches only
+ * that column.  Each process costs an openat() relative to a /proc
+ * descriptor held open for the life of the table, a read into a
+ * buffer that is reused from one snapshot to the next, and a parse by
+ * hand -- no stdio, no path lookups from the root.  The rows can be
+ * read in parallel on the Executor's workers.
+ *
+ * Two snapshots are kept and reused in turn; each row's cpu column is
+ * the CPU time the process used since the previous snapshot.
+ */
+
+#ifndef _PROCESS_TABLE_H_
+#define _PROCESS_TABLE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include <vector>
+
+namespace Process {
+
+    /**
+     * Times are in clock ticks, memory in pages, except swap (kB) and
+     * vsize (bytes), which is how the kernel reports them.  uid and
+     * swap are only filled when status is read; fields is the mask
+     * take() was given.
+     */
+    struct Snapshot {
+        struct Name {
+            char text[16];
+        };
+
+        uint64_t usec;
+        uint64_t interval;
+        size_t count;
+        int fields;
+        std::vector<pid_t> pid;
+        std::vector<pid_t> ppid;
+        std::vector<char> state;
+        std::vector<Name> name;
+        std::vector<uint32_t> threads;
+        std::vector<int> uid;
+        std::vector<uint64_t> start_time;
+        std::vector<uint64_t> utime;
+        std::vector<uint64_t> stime;
+        std::vector<uint64_t> cpu;
+        std::vector<uint64_t> vsize;
+        std::vector<uint64_t> rss;
+        std::vector<uint64_t> shared;
+        std::vector<uint64_t> swap;
+
+        void resize( size_t );
+        void move( size_t, size_t );
+        int find( pid_t ) const;
+    };
+
+    struct TableStatistics {
+        unsigned long snapshots;
+        unsigned long processes;
+        unsigned long vanished;
+        unsigned long tasks;
+        uint64_t last_usec;
+        uint64_t max_usec;
+        uint64_t total_usec;
+    };
+
+    /**
+     * take() lists /proc, reads every process into the older of the
+     * two snapshots and makes it the current one.  With parallel > 1
+     * the rows are split into that many ranges, all but the first
+     * handed to the Executor; the caller reads the first itself and
+     * then waits for the rest.
+     */
+    class ProcessTable {
+    public:
+        enum Field { STATM = 0x1, STATUS = 0x2 };
+        enum Column { RSS, CPU, VSIZE, SWAP, THREADS };
+        static int column_named( const char * );
+
+    private:
+        class Reader;
+        friend class Reader;
+
+        static const size_t LISTING_SIZE = 32 * 1024;
+
+        int proc_fd;
+        long page_size;
+        long ticks;
+        char *listing;
+        std::vector<pid_t> pids;
+        std::vector<uint64_t> widened;
+        std::vector<Reader *> readers;
+        Snapshot snapshots[2];
+        int latest;
+        bool primed;
+        uint32_t remaining;
+        pthread_mutex_t lock;
+        TableStatistics stats;
+
+        bool list();
+        void read_rows( Reader * );
+        void compact( Snapshot& );
+        void deltas( Snapshot&, const Snapshot& );
+
+    public:
+        ProcessTable();
+        ~ProcessTable();
+
+        bool open();
+        const Snapshot *take( int, int );
+        const Snapshot *snapshot() const;
+        int top( int, int, std::vector<size_t>& );
+        long page() const { return page_size; }
+        long hz() const { return ticks; }
+        void statistics( TableStatistics& );
+    };
+
+}
+
+#endif
+
+/* vim: set autoindent expandtab sw=4 : */
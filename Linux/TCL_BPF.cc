@@ -0,0 +1,917 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** \file TCL_BPF.cc
+ * \brief TCL wrappers for classic BPF socket filters.
+ *
+ * A program is written as a list of instructions, one list each:
+ *
+ *   ld b|h|w OFFSET        A = packet[OFFSET]
+ *   ld len                 A = packet length
+ *   ldi VALUE              A = VALUE
+ *   add|sub|mul|div|and|or|lsh|rsh VALUE
+ *   jeq|jgt|jge|jset VALUE TRUE ?FALSE?
+ *   ja LABEL
+ *   ret VALUE|accept|drop
+ *   label NAME
+ *
+ * Jumps name labels further on; "next" (or an omitted FALSE) is the
+ * following instruction.
+ *
+ * BPF::load name path loads a compiled eBPF object instead.  Its
+ * programs attach to an interface (xdp, ingress, egress) or a socket,
+ * and each of its maps becomes the command name::map, with lookup,
+ * update, delete and a batched dump.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <netinet/icmp6.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <vector>
+
+#include "logger.h"
+
+#include "tcl_util.h"
+#include "AppInit.h"
+#include "BPF.h"
+#include "EBPF.h"
+#include "ICMPv6.h"
+#include "NetLink.h"
+
+namespace {
+    int debug = 0;
+
+    struct Opcode {
+        const char *name;
+        uint16_t op;
+    };
+
+    Opcode alu_ops[] = {
+        { "add", BPF_ADD }, { "sub", BPF_SUB }, { "mul", BPF_MUL }, { "div", BPF_DIV },
+        { "and", BPF_AND }, { "or",  BPF_OR  }, { "lsh", BPF_LSH }, { "rsh", BPF_RSH },
+        { NULL, 0 }
+    };
+
+    Opcode jump_ops[] = {
+        { "jeq", BPF_JEQ }, { "jgt", BPF_JGT }, { "jge", BPF_JGE }, { "jset", BPF_JSET },
+        { NULL, 0 }
+    };
+
+    int find_op( Opcode *ops, const char *name ) {
+        for ( int i = 0 ; ops[i].name != NULL ; ++i ) {
+            if ( strcmp(ops[i].name, name) == 0 )  return ops[i].op;
+        }
+        return -1;
+    }
+
+    const char *jump_label( const char *name ) {
+        if ( strcmp(name, "next") == 0 )  return NULL;
+        return name;
+    }
+
+    bool get_value( Tcl_Interp *interp, Tcl_Obj *object, uint32_t *value ) {
+        Tcl_WideInt wide;
+        if ( Tcl_GetWideIntFromObj(interp, object, &wide) != TCL_OK )  return false;
+        *value = (uint32_t)wide;
+        return true;
+    }
+
+    /**
+     * Add one instruction, given as a list, to the program.  Leaves a
+     * message in the interp result if it cannot.
+     */
+    bool assemble( Tcl_Interp *interp, BPF::Program *program, Tcl_Obj *instruction ) {
+        int count;
+        Tcl_Obj **words;
+        if ( Tcl_ListObjGetElements(interp, instruction, &count, &words) != TCL_OK )  return false;
+        if ( count == 0 )  return true;
+
+        const char *op = Tcl_GetStringFromObj( words[0], NULL );
+        uint32_t value;
+        int code;
+
+        if ( strcmp(op, "label") == 0 ) {
+            if ( count != 2 )  goto usage;
+            if ( program->label(Tcl_GetStringFromObj(words[1], NULL)) == false ) {
+                Tcl_SetResult( interp, (char *)program->error(), TCL_VOLATILE );
+                return false;
+            }
+            return true;
+        }
+
+        if ( strcmp(op, "ld") == 0 ) {
+            const char *width = (count > 1) ? Tcl_GetStringFromObj(words[1], NULL) : "";
+            if ( (count == 2) and (strcmp(width, "len") == 0) ) {
+                program->load_length();
+                return true;
+            }
+            if ( count != 3 )  goto usage;
+            if ( get_value(interp, words[2], &value) == false )  return false;
+            if ( strcmp(width, "b") == 0 )       program->load( 1, value );
+            else if ( strcmp(width, "h") == 0 )  program->load( 2, value );
+            else if ( strcmp(width, "w") == 0 )  program->load( 4, value );
+            else goto usage;
+            return true;
+        }
+
+        if ( strcmp(op, "ldi") == 0 ) {
+            if ( count != 2 )  goto usage;
+            if ( get_value(interp, words[1], &value) == false )  return false;
+            program->load_immediate( value );
+            return true;
+        }
+
+        if ( (code = find_op(alu_ops, op)) >= 0 ) {
+            if ( count != 2 )  goto usage;
+            if ( get_value(interp, words[1], &value) == false )  return false;
+            program->alu( code, value );
+            return true;
+        }
+
+        if ( (code = find_op(jump_ops, op)) >= 0 ) {
+            if ( (count != 3) and (count != 4) )  goto usage;
+            if ( get_value(interp, words[1], &value) == false )  return false;
+            const char *on_true = jump_label( Tcl_GetStringFromObj(words[2], NULL) );
+            const char *on_false = NULL;
+            if ( count == 4 )  on_false = jump_label( Tcl_GetStringFromObj(words[3], NULL) );
+            program->jump( code, value, on_true, on_false );
+            return true;
+        }
+
+        if ( strcmp(op, "ja") == 0 ) {
+            if ( count != 2 )  goto usage;
+            program->jump( Tcl_GetStringFromObj(words[1], NULL) );
+            return true;
+        }
+
+        if ( strcmp(op, "ret") == 0 ) {
+            if ( count != 2 )  goto usage;
+            const char *what = Tcl_GetStringFromObj( words[1], NULL );
+            if ( strcmp(what, "accept") == 0 )     value = 0xffffffff;
+            else if ( strcmp(what, "drop") == 0 )  value = 0;
+            else if ( get_value(interp, words[1], &value) == false )  return false;
+            program->ret( value );
+            return true;
+        }
+
+    usage:
+        Tcl_ResetResult( interp );
+        Tcl_AppendResult( interp, "bad instruction: ", Tcl_GetStringFromObj(instruction, NULL), NULL );
+        return false;
+    }
+
+    /**
+     * Find the descriptor of an ICMPv6::Socket or NetLink::RouteSocket
+     * from its kind and the handle its TCL command returns.
+     */
+    bool socket_descriptor( Tcl_Interp *interp, Tcl_Obj *kind_object, Tcl_Obj *handle, int *fd ) {
+        long pointer;
+        if ( Tcl_GetLongFromObj(interp, handle, &pointer) != TCL_OK )  return false;
+
+        const char *kind = Tcl_GetStringFromObj( kind_object, NULL );
+        if ( strcmp(kind, "icmpv6") == 0 ) {
+            *fd = ((ICMPv6::Socket *)pointer)->descriptor();
+            return true;
+        }
+        if ( strcmp(kind, "netlink") == 0 ) {
+            *fd = ((NetLink::RouteSocket *)pointer)->descriptor();
+            return true;
+        }
+        Tcl_ResetResult( interp );
+        Tcl_AppendResult( interp, "socket kind must be icmpv6 or netlink, not ", kind, NULL );
+        return false;
+    }
+}
+
+/**
+ */
+static int
+program_obj( ClientData data, Tcl_Interp *interp,
+             int objc, Tcl_Obj * CONST *objv )
+{
+    BPF::Program *program = (BPF::Program *)data;
+
+    if ( objc == 1 ) {
+        Tcl_SetObjResult( interp, Tcl_NewLongObj((long)(program)) );
+        return TCL_OK;
+    }
+
+    char *command = Tcl_GetStringFromObj( objv[1], NULL );
+    if ( Tcl_StringMatch(command, "type") ) {
+        Tcl_StaticSetResult( interp, "BPF::Program" );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "length") ) {
+        Tcl_SetObjResult( interp, Tcl_NewIntObj(program->length()) );
+        return TCL_OK;
+    }
+
+    /**
+     * The assembled program, as {code jt jf k} for each instruction
+     */
+    if ( Tcl_StringMatch(command, "dump") ) {
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        const struct sock_filter *instructions = program->instructions();
+        for ( int i = 0 ; i < program->length() ; ++i ) {
+            Tcl_Obj *instruction = Tcl_NewListObj( 0, 0 );
+            Tcl_ListObjAppendElement( interp, instruction, Tcl_NewIntObj(instructions[i].code) );
+            Tcl_ListObjAppendElement( interp, instruction, Tcl_NewIntObj(instructions[i].jt) );
+            Tcl_ListObjAppendElement( interp, instruction, Tcl_NewIntObj(instructions[i].jf) );
+            Tcl_ListObjAppendElement( interp, instruction, Tcl_NewWideIntObj(instructions[i].k) );
+            Tcl_ListObjAppendElement( interp, result, instruction );
+        }
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
+    /**
+     */
+    if ( Tcl_StringMatch(command, "attach") or Tcl_StringMatch(command, "detach") or
+         Tcl_StringMatch(command, "drops") ) {
+        if ( objc != 4 ) {
+            Tcl_ResetResult( interp );
+            Tcl_WrongNumArgs( interp, 2, objv, "icmpv6|netlink socket" );
+            return TCL_ERROR;
+        }
+        int fd;
+        if ( socket_descriptor(interp, objv[2], objv[3], &fd) == false )  return TCL_ERROR;
+
+        if ( Tcl_StringMatch(command, "drops") ) {
+            Tcl_SetObjResult( interp, Tcl_NewLongObj(BPF::Program::drops(fd)) );
+            return TCL_OK;
+        }
+        if ( Tcl_StringMatch(command, "detach") ) {
+            Tcl_SetObjResult( interp, Tcl_NewBooleanObj(BPF::Program::detach(fd)) );
+            return TCL_OK;
+        }
+        if ( program->attach(fd) == false ) {
+            Tcl_SetResult( interp, (char *)program->error(), TCL_VOLATILE );
+            return TCL_ERROR;
+        }
+        Tcl_ResetResult( interp );
+        return TCL_OK;
+    }
+
+    Tcl_StaticSetResult( interp, "Unknown command for BPF object" );
+    return TCL_ERROR;
+}
+
+/**
+ */
+static void
+program_delete( ClientData data ) {
+    BPF::Program *program = (BPF::Program *)data;
+    delete program;
+}
+
+/**
+ */
+static int
+program_cmd( ClientData data, Tcl_Interp *interp,
+             int objc, Tcl_Obj * CONST *objv )
+{
+    if ( objc != 3 ) {
+        Tcl_ResetResult( interp );
+        Tcl_WrongNumArgs( interp, 1, objv, "name instructions" );
+        return TCL_ERROR;
+    }
+
+    int count;
+    Tcl_Obj **instructions;
+    if ( Tcl_ListObjGetElements(interp, objv[2], &count, &instructions) != TCL_OK ) {
+        return TCL_ERROR;
+    }
+
+    BPF::Program *program = new BPF::Program();
+    for ( int i = 0 ; i < count ; ++i ) {
+        if ( assemble(interp, program, instructions[i]) == false ) {
+            delete program;
+            return TCL_ERROR;
+        }
+    }
+    if ( program->finish() == false ) {
+        Tcl_SetResult( interp, (char *)program->error(), TCL_VOLATILE );
+        delete program;
+        return TCL_ERROR;
+    }
+
+    char *name = Tcl_GetStringFromObj( objv[1], NULL );
+    Tcl_CreateObjCommand( interp, name, program_obj, (ClientData)program, program_delete );
+    Tcl_SetResult( interp, name, TCL_VOLATILE );
+    return TCL_OK;
+}
+
+/**
+ * A filter passing only the given ICMPv6 types, by default the
+ * neighbor discovery ones.
+ */
+static int
+icmpv6_cmd( ClientData data, Tcl_Interp *interp,
+            int objc, Tcl_Obj * CONST *objv )
+{
+    if ( objc < 2 ) {
+        Tcl_ResetResult( interp );
+        Tcl_WrongNumArgs( interp, 1, objv, "name ?type ...?" );
+        return TCL_ERROR;
+    }
+
+    uint8_t types[256];
+    int count = 0;
+    if ( objc == 2 ) {
+        types[count++] = ND_ROUTER_SOLICIT;
+        types[count++] = ND_ROUTER_ADVERT;
+        types[count++] = ND_NEIGHBOR_SOLICIT;
+        types[count++] = ND_NEIGHBOR_ADVERT;
+        types[count++] = ND_REDIRECT;
+    }
+    if ( objc - 2 > 256 ) {
+        Tcl_StaticSetResult( interp, "at most 256 types" );
+        return TCL_ERROR;
+    }
+    for ( int i = 2 ; i < objc ; ++i ) {
+        int type;
+        if ( Tcl_GetIntFromObj(interp, objv[i], &type) != TCL_OK )  return TCL_ERROR;
+        if ( (type < 0) or (type > 255) ) {
+            Tcl_ResetResult( interp );
+            Tcl_AppendResult( interp, "type ", Tcl_GetString(objv[i]), " is out of range", NULL );
+            return TCL_ERROR;
+        }
+        types[count++] = type;
+    }
+
+    char *name = Tcl_GetStringFromObj( objv[1], NULL );
+    BPF::Program *program = BPF::Program::icmpv6( types, count );
+    if ( program == NULL ) {
+        Tcl_StaticSetResult( interp, "too many types for one filter" );
+        return TCL_ERROR;
+    }
+    Tcl_CreateObjCommand( interp, name, program_obj, (ClientData)program, program_delete );
+    Tcl_SetResult( interp, name, TCL_VOLATILE );
+    return TCL_OK;
+}
+
+/**
+ * A filter passing only the given netlink message types, by default
+ * the link, address, route and neighbor changes.
+ */
+static int
+netlink_cmd( ClientData data, Tcl_Interp *interp,
+             int objc, Tcl_Obj * CONST *objv )
+{
+    if ( objc < 2 ) {
+        Tcl_ResetResult( interp );
+        Tcl_WrongNumArgs( interp, 1, objv, "name ?type ...?" );
+        return TCL_ERROR;
+    }
+
+    uint16_t types[256];
+    int count = 0;
+    if ( objc == 2 ) {
+        types[count++] = RTM_NEWLINK;
+        types[count++] = RTM_DELLINK;
+        types[count++] = RTM_NEWADDR;
+        types[count++] = RTM_DELADDR;
+        types[count++] = RTM_NEWROUTE;
+        types[count++] = RTM_DELROUTE;
+        types[count++] = RTM_NEWNEIGH;
+        types[count++] = RTM_DELNEIGH;
+    }
+    if ( objc - 2 > 256 ) {
+        Tcl_StaticSetResult( interp, "at most 256 types" );
+        return TCL_ERROR;
+    }
+    for ( int i = 2 ; i < objc ; ++i ) {
+        int type;
+        if ( Tcl_GetIntFromObj(interp, objv[i], &type) != TCL_OK )  return TCL_ERROR;
+        if ( (type < 0) or (type > 65535) ) {
+            Tcl_ResetResult( interp );
+            Tcl_AppendResult( interp, "type ", Tcl_GetString(objv[i]), " is out of range", NULL );
+            return TCL_ERROR;
+        }
+        types[count++] = type;
+    }
+
+    char *name = Tcl_GetStringFromObj( objv[1], NULL );
+    BPF::Program *program = BPF::Program::netlink( types, count );
+    if ( program == NULL ) {
+        Tcl_StaticSetResult( interp, "too many types for one filter" );
+        return TCL_ERROR;
+    }
+    Tcl_CreateObjCommand( interp, name, program_obj, (ClientData)program, program_delete );
+    Tcl_SetResult( interp, name, TCL_VOLATILE );
+    return TCL_OK;
+}
+
+namespace {
+
+    /**
+     * Keys and values of 1, 2, 4 or 8 bytes are integers in TCL,
+     * anything else is a byte array.
+     */
+    Tcl_Obj *encode( const void *data, size_t size ) {
+        switch ( size ) {
+        case 1: { uint8_t v;  memcpy( &v, data, size ); return Tcl_NewWideIntObj(v); }
+        case 2: { uint16_t v; memcpy( &v, data, size ); return Tcl_NewWideIntObj(v); }
+        case 4: { uint32_t v; memcpy( &v, data, size ); return Tcl_NewWideIntObj(v); }
+        case 8: { uint64_t v; memcpy( &v, data, size ); return Tcl_NewWideIntObj((Tcl_WideInt)v); }
+        }
+        return Tcl_NewByteArrayObj( (const unsigned char *)data, size );
+    }
+
+    bool decode( Tcl_Interp *interp, Tcl_Obj *object, void *data, size_t size ) {
+        if ( (size == 1) or (size == 2) or (size == 4) or (size == 8) ) {
+            Tcl_WideInt wide;
+            if ( Tcl_GetWideIntFromObj(interp, object, &wide) != TCL_OK )  return false;
+            uint8_t  v8  = wide;
+            uint16_t v16 = wide;
+            uint32_t v32 = wide;
+            uint64_t v64 = wide;
+            switch ( size ) {
+            case 1: memcpy( data, &v8, size );  break;
+            case 2: memcpy( data, &v16, size ); break;
+            case 4: memcpy( data, &v32, size ); break;
+            case 8: memcpy( data, &v64, size ); break;
+            }
+            return true;
+        }
+        int length;
+        unsigned char *bytes = Tcl_GetByteArrayFromObj( object, &length );
+        if ( (size_t)length != size ) {
+            char message[80];
+            snprintf( message, sizeof(message), "expected %zu bytes, got %d", size, length );
+            Tcl_SetResult( interp, message, TCL_VOLATILE );
+            return false;
+        }
+        memcpy( data, bytes, size );
+        return true;
+    }
+
+    /**
+     * A per-cpu value is a list with one element per possible CPU.
+     */
+    Tcl_Obj *encode_value( BPF::Map *map, const void *data ) {
+        if ( map->per_cpu() == false )  return encode( data, map->value_size() );
+        size_t stride = (map->value_size() + 7) & ~7;
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        for ( int cpu = 0 ; cpu < map->cpus() ; ++cpu ) {
+            Tcl_ListObjAppendElement( NULL, result, encode((const char *)data + cpu * stride, map->value_size()) );
+        }
+        return result;
+    }
+
+    /**
+     * Per-cpu maps take either one value for every CPU or a single
+     * value that is stored for all of them.
+     */
+    bool decode_value( Tcl_Interp *interp, BPF::Map *map, Tcl_Obj *object, char *data ) {
+        if ( map->per_cpu() == false )  return decode( interp, object, data, map->value_size() );
+        size_t stride = (map->value_size() + 7) & ~7;
+        memset( data, 0, map->value_length() );
+
+        int count;
+        Tcl_Obj **values;
+        if ( Tcl_ListObjGetElements(interp, object, &count, &values) != TCL_OK )  return false;
+        if ( (count != 1) and (count != map->cpus()) ) {
+            Tcl_StaticSetResult( interp, "per-cpu value needs one element or one per CPU" );
+            return false;
+        }
+        for ( int cpu = 0 ; cpu < map->cpus() ; ++cpu ) {
+            Tcl_Obj *value = values[ (count == 1) ? 0 : cpu ];
+            if ( decode(interp, value, data + cpu * stride, map->value_size()) == false )  return false;
+        }
+        return true;
+    }
+
+    /**
+     */
+    class DumpMap : public BPF::MapIterator {
+        BPF::Map *map;
+        Tcl_Obj *result;
+    public:
+        DumpMap( BPF::Map *map, Tcl_Obj *result ) : map(map), result(result) {}
+        virtual ~DumpMap() {}
+        virtual int operator() ( const void *key, const void *value ) {
+            Tcl_ListObjAppendElement( NULL, result, encode(key, map->key_size()) );
+            Tcl_ListObjAppendElement( NULL, result, encode_value(map, value) );
+            return 0;
+        }
+    };
+
+    /**
+     */
+    class CountMap : public BPF::MapIterator {
+    public:
+        int count;
+        CountMap() : count(0) {}
+        virtual ~CountMap() {}
+        virtual int operator() ( const void *key, const void *value ) { count++; return 0; }
+    };
+
+    /**
+     * An interface is given by index or by name.
+     */
+    bool interface_index( Tcl_Interp *interp, Tcl_Obj *object, int *index ) {
+        if ( Tcl_GetIntFromObj(NULL, object, index) == TCL_OK )  return true;
+        const char *name = Tcl_GetStringFromObj( object, NULL );
+        *index = if_nametoindex( name );
+        if ( *index != 0 )  return true;
+        Tcl_ResetResult( interp );
+        Tcl_AppendResult( interp, "no interface ", name, NULL );
+        return false;
+    }
+
+    /**
+     * The TCL side of a loaded object: its map commands live in a
+     * namespace of the same name, removed along with the object.
+     */
+    struct Loaded {
+        BPF::Object *object;
+        Tcl_Interp *interp;
+        char name[128];
+    };
+}
+
+/**
+ */
+static int
+map_obj( ClientData data, Tcl_Interp *interp,
+         int objc, Tcl_Obj * CONST *objv )
+{
+    BPF::Map *map = (BPF::Map *)data;
+
+    if ( objc == 1 ) {
+        Tcl_SetObjResult( interp, Tcl_NewLongObj((long)(map)) );
+        return TCL_OK;
+    }
+
+    char *command = Tcl_GetStringFromObj( objv[1], NULL );
+    if ( Tcl_StringMatch(command, "type") ) {
+        Tcl_StaticSetResult( interp, "BPF::Map" );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "info") ) {
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("name", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj(map->name(), -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("type", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewIntObj(map->type()) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("key_size", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewIntObj(map->key_size()) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("value_size", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewIntObj(map->value_size()) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("max_entries", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewIntObj(map->max_entries()) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("per_cpu", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewBooleanObj(map->per_cpu()) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("syscalls", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(map->syscalls()) );
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
+    /**
+     * Every entry as a flat key value list, read in batches
+     */
+    if ( Tcl_StringMatch(command, "dump") or Tcl_StringMatch(command, "count") ) {
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        DumpMap dumper( map, result );
+        CountMap counter;
+        int visited;
+        if ( Tcl_StringMatch(command, "dump") ) {
+            visited = map->each( dumper );
+        } else {
+            visited = map->each( counter );
+            Tcl_SetIntObj( result, counter.count );
+        }
+        if ( visited < 0 ) {
+            Tcl_DecrRefCount( result );
+            Tcl_ResetResult( interp );
+            Tcl_AppendResult( interp, "cannot read map ", map->name(), ": ", strerror(errno), NULL );
+            return TCL_ERROR;
+        }
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
+    std::vector<char> key( map->key_size() );
+    std::vector<char> value( map->value_length() );
+
+    if ( Tcl_StringMatch(command, "lookup") ) {
+        if ( objc != 3 ) {
+            Tcl_ResetResult( interp );
+            Tcl_WrongNumArgs( interp, 2, objv, "key" );
+            return TCL_ERROR;
+        }
+        if ( decode(interp, objv[2], &key[0], key.size()) == false )  return TCL_ERROR;
+        if ( map->lookup(&key[0], &value[0]) == false ) {
+            Tcl_ResetResult( interp );
+            Tcl_AppendResult( interp, "lookup failed: ", strerror(errno), NULL );
+            return TCL_ERROR;
+        }
+        Tcl_SetObjResult( interp, encode_value(map, &value[0]) );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "update") ) {
+        if ( (objc != 4) and (objc != 5) ) {
+            Tcl_ResetResult( interp );
+            Tcl_WrongNumArgs( interp, 2, objv, "key value ?any|new|exists?" );
+            return TCL_ERROR;
+        }
+        uint64_t flags = BPF_ANY;
+        if ( objc == 5 ) {
+            const char *how = Tcl_GetStringFromObj( objv[4], NULL );
+            if ( strcmp(how, "new") == 0 )          flags = BPF_NOEXIST;
+            else if ( strcmp(how, "exists") == 0 )  flags = BPF_EXIST;
+            else if ( strcmp(how, "any") != 0 ) {
+                Tcl_StaticSetResult( interp, "update mode must be any, new or exists" );
+                return TCL_ERROR;
+            }
+        }
+        if ( decode(interp, objv[2], &key[0], key.size()) == false )  return TCL_ERROR;
+        if ( decode_value(interp, map, objv[3], &value[0]) == false )  return TCL_ERROR;
+        if ( map->update(&key[0], &value[0], flags) == false ) {
+            Tcl_ResetResult( interp );
+            Tcl_AppendResult( interp, "update failed: ", strerror(errno), NULL );
+            return TCL_ERROR;
+        }
+        Tcl_ResetResult( interp );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "delete") ) {
+        if ( objc != 3 ) {
+            Tcl_ResetResult( interp );
+            Tcl_WrongNumArgs( interp, 2, objv, "key" );
+            return TCL_ERROR;
+        }
+        if ( decode(interp, objv[2], &key[0], key.size()) == false )  return TCL_ERROR;
+        Tcl_SetObjResult( interp, Tcl_NewBooleanObj(map->remove(&key[0])) );
+        return TCL_OK;
+    }
+
+    Tcl_StaticSetResult( interp, "Unknown command for BPF::Map object" );
+    return TCL_ERROR;
+}
+
+/**
+ */
+static int
+object_obj( ClientData data, Tcl_Interp *interp,
+            int objc, Tcl_Obj * CONST *objv )
+{
+    Loaded *loaded = (Loaded *)data;
+    BPF::Object *object = loaded->object;
+
+    if ( objc == 1 ) {
+        Tcl_SetObjResult( interp, Tcl_NewLongObj((long)(object)) );
+        return TCL_OK;
+    }
+
+    char *command = Tcl_GetStringFromObj( objv[1], NULL );
+    if ( Tcl_StringMatch(command, "type") ) {
+        Tcl_StaticSetResult( interp, "BPF::Object" );
+        return TCL_OK;
+    }
+
+    /**
+     * One key value list per program
+     */
+    if ( Tcl_StringMatch(command, "programs") ) {
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        for ( int i = 0 ; i < object->sections() ; ++i ) {
+            const BPF::Section& section = object->section( i );
+            Tcl_Obj *program = Tcl_NewListObj( 0, 0 );
+            Tcl_ListObjAppendElement( interp, program, Tcl_NewStringObj("name", -1) );
+            Tcl_ListObjAppendElement( interp, program, Tcl_NewStringObj(section.symbol, -1) );
+            Tcl_ListObjAppendElement( interp, program, Tcl_NewStringObj("section", -1) );
+            Tcl_ListObjAppendElement( interp, program, Tcl_NewStringObj(section.name, -1) );
+            Tcl_ListObjAppendElement( interp, program, Tcl_NewStringObj("type", -1) );
+            Tcl_ListObjAppendElement( interp, program, Tcl_NewStringObj(BPF::Object::type_name(section.type), -1) );
+            Tcl_ListObjAppendElement( interp, program, Tcl_NewStringObj("hook", -1) );
+            Tcl_ListObjAppendElement( interp, program, Tcl_NewStringObj(BPF::Object::hook_name(section.hook), -1) );
+            Tcl_ListObjAppendElement( interp, program, Tcl_NewStringObj("target", -1) );
+            Tcl_ListObjAppendElement( interp, program, Tcl_NewIntObj(section.target) );
+            Tcl_ListObjAppendElement( interp, result, program );
+        }
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
+    /**
+     * The map commands, name::map
+     */
+    if ( Tcl_StringMatch(command, "maps") ) {
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        for ( int i = 0 ; i < object->maps() ; ++i ) {
+            Tcl_Obj *name = Tcl_NewStringObj( loaded->name, -1 );
+            Tcl_AppendStringsToObj( name, "::", object->map(i)->name(), NULL );
+            Tcl_ListObjAppendElement( interp, result, name );
+        }
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
+    /**
+     * attach program xdp|ingress|egress interface
+     * attach program socket icmpv6|netlink handle
+     */
+    if ( Tcl_StringMatch(command, "attach") ) {
+        if ( (objc != 5) and (objc != 6) ) {
+            Tcl_ResetResult( interp );
+            Tcl_WrongNumArgs( interp, 2, objv, "program xdp|ingress|egress interface | program socket icmpv6|netlink handle" );
+            return TCL_ERROR;
+        }
+        const char *program = Tcl_GetStringFromObj( objv[2], NULL );
+        const char *hook_name = Tcl_GetStringFromObj( objv[3], NULL );
+        BPF::Section::Hook hook;
+        int target;
+        if ( strcmp(hook_name, "socket") == 0 ) {
+            if ( objc != 6 ) {
+                Tcl_ResetResult( interp );
+                Tcl_WrongNumArgs( interp, 2, objv, "program socket icmpv6|netlink handle" );
+                return TCL_ERROR;
+            }
+            hook = BPF::Section::SOCKET;
+            if ( socket_descriptor(interp, objv[4], objv[5], &target) == false )  return TCL_ERROR;
+        } else {
+            if ( strcmp(hook_name, "xdp") == 0 )           hook = BPF::Section::XDP;
+            else if ( strcmp(hook_name, "ingress") == 0 )  hook = BPF::Section::TC_INGRESS;
+            else if ( strcmp(hook_name, "egress") == 0 )   hook = BPF::Section::TC_EGRESS;
+            else {
+                Tcl_ResetResult( interp );
+                Tcl_AppendResult( interp, "hook must be xdp, ingress, egress or socket, not ", hook_name, NULL );
+                return TCL_ERROR;
+            }
+            if ( interface_index(interp, objv[4], &target) == false )  return TCL_ERROR;
+        }
+        if ( object->attach(program, hook, target) == false ) {
+            Tcl_SetResult( interp, (char *)object->error(), TCL_VOLATILE );
+            return TCL_ERROR;
+        }
+        Tcl_ResetResult( interp );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "detach") ) {
+        if ( objc != 3 ) {
+            Tcl_ResetResult( interp );
+            Tcl_WrongNumArgs( interp, 2, objv, "program" );
+            return TCL_ERROR;
+        }
+        if ( object->detach(Tcl_GetStringFromObj(objv[2], NULL)) == false ) {
+            Tcl_SetResult( interp, (char *)object->error(), TCL_VOLATILE );
+            return TCL_ERROR;
+        }
+        Tcl_ResetResult( interp );
+        return TCL_OK;
+    }
+
+    Tcl_StaticSetResult( interp, "Unknown command for BPF::Object" );
+    return TCL_ERROR;
+}
+
+/**
+ * The map commands go first, they point into the object.
+ */
+static void
+object_delete( ClientData data ) {
+    Loaded *loaded = (Loaded *)data;
+    if ( Tcl_InterpDeleted(loaded->interp) == false ) {
+        Tcl_Namespace *ns = Tcl_FindNamespace( loaded->interp, loaded->name, NULL, 0 );
+        if ( ns != NULL )  Tcl_DeleteNamespace( ns );
+    }
+    delete loaded->object;
+    delete loaded;
+}
+
+/**
+ * Load an eBPF ELF object, creating a command for it and one in the
+ * namespace of the same name for each of its maps.
+ */
+static int
+load_cmd( ClientData data, Tcl_Interp *interp,
+             int objc, Tcl_Obj * CONST *objv )
+{
+    if ( objc != 3 ) {
+        Tcl_ResetResult( interp );
+        Tcl_WrongNumArgs( interp, 1, objv, "name path" );
+        return TCL_ERROR;
+    }
+
+    char *name = Tcl_GetStringFromObj( objv[1], NULL );
+    char *path = Tcl_GetStringFromObj( objv[2], NULL );
+    if ( strlen(name) >= sizeof(((Loaded *)0)->name) ) {
+        Tcl_StaticSetResult( interp, "object name too long" );
+        return TCL_ERROR;
+    }
+
+    BPF::Object *object = new BPF::Object();
+    if ( object->load(path) == false ) {
+        Tcl_SetResult( interp, (char *)object->error(), TCL_VOLATILE );
+        delete object;
+        return TCL_ERROR;
+    }
+
+    Tcl_Namespace *ns = Tcl_CreateNamespace( interp, name, (ClientData)0, NULL );
+    if ( ns == NULL ) {
+        delete object;
+        return TCL_ERROR;
+    }
+
+    Loaded *loaded = new Loaded;
+    loaded->object = object;
+    loaded->interp = interp;
+    strcpy( loaded->name, name );
+
+    for ( int i = 0 ; i < object->maps() ; ++i ) {
+        BPF::Map *map = object->map( i );
+        Tcl_Obj *map_name = Tcl_NewStringObj( name, -1 );
+        Tcl_AppendStringsToObj( map_name, "::", map->name(), NULL );
+        Tcl_IncrRefCount( map_name );
+        Tcl_CreateObjCommand( interp, Tcl_GetStringFromObj(map_name, NULL), map_obj, (ClientData)map, NULL );
+        Tcl_DecrRefCount( map_name );
+    }
+
+    Tcl_CreateObjCommand( interp, name, object_obj, (ClientData)loaded, object_delete );
+    Tcl_SetResult( interp, name, TCL_VOLATILE );
+    return TCL_OK;
+}
+
+/**
+ */
+bool BPF_Module( Tcl_Interp *interp ) {
+
+    Tcl_Command command;
+
+    Tcl_Namespace *ns = Tcl_CreateNamespace(interp, "BPF", (ClientData)0, NULL);
+    if ( ns == NULL ) {
+        return false;
+    }
+
+    if ( Tcl_LinkVar(interp, "BPF::debug", (char *)&debug, TCL_LINK_INT) != TCL_OK ) {
+        log_err( "failed to link BPF::debug" );
+        _exit( 1 );
+    }
+
+    command = Tcl_CreateObjCommand(interp, "BPF::program", program_cmd, (ClientData)0, NULL);
+    if ( command == NULL ) {
+        // logger ?? want to report TCL Error
+        return false;
+    }
+
+    command = Tcl_CreateObjCommand(interp, "BPF::icmpv6", icmpv6_cmd, (ClientData)0, NULL);
+    if ( command == NULL ) {
+        // logger ?? want to report TCL Error
+        return false;
+    }
+
+    command = Tcl_CreateObjCommand(interp, "BPF::netlink", netlink_cmd, (ClientData)0, NULL);
+    if ( command == NULL ) {
+        // logger ?? want to report TCL Error
+        return false;
+    }
+
+    command = Tcl_CreateObjCommand(interp, "BPF::load", load_cmd, (ClientData)0, NULL);
+    if ( command == NULL ) {
+        // logger ?? want to report TCL Error
+        return false;
+    }
+
+    return true;
+}
+
+app_init( BPF_Module );
+
+/* vim: set autoindent expandtab sw=4 : */
@@ -0,0 +1,218 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+/** \file TCL_Ethtool.cc
+ * \brief TCL access to the ethtool settings cache.
+ *
+ *   Ethtool::interfaces
+ *   Ethtool::interface index
+ *   Ethtool::refresh
+ *   Ethtool::stats
+ *
+ * Each interface is a key/value list: index, name, and whichever of
+ * speed/duplex/autoneg, port, features and rings the driver reported.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <tcl.h>
+#include "tcl_util.h"
+
+#include "logger.h"
+#include "Ethtool.h"
+
+#include "AppInit.h"
+
+namespace {
+    void append( Tcl_Interp *interp, Tcl_Obj *list, const char *key, Tcl_Obj *value ) {
+        Tcl_ListObjAppendElement( interp, list, Tcl_NewStringObj(key, -1) );
+        Tcl_ListObjAppendElement( interp, list, value );
+    }
+
+    Tcl_Obj *settings_list( Tcl_Interp *interp, const Ethtool::Settings& settings ) {
+        using namespace Ethtool;
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        append( interp, result, "index", Tcl_NewIntObj(settings.index) );
+        append( interp, result, "name", Tcl_NewStringObj(settings.name, -1) );
+
+        if ( settings.valid & Settings::LINK_MODES ) {
+            // SPEED_UNKNOWN is reported as -1, as the ioctl did
+            append( interp, result, "speed", Tcl_NewIntObj((int)settings.speed) );
+            append( interp, result, "duplex", Tcl_NewIntObj(settings.duplex) );
+            append( interp, result, "autoneg", Tcl_NewIntObj(settings.autoneg) );
+        }
+        if ( settings.valid & Settings::LINK_INFO ) {
+            append( interp, result, "port", Tcl_NewIntObj(settings.port) );
+        }
+        if ( settings.valid & Settings::FEATURES ) {
+            Tcl_Obj *features = Tcl_NewListObj( 0, 0 );
+            for ( int feature = RX_CHECKSUM ; feature <= LRO ; feature <<= 1 ) {
+                if ( (settings.features & feature) == 0 )  continue;
+                Tcl_ListObjAppendElement( interp, features, Tcl_NewStringObj(feature_name(feature), -1) );
+            }
+            append( interp, result, "features", features );
+        }
+        if ( settings.valid & Settings::RINGS ) {
+            append( interp, result, "rx", Tcl_NewLongObj(settings.rx) );
+            append( interp, result, "rx_max", Tcl_NewLongObj(settings.rx_max) );
+            append( interp, result, "tx", Tcl_NewLongObj(settings.tx) );
+            append( interp, result, "tx_max", Tcl_NewLongObj(settings.tx_max) );
+        }
+        return result;
+    }
+
+    /**
+     */
+    class AppendSettings : public Ethtool::SettingsIterator {
+        Tcl_Interp *interp;
+        Tcl_Obj *list;
+    public:
+        AppendSettings( Tcl_Interp *interp, Tcl_Obj *list ) : interp(interp), list(list) {}
+        virtual ~AppendSettings() {}
+        virtual int operator() ( const Ethtool::Settings& settings ) {
+            Tcl_ListObjAppendElement( interp, list, settings_list(interp, settings) );
+            return 1;
+        }
+    };
+
+    bool unavailable( Tcl_Interp *interp ) {
+        if ( Ethtool::Cache::shared()->available() )  return false;
+        Tcl_StaticSetResult( interp, "ethtool netlink is not available" );
+        return true;
+    }
+}
+
+/**
+ */
+static int
+interfaces_cmd( ClientData data, Tcl_Interp *interp,
+                int objc, Tcl_Obj * CONST *objv )
+{
+    if ( objc != 1 ) {
+        Tcl_ResetResult( interp );
+        Tcl_WrongNumArgs( interp, 1, objv, "" );
+        return TCL_ERROR;
+    }
+    if ( unavailable(interp) )  return TCL_ERROR;
+
+    Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+    AppendSettings callback( interp, result );
+    Ethtool::Cache::shared()->each( callback );
+    Tcl_SetObjResult( interp, result );
+    return TCL_OK;
+}
+
+/**
+ */
+static int
+interface_cmd( ClientData data, Tcl_Interp *interp,
+               int objc, Tcl_Obj * CONST *objv )
+{
+    if ( objc != 2 ) {
+        Tcl_ResetResult( interp );
+        Tcl_WrongNumArgs( interp, 1, objv, "index" );
+        return TCL_ERROR;
+    }
+    int index;
+    if ( Tcl_GetIntFromObj(interp, objv[1], &index) != TCL_OK ) {
+        return TCL_ERROR;
+    }
+    if ( unavailable(interp) )  return TCL_ERROR;
+
+    Ethtool::Settings settings;
+    if ( Ethtool::Cache::shared()->lookup(index, settings) == false ) {
+        Tcl_ResetResult( interp );
+        Tcl_AppendResult( interp, "no ethtool settings for interface ", Tcl_GetString(objv[1]), NULL );
+        return TCL_ERROR;
+    }
+    Tcl_SetObjResult( interp, settings_list(interp, settings) );
+    return TCL_OK;
+}
+
+/**
+ */
+static int
+refresh_cmd( ClientData data, Tcl_Interp *interp,
+             int objc, Tcl_Obj * CONST *objv )
+{
+    if ( unavailable(interp) )  return TCL_ERROR;
+    Tcl_SetObjResult( interp, Tcl_NewIntObj(Ethtool::Cache::shared()->refresh()) );
+    return TCL_OK;
+}
+
+/**
+ */
+static int
+stats_cmd( ClientData data, Tcl_Interp *interp,
+           int objc, Tcl_Obj * CONST *objv )
+{
+    Ethtool::CacheStatistics stats;
+    Ethtool::Cache::shared()->statistics( stats );
+
+    Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+    append( interp, result, "requests", Tcl_NewLongObj(stats.requests) );
+    append( interp, result, "dumps", Tcl_NewLongObj(stats.dumps) );
+    append( interp, result, "replies", Tcl_NewLongObj(stats.replies) );
+    append( interp, result, "notifications", Tcl_NewLongObj(stats.notifications) );
+    append( interp, result, "overruns", Tcl_NewLongObj(stats.overruns) );
+    append( interp, result, "hits", Tcl_NewLongObj(stats.hits) );
+    append( interp, result, "misses", Tcl_NewLongObj(stats.misses) );
+    Tcl_SetObjResult( interp, result );
+    return TCL_OK;
+}
+
+/**
+ */
+static bool
+Ethtool_Module( Tcl_Interp *interp ) {
+    Tcl_Command command;
+
+    Tcl_Namespace *ns = Tcl_FindNamespace(interp, "Ethtool", NULL, 0);
+    if ( ns == NULL )  ns = Tcl_CreateNamespace(interp, "Ethtool", (ClientData)0, NULL);
+    if ( ns == NULL ) {
+        return false;
+    }
+
+    command = Tcl_CreateObjCommand(interp, "Ethtool::interfaces", interfaces_cmd, (ClientData)0, NULL);
+    if ( command == NULL ) {
+        return false;
+    }
+    command = Tcl_CreateObjCommand(interp, "Ethtool::interface", interface_cmd, (ClientData)0, NULL);
+    if ( command == NULL ) {
+        return false;
+    }
+    command = Tcl_CreateObjCommand(interp, "Ethtool::refresh", refresh_cmd, (ClientData)0, NULL);
+    if ( command == NULL ) {
+        return false;
+    }
+    command = Tcl_CreateObjCommand(interp, "Ethtool::stats", stats_cmd, (ClientData)0, NULL);
+    if ( command == NULL ) {
+        return false;
+    }
+
+    return true;
+}
+
+app_init( Ethtool_Module );
+
+/* vim: set autoindent expandtab sw=4 : */
@@ -0,0 +1,235 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** \file TCL_ICMPv6Receiver.cc
+ * \brief TCL wrapper for the ICMPv6 receive engine.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <tcl.h>
+#include "tcl_util.h"
+
+#include "logger.h"
+#include "ICMPv6Receiver.h"
+
+#include "AppInit.h"
+
+namespace {
+    int debug = 0;
+
+    /**
+     * Sockets added from TCL have nobody to hand their packets to,
+     * so they are just counted by type.
+     */
+    class Tally : public ICMPv6::ReceiveCallbackInterface {
+    public:
+        unsigned long echo_requests;
+        unsigned long echo_replies;
+        unsigned long solicitations;
+        unsigned long advertisements;
+        unsigned long others;
+        Tally() : echo_requests(0), echo_replies(0), solicitations(0), advertisements(0), others(0) {}
+        virtual ~Tally() {}
+        virtual void receive( ICMPv6::EchoRequest * )           { echo_requests++; }
+        virtual void receive( ICMPv6::EchoReply * )             { echo_replies++; }
+        virtual void receive( ICMPv6::NeighborSolicitation * )  { solicitations++; }
+        virtual void receive( ICMPv6::NeighborAdvertisement * ) { advertisements++; }
+        virtual void receive( ICMPv6::PDU * )                   { others++; }
+    };
+
+    /**
+     */
+    class AppendStatistics : public ICMPv6::ReceiverIterator {
+        Tcl_Interp *interp;
+        Tcl_Obj *list;
+    public:
+        AppendStatistics( Tcl_Interp *interp, Tcl_Obj *list ) : interp(interp), list(list) {}
+        virtual ~AppendStatistics() {}
+        virtual int operator() ( ICMPv6::Socket *socket, int index, const ICMPv6::ReceiverStatistics& stats ) {
+            uint64_t average = 0;
+            if ( stats.packets > 0 )  average = stats.total_usec / stats.packets;
+
+            Tcl_Obj *entry = Tcl_NewListObj( 0, 0 );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("index", -1) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewIntObj(index) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("packets", -1) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewLongObj(stats.packets) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("bytes", -1) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewLongObj(stats.bytes) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("batches", -1) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewLongObj(stats.batches) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("drops", -1) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewLongObj(stats.drops) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("malformed", -1) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewLongObj(stats.malformed) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("last_usec", -1) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewWideIntObj(stats.last_usec) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("avg_usec", -1) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewWideIntObj(average) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("max_usec", -1) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewWideIntObj(stats.max_usec) );
+            Tcl_ListObjAppendElement( interp, list, entry );
+            return 1;
+        }
+    };
+
+    struct ReceiverObject {
+        ICMPv6::Receiver *receiver;
+        Tally tally;
+    };
+}
+
+/**
+ */
+static int
+Receiver_obj( ClientData data, Tcl_Interp *interp,
+              int objc, Tcl_Obj * CONST *objv )
+{
+    using namespace ICMPv6;
+    ReceiverObject *object = (ReceiverObject *)data;
+    Receiver *receiver = object->receiver;
+
+    if ( objc == 1 ) {
+        Tcl_SetObjResult( interp, Tcl_NewLongObj((long)(receiver)) );
+        return TCL_OK;
+    }
+    char *command = Tcl_GetStringFromObj( objv[1], NULL );
+    if ( Tcl_StringMatch(command, "type") ) {
+        Tcl_SetResult( interp, (char *)"ICMPv6::Receiver", TCL_STATIC );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "start") ) {
+        receiver->start();
+        Tcl_ResetResult( interp );
+        return TCL_OK;
+    }
+
+    /**
+     * Argument is a socket, optionally followed by the interface index
+     */
+    if ( Tcl_StringMatch(command, "add") or Tcl_StringMatch(command, "remove") ) {
+        if ( (objc != 3) and (objc != 4) ) {
+            Tcl_ResetResult( interp );
+            Tcl_WrongNumArgs( interp, 1, objv, "add|remove socket ?index?" );
+            return TCL_ERROR;
+        }
+
+        Socket *socket;
+        void *p = (void *)&(socket);
+        if ( Tcl_GetLongFromObj(interp,objv[2],(long*)p) != TCL_OK ) {
+            return TCL_ERROR;
+        }
+
+        bool result;
+        if ( Tcl_StringMatch(command, "add") ) {
+            int index = 0;
+            if ( (objc == 4) and (Tcl_GetIntFromObj(interp, objv[3], &index) != TCL_OK) ) {
+                return TCL_ERROR;
+            }
+            result = receiver->add( socket, &(object->tally), index );
+        } else {
+            result = receiver->remove( socket );
+        }
+        Tcl_SetObjResult( interp, Tcl_NewBooleanObj(result) );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "stats") ) {
+        Tcl_Obj *sockets = Tcl_NewListObj( 0, 0 );
+        AppendStatistics callback( interp, sockets );
+        receiver->each_binding( callback );
+
+        Tally& tally = object->tally;
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("echo_requests", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(tally.echo_requests) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("echo_replies", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(tally.echo_replies) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("solicitations", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(tally.solicitations) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("advertisements", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(tally.advertisements) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("others", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(tally.others) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("sockets", -1) );
+        Tcl_ListObjAppendElement( interp, result, sockets );
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
+    Tcl_SetResult( interp, (char *)"Unknown command for Receiver object", TCL_STATIC );
+    return TCL_ERROR;
+}
+
+/**
+ * The receiver is a thread, so it is never deleted -- deleting the
+ * command only forgets it.
+ */
+static void
+Receiver_delete( ClientData data ) {
+}
+
+/**
+ */
+static int
+Receiver_cmd( ClientData data, Tcl_Interp *interp,
+              int objc, Tcl_Obj * CONST *objv )
+{
+    if ( objc != 2 ) {
+        Tcl_ResetResult( interp );
+        Tcl_WrongNumArgs( interp, 1, objv, "name" );
+        return TCL_ERROR;
+    }
+
+    char *name = Tcl_GetStringFromObj( objv[1], NULL );
+
+    ReceiverObject *object = new ReceiverObject;
+    object->receiver = new ICMPv6::Receiver( name );
+    Tcl_CreateObjCommand( interp, name, Receiver_obj, (ClientData)object, Receiver_delete );
+    Tcl_SetResult( interp, name, TCL_VOLATILE );
+    return TCL_OK;
+}
+
+/**
+ */
+static bool
+ICMPv6Receiver_Module( Tcl_Interp *interp ) {
+    Tcl_Command command;
+
+    Tcl_EvalEx( interp, "namespace eval ICMPv6 {}", -1, TCL_EVAL_GLOBAL );
+    command = Tcl_CreateObjCommand(interp, "ICMPv6::Receiver", Receiver_cmd, (ClientData)0, NULL);
+    if ( command == NULL ) {
+        // logger ?? want to report TCL Error
+        return false;
+    }
+
+    return true;
+}
+
+app_init( ICMPv6Receiver_Module );
+
+/* vim: set autoindent expandtab sw=4 : */
@@ -0,0 +1,340 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+/** \file TCL_LinkSampler.cc
+ * \brief TCL wrapper for the interface counter sampler.
+ *
+ *   NetLink::LinkSampler name ?interval_ms? ?depth?
+ *   name start
+ *   name interfaces
+ *   name samples interface ?count?
+ *   name rates interface ?seconds?
+ *   name percentiles interface ?seconds?
+ *   name stats
+ *
+ * Rates are per second.  percentiles gives p50, p90, p99 and the
+ * maximum of the per-tick rate of each counter over the window.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <tcl.h>
+#include "tcl_util.h"
+
+#include "logger.h"
+#include "LinkSampler.h"
+
+#include "AppInit.h"
+
+namespace {
+    /**
+     */
+    class AppendName : public NetLink::LinkHistoryIterator {
+        Tcl_Interp *interp;
+        Tcl_Obj *list;
+    public:
+        AppendName( Tcl_Interp *interp, Tcl_Obj *list ) : interp(interp), list(list) {}
+        virtual ~AppendName() {}
+        virtual int operator() ( int index, const char *name ) {
+            Tcl_ListObjAppendElement( interp, list, Tcl_NewStringObj(name, -1) );
+            return 1;
+        }
+    };
+
+    /**
+     * The newest samples for an interface covering at most `seconds'
+     * (all of them when seconds is 0).  Leaves an error in interp and
+     * returns -1 for an unknown interface.
+     */
+    int window( Tcl_Interp *interp, NetLink::LinkSampler *sampler, const char *name,
+                double seconds, std::vector<NetLink::LinkSample>& result ) {
+        result.resize( sampler->capacity() );
+        int count = sampler->samples( name, &result[0], result.size() );
+        if ( count < 0 ) {
+            Tcl_ResetResult( interp );
+            Tcl_AppendResult( interp, "no samples for interface ", name, NULL );
+            return -1;
+        }
+        result.resize( count );
+        if ( (seconds <= 0) or (count == 0) )  return count;
+
+        uint64_t newest = result[count - 1].usec;
+        uint64_t span = (uint64_t)(seconds * 1000000);
+        int first = count;
+        while ( (first > 0) and (newest - result[first - 1].usec < span) )  first--;
+        result.erase( result.begin(), result.begin() + first );
+        return result.size();
+    }
+
+    double rate( const NetLink::LinkSample& sample, int counter ) {
+        if ( sample.interval == 0 )  return 0.0;
+        return (sample.counter[counter] * 1000000.0) / sample.interval;
+    }
+
+    /**
+     * Nearest rank on sorted values.
+     */
+    double percentile( const std::vector<double>& sorted, int percent ) {
+        if ( sorted.empty() )  return 0.0;
+        size_t rank = ((sorted.size() * percent) + 99) / 100;
+        if ( rank < 1 )  rank = 1;
+        return sorted[rank - 1];
+    }
+
+    bool optional_seconds( Tcl_Interp *interp, int objc, Tcl_Obj * CONST *objv, double *seconds ) {
+        *seconds = 0;
+        if ( objc < 4 )  return true;
+        return Tcl_GetDoubleFromObj( interp, objv[3], seconds ) == TCL_OK;
+    }
+}
+
+/**
+ */
+static int
+LinkSampler_obj( ClientData data, Tcl_Interp *interp,
+                 int objc, Tcl_Obj * CONST *objv )
+{
+    using namespace NetLink;
+    LinkSampler *sampler = (LinkSampler *)data;
+
+    if ( objc == 1 ) {
+        Tcl_SetObjResult( interp, Tcl_NewLongObj((long)(sampler)) );
+        return TCL_OK;
+    }
+    char *command = Tcl_GetStringFromObj( objv[1], NULL );
+    if ( Tcl_StringMatch(command, "type") ) {
+        Tcl_StaticSetResult( interp, "NetLink::LinkSampler" );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "start") ) {
+        sampler->start();
+        Tcl_ResetResult( interp );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "interfaces") ) {
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        AppendName callback( interp, result );
+        sampler->each_interface( callback );
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
+    if ( (objc < 3) and (Tcl_StringMatch(command, "samples") or
+                         Tcl_StringMatch(command, "rates") or
+                         Tcl_StringMatch(command, "percentiles")) ) {
+        Tcl_ResetResult( interp );
+        Tcl_WrongNumArgs( interp, 2, objv, "interface ?count|seconds?" );
+        return TCL_ERROR;
+    }
+
+    if ( Tcl_StringMatch(command, "samples") ) {
+        int count = 0;
+        if ( (objc > 3) and (Tcl_GetIntFromObj(interp, objv[3], &count) != TCL_OK) ) {
+            return TCL_ERROR;
+        }
+        std::vector<LinkSample> samples;
+        if ( window(interp, sampler, Tcl_GetString(objv[2]), 0, samples) < 0 ) {
+            return TCL_ERROR;
+        }
+        size_t first = 0;
+        if ( (count > 0) and ((size_t)count < samples.size()) )  first = samples.size() - count;
+
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        for ( size_t i = first ; i < samples.size() ; ++i ) {
+            Tcl_Obj *entry = Tcl_NewListObj( 0, 0 );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("usec", -1) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewWideIntObj(samples[i].usec) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("interval", -1) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewWideIntObj(samples[i].interval) );
+            for ( int c = 0 ; c < LinkSample::COUNTERS ; ++c ) {
+                Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj(LinkSample::counter_name(c), -1) );
+                Tcl_ListObjAppendElement( interp, entry, Tcl_NewWideIntObj(samples[i].counter[c]) );
+            }
+            Tcl_ListObjAppendElement( interp, result, entry );
+        }
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
+    /**
+     * Totals over the window divided by its length, so short ticks
+     * do not count for more than long ones.
+     */
+    if ( Tcl_StringMatch(command, "rates") ) {
+        double seconds;
+        if ( optional_seconds(interp, objc, objv, &seconds) == false )  return TCL_ERROR;
+        std::vector<LinkSample> samples;
+        if ( window(interp, sampler, Tcl_GetString(objv[2]), seconds, samples) < 0 ) {
+            return TCL_ERROR;
+        }
+
+        uint64_t elapsed = 0;
+        uint64_t totals[LinkSample::COUNTERS];
+        memset( totals, 0, sizeof(totals) );
+        for ( size_t i = 0 ; i < samples.size() ; ++i ) {
+            elapsed += samples[i].interval;
+            for ( int c = 0 ; c < LinkSample::COUNTERS ; ++c )  totals[c] += samples[i].counter[c];
+        }
+
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("samples", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewIntObj(samples.size()) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("seconds", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewDoubleObj(elapsed / 1000000.0) );
+        for ( int c = 0 ; c < LinkSample::COUNTERS ; ++c ) {
+            double per_second = (elapsed == 0) ? 0.0 : (totals[c] * 1000000.0) / elapsed;
+            Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj(LinkSample::counter_name(c), -1) );
+            Tcl_ListObjAppendElement( interp, result, Tcl_NewDoubleObj(per_second) );
+        }
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "percentiles") ) {
+        double seconds;
+        if ( optional_seconds(interp, objc, objv, &seconds) == false )  return TCL_ERROR;
+        std::vector<LinkSample> samples;
+        if ( window(interp, sampler, Tcl_GetString(objv[2]), seconds, samples) < 0 ) {
+            return TCL_ERROR;
+        }
+
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("samples", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewIntObj(samples.size()) );
+        std::vector<double> rates( samples.size() );
+        for ( int c = 0 ; c < LinkSample::COUNTERS ; ++c ) {
+            for ( size_t i = 0 ; i < samples.size() ; ++i )  rates[i] = rate( samples[i], c );
+            std::sort( rates.begin(), rates.end() );
+
+            Tcl_Obj *entry = Tcl_NewListObj( 0, 0 );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("p50", -1) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewDoubleObj(percentile(rates, 50)) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("p90", -1) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewDoubleObj(percentile(rates, 90)) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("p99", -1) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewDoubleObj(percentile(rates, 99)) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("max", -1) );
+            Tcl_ListObjAppendElement( interp, entry, Tcl_NewDoubleObj(rates.empty() ? 0.0 : rates.back()) );
+            Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj(LinkSample::counter_name(c), -1) );
+            Tcl_ListObjAppendElement( interp, result, entry );
+        }
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "stats") ) {
+        LinkSamplerStatistics stats;
+        sampler->statistics( stats );
+        uint64_t average = 0;
+        if ( stats.ticks > 0 )  average = stats.total_usec / stats.ticks;
+
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("interval_usec", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(sampler->interval()) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("depth", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewIntObj(sampler->capacity()) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("ticks", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(stats.ticks) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("missed", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(stats.missed) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("failures", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(stats.failures) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("interfaces", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(stats.interfaces) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("last_usec", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.last_usec) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("avg_usec", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(average) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("max_usec", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.max_usec) );
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
+    Tcl_StaticSetResult( interp, "Unknown command for LinkSampler object" );
+    return TCL_ERROR;
+}
+
+/**
+ * The sampler is a thread, so it is never deleted -- deleting the
+ * command only forgets it.
+ */
+static void
+LinkSampler_delete( ClientData data ) {
+}
+
+/**
+ */
+static int
+LinkSampler_cmd( ClientData data, Tcl_Interp *interp,
+                 int objc, Tcl_Obj * CONST *objv )
+{
+    if ( (objc < 2) or (objc > 4) ) {
+        Tcl_ResetResult( interp );
+        Tcl_WrongNumArgs( interp, 1, objv, "name ?interval_ms? ?depth?" );
+        return TCL_ERROR;
+    }
+
+    double interval = 100;
+    int depth = 600;
+    if ( (objc > 2) and (Tcl_GetDoubleFromObj(interp, objv[2], &interval) != TCL_OK) ) {
+        return TCL_ERROR;
+    }
+    if ( (objc > 3) and (Tcl_GetIntFromObj(interp, objv[3], &depth) != TCL_OK) ) {
+        return TCL_ERROR;
+    }
+
+    char *name = Tcl_GetStringFromObj( objv[1], NULL );
+    NetLink::LinkSampler *sampler = new NetLink::LinkSampler( name, (uint64_t)(interval * 1000), depth );
+    Tcl_CreateObjCommand( interp, name, LinkSampler_obj, (ClientData)sampler, LinkSampler_delete );
+    Tcl_SetResult( interp, name, TCL_VOLATILE );
+    return TCL_OK;
+}
+
+/**
+ */
+static bool
+LinkSampler_Module( Tcl_Interp *interp ) {
+    Tcl_Command command;
+
+    Tcl_Namespace *ns = Tcl_FindNamespace(interp, "NetLink", NULL, 0);
+    if ( ns == NULL )  ns = Tcl_CreateNamespace(interp, "NetLink", (ClientData)0, NULL);
+    if ( ns == NULL ) {
+        return false;
+    }
+    command = Tcl_CreateObjCommand(interp, "NetLink::LinkSampler", LinkSampler_cmd, (ClientData)0, NULL);
+    if ( command == NULL ) {
+        return false;
+    }
+
+    return true;
+}
+
+app_init( LinkSampler_Module );
+
+/* vim: set autoindent expandtab sw=4 : */
@@ -58,10 +58,6 @@
         ((struct rtattr *) (((uint8_t *) (nmsg)) + NLMSG_ALIGN((nmsg)->nlmsg_len)))
 
 namespace {
-    typedef NetLink::Message *(*MessageFactory)( struct nlmsghdr * );
-    typedef NetLink::RouteMessage *(*RouteMessageFactory)( struct nlmsghdr * );
-    static const int MAX_RTFACTORY = 1024;
-    RouteMessageFactory routeFactories[ MAX_RTFACTORY ];
     int debug = 0;
 }
 
@@ -103,6 +99,77 @@ RouteSocket_obj( ClientData data, Tcl_Interp *interp,
         Tcl_ResetResult( interp );
         return TCL_OK;
     }
+
+    /**
+     * Dump a whole table and return the number of entries read.
+     */
+    if ( Tcl_StringMatch(command, "dump") ) {
+        if ( objc != 3 ) {
+            Tcl_ResetResult( interp );
+            Tcl_WrongNumArgs( interp, 1, objv, "dump link|address|route|neighbor" );
+            return TCL_ERROR;
+        }
+
+        char *table = Tcl_GetStringFromObj( objv[2], NULL );
+        uint16_t type;
+        unsigned char family = AF_UNSPEC;
+        if ( Tcl_StringMatch(table, "link") ) {
+            type = RTM_GETLINK;
+            family = AF_PACKET;
+        } else if ( Tcl_StringMatch(table, "address") ) {
+            type = RTM_GETADDR;
+        } else if ( Tcl_StringMatch(table, "route") ) {
+            type = RTM_GETROUTE;
+        } else if ( Tcl_StringMatch(table, "neighbor") ) {
+            type = RTM_GETNEIGH;
+        } else {
+            Tcl_StaticSetResult( interp, "table must be one of link, address, route or neighbor" );
+            return TCL_ERROR;
+        }
+
+        RouteResponseHandler handler;
+        int count = socket->dump( type, family, &handler );
+        if ( count < 0 ) {
+            Tcl_StaticSetResult( interp, "dump failed" );
+            return TCL_ERROR;
+        }
+        Tcl_SetObjResult( interp, Tcl_NewIntObj(count) );
+        return TCL_OK;
+    }
+
+    /**
+     * Dump counters and timing (microseconds) as a key/value list.
+     */
+    if ( Tcl_StringMatch(command, "stats") ) {
+        const DumpStatistics& stats = socket->dump_statistics();
+        uint64_t average = 0;
+        if ( stats.dumps > 0 )  average = stats.total_usec / stats.dumps;
+
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("dumps", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.dumps) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("restarts", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.restarts) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("syscalls", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.syscalls) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("datagrams", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.datagrams) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("bytes", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.bytes) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("messages", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.messages) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("last_usec", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.last_usec) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("avg_usec", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(average) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("max_usec", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.max_usec) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("overruns", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(socket->overruns()) );
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
     Tcl_StaticSetResult( interp, "Unknown command for RouteSocket object" );
     return TCL_ERROR;
 }
@@ -873,25 +940,9 @@ static bool
 NetLink_Module( Tcl_Interp *interp ) {
     Tcl_Command command;
 
-    for ( int i = 0 ; i < MAX_RTFACTORY ; i++ ) {
-        // This should be a generic route factory, not a simple netlink message
-        routeFactories[i] = NetLink::RouteMessage::Factory;
-    }
-    // set specific message factories
-    routeFactories[RTM_NEWLINK]  = NetLink::NewLink::Factory;
-    routeFactories[RTM_DELLINK]  = NetLink::DelLink::Factory;
-    routeFactories[RTM_GETLINK]  = NetLink::GetLink::Factory;
-    routeFactories[RTM_NEWADDR]  = NetLink::NewAddress::Factory;
-    routeFactories[RTM_DELADDR]  = NetLink::DelAddress::Factory;
-    routeFactories[RTM_GETADDR]  = NetLink::GetAddress::Factory;
-    routeFactories[RTM_NEWROUTE] = NetLink::NewRoute::Factory;
-    routeFactories[RTM_DELROUTE] = NetLink::DelRoute::Factory;
-    routeFactories[RTM_GETROUTE] = NetLink::GetRoute::Factory;
-    routeFactories[RTM_NEWNEIGH]  = NetLink::NewNeighbor::Factory;
-    routeFactories[RTM_DELNEIGH]  = NetLink::DelNeighbor::Factory;
-    routeFactories[RTM_GETNEIGH]  = NetLink::GetNeighbor::Factory;
-
-    Tcl_Namespace *ns = Tcl_CreateNamespace(interp, "NetLink", (ClientData)0, NULL);
+    // other NetLink modules (LinkSampler) may have made it already
+    Tcl_Namespace *ns = Tcl_FindNamespace(interp, "NetLink", NULL, 0);
+    if ( ns == NULL )  ns = Tcl_CreateNamespace(interp, "NetLink", (ClientData)0, NULL);
     if ( ns == NULL ) {
         return false;
     }
@@ -0,0 +1,425 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+/** \file TCL_ProcessManager.cc
+ * \brief TCL commands for the asynchronous process manager.
+ *
+ *   Process::spawn ?-timeout ms? ?-callback script? ?--? command ?arg ...?
+ *   Process::run ?-timeout ms? ?--? command ?arg ...?
+ *   Process::jobs
+ *   Process::stats
+ *
+ * spawn returns the pid at once.  With a callback the output is
+ * captured, and once the child is reaped the callback is run from the
+ * event loop as `callback result'.  run waits for the child and
+ * returns the result.  A result is a key/value list: pid, status
+ * (exited, signaled, timeout), code, elapsed_ms, output, truncated.
+ */
+
+#include <sys/types.h>
+#include <sys/eventfd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <map>
+#include <vector>
+
+#include <tcl.h>
+#include "tcl_util.h"
+
+#include "logger.h"
+#include "ProcessManager.h"
+
+#include "AppInit.h"
+
+namespace {
+    /**
+     * A Result copied off the manager thread.
+     */
+    struct Finished {
+        pid_t pid;
+        int state;
+        int code;
+        uint64_t elapsed;
+        char *output;
+        size_t length;
+        bool truncated;
+
+        void copy( const Process::Result& result ) {
+            pid = result.pid;
+            state = result.state;
+            code = result.code;
+            elapsed = result.elapsed;
+            output = (char *)malloc( result.length + 1 );
+            memcpy( output, result.output, result.length );
+            length = result.length;
+            truncated = result.truncated;
+        }
+    };
+
+    /**
+     * Callbacks waiting on children, and the results that have come
+     * back for them.  The manager thread queues a result and pokes
+     * the eventfd; the interpreter's event loop runs the callback.
+     * The eventfd and its handler are only made on the first
+     * -callback, so interpreters that never run an event loop (a
+     * service's workers) do not carry them.
+     */
+    struct Deliveries {
+        Tcl_Interp *interp;
+        int fd;
+        pthread_mutex_t lock;
+        std::vector<Finished> finished;
+        std::map<pid_t, Tcl_Obj *> callbacks;
+    };
+
+    /**
+     */
+    class Deliver : public Process::Completion {
+        Deliveries *deliveries;
+    public:
+        Deliver( Deliveries *deliveries ) : deliveries(deliveries) {}
+        virtual ~Deliver() {}
+        virtual void operator() ( const Process::Result& result ) {
+            Finished finished;
+            finished.copy( result );
+            pthread_mutex_lock( &deliveries->lock );
+            deliveries->finished.push_back( finished );
+            pthread_mutex_unlock( &deliveries->lock );
+            uint64_t one = 1;
+            if ( write(deliveries->fd, &one, sizeof(one)) < 0 ) {
+                log_err( "Process: cannot wake interpreter: %s", strerror(errno) );
+            }
+            delete this;
+        }
+    };
+
+    /**
+     * For run: the calling thread sleeps on the condition until the
+     * manager hands over the result.
+     */
+    class Wait : public Process::Completion {
+        pthread_mutex_t lock;
+        pthread_cond_t done;
+        bool complete;
+    public:
+        Finished result;
+        Wait() : complete(false) {
+            pthread_mutex_init( &lock, NULL );
+            pthread_cond_init( &done, NULL );
+        }
+        virtual ~Wait() {
+            pthread_cond_destroy( &done );
+            pthread_mutex_destroy( &lock );
+        }
+        virtual void operator() ( const Process::Result& finished ) {
+            pthread_mutex_lock( &lock );
+            result.copy( finished );
+            complete = true;
+            pthread_cond_signal( &done );
+            pthread_mutex_unlock( &lock );
+        }
+        void wait() {
+            pthread_mutex_lock( &lock );
+            while ( complete == false )  pthread_cond_wait( &done, &lock );
+            pthread_mutex_unlock( &lock );
+        }
+    };
+
+    void append( Tcl_Obj *list, const char *key, Tcl_Obj *value ) {
+        Tcl_ListObjAppendElement( NULL, list, Tcl_NewStringObj(key, -1) );
+        Tcl_ListObjAppendElement( NULL, list, value );
+    }
+
+    Tcl_Obj *result_list( const Finished& finished ) {
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        append( result, "pid", Tcl_NewIntObj(finished.pid) );
+        append( result, "status", Tcl_NewStringObj(Process::Result::state_name(finished.state), -1) );
+        append( result, "code", Tcl_NewIntObj(finished.code) );
+        append( result, "elapsed_ms", Tcl_NewWideIntObj((Tcl_WideInt)(finished.elapsed / 1000)) );
+        append( result, "output", Tcl_NewStringObj(finished.output, finished.length) );
+        append( result, "truncated", Tcl_NewBooleanObj(finished.truncated) );
+        return result;
+    }
+
+    /**
+     * Run the callback of every child that has finished, at global
+     * level.  A callback may spawn more children.
+     */
+    void deliver( ClientData data, int mask ) {
+        Deliveries *deliveries = (Deliveries *)data;
+        uint64_t value;
+        if ( (read(deliveries->fd, &value, sizeof(value)) < 0) and (errno != EAGAIN) ) {
+            log_err( "Process: cannot read wakeup: %s", strerror(errno) );
+        }
+
+        std::vector<Finished> finished;
+        pthread_mutex_lock( &deliveries->lock );
+        finished.swap( deliveries->finished );
+        pthread_mutex_unlock( &deliveries->lock );
+
+        for ( size_t i = 0 ; i < finished.size() ; ++i ) {
+            std::map<pid_t, Tcl_Obj *>::iterator found = deliveries->callbacks.find( finished[i].pid );
+            if ( found != deliveries->callbacks.end() ) {
+                Tcl_Obj *callback = found->second;
+                deliveries->callbacks.erase( found );
+
+                Tcl_Obj *command = Tcl_DuplicateObj( callback );
+                Tcl_IncrRefCount( command );
+                Tcl_ListObjAppendElement( NULL, command, result_list(finished[i]) );
+                Tcl_DecrRefCount( callback );
+                if ( Tcl_EvalObjEx(deliveries->interp, command, TCL_EVAL_GLOBAL) != TCL_OK ) {
+                    Tcl_BackgroundError( deliveries->interp );
+                }
+                Tcl_DecrRefCount( command );
+            }
+            free( finished[i].output );
+        }
+    }
+
+    /**
+     * Make the eventfd and watch it from this interpreter's thread.
+     */
+    bool listen( Deliveries *deliveries ) {
+        if ( deliveries->fd != -1 )  return true;
+        deliveries->fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+        if ( deliveries->fd < 0 ) {
+            log_err( "Process: cannot create eventfd: %s", strerror(errno) );
+            return false;
+        }
+        Tcl_CreateFileHandler( deliveries->fd, TCL_READABLE, deliver, (ClientData)deliveries );
+        return true;
+    }
+
+    /**
+     * Parse ?-timeout ms? ?-callback script? ?--?; returns the index
+     * of the command, or -1 with an error in interp.
+     */
+    int options( Tcl_Interp *interp, int objc, Tcl_Obj * CONST *objv,
+                 int *timeout, Tcl_Obj **callback ) {
+        int i = 1;
+        while ( i < objc ) {
+            char *option = Tcl_GetString( objv[i] );
+            if ( option[0] != '-' )  break;
+            if ( strcmp(option, "--") == 0 ) {
+                i++;
+                break;
+            }
+            if ( i + 1 >= objc ) {
+                Tcl_ResetResult( interp );
+                Tcl_AppendResult( interp, "missing value for ", option, NULL );
+                return -1;
+            }
+            if ( strcmp(option, "-timeout") == 0 ) {
+                if ( Tcl_GetIntFromObj(interp, objv[i + 1], timeout) != TCL_OK )  return -1;
+            } else if ( (callback != NULL) and (strcmp(option, "-callback") == 0) ) {
+                *callback = objv[i + 1];
+            } else {
+                Tcl_ResetResult( interp );
+                Tcl_AppendResult( interp, "unknown option ", option, NULL );
+                return -1;
+            }
+            i += 2;
+        }
+        if ( i >= objc ) {
+            Tcl_StaticSetResult( interp, "no command given" );
+            return -1;
+        }
+        return i;
+    }
+
+    void arguments( int objc, Tcl_Obj * CONST *objv, std::vector<char *>& argv ) {
+        for ( int i = 0 ; i < objc ; ++i )  argv.push_back( Tcl_GetString(objv[i]) );
+        argv.push_back( NULL );
+    }
+
+    /**
+     */
+    class AppendJob : public Process::JobIterator {
+        Tcl_Obj *list;
+    public:
+        AppendJob( Tcl_Obj *list ) : list(list) {}
+        virtual ~AppendJob() {}
+        virtual int operator() ( pid_t pid, const char *command, uint64_t elapsed ) {
+            Tcl_Obj *job = Tcl_NewListObj( 0, 0 );
+            append( job, "pid", Tcl_NewIntObj(pid) );
+            append( job, "command", Tcl_NewStringObj(command, -1) );
+            append( job, "elapsed_ms", Tcl_NewWideIntObj((Tcl_WideInt)(elapsed / 1000)) );
+            Tcl_ListObjAppendElement( NULL, list, job );
+            return 1;
+        }
+    };
+}
+
+/**
+ * Process::spawn ?-timeout ms? ?-callback script? ?--? command ?arg ...?
+ */
+static int
+spawn_cmd( ClientData data, Tcl_Interp *interp,
+           int objc, Tcl_Obj * CONST *objv )
+{
+    Deliveries *deliveries = (Deliveries *)data;
+    int timeout = 0;
+    Tcl_Obj *callback = NULL;
+    int first = options( interp, objc, objv, &timeout, &callback );
+    if ( first < 0 )  return TCL_ERROR;
+
+    if ( (callback != NULL) and (listen(deliveries) == false) ) {
+        Tcl_StaticSetResult( interp, "cannot create the callback eventfd" );
+        return TCL_ERROR;
+    }
+
+    std::vector<char *> argv;
+    arguments( objc - first, objv + first, argv );
+
+    Process::Manager *manager = Process::Manager::shared();
+    pid_t pid;
+    if ( callback == NULL ) {
+        pid = manager->spawn( &argv[0], timeout, NULL );
+    } else {
+        Deliver *completion = new Deliver( deliveries );
+        pid = manager->spawn( &argv[0], timeout, completion, Process::Manager::CAPTURE );
+        if ( pid < 0 ) {
+            delete completion;
+        } else {
+            Tcl_IncrRefCount( callback );
+            deliveries->callbacks[pid] = callback;
+        }
+    }
+    if ( pid < 0 ) {
+        Tcl_ResetResult( interp );
+        Tcl_AppendResult( interp, "cannot start ", argv[0], ": ", strerror(errno), NULL );
+        return TCL_ERROR;
+    }
+
+    Tcl_SetObjResult( interp, Tcl_NewIntObj(pid) );
+    return TCL_OK;
+}
+
+/**
+ * Process::run ?-timeout ms? ?--? command ?arg ...?
+ */
+static int
+run_cmd( ClientData data, Tcl_Interp *interp,
+         int objc, Tcl_Obj * CONST *objv )
+{
+    int timeout = 0;
+    int first = options( interp, objc, objv, &timeout, NULL );
+    if ( first < 0 )  return TCL_ERROR;
+
+    std::vector<char *> argv;
+    arguments( objc - first, objv + first, argv );
+
+    Wait completion;
+    pid_t pid = Process::Manager::shared()->spawn( &argv[0], timeout, &completion, Process::Manager::CAPTURE );
+    if ( pid < 0 ) {
+        Tcl_ResetResult( interp );
+        Tcl_AppendResult( interp, "cannot start ", argv[0], ": ", strerror(errno), NULL );
+        return TCL_ERROR;
+    }
+    completion.wait();
+
+    Tcl_SetObjResult( interp, result_list(completion.result) );
+    free( completion.result.output );
+    return TCL_OK;
+}
+
+/**
+ * Process::jobs
+ */
+static int
+jobs_cmd( ClientData data, Tcl_Interp *interp,
+          int objc, Tcl_Obj * CONST *objv )
+{
+    Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+    AppendJob callback( result );
+    Process::Manager::shared()->each_job( callback );
+    Tcl_SetObjResult( interp, result );
+    return TCL_OK;
+}
+
+/**
+ * Process::stats
+ */
+static int
+stats_cmd( ClientData data, Tcl_Interp *interp,
+           int objc, Tcl_Obj * CONST *objv )
+{
+    Process::ManagerStatistics stats;
+    Process::Manager::shared()->statistics( stats );
+
+    Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+    append( result, "spawned", Tcl_NewLongObj(stats.spawned) );
+    append( result, "failed", Tcl_NewLongObj(stats.failed) );
+    append( result, "completed", Tcl_NewLongObj(stats.completed) );
+    append( result, "timeouts", Tcl_NewLongObj(stats.timeouts) );
+    append( result, "running", Tcl_NewLongObj(stats.running) );
+    append( result, "output_bytes", Tcl_NewLongObj(stats.output_bytes) );
+    Tcl_SetObjResult( interp, result );
+    return TCL_OK;
+}
+
+/**
+ * Also creates the manager, here on the main thread.
+ */
+static bool
+ProcessManager_Module( Tcl_Interp *interp ) {
+    Tcl_Command command;
+
+    Tcl_Namespace *ns = Tcl_FindNamespace(interp, "Process", NULL, 0);
+    if ( ns == NULL )  ns = Tcl_CreateNamespace(interp, "Process", (ClientData)0, NULL);
+    if ( ns == NULL ) {
+        return false;
+    }
+
+    Deliveries *deliveries = new Deliveries;
+    deliveries->interp = interp;
+    pthread_mutex_init( &deliveries->lock, NULL );
+    deliveries->fd = -1;
+
+    Process::Manager::shared();
+
+    command = Tcl_CreateObjCommand(interp, "Process::spawn", spawn_cmd, (ClientData)deliveries, NULL);
+    if ( command == NULL ) {
+        return false;
+    }
+    command = Tcl_CreateObjCommand(interp, "Process::run", run_cmd, (ClientData)0, NULL);
+    if ( command == NULL ) {
+        return false;
+    }
+    command = Tcl_CreateObjCommand(interp, "Process::jobs", jobs_cmd, (ClientData)0, NULL);
+    if ( command == NULL ) {
+        return false;
+    }
+    command = Tcl_CreateObjCommand(interp, "Process::stats", stats_cmd, (ClientData)0, NULL);
+    if ( command == NULL ) {
+        return false;
+    }
+
+    return true;
+}
+
+app_init( ProcessManager_Module );
+
+/* vim: set autoindent expandtab sw=4 : */
@@ -0,0 +1,244 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+/** \file TCL_ProcessTable.cc
+ * \brief TCL commands for process table snapshots.
+ *
+ *   Process::snapshot take ?-status? ?-parallel count?
+ *   Process::snapshot top rss|cpu|vsize|swap|threads ?count?
+ *   Process::snapshot process pid
+ *   Process::snapshot stats
+ *
+ * take reads every process (stat and statm, and status with -status)
+ * and returns a summary of the snapshot.  top and process look at the
+ * latest snapshot, and describe each process as a key/value list:
+ * pid, ppid, name, state, uid, threads, rss_kb, shared_kb, vsize_kb,
+ * swap_kb, utime, stime and cpu -- the percent of one CPU used since
+ * the snapshot before.  uid and swap_kb need -status: without it
+ * they are left out, and `top swap' is an error.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include <tcl.h>
+#include "tcl_util.h"
+
+#include "logger.h"
+#include "ProcessTable.h"
+
+#include "AppInit.h"
+
+namespace {
+    void append( Tcl_Obj *list, const char *key, Tcl_Obj *value ) {
+        Tcl_ListObjAppendElement( NULL, list, Tcl_NewStringObj(key, -1) );
+        Tcl_ListObjAppendElement( NULL, list, value );
+    }
+
+    Tcl_Obj *row_list( Process::ProcessTable *table, const Process::Snapshot *s, size_t row ) {
+        uint64_t page_kb = table->page() / 1024;
+        double cpu = 0.0;
+        if ( s->interval > 0 ) {
+            cpu = (s->cpu[row] * 100.0 * 1000000.0) / ((double)table->hz() * s->interval);
+        }
+
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        append( result, "pid", Tcl_NewIntObj(s->pid[row]) );
+        append( result, "ppid", Tcl_NewIntObj(s->ppid[row]) );
+        append( result, "name", Tcl_NewStringObj(s->name[row].text, -1) );
+        append( result, "state", Tcl_NewStringObj(&s->state[row], 1) );
+        bool status = (s->fields & Process::ProcessTable::STATUS) != 0;
+        if ( status )  append( result, "uid", Tcl_NewIntObj(s->uid[row]) );
+        append( result, "threads", Tcl_NewIntObj(s->threads[row]) );
+        append( result, "rss_kb", Tcl_NewWideIntObj((Tcl_WideInt)(s->rss[row] * page_kb)) );
+        append( result, "shared_kb", Tcl_NewWideIntObj((Tcl_WideInt)(s->shared[row] * page_kb)) );
+        append( result, "vsize_kb", Tcl_NewWideIntObj((Tcl_WideInt)(s->vsize[row] / 1024)) );
+        if ( status )  append( result, "swap_kb", Tcl_NewWideIntObj((Tcl_WideInt)s->swap[row]) );
+        append( result, "utime", Tcl_NewWideIntObj((Tcl_WideInt)s->utime[row]) );
+        append( result, "stime", Tcl_NewWideIntObj((Tcl_WideInt)s->stime[row]) );
+        append( result, "cpu", Tcl_NewDoubleObj(cpu) );
+        return result;
+    }
+
+    bool have_snapshot( Tcl_Interp *interp, const Process::Snapshot *s ) {
+        if ( s != NULL )  return true;
+        Tcl_StaticSetResult( interp, "no snapshot taken yet" );
+        return false;
+    }
+}
+
+/**
+ */
+static int
+snapshot_obj( ClientData data, Tcl_Interp *interp,
+              int objc, Tcl_Obj * CONST *objv )
+{
+    using namespace Process;
+    ProcessTable *table = (ProcessTable *)data;
+
+    if ( objc < 2 ) {
+        Tcl_ResetResult( interp );
+        Tcl_WrongNumArgs( interp, 1, objv, "command ..." );
+        return TCL_ERROR;
+    }
+    char *command = Tcl_GetStringFromObj( objv[1], NULL );
+
+    if ( Tcl_StringMatch(command, "take") ) {
+        int fields = ProcessTable::STATM;
+        int parallel = 1;
+        for ( int i = 2 ; i < objc ; ++i ) {
+            char *option = Tcl_GetString( objv[i] );
+            if ( strcmp(option, "-status") == 0 ) {
+                fields |= ProcessTable::STATUS;
+                continue;
+            }
+            if ( (strcmp(option, "-parallel") == 0) and (i + 1 < objc) ) {
+                if ( Tcl_GetIntFromObj(interp, objv[++i], &parallel) != TCL_OK )  return TCL_ERROR;
+                continue;
+            }
+            Tcl_ResetResult( interp );
+            Tcl_WrongNumArgs( interp, 2, objv, "?-status? ?-parallel count?" );
+            return TCL_ERROR;
+        }
+
+        const Snapshot *s = table->take( fields, parallel );
+        if ( s == NULL ) {
+            Tcl_StaticSetResult( interp, "cannot read /proc" );
+            return TCL_ERROR;
+        }
+        TableStatistics stats;
+        table->statistics( stats );
+
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        append( result, "processes", Tcl_NewLongObj(s->count) );
+        append( result, "usec", Tcl_NewWideIntObj((Tcl_WideInt)stats.last_usec) );
+        append( result, "interval_ms", Tcl_NewWideIntObj((Tcl_WideInt)(s->interval / 1000)) );
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "top") ) {
+        if ( (objc < 3) or (objc > 4) ) {
+            Tcl_ResetResult( interp );
+            Tcl_WrongNumArgs( interp, 2, objv, "rss|cpu|vsize|swap|threads ?count?" );
+            return TCL_ERROR;
+        }
+        int column = ProcessTable::column_named( Tcl_GetString(objv[2]) );
+        if ( column < 0 ) {
+            Tcl_ResetResult( interp );
+            Tcl_AppendResult( interp, "unknown column ", Tcl_GetString(objv[2]), NULL );
+            return TCL_ERROR;
+        }
+        int count = 10;
+        if ( (objc > 3) and (Tcl_GetIntFromObj(interp, objv[3], &count) != TCL_OK) ) {
+            return TCL_ERROR;
+        }
+        const Snapshot *s = table->snapshot();
+        if ( have_snapshot(interp, s) == false )  return TCL_ERROR;
+        if ( (column == ProcessTable::SWAP) and ((s->fields & ProcessTable::STATUS) == 0) ) {
+            Tcl_StaticSetResult( interp, "snapshot taken without -status" );
+            return TCL_ERROR;
+        }
+
+        std::vector<size_t> rows;
+        table->top( column, count, rows );
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        for ( size_t i = 0 ; i < rows.size() ; ++i ) {
+            Tcl_ListObjAppendElement( interp, result, row_list(table, s, rows[i]) );
+        }
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "process") ) {
+        int pid;
+        if ( objc != 3 ) {
+            Tcl_ResetResult( interp );
+            Tcl_WrongNumArgs( interp, 2, objv, "pid" );
+            return TCL_ERROR;
+        }
+        if ( Tcl_GetIntFromObj(interp, objv[2], &pid) != TCL_OK )  return TCL_ERROR;
+        const Snapshot *s = table->snapshot();
+        if ( have_snapshot(interp, s) == false )  return TCL_ERROR;
+
+        int row = s->find( pid );
+        if ( row < 0 ) {
+            Tcl_ResetResult( interp );
+            Tcl_AppendResult( interp, "no process ", Tcl_GetString(objv[2]), " in snapshot", NULL );
+            return TCL_ERROR;
+        }
+        Tcl_SetObjResult( interp, row_list(table, s, row) );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "stats") ) {
+        TableStatistics stats;
+        table->statistics( stats );
+        uint64_t average = (stats.snapshots == 0) ? 0 : stats.total_usec / stats.snapshots;
+
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        append( result, "snapshots", Tcl_NewLongObj(stats.snapshots) );
+        append( result, "processes", Tcl_NewLongObj(stats.processes) );
+        append( result, "vanished", Tcl_NewLongObj(stats.vanished) );
+        append( result, "tasks", Tcl_NewLongObj(stats.tasks) );
+        append( result, "last_usec", Tcl_NewWideIntObj((Tcl_WideInt)stats.last_usec) );
+        append( result, "average_usec", Tcl_NewWideIntObj((Tcl_WideInt)average) );
+        append( result, "max_usec", Tcl_NewWideIntObj((Tcl_WideInt)stats.max_usec) );
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
+    Tcl_StaticSetResult( interp, "Unknown command for Process::snapshot" );
+    return TCL_ERROR;
+}
+
+/**
+ */
+static bool
+ProcessTable_Module( Tcl_Interp *interp ) {
+    Tcl_Command command;
+
+    Tcl_Namespace *ns = Tcl_FindNamespace(interp, "Process", NULL, 0);
+    if ( ns == NULL )  ns = Tcl_CreateNamespace(interp, "Process", (ClientData)0, NULL);
+    if ( ns == NULL ) {
+        return false;
+    }
+
+    Process::ProcessTable *table = new Process::ProcessTable;
+    if ( table->open() == false ) {
+        delete table;
+        return false;
+    }
+
+    command = Tcl_CreateObjCommand(interp, "Process::snapshot", snapshot_obj, (ClientData)table, NULL);
+    if ( command == NULL ) {
+        return false;
+    }
+
+    return true;
+}
+
+app_init( ProcessTable_Module );
+
+/* vim: set autoindent expandtab sw=4 : */
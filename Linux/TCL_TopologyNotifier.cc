@@ -0,0 +1,186 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+/** \file TCL_TopologyNotifier.cc
+ * \brief TCL wrapper for the topology change notifier.
+ *
+ *   Network::TopologyNotifier name ?window_ms?
+ *   name start
+ *   name changed ?who?
+ *   name window ?ms?
+ *   name program ?path?
+ *   name stats
+ *
+ * Once started, changes the network monitor sees are reported to it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <tcl.h>
+#include "tcl_util.h"
+
+#include "logger.h"
+#include "TopologyNotifier.h"
+
+#include "AppInit.h"
+
+/**
+ */
+static int
+TopologyNotifier_obj( ClientData data, Tcl_Interp *interp,
+                      int objc, Tcl_Obj * CONST *objv )
+{
+    using namespace Network;
+    TopologyNotifier *notifier = (TopologyNotifier *)data;
+
+    if ( objc == 1 ) {
+        Tcl_SetObjResult( interp, Tcl_NewLongObj((long)(notifier)) );
+        return TCL_OK;
+    }
+    char *command = Tcl_GetStringFromObj( objv[1], NULL );
+    if ( Tcl_StringMatch(command, "type") ) {
+        Tcl_StaticSetResult( interp, "Network::TopologyNotifier" );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "start") ) {
+        if ( notifier->start() == false ) {
+            Tcl_StaticSetResult( interp, "failed to start topology notifier" );
+            return TCL_ERROR;
+        }
+        Tcl_ResetResult( interp );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "changed") ) {
+        const char *who = (objc > 2) ? Tcl_GetString(objv[2]) : "tcl";
+        notifier->changed( who );
+        Tcl_ResetResult( interp );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "window") ) {
+        if ( objc > 2 ) {
+            int ms;
+            if ( Tcl_GetIntFromObj(interp, objv[2], &ms) != TCL_OK ) {
+                return TCL_ERROR;
+            }
+            notifier->window( ms );
+        }
+        Tcl_SetObjResult( interp, Tcl_NewIntObj(notifier->window()) );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "program") ) {
+        if ( objc > 2 )  notifier->program( Tcl_GetString(objv[2]) );
+        Tcl_SetObjResult( interp, Tcl_NewStringObj(notifier->program(), -1) );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "stats") ) {
+        TopologyStatistics stats;
+        notifier->statistics( stats );
+
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("changes", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(stats.changes) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("events", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(stats.events) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("deliveries", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(stats.deliveries) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("backlogged", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(stats.backlogged) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("spawns", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(stats.spawns) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("spawn_failures", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(stats.spawn_failures) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("deferred", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(stats.deferred) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("subscribers", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(stats.subscribers) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("last_latency_usec", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.last_latency) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("max_latency_usec", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.max_latency) );
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
+    Tcl_StaticSetResult( interp, "Unknown command for TopologyNotifier object" );
+    return TCL_ERROR;
+}
+
+/**
+ * The notifier is a thread, so it is never deleted -- deleting the
+ * command only forgets it.
+ */
+static void
+TopologyNotifier_delete( ClientData data ) {
+}
+
+/**
+ */
+static int
+TopologyNotifier_cmd( ClientData data, Tcl_Interp *interp,
+                      int objc, Tcl_Obj * CONST *objv )
+{
+    if ( (objc < 2) or (objc > 3) ) {
+        Tcl_ResetResult( interp );
+        Tcl_WrongNumArgs( interp, 1, objv, "name ?window_ms?" );
+        return TCL_ERROR;
+    }
+
+    int window = 250;
+    if ( (objc > 2) and (Tcl_GetIntFromObj(interp, objv[2], &window) != TCL_OK) ) {
+        return TCL_ERROR;
+    }
+
+    char *name = Tcl_GetStringFromObj( objv[1], NULL );
+    Network::TopologyNotifier *notifier = new Network::TopologyNotifier( name, window );
+    Tcl_CreateObjCommand( interp, name, TopologyNotifier_obj, (ClientData)notifier, TopologyNotifier_delete );
+    Tcl_SetResult( interp, name, TCL_VOLATILE );
+    return TCL_OK;
+}
+
+/**
+ */
+static bool
+TopologyNotifier_Module( Tcl_Interp *interp ) {
+    Tcl_Command command;
+
+    Tcl_Namespace *ns = Tcl_FindNamespace(interp, "Network", NULL, 0);
+    if ( ns == NULL )  ns = Tcl_CreateNamespace(interp, "Network", (ClientData)0, NULL);
+    if ( ns == NULL ) {
+        return false;
+    }
+    command = Tcl_CreateObjCommand(interp, "Network::TopologyNotifier", TopologyNotifier_cmd, (ClientData)0, NULL);
+    if ( command == NULL ) {
+        return false;
+    }
+
+    return true;
+}
+
+app_init( TopologyNotifier_Module );
+
+/* vim: set autoindent expandtab sw=4 : */
@@ -0,0 +1,510 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+/** \file TopologyNotifier.cc
+ * \brief Debounced, coalesced network topology change events.
+ *
+ * Everything but changed() runs on the notifier thread, which waits
+ * in epoll on an eventfd (the first change of a window), a timerfd
+ * (the end of the window), the subscriber socket, each subscriber,
+ * and a pidfd for the event program while it runs.
+ *
+ * Only root and this process's own user may subscribe, since a
+ * subscriber takes the place of the event program.  A subscriber
+ * whose socket is full is owed the changes it missed; they go out,
+ * folded into one event, as soon as it can take them.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <spawn.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+
+#include <set>
+
+#include "logger.h"
+#include "PlatformThread.h"
+#include "TopologyNotifier.h"
+
+namespace {
+    int debug = 0;
+
+    const char *DEFAULT_PROGRAM = "/usr/lib/spine/bin/genevent";
+    const char SOCKET_NAME[] = "\0redx.topology";
+
+    uint64_t now_usec() {
+        struct timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+    }
+
+    bool watch( int epoll_fd, int fd, int operation = EPOLL_CTL_ADD, uint32_t events = EPOLLIN ) {
+        struct epoll_event event;
+        memset( &event, 0, sizeof(event) );
+        event.events = events;
+        event.data.fd = fd;
+        return epoll_ctl( epoll_fd, operation, fd, &event ) == 0;
+    }
+
+    /**
+     * Whether the peer runs as root or as us.
+     */
+    bool trusted( int fd ) {
+        struct ucred credentials;
+        socklen_t length = sizeof(credentials);
+        if ( getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) < 0 )  return false;
+        return (credentials.uid == 0) or (credentials.uid == geteuid());
+    }
+}
+
+Network::TopologyNotifier *Network::TopologyNotifier::installed = NULL;
+const char *Network::TopologyNotifier::EVENT_NAME = "SuperNova::NetTopologyUpdate";
+
+/**
+ * window is in milliseconds.
+ */
+Network::TopologyNotifier::TopologyNotifier( const char *name, int window )
+: Thread(name),
+  window_ms(window < 0 ? 0 : window),
+  _program(strdup(DEFAULT_PROGRAM)),
+  epoll_fd(-1),
+  wake_fd(-1),
+  timer_fd(-1),
+  listen_fd(-1),
+  child_fd(-1),
+  child(0),
+  armed(false),
+  pending(0),
+  first_change(0),
+  generation(0)
+{
+    pthread_mutex_init( &lock, NULL );
+    memset( &stats, 0, sizeof(stats) );
+}
+
+/**
+ */
+Network::TopologyNotifier::~TopologyNotifier() {
+    if ( __atomic_load_n(&installed, __ATOMIC_ACQUIRE) == this ) {
+        __atomic_store_n( &installed, (TopologyNotifier *)NULL, __ATOMIC_RELEASE );
+    }
+    std::map<int, uint64_t>::iterator iter = subscribers.begin();
+    for ( ; iter != subscribers.end() ; ++iter )  close( iter->first );
+    if ( listen_fd != -1 )  close( listen_fd );
+    if ( timer_fd != -1 )  close( timer_fd );
+    if ( wake_fd != -1 )  close( wake_fd );
+    if ( epoll_fd != -1 )  close( epoll_fd );
+    free( _program );
+}
+
+/**
+ * The subscriber socket is optional: if another process holds the
+ * name, events are only delivered by the program.
+ */
+bool
+Network::TopologyNotifier::open() {
+    epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+    wake_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    timer_fd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+    if ( (epoll_fd < 0) or (wake_fd < 0) or (timer_fd < 0) ) {
+        log_err( "%s: cannot create event descriptors: %s", thread_name(), strerror(errno) );
+        return false;
+    }
+    watch( epoll_fd, wake_fd );
+    watch( epoll_fd, timer_fd );
+
+    struct sockaddr_un address;
+    memset( &address, 0, sizeof(address) );
+    address.sun_family = AF_UNIX;
+    memcpy( address.sun_path, SOCKET_NAME, sizeof(SOCKET_NAME) - 1 );
+    socklen_t length = offsetof(struct sockaddr_un, sun_path) + sizeof(SOCKET_NAME) - 1;
+
+    listen_fd = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    if ( (listen_fd < 0) or
+         (bind(listen_fd, (struct sockaddr *)&address, length) < 0) or
+         (listen(listen_fd, 16) < 0) ) {
+        log_warn( "%s: no subscriber socket (%s), events go to %s only",
+                  thread_name(), strerror(errno), _program );
+        if ( listen_fd != -1 )  close( listen_fd );
+        listen_fd = -1;
+    } else {
+        watch( epoll_fd, listen_fd );
+    }
+    return true;
+}
+
+/**
+ * Becomes the notifier that notify() reports to.
+ */
+bool
+Network::TopologyNotifier::start() {
+    if ( open() == false )  return false;
+    __atomic_store_n( &installed, this, __ATOMIC_RELEASE );
+    return Thread::start();
+}
+
+/**
+ * For callers that do not hold a notifier: does nothing until one has
+ * been started.
+ */
+void
+Network::TopologyNotifier::notify( const char *who ) {
+    TopologyNotifier *notifier = __atomic_load_n( &installed, __ATOMIC_ACQUIRE );
+    if ( notifier != NULL )  notifier->changed( who );
+}
+
+/**
+ * Called on the monitor thread.  Only the first change of a window
+ * makes a system call.
+ */
+void
+Network::TopologyNotifier::changed( const char *who ) {
+    __atomic_add_fetch( &stats.changes, 1, __ATOMIC_RELAXED );
+    if ( debug > 0 )  log_notice( "%s: topology change from %s", thread_name(), who );
+
+    if ( __atomic_fetch_add(&pending, 1, __ATOMIC_ACQ_REL) == 0 ) {
+        __atomic_store_n( &first_change, now_usec(), __ATOMIC_RELEASE );
+        uint64_t one = 1;
+        if ( write(wake_fd, &one, sizeof(one)) < 0 ) {
+            log_err( "%s: cannot wake notifier: %s", thread_name(), strerror(errno) );
+        }
+    }
+}
+
+/**
+ */
+void
+Network::TopologyNotifier::window( int ms ) {
+    __atomic_store_n( &window_ms, ms < 0 ? 0 : ms, __ATOMIC_RELAXED );
+}
+
+/**
+ */
+void
+Network::TopologyNotifier::program( const char *path ) {
+    char *copy = strdup( path );
+    pthread_mutex_lock( &lock );
+    char *old = _program;
+    _program = copy;
+    pthread_mutex_unlock( &lock );
+    free( old );
+}
+
+/**
+ */
+void
+Network::TopologyNotifier::statistics( TopologyStatistics& result ) {
+    pthread_mutex_lock( &lock );
+    result = stats;
+    pthread_mutex_unlock( &lock );
+    result.changes = __atomic_load_n( &stats.changes, __ATOMIC_RELAXED );
+}
+
+/**
+ * A one shot timer usec from now.  A zero it_value would disarm it.
+ */
+void
+Network::TopologyNotifier::schedule( uint64_t usec ) {
+    struct itimerspec spec;
+    memset( &spec, 0, sizeof(spec) );
+    spec.it_value.tv_sec = usec / 1000000;
+    spec.it_value.tv_nsec = (usec % 1000000) * 1000;
+    if ( usec == 0 )  spec.it_value.tv_nsec = 1;
+    timerfd_settime( timer_fd, 0, &spec, NULL );
+    armed = true;
+}
+
+/**
+ * Close the window a fixed time after its first change, so a steady
+ * stream of changes still produces an event every window.
+ */
+void
+Network::TopologyNotifier::arm() {
+    if ( armed )  return;
+    uint64_t window = (uint64_t)__atomic_load_n(&window_ms, __ATOMIC_RELAXED) * 1000;
+    uint64_t elapsed = now_usec() - __atomic_load_n( &first_change, __ATOMIC_ACQUIRE );
+    schedule( elapsed >= window ? 0 : window - elapsed );
+}
+
+/**
+ */
+void
+Network::TopologyNotifier::accept_subscriber() {
+    for (;;) {
+        int fd = accept4( listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+        if ( fd < 0 )  return;
+        if ( trusted(fd) == false ) {
+            log_warn( "%s: refused a subscriber that is neither root nor our user", thread_name() );
+            close( fd );
+            continue;
+        }
+        if ( watch(epoll_fd, fd) == false ) {
+            close( fd );
+            continue;
+        }
+        subscribers[fd] = 0;
+        pthread_mutex_lock( &lock );
+        stats.subscribers = subscribers.size();
+        pthread_mutex_unlock( &lock );
+        if ( debug > 0 )  log_notice( "%s: subscriber %d attached", thread_name(), fd );
+    }
+}
+
+/**
+ */
+void
+Network::TopologyNotifier::drop_subscriber( int fd ) {
+    if ( subscribers.erase(fd) == 0 )  return;
+    epoll_ctl( epoll_fd, EPOLL_CTL_DEL, fd, NULL );
+    close( fd );
+    pthread_mutex_lock( &lock );
+    stats.subscribers = subscribers.size();
+    pthread_mutex_unlock( &lock );
+    if ( debug > 0 )  log_notice( "%s: subscriber %d detached", thread_name(), fd );
+}
+
+/**
+ * Send a subscriber the current generation with every change it is
+ * owed.  If its socket is full the changes stay owed and it is watched
+ * for room.  Returns false if it has gone away.
+ */
+bool
+Network::TopologyNotifier::send_event( int fd, uint64_t& owed ) {
+    char message[128];
+    int length = snprintf( message, sizeof(message), "%s %lu %lu", EVENT_NAME,
+                           (unsigned long)generation, (unsigned long)owed );
+    if ( send(fd, message, length, MSG_DONTWAIT | MSG_NOSIGNAL) == length ) {
+        if ( debug > 0 )  log_notice( "%s: subscriber %d sent %lu changes", thread_name(), fd, (unsigned long)owed );
+        owed = 0;
+        watch( epoll_fd, fd, EPOLL_CTL_MOD, EPOLLIN );
+        return true;
+    }
+    if ( (errno != EAGAIN) and (errno != EWOULDBLOCK) )  return false;
+    watch( epoll_fd, fd, EPOLL_CTL_MOD, EPOLLIN | EPOLLOUT );
+    return true;
+}
+
+/**
+ * Start the event program and return without waiting for it.  It
+ * gets the same argv and empty environment genevent always had.
+ */
+bool
+Network::TopologyNotifier::spawn( uint64_t changes ) {
+    pthread_mutex_lock( &lock );
+    char *path = strdup( _program );
+    pthread_mutex_unlock( &lock );
+
+    const char *base = strrchr( path, '/' );
+    base = (base == NULL) ? path : base + 1;
+    char *argv[] = { const_cast<char*>(base), const_cast<char*>(EVENT_NAME), 0 };
+    char *envp[] = { 0 };
+
+    // the notifier's signal mask and handlers are not the program's
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init( &attributes );
+    sigset_t signals;
+    sigemptyset( &signals );
+    posix_spawnattr_setsigmask( &attributes, &signals );
+    sigfillset( &signals );
+    posix_spawnattr_setsigdefault( &attributes, &signals );
+    posix_spawnattr_setflags( &attributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF );
+
+    pid_t pid;
+    int error = posix_spawn( &pid, path, NULL, &attributes, argv, envp );
+    posix_spawnattr_destroy( &attributes );
+    if ( error != 0 ) {
+        log_err( "failed to send %s event - couldn't spawn %s: %s", EVENT_NAME, path, strerror(error) );
+        free( path );
+        return false;
+    }
+    log_notice( "%s: sent %s event to spine for %lu changes", thread_name(), EVENT_NAME, (unsigned long)changes );
+    free( path );
+
+    child = pid;
+    child_fd = process_handle( pid );
+    if ( (child_fd >= 0) and (watch(epoll_fd, child_fd) == false) ) {
+        close( child_fd );
+        child_fd = -1;
+    }
+    return true;
+}
+
+/**
+ * Returns true once the program has exited (or was reaped by someone
+ * else), false while it is still running.
+ */
+bool
+Network::TopologyNotifier::reap() {
+    int status = 0;
+    pid_t result = waitpid( child, &status, WNOHANG );
+    if ( result == 0 )  return false;
+    if ( (result == child) and (WIFEXITED(status) == false or WEXITSTATUS(status) != 0) ) {
+        log_warn( "%s: %s event program exited with status 0x%x", thread_name(), EVENT_NAME, status );
+    }
+    if ( child_fd != -1 ) {
+        epoll_ctl( epoll_fd, EPOLL_CTL_DEL, child_fd, NULL );
+        close( child_fd );
+        child_fd = -1;
+    }
+    child = 0;
+    return true;
+}
+
+/**
+ * Send one event for every change since the last.  Without
+ * subscribers, and with the program from the last event still
+ * running, the event waits for it to exit.
+ */
+void
+Network::TopologyNotifier::deliver() {
+    if ( subscribers.empty() and (child != 0) and (reap() == false) ) {
+        pthread_mutex_lock( &lock );
+        stats.deferred++;
+        pthread_mutex_unlock( &lock );
+        if ( child_fd == -1 )  schedule( (uint64_t)__atomic_load_n(&window_ms, __ATOMIC_RELAXED) * 1000 );
+        return;
+    }
+
+    uint64_t started = __atomic_load_n( &first_change, __ATOMIC_ACQUIRE );
+    uint64_t changes = __atomic_exchange_n( &pending, 0, __ATOMIC_ACQ_REL );
+    if ( changes == 0 )  return;
+    generation++;
+
+    unsigned long sent = 0, backlogged = 0;
+    bool spawned = false, failed = false;
+    if ( subscribers.empty() ) {
+        spawned = spawn( changes );
+        failed = not spawned;
+    } else {
+        std::set<int> lost;
+        std::map<int, uint64_t>::iterator iter = subscribers.begin();
+        for ( ; iter != subscribers.end() ; ++iter ) {
+            // one still behind gets this event with the rest once it has room
+            bool behind = iter->second > 0;
+            iter->second += changes;
+            if ( behind ) {
+                backlogged++;
+            } else if ( send_event(iter->first, iter->second) == false ) {
+                lost.insert( iter->first );
+            } else if ( iter->second == 0 ) {
+                sent++;
+            } else {
+                backlogged++;
+            }
+        }
+        std::set<int>::iterator fd = lost.begin();
+        for ( ; fd != lost.end() ; ++fd )  drop_subscriber( *fd );
+    }
+
+    uint64_t latency = now_usec() - started;
+    pthread_mutex_lock( &lock );
+    stats.events++;
+    stats.deliveries += sent;
+    stats.backlogged += backlogged;
+    if ( spawned )  stats.spawns++;
+    if ( failed )  stats.spawn_failures++;
+    stats.last_latency = latency;
+    if ( latency > stats.max_latency )  stats.max_latency = latency;
+    pthread_mutex_unlock( &lock );
+}
+
+/**
+ */
+void
+Network::TopologyNotifier::run() {
+    for (;;) {
+        struct epoll_event events[16];
+        int count = epoll_wait( epoll_fd, events, 16, -1 );
+        if ( count < 0 ) {
+            if ( errno == EINTR )  continue;
+            log_err( "%s: epoll_wait failed: %s", thread_name(), strerror(errno) );
+            break;
+        }
+
+        for ( int i = 0 ; i < count ; ++i ) {
+            int fd = events[i].data.fd;
+            uint64_t value;
+
+            if ( fd == wake_fd ) {
+                if ( read(wake_fd, &value, sizeof(value)) > 0 )  arm();
+                continue;
+            }
+            if ( fd == timer_fd ) {
+                if ( read(timer_fd, &value, sizeof(value)) <= 0 )  continue;
+                armed = false;
+                deliver();
+                continue;
+            }
+            if ( fd == listen_fd ) {
+                accept_subscriber();
+                continue;
+            }
+            if ( fd == child_fd ) {
+                // an event held back for the program goes out now
+                if ( reap() and (armed == false) and (__atomic_load_n(&pending, __ATOMIC_ACQUIRE) > 0) ) {
+                    deliver();
+                }
+                continue;
+            }
+
+            std::map<int, uint64_t>::iterator subscriber = subscribers.find( fd );
+            if ( subscriber == subscribers.end() )  continue;
+            if ( events[i].events & (EPOLLHUP | EPOLLERR) ) {
+                drop_subscriber( fd );
+                continue;
+            }
+            if ( (events[i].events & EPOLLOUT) and (subscriber->second > 0) ) {
+                if ( send_event(fd, subscriber->second) == false ) {
+                    drop_subscriber( fd );
+                    continue;
+                }
+                if ( subscriber->second == 0 ) {
+                    pthread_mutex_lock( &lock );
+                    stats.deliveries++;
+                    pthread_mutex_unlock( &lock );
+                }
+            }
+            if ( (events[i].events & EPOLLIN) == 0 )  continue;
+
+            // subscribers only listen; anything readable is a hangup or noise
+            char discard[64];
+            ssize_t bytes = recv( fd, discard, sizeof(discard), MSG_DONTWAIT );
+            if ( (bytes == 0) or ((bytes < 0) and (errno != EAGAIN)) ) {
+                drop_subscriber( fd );
+            }
+        }
+    }
+}
+
+/* vim: set autoindent expandtab sw=4 : */
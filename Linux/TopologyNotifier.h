@@ -0,0 +1,122 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+/** \file TopologyNotifier.h
+ * \brief Debounced, coalesced network topology change events.
+ *
+ * The monitor reports each topology change with changed(), which only
+ * counts it and, for the first change of a window, wakes the notifier
+ * thread.  When the window closes the notifier sends one event for
+ * everything that happened in it: to every subscriber connected to
+ * the abstract socket "\0redx.topology" (only root and the service's
+ * own user may connect), or, when there are none, by spawning the
+ * event program without waiting for it.  A subscriber that cannot
+ * take an event at once gets it, with any that follow, when it has
+ * room.  At most one
+ * program runs at a time; changes that arrive meanwhile are folded
+ * into the next event.
+ */
+
+#ifndef _TOPOLOGY_NOTIFIER_H_
+#define _TOPOLOGY_NOTIFIER_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include <map>
+
+#include "Thread.h"
+
+namespace Network {
+
+    /**
+     * Latencies are in microseconds, from the first change of a window
+     * to the delivery of its event.
+     */
+    struct TopologyStatistics {
+        unsigned long changes;
+        unsigned long events;
+        unsigned long deliveries;
+        unsigned long backlogged;
+        unsigned long spawns;
+        unsigned long spawn_failures;
+        unsigned long deferred;
+        unsigned long subscribers;
+        uint64_t last_latency;
+        uint64_t max_latency;
+    };
+
+    /**
+     */
+    class TopologyNotifier : public Thread {
+    private:
+        static TopologyNotifier *installed;
+
+        int window_ms;
+        char *_program;
+        int epoll_fd;
+        int wake_fd;
+        int timer_fd;
+        int listen_fd;
+        int child_fd;
+        pid_t child;
+        bool armed;
+        uint64_t pending;
+        uint64_t first_change;
+        uint64_t generation;
+        std::map<int, uint64_t> subscribers;
+        pthread_mutex_t lock;
+        TopologyStatistics stats;
+
+        bool open();
+        void arm();
+        void schedule( uint64_t );
+        void accept_subscriber();
+        void drop_subscriber( int );
+        bool send_event( int, uint64_t& );
+        void deliver();
+        bool spawn( uint64_t );
+        bool reap();
+    public:
+        static const char *EVENT_NAME;
+
+        TopologyNotifier( const char *, int );
+        virtual ~TopologyNotifier();
+        virtual void run();
+        virtual bool start();
+
+        static void notify( const char * );
+        void changed( const char * );
+
+        int window() const { return window_ms; }
+        void window( int );
+        const char *program() const { return _program; }
+        void program( const char * );
+        void statistics( TopologyStatistics& );
+    };
+
+}
+
+#endif
+
+/* vim: set autoindent expandtab sw=4 : */
@@ -0,0 +1,291 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** \file netlink-bench.cc
+ * \brief Replay captured netlink dumps through the message decoders.
+ *
+ * Datagrams are either captured live (link, address, route and
+ * neighbor dumps) or loaded from a file written by an earlier -w run.
+ * They are then decoded repeatedly, once through the stack based
+ * RouteSocket::dispatch() path and once through the heap allocating
+ * Factory() path, and the cost per message is reported for each.
+ *
+ * The capture file is a sequence of datagrams, each preceded by its
+ * length as a native uint32_t.
+ *
+ *   netlink-bench [-r file | -w file] [-n iterations]
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+
+#include "NetLink.h"
+
+namespace {
+    int debug = 0;
+
+    static const int MAX_DATAGRAMS = 65536;
+
+    struct datagram {
+        uint32_t length;
+        struct nlmsghdr *data;
+    };
+
+    datagram capture[ MAX_DATAGRAMS ];
+    int captured = 0;
+
+    /**
+     * Looks at what the network monitor looks at: the fixed header
+     * for every message, and the attributes only for links.
+     */
+    class Counter : public NetLink::RouteReceiveCallbackInterface {
+    public:
+        unsigned long messages;
+        unsigned long checksum;
+        Counter() : messages(0), checksum(0) {}
+        virtual ~Counter() {}
+        virtual void receive( NetLink::NewLink *m )     { messages++; checksum += m->index() + m->name()[0]; }
+        virtual void receive( NetLink::DelLink *m )     { messages++; checksum += m->index(); }
+        virtual void receive( NetLink::NewRoute *m )    { messages++; checksum += m->scope(); }
+        virtual void receive( NetLink::DelRoute *m )    { messages++; checksum += m->scope(); }
+        virtual void receive( NetLink::NewAddress *m )  { messages++; checksum += m->index(); }
+        virtual void receive( NetLink::DelAddress *m )  { messages++; checksum += m->index(); }
+        virtual void receive( NetLink::NewNeighbor *m ) { messages++; }
+        virtual void receive( NetLink::DelNeighbor *m ) { messages++; }
+        virtual void receive( NetLink::RouteMessage *m ) { messages++; }
+        virtual void receive( NetLink::RouteError *m )  { }
+    };
+
+    uint64_t now_nsec() {
+        struct timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        return ((uint64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+    }
+
+    void remember( void *data, uint32_t length ) {
+        if ( captured >= MAX_DATAGRAMS ) return;
+        capture[captured].length = length;
+        capture[captured].data = (struct nlmsghdr *)malloc( length );
+        memcpy( capture[captured].data, data, length );
+        captured++;
+    }
+
+    /**
+     * Send one dump request and keep every datagram of the response.
+     */
+    void dump( int fd, uint16_t type, unsigned char family ) {
+        struct {
+            struct nlmsghdr n;
+            struct rtgenmsg g;
+        } request;
+        memset( &request, 0, sizeof(request) );
+        request.n.nlmsg_len = sizeof(request);
+        request.n.nlmsg_type = type;
+        request.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+        request.n.nlmsg_seq = type;
+        request.g.rtgen_family = family;
+
+        if ( send(fd, &request, sizeof(request), 0) < 0 ) {
+            perror( "netlink dump request" );
+            return;
+        }
+
+        char buffer[32 * 1024];
+        for (;;) {
+            ssize_t bytes = recv( fd, buffer, sizeof(buffer), 0 );
+            if ( bytes < 0 ) {
+                if ( errno == EINTR ) continue;
+                perror( "netlink dump recv" );
+                return;
+            }
+            if ( bytes == 0 ) return;
+            remember( buffer, bytes );
+
+            bool done = false;
+            unsigned int length = bytes;
+            struct nlmsghdr *h = (struct nlmsghdr *)buffer;
+            while ( NLMSG_OK(h, length) ) {
+                if ( h->nlmsg_type == NLMSG_DONE )  done = true;
+                if ( h->nlmsg_type == NLMSG_ERROR )  done = true;
+                h = NLMSG_NEXT( h, length );
+            }
+            if ( done ) return;
+        }
+    }
+
+    bool capture_live() {
+        int fd = socket( AF_NETLINK, SOCK_RAW, NETLINK_ROUTE );
+        if ( fd < 0 ) {
+            perror( "netlink socket" );
+            return false;
+        }
+        dump( fd, RTM_GETLINK, AF_PACKET );
+        dump( fd, RTM_GETADDR, AF_UNSPEC );
+        dump( fd, RTM_GETROUTE, AF_UNSPEC );
+        dump( fd, RTM_GETNEIGH, AF_UNSPEC );
+        close( fd );
+        return true;
+    }
+
+    bool load( const char *path ) {
+        FILE *f = fopen( path, "r" );
+        if ( f == NULL ) {
+            perror( path );
+            return false;
+        }
+        uint32_t length;
+        while ( fread(&length, sizeof(length), 1, f) == 1 ) {
+            if ( captured >= MAX_DATAGRAMS ) break;
+            struct nlmsghdr *data = (struct nlmsghdr *)malloc( length );
+            if ( fread(data, length, 1, f) != 1 ) {
+                free( data );
+                break;
+            }
+            capture[captured].length = length;
+            capture[captured].data = data;
+            captured++;
+        }
+        fclose( f );
+        return true;
+    }
+
+    bool save( const char *path ) {
+        FILE *f = fopen( path, "w" );
+        if ( f == NULL ) {
+            perror( path );
+            return false;
+        }
+        for ( int i = 0 ; i < captured ; ++i ) {
+            fwrite( &capture[i].length, sizeof(capture[i].length), 1, f );
+            fwrite( capture[i].data, capture[i].length, 1, f );
+        }
+        fclose( f );
+        return true;
+    }
+
+    /**
+     * The old receive path -- one heap allocated message per nlmsg.
+     */
+    NetLink::RouteMessage *factory( struct nlmsghdr *h ) {
+        using namespace NetLink;
+        switch ( h->nlmsg_type ) {
+        case RTM_NEWLINK:  return NewLink::Factory( h );
+        case RTM_DELLINK:  return DelLink::Factory( h );
+        case RTM_NEWADDR:  return NewAddress::Factory( h );
+        case RTM_DELADDR:  return DelAddress::Factory( h );
+        case RTM_NEWROUTE: return NewRoute::Factory( h );
+        case RTM_DELROUTE: return DelRoute::Factory( h );
+        case RTM_NEWNEIGH: return NewNeighbor::Factory( h );
+        case RTM_DELNEIGH: return DelNeighbor::Factory( h );
+        }
+        return RouteMessage::Factory( h );
+    }
+
+    void replay_factory( Counter *counter ) {
+        for ( int i = 0 ; i < captured ; ++i ) {
+            struct nlmsghdr *h = capture[i].data;
+            unsigned int length = capture[i].length;
+            while ( NLMSG_OK(h, length) ) {
+                if ( (h->nlmsg_type == NLMSG_DONE) or (h->nlmsg_type == NLMSG_ERROR) ) break;
+                NetLink::RouteMessage *message = factory( h );
+                message->deliver( counter );
+                delete message;
+                h = NLMSG_NEXT( h, length );
+            }
+        }
+    }
+
+    void replay_dispatch( Counter *counter ) {
+        for ( int i = 0 ; i < captured ; ++i ) {
+            NetLink::RouteSocket::dispatch( capture[i].data, capture[i].length, counter );
+        }
+    }
+
+    void report( const char *name, Counter& counter, uint64_t elapsed ) {
+        double per_message = 0.0;
+        if ( counter.messages > 0 )  per_message = (double)elapsed / counter.messages;
+        printf( "%-10s %10lu messages %12.3f ms %10.1f ns/message\n",
+                name, counter.messages, elapsed / 1000000.0, per_message );
+    }
+}
+
+/**
+ */
+int main( int argc, char **argv ) {
+    const char *read_path = NULL;
+    const char *write_path = NULL;
+    int iterations = 1000;
+
+    int opt;
+    while ( (opt = getopt(argc, argv, "r:w:n:d")) != -1 ) {
+        switch ( opt ) {
+        case 'r': read_path = optarg; break;
+        case 'w': write_path = optarg; break;
+        case 'n': iterations = atoi( optarg ); break;
+        case 'd': debug++; break;
+        default:
+            fprintf( stderr, "usage: %s [-r file | -w file] [-n iterations]\n", argv[0] );
+            exit( 1 );
+        }
+    }
+
+    bool loaded = (read_path != NULL) ? load( read_path ) : capture_live();
+    if ( loaded == false )  exit( 1 );
+
+    size_t bytes = 0;
+    for ( int i = 0 ; i < captured ; ++i )  bytes += capture[i].length;
+    printf( "%d datagrams, %zu bytes, %d iterations\n", captured, bytes, iterations );
+
+    if ( write_path != NULL ) {
+        if ( save(write_path) == false )  exit( 1 );
+        printf( "saved capture to %s\n", write_path );
+    }
+
+    Counter heap;
+    uint64_t start = now_nsec();
+    for ( int i = 0 ; i < iterations ; ++i )  replay_factory( &heap );
+    report( "factory", heap, now_nsec() - start );
+
+    Counter stack;
+    start = now_nsec();
+    for ( int i = 0 ; i < iterations ; ++i )  replay_dispatch( &stack );
+    report( "dispatch", stack, now_nsec() - start );
+
+    if ( heap.checksum != stack.checksum ) {
+        fprintf( stderr, "decoders disagree: checksum %lu != %lu\n", heap.checksum, stack.checksum );
+        exit( 1 );
+    }
+    return 0;
+}
+
+/* vim: set autoindent expandtab sw=4 : */
@@ -130,6 +130,10 @@ namespace Network {
         const struct timeval * last_advertised() const { return &neighbor_advertised; }
 
         bool reported;
+
+        // owned by the Interface neighbor table
+        int table_position;
+        int aging_slot;
     };
 
     /**
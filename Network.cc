@@ -62,6 +62,8 @@
 #include "host_table.h"
 #include "NetLink.h"
 #include "Network.h"
+#include "TopologyNotifier.h"
+#include "ProcessManager.h"
 
 namespace { int debug = 0; }
 
@@ -168,7 +170,7 @@ void Network::Monitor::receive( NetLink::NewLink *message ) {
              interface->not_sync() and interface->not_listening_to("udp6", 123) ) { // NTP
             log_notice( "%s is not listening to port 123 on its primary address, restart ntpd",
                                 interface->name() );
-            system( "/usr/bin/config_ntpd --restart" );
+            Process::Manager::shared()->shell( "/usr/bin/config_ntpd --restart" );
         }
 
     } else { // if we do have it ... look for state changes
@@ -189,7 +191,7 @@ void Network::Monitor::receive( NetLink::NewLink *message ) {
                      interface->not_sync() and interface->not_listening_to("udp6", 123) ) { // NTP
                     log_notice( "%s is not listening to port 123 on its primary address, restart ntpd",
                                         interface->name() );
-                    system( "/usr/bin/config_ntpd --restart" );
+                    Process::Manager::shared()->shell( "/usr/bin/config_ntpd --restart" );
                 }
 
             } else {
@@ -375,7 +377,7 @@ void Network::Monitor::receive( NetLink::NewAddress *message ) {
              interface->not_listening_to("udp6", 123) ) { // NTP
             log_notice( "%s is not listening to port 123 on its primary address, restart ntpd",
                                 interface->name() );
-            system( "/usr/bin/config_ntpd --restart" );
+            Process::Manager::shared()->shell( "/usr/bin/config_ntpd --restart" );
         }
     } else {
         if ( debug > 0 ) {
@@ -603,33 +605,12 @@ Network::Monitor::find_physical_interface( Interface *interface ) {
 }
 
 /**
+ * Events are coalesced and delivered by the topology notifier, so
+ * the monitor never forks or waits here.
  */
 static bool
 send_topology_event( const char *who ) {
-    log_notice( "%s sending NetTopologyUpdate event to spine", who );
-
-    char *event_name = const_cast<char*>("SuperNova::NetTopologyUpdate");
-    pid_t child = fork();
-
-    if ( child < 0 ) {
-        log_err( "failed to send %s event - couldn't fork", event_name );
-        return false;
-    }
-
-    if ( child > 0 ) {
-        int status;
-        waitpid( child, &status, 0);
-        return true;
-    }
-
-    char *argv[] = { const_cast<char*>("genevent"), event_name, 0 };
-    char *envp[] = { 0 };
-    if ( execve("/usr/lib/spine/bin/genevent", argv, envp) < 0 ) {
-        log_err( "failed to send %s event - couldn't execve", event_name );
-        _exit( 0 );
-    }
-
-    // NOT REACHED
+    Network::TopologyNotifier::notify( who );
     return true;
 }
 
@@ -149,6 +149,38 @@ Network::Monitor::run() {
     abort();
 }
 
+/**
+ * Account for one batch of events delivered by the event loop.
+ */
+void
+Network::Monitor::record_batch( int events, uint64_t latency ) {
+    stats.batches++;
+    stats.events += events;
+    if ( (uint64_t)events > stats.largest_batch )  stats.largest_batch = events;
+    stats.last_latency = latency;
+    stats.total_latency += latency;
+    if ( latency > stats.max_latency )  stats.max_latency = latency;
+}
+
+/**
+ * Periodic work done by the event loop once every interval,
+ * independent of how many events arrive.
+ */
+void
+Network::Monitor::tick() {
+    stats.ticks++;
+
+    std::map<int, Network::Interface *>::const_iterator iter = interfaces.begin();
+    while ( iter != interfaces.end() ) {
+        Network::Interface *interface = iter->second;
+        if ( interface != NULL )  interface->expire_neighbors();
+        iter++;
+    }
+
+    advertise();
+    update_hosts();
+}
+
 /** Iterate and call a callback for each Network::Interface.
  */
 int
@@ -165,6 +197,74 @@ Network::Monitor::each_interface( Network::InterfaceIterator& callback ) {
     return result;
 }
 
+namespace {
+
+    const uint32_t INITIAL_NODE_SLOTS = 256;
+
+    inline void node_key( UUID& uuid, uint64_t *hi, uint64_t *lo ) {
+        memcpy( hi, uuid.raw(), sizeof(*hi) );
+        memcpy( lo, uuid.raw() + sizeof(*hi), sizeof(*lo) );
+    }
+
+    inline uint32_t node_hash( uint64_t hi, uint64_t lo ) {
+        uint64_t h = hi ^ (lo * 0x9e3779b97f4a7c15ULL);
+        h ^= h >> 32;
+        h *= 0xd6e8feb86659fd93ULL;
+        h ^= h >> 32;
+        return (uint32_t)h;
+    }
+
+    Network::NodeIndex *new_node_index( uint32_t slots ) {
+        Network::NodeIndex *index = (Network::NodeIndex *)malloc( sizeof(Network::NodeIndex) );
+        index->mask = slots - 1;
+        index->count = 0;
+        index->key_hi = (uint64_t *)calloc( slots, sizeof(uint64_t) );
+        index->key_lo = (uint64_t *)calloc( slots, sizeof(uint64_t) );
+        index->nodes = (Network::Node **)calloc( slots, sizeof(Network::Node *) );
+        return index;
+    }
+
+    void free_node_index( Network::NodeIndex *index ) {
+        free( index->key_hi );
+        free( index->key_lo );
+        free( index->nodes );
+        free( index );
+    }
+
+    /**
+     * Safe against a concurrent writer in the sense that it always
+     * terminates; the caller's sequence check decides if the answer
+     * is any good.
+     */
+    Network::Node *probe_node( Network::NodeIndex *index, uint64_t hi, uint64_t lo ) {
+        uint32_t slot = node_hash( hi, lo ) & index->mask;
+        for ( uint32_t n = 0 ; n <= index->mask ; ++n ) {
+            Network::Node *node = __atomic_load_n( &(index->nodes[slot]), __ATOMIC_RELAXED );
+            if ( node == NULL )  return NULL;
+            if ( (__atomic_load_n(&(index->key_hi[slot]), __ATOMIC_RELAXED) == hi) and
+                 (__atomic_load_n(&(index->key_lo[slot]), __ATOMIC_RELAXED) == lo) ) {
+                return node;
+            }
+            slot = (slot + 1) & index->mask;
+        }
+        return NULL;
+    }
+
+    /**
+     * Writers bracket every change to the index with these, while
+     * holding node_table_lock.
+     */
+    inline void write_begin( uint32_t *sequence ) {
+        __atomic_store_n( sequence, *sequence + 1, __ATOMIC_RELAXED );
+        __atomic_thread_fence( __ATOMIC_RELEASE );
+    }
+
+    inline void write_end( uint32_t *sequence ) {
+        __atomic_store_n( sequence, *sequence + 1, __ATOMIC_RELEASE );
+    }
+
+}
+
 /** Iterate and call a callback for each Node.
  */
 int
@@ -172,63 +272,114 @@ Network::Monitor::each_node( NodeIterator& callback ) {
     int result = 0;
 
     pthread_mutex_lock( &node_table_lock );
-    for ( int i = 0 ; i < NODE_TABLE_SIZE ; ++i ) {
-        Network::Node& node = node_table[i];
-        if ( node.is_invalid() ) continue;
-        result += callback( &node );
+    for ( size_t chunk = 0 ; chunk < node_chunks.size() ; ++chunk ) {
+        for ( int i = 0 ; i < NODE_CHUNK_SIZE ; ++i ) {
+            Network::Node& node = node_chunks[chunk][i];
+            if ( node.is_invalid() ) continue;
+            result += callback( &node );
+        }
     }
     pthread_mutex_unlock( &node_table_lock );
 
     return result;
 }
-
+
 /**
- *
+ * Take a node from the free list, mapping another chunk of them
+ * if there are none.  Called with node_table_lock held.
  */
 Network::Node*
-Network::Monitor::intern_node( UUID& uuid ) {
-    int in_use_count = 0;
-    Network::Node *result = NULL;
-    Network::Node *available = NULL;
-
-    pthread_mutex_lock( &node_table_lock );
-    int i = 0;
-    for ( ; i < NODE_TABLE_SIZE ; ++i ) {
-        Network::Node& node = node_table[i];
-        if ( node.is_invalid() ) {
-            available = &node;
-            continue;
+Network::Monitor::allocate_node() {
+    if ( free_nodes.empty() ) {
+        size_t size = sizeof(Node) * NODE_CHUNK_SIZE;
+        Node *chunk = (Node *)mmap( 0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, 0, 0 );
+        if ( chunk == MAP_FAILED ) {
+            log_err( "node table alloc failed" );
+            return NULL;
         }
-        in_use_count += 1;
-        if ( node != uuid ) continue;
-        result = &node;
-        break;
-    }
-    if ( in_use_count > 256 ) {
-        if ( table_warning_reported == false ) {
-            log_warn( "WARNING: node table exceeds 256 entries" );
-            table_warning_reported = true;
+        for ( int i = NODE_CHUNK_SIZE - 1 ; i >= 0 ; --i ) {
+            chunk[i].invalidate();
+            free_nodes.push_back( &chunk[i] );
         }
+        node_chunks.push_back( chunk );
+        if ( debug > 0 ) log_notice( "node table chunk %zu is at %p", node_chunks.size(), chunk );
     }
-    if ( result == NULL ) {
-        if ( available == NULL ) {        // EDM ??? wasn't this set above ???
-            for ( ; i < NODE_TABLE_SIZE ; ++i ) {
-                Network::Node& node = node_table[i];
-                if ( node.is_valid() ) continue;
-                available = &node;
-                break;
-            }
-        }
 
-        if ( available != NULL ) {
-            available->uuid( uuid );
-            result = available;
-        } else {
-            if ( table_error_reported == false ) {
-                log_err( "ERROR: node table is full" );
-                table_error_reported = true;
-            }
+    Node *node = free_nodes.back();
+    free_nodes.pop_back();
+    return node;
+}
+
+/**
+ * Add a node to the current index.  Called with node_table_lock
+ * held and inside a write sequence, or on an index not yet published.
+ */
+void
+Network::Monitor::insert_node( Node *node ) {
+    NodeIndex *index = node_index;
+    uint64_t hi, lo;
+    node_key( node->uuid(), &hi, &lo );
+
+    uint32_t slot = node_hash( hi, lo ) & index->mask;
+    while ( index->nodes[slot] != NULL ) {
+        slot = (slot + 1) & index->mask;
+    }
+    __atomic_store_n( &(index->key_hi[slot]), hi, __ATOMIC_RELAXED );
+    __atomic_store_n( &(index->key_lo[slot]), lo, __ATOMIC_RELAXED );
+    __atomic_store_n( &(index->nodes[slot]), node, __ATOMIC_RELAXED );
+    index->count++;
+}
+
+/**
+ * Double the index.  The new one is filled before it is published,
+ * and the old one is retired rather than freed.
+ */
+void
+Network::Monitor::grow_node_index() {
+    NodeIndex *old = node_index;
+    NodeIndex *index = new_node_index( (old->mask + 1) * 2 );
+
+    for ( uint32_t slot = 0 ; slot <= old->mask ; ++slot ) {
+        Node *node = old->nodes[slot];
+        if ( node == NULL ) continue;
+        uint32_t i = node_hash( old->key_hi[slot], old->key_lo[slot] ) & index->mask;
+        while ( index->nodes[i] != NULL )  i = (i + 1) & index->mask;
+        index->key_hi[i] = old->key_hi[slot];
+        index->key_lo[i] = old->key_lo[slot];
+        index->nodes[i] = node;
+        index->count++;
+    }
+
+    __atomic_store_n( &node_index, index, __ATOMIC_RELEASE );
+    retired_indexes.push_back( old );
+    if ( debug > 0 ) log_notice( "node index grown to %u slots", index->mask + 1 );
+}
+
+/**
+ * Find the node for this UUID, creating it if it is new.  The common
+ * case -- a node that is already known -- takes no lock.
+ */
+Network::Node*
+Network::Monitor::intern_node( UUID& uuid ) {
+    Network::Node *result = find_node( &uuid );
+    if ( result != NULL )  return result;
+
+    uint64_t hi, lo;
+    node_key( uuid, &hi, &lo );
+
+    pthread_mutex_lock( &node_table_lock );
+    result = probe_node( node_index, hi, lo );
+    if ( result == NULL ) {
+        result = allocate_node();
+    }
+    if ( (result != NULL) and result->is_invalid() ) {
+        result->uuid( uuid );
+        write_begin( &node_table_sequence );
+        if ( (node_index->count + 1) * 4 > (node_index->mask + 1) * 3 ) {
+            grow_node_index();
         }
+        insert_node( result );
+        write_end( &node_table_sequence );
     }
     pthread_mutex_unlock( &node_table_lock );
 
@@ -236,40 +387,72 @@ Network::Monitor::intern_node( UUID& uuid ) {
 }
 
 /**
- *
+ * Remove the node from the index and invalidate it.  Later entries
+ * in the probe run are shifted back over the hole, so there are no
+ * tombstones to accumulate.
  */
 bool
 Network::Monitor::remove_node( UUID *uuid ) {
+    uint64_t hi, lo;
+    node_key( *uuid, &hi, &lo );
+
     pthread_mutex_lock( &node_table_lock );
-    for ( int i = 0 ; i < NODE_TABLE_SIZE ; ++i ) {
-        Network::Node& node = node_table[i];
-        if ( node.is_invalid() ) continue;
-        if ( node != *uuid ) continue;
-        node.invalidate();
+    NodeIndex *index = node_index;
+    uint32_t hole = node_hash( hi, lo ) & index->mask;
+    for (;;) {
+        if ( index->nodes[hole] == NULL ) {
+            pthread_mutex_unlock( &node_table_lock );
+            return true;
+        }
+        if ( (index->key_hi[hole] == hi) and (index->key_lo[hole] == lo) ) break;
+        hole = (hole + 1) & index->mask;
+    }
+
+    Node *node = index->nodes[hole];
+
+    write_begin( &node_table_sequence );
+    __atomic_store_n( &(index->nodes[hole]), (Node *)NULL, __ATOMIC_RELAXED );
+    uint32_t slot = hole;
+    for (;;) {
+        slot = (slot + 1) & index->mask;
+        if ( index->nodes[slot] == NULL ) break;
+        uint32_t home = node_hash( index->key_hi[slot], index->key_lo[slot] ) & index->mask;
+        // leave it if its home is cyclically within (hole, slot]
+        if ( ((slot - home) & index->mask) < ((slot - hole) & index->mask) ) continue;
+        __atomic_store_n( &(index->key_hi[hole]), index->key_hi[slot], __ATOMIC_RELAXED );
+        __atomic_store_n( &(index->key_lo[hole]), index->key_lo[slot], __ATOMIC_RELAXED );
+        __atomic_store_n( &(index->nodes[hole]), index->nodes[slot], __ATOMIC_RELAXED );
+        __atomic_store_n( &(index->nodes[slot]), (Node *)NULL, __ATOMIC_RELAXED );
+        hole = slot;
     }
+    index->count--;
+    write_end( &node_table_sequence );
+
+    node->invalidate();
+    free_nodes.push_back( node );
     pthread_mutex_unlock( &node_table_lock );
 
     return true;
 }
 
 /**
- *
+ * Lock free lookup, retried if a writer got in the way.
  */
 Network::Node*
 Network::Monitor::find_node( UUID *uuid ) {
-    using namespace Network;
-    Node *result = NULL;
+    uint64_t hi, lo;
+    node_key( *uuid, &hi, &lo );
 
-    pthread_mutex_lock( &node_table_lock );
-    for ( int i = 0 ; i < NODE_TABLE_SIZE ; ++i ) {
-        Network::Node& node = node_table[i];
-        if ( node.is_invalid() ) continue;
-        if ( node != *uuid ) continue;
-        result = &node;
+    for (;;) {
+        uint32_t sequence = __atomic_load_n( &node_table_sequence, __ATOMIC_ACQUIRE );
+        if ( sequence & 1 ) continue;
+        NodeIndex *index = __atomic_load_n( &node_index, __ATOMIC_ACQUIRE );
+        Node *result = probe_node( index, hi, lo );
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        if ( __atomic_load_n(&node_table_sequence, __ATOMIC_RELAXED) == sequence ) {
+            return result;
+        }
     }
-    pthread_mutex_unlock( &node_table_lock );
-
-    return result;
 }
 
 /**
@@ -287,15 +470,17 @@ Network::Monitor::save_cache() {
     int partner_count = 0;
 
     pthread_mutex_lock( &node_table_lock );
-    for ( int i = 0 ; i < NODE_TABLE_SIZE ; ++i ) {
-        Network::Node& node = node_table[i];
-        if ( node.is_invalid() ) continue;
-        if ( node.not_partner() ) continue;
-        if ( debug ) log_notice( "save partner [%s]", node.uuid().to_s() );
-        if ( partner_count == 0 ) {
-            fprintf( f, "%s\n", node.uuid().to_s() );
+    for ( size_t chunk = 0 ; chunk < node_chunks.size() ; ++chunk ) {
+        for ( int i = 0 ; i < NODE_CHUNK_SIZE ; ++i ) {
+            Network::Node& node = node_chunks[chunk][i];
+            if ( node.is_invalid() ) continue;
+            if ( node.not_partner() ) continue;
+            if ( debug ) log_notice( "save partner [%s]", node.uuid().to_s() );
+            if ( partner_count == 0 ) {
+                fprintf( f, "%s\n", node.uuid().to_s() );
+            }
+            partner_count++;
         }
-        partner_count++;
     }
     pthread_mutex_unlock( &node_table_lock );
 
@@ -357,122 +542,159 @@ Network::Monitor::load_cache() {
     node->make_partner();
 }
 
-/**
- */
-class WriteHostsForNeighbors : public Network::NeighborIterator {
-    int fd;
-public:
-    WriteHostsForNeighbors( int fd ) : fd(fd) {}
-    virtual ~WriteHostsForNeighbors() {}
-    virtual int operator() ( Network::Peer& neighbor ) {
-        struct host_entry entry;
-        memset( &entry, 0, sizeof(entry) );
-
-        Network::Node *node = neighbor.node();
-        if ( node == NULL ) {
-            return 0;
+namespace {
+    /**
+     * Collects the host entries for the current topology, in the order
+     * they are laid out in the table.
+     */
+    class HostEntries {
+    public:
+        struct host_entry entry[HOST_TABLE_ENTRIES];
+        int count;
+        HostEntries() : count(0) {
+            memset( entry, 0, sizeof(entry) );
         }
-        if ( node->not_partner() ) {
-            return 0;
+        void add( const struct host_entry& e ) {
+            if ( count < HOST_TABLE_ENTRIES ) {
+                entry[count++] = e;
+            } else {
+                log_err( "host table full, dropping entry" );
+            }
         }
+    };
 
-        entry.flags.valid = 1;
-        entry.flags.partner = neighbor.is_partner();
-        entry.node.ordinal = node->ordinal();
-        entry.interface.ordinal = neighbor.ordinal();
-        entry.flags.is_private = neighbor.is_private();
-        neighbor.copy_address( &(entry.primary_address) );
-
-        if ( debug > 1 ) log_notice( "write host entry for peer" );
-        // populate entry for the interface itself
-        ssize_t bytes = write( fd, &entry, sizeof(entry) );
-        if ( (size_t)bytes < sizeof(entry) ) {
-            log_err( "write failed creating hosts entry peer" );
-        }
+    /**
+     */
+    class WriteHostsForNeighbors : public Network::NeighborIterator {
+        HostEntries& table;
+    public:
+        WriteHostsForNeighbors( HostEntries& table ) : table(table) {}
+        virtual ~WriteHostsForNeighbors() {}
+        virtual int operator() ( Network::Peer& neighbor ) {
+            struct host_entry entry;
+            memset( &entry, 0, sizeof(entry) );
+
+            Network::Node *node = neighbor.node();
+            if ( node == NULL ) {
+                return 0;
+            }
+            if ( node->not_partner() ) {
+                return 0;
+            }
 
-        return 0;
-    }
-};
+            entry.flags.valid = 1;
+            entry.flags.partner = neighbor.is_partner();
+            entry.node.ordinal = node->ordinal();
+            entry.interface.ordinal = neighbor.ordinal();
+            entry.flags.is_private = neighbor.is_private();
+            neighbor.copy_address( &(entry.primary_address) );
 
-/**
- */
-class WriteHostsForInterface : public Network::InterfaceIterator {
-    int fd;
-public:
-    WriteHostsForInterface( int fd ) : fd(fd) {}
-    virtual ~WriteHostsForInterface() {}
-    virtual int operator() ( Network::Interface * interface ) {
-        struct host_entry entry;
-        memset( &entry, 0, sizeof(entry) );
-
-        entry.flags.valid = 1;
-        entry.flags.partner = 0;
-        entry.node.ordinal = gethostid();
-        entry.flags.is_private = 0 /* interface->is_private() */ ;
-        entry.interface.ordinal = interface->ordinal();
-        interface->lladdr( &entry.primary_address );
-
-        unsigned char *mac = interface->mac();
-        entry.mac[0] = mac[0];
-        entry.mac[1] = mac[1];
-        entry.mac[2] = mac[2];
-        entry.mac[3] = mac[3];
-        entry.mac[4] = mac[4];
-        entry.mac[5] = mac[5];
-
-        if ( interface->not_bridge() /* and interface->not_private() */ ) {
+            if ( debug > 1 ) log_notice( "host entry for peer" );
+            table.add( entry );
             return 0;
         }
-        if ( debug > 1 ) log_notice( "write host entry for %s", interface->name() );
-        // populate entry for the interface itself
-        ssize_t bytes = write( fd, &entry, sizeof(entry) );
-        if ( (size_t)bytes < sizeof(entry) ) {
-            log_err( "write failed creating hosts entry" );
-        }
+    };
 
-        // call iterator for each neighbor
-        WriteHostsForNeighbors callback(fd);
-        interface->each_neighbor( callback );
+    /**
+     */
+    class WriteHostsForInterface : public Network::InterfaceIterator {
+        HostEntries& table;
+    public:
+        WriteHostsForInterface( HostEntries& table ) : table(table) {}
+        virtual ~WriteHostsForInterface() {}
+        virtual int operator() ( Network::Interface * interface ) {
+            struct host_entry entry;
+            memset( &entry, 0, sizeof(entry) );
+
+            entry.flags.valid = 1;
+            entry.flags.partner = 0;
+            entry.node.ordinal = gethostid();
+            entry.flags.is_private = 0 /* interface->is_private() */ ;
+            entry.interface.ordinal = interface->ordinal();
+            interface->lladdr( &entry.primary_address );
+
+            unsigned char *mac = interface->mac();
+            entry.mac[0] = mac[0];
+            entry.mac[1] = mac[1];
+            entry.mac[2] = mac[2];
+            entry.mac[3] = mac[3];
+            entry.mac[4] = mac[4];
+            entry.mac[5] = mac[5];
+
+            if ( interface->not_bridge() /* and interface->not_private() */ ) {
+                return 0;
+            }
+            if ( debug > 1 ) log_notice( "host entry for %s", interface->name() );
+            // populate entry for the interface itself
+            table.add( entry );
 
-        return 0;
-    }
-};
+            // call iterator for each neighbor
+            WriteHostsForNeighbors callback( table );
+            interface->each_neighbor( callback );
+
+            return 0;
+        }
+    };
+}
 
 /**
+ * Map the hosts file, creating or reformatting it if it is not a
+ * host table of the current version.  A generation left odd by a
+ * monitor that died mid-update is made even again; the entries are
+ * all rewritten on the next update anyway.
  */
-static int
-mkfile( char *path, size_t size ) {
-    int result = 0;
-    void *addr;
-    int fd;
-
-    fd = open("/dev/zero", O_RDWR);
+bool
+Network::Monitor::open_host_table() {
+    int fd = open( "hosts", O_RDWR | O_CREAT, 0644 );
     if ( fd < 0 ) {
-        log_err( "[mkfile] could not map /dev/zero" );
-        return 0;
+        if ( debug > 0 ) log_err( "could not open the hosts table" );
+        return false;
     }
-    addr = mmap( 0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
-    close( fd );
 
-    fd = open( path, O_CREAT | O_WRONLY | O_TRUNC, 0644 );
-    for (;;) {
-        if ( fd < 0 ) {
-            log_err( "[mkfile] open failed creating %s", path );
-            break;
-        }
-        ssize_t bytes = write(fd, addr, size);
-        if ( (size_t)bytes == size ) {
-            result = 1;
-        } else {
-            log_err( "write failed creating %s", path );
+    struct stat st;
+    if ( fstat(fd, &st) < 0 ) {
+        close( fd );
+        return false;
+    }
+    bool reformat = ((size_t)st.st_size != sizeof(struct host_table));
+    if ( reformat ) {
+        if ( (ftruncate(fd, 0) < 0) or (ftruncate(fd, sizeof(struct host_table)) < 0) ) {
+            log_err( "could not size the hosts table" );
+            close( fd );
+            return false;
         }
+    }
+
+    void *address = mmap( 0, sizeof(struct host_table), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if ( address == MAP_FAILED ) {
+        log_err( "could not map the hosts table" );
         close( fd );
-        break;
+        return false;
     }
 
-done:
-    munmap( addr, size );
-    return result;
+    struct host_table *table = (struct host_table *)address;
+    struct host_table_header& header = table->header;
+    if ( (header.magic != HOST_TABLE_MAGIC) or (header.version != HOST_TABLE_VERSION) or
+         (header.entries != HOST_TABLE_ENTRIES) or (header.count > HOST_TABLE_ENTRIES) ) {
+        reformat = true;
+    }
+    if ( reformat ) {
+        memset( table, 0, sizeof(*table) );
+        header.version = HOST_TABLE_VERSION;
+        header.entries = HOST_TABLE_ENTRIES;
+        __atomic_store_n( &(header.magic), HOST_TABLE_MAGIC, __ATOMIC_RELEASE );
+        msync( table, sizeof(*table), MS_SYNC );
+        log_notice( "formatted the hosts table" );
+    }
+    if ( header.generation & 1 ) {
+        __atomic_store_n( &(header.generation), header.generation + 1, __ATOMIC_RELEASE );
+        header.count = 0;
+        memset( table->entry, 0, sizeof(table->entry) );
+    }
+
+    host_fd = fd;
+    host_table = table;
+    return true;
 }
 
 /** Update hosts file with partner addresses
@@ -481,33 +703,69 @@ done:
  * then add a host file entry for that name/uuid and interface
  *
  * node0.ip6.ibiz0    fe80::XXXX
+ *
+ * The table is compared with what is mapped, and only the entries
+ * that differ are written, inside one seqlock generation; only the
+ * pages holding them (and the header) are synced.  Nothing is
+ * written when the topology has not changed.
  */
 void
 Network::Monitor::update_hosts() {
-    if ( mkfile(const_cast<char*>("hosts.tmp"), HOST_TABLE_SIZE) == 0 ) {
-        log_err( "could not create the tmp hosts table" );
+    if ( (host_table == NULL) and (open_host_table() == false) ) {
+        log_err( "could not open the hosts table" );
         return;
     }
 
-    int fd = open("hosts.tmp", O_RDWR);
-    if ( fd < 0 ) {
-        if ( debug > 0 ) log_err( "could not open the hosts table for writing" );
+    HostEntries *fresh = new HostEntries;
+    WriteHostsForInterface callback( *fresh );
+    each_interface( callback );
+
+    struct host_table_header& header = host_table->header;
+    bool dirty[HOST_TABLE_ENTRIES];
+    int changed = 0;
+    for ( int i = 0 ; i < HOST_TABLE_ENTRIES ; ++i ) {
+        dirty[i] = memcmp( &(host_table->entry[i]), &(fresh->entry[i]), sizeof(struct host_entry) ) != 0;
+        if ( dirty[i] )  changed++;
+    }
+    if ( (changed == 0) and (header.count == (uint32_t)fresh->count) ) {
+        delete fresh;
         return;
     }
 
-    WriteHostsForInterface callback(fd);
-    each_interface( callback );
-
-    fsync( fd );
-    close( fd );
+    __atomic_store_n( &(header.generation), header.generation + 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+    for ( int i = 0 ; i < HOST_TABLE_ENTRIES ; ++i ) {
+        if ( dirty[i] )  host_table->entry[i] = fresh->entry[i];
+    }
+    int count = fresh->count;
+    header.count = count;
+    header.updated = time(0);
+    __atomic_store_n( &(header.generation), header.generation + 1, __ATOMIC_RELEASE );
+    delete fresh;
 
-    unlink( "hosts.1" );
-    if ( link("hosts", "hosts.1") != 0 ) {
-        log_err( "could not create the link for the old hosts table" );
+    /*
+     * The header and entries share pages, so sync each page once,
+     * starting with the one holding the header.
+     */
+    uintptr_t page = sysconf( _SC_PAGESIZE );
+    uintptr_t last = (uintptr_t)host_table;
+    msync( host_table, page, MS_ASYNC );
+    for ( int i = 0 ; i < HOST_TABLE_ENTRIES ; ++i ) {
+        if ( dirty[i] == false )  continue;
+        uintptr_t start = (uintptr_t)&(host_table->entry[i]) & ~(page - 1);
+        uintptr_t end = ((uintptr_t)&(host_table->entry[i + 1]) - 1) & ~(page - 1);
+        for ( uintptr_t p = start ; p <= end ; p += page ) {
+            if ( p <= last )  continue;
+            msync( (void *)p, page, MS_ASYNC );
+            last = p;
+        }
     }
-    rename( "hosts.tmp", "hosts" );
+
+    stats.host_updates++;
+    stats.host_entries_written += changed;
+    if ( debug > 0 ) log_notice( "hosts table: %d entries, %d rewritten", count, changed );
 }
-
+
 /**
  * The network monitor needs to probe the current system for network
  * devices and keep a list of devices that are being monitored.
@@ -524,28 +782,28 @@ Network::Monitor::Monitor( Tcl_Interp *interp, Network::ListenerInterfaceFactory
 : Thread("network.monitor"),
   interp(interp),
   factory(factory),
-  table_warning_reported(false),
-  table_error_reported(false)
+  _interval(3),
+  node_table_sequence(0),
+  host_fd(-1),
+  host_table(NULL)
 {
+    memset( &stats, 0, sizeof(stats) );
     pthread_mutex_init( &node_table_lock, NULL );
-    size_t size = sizeof(Node) * NODE_TABLE_SIZE;
-    node_table = (Node *)mmap( 0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, 0, 0 );
-
-    if ( node_table == MAP_FAILED ) {
-        log_err( "node table alloc failed" );
-        exit( errno );
-    }
-
-    for ( int i = 0 ; i < NODE_TABLE_SIZE ; i++ ) {
-        node_table[i].invalidate();
-    }
-
-    if ( debug > 0 ) log_err( "node table is at %p (%zu)", node_table, size );
+    node_index = new_node_index( INITIAL_NODE_SLOTS );
 }
 
 /**
  */
 Network::Monitor::~Monitor() {
+    for ( size_t i = 0 ; i < retired_indexes.size() ; ++i ) {
+        free_node_index( retired_indexes[i] );
+    }
+    free_node_index( node_index );
+    for ( size_t i = 0 ; i < node_chunks.size() ; ++i ) {
+        munmap( node_chunks[i], sizeof(Node) * NODE_CHUNK_SIZE );
+    }
+    if ( host_table != NULL )  munmap( host_table, sizeof(struct host_table) );
+    if ( host_fd != -1 )  close( host_fd );
 }
 
 /* vim: set autoindent expandtab sw=4 : */
@@ -39,6 +39,7 @@
 
 #include <list>
 #include <map>
+#include <vector>
 
 #include "UUID.h"
 #include "Thread.h"
@@ -46,6 +47,7 @@
 #include "NodeIterator.h"
 
 namespace ICMPv6 { class Socket; }
+struct host_table;
 
 /**
  */
@@ -81,6 +83,39 @@ namespace Network {
 
     class Manager;
 
+    /**
+     * Counters kept by a monitor event loop.  A batch is everything
+     * read from the event source on one wakeup.  Latencies are in
+     * microseconds, measured from the wakeup until the last event in
+     * the batch has been delivered.
+     */
+    struct MonitorStatistics {
+        uint64_t batches;
+        uint64_t events;
+        uint64_t largest_batch;
+        uint64_t last_latency;
+        uint64_t total_latency;
+        uint64_t max_latency;
+        uint64_t overruns;
+        uint64_t ticks;
+        uint64_t host_updates;
+        uint64_t host_entries_written;
+    };
+
+    /**
+     * Open addressing index from node UUID to Node, probed linearly.
+     * The keys and node pointers are kept in parallel arrays so a probe
+     * only touches the key words.  A slot with a NULL node is empty.
+     * An index is never changed in size; growing builds a new one.
+     */
+    struct NodeIndex {
+        uint32_t mask;
+        uint32_t count;
+        uint64_t *key_hi;
+        uint64_t *key_lo;
+        Node **nodes;
+    };
+
     /**
      * Monitor thread for watching network events and performing actions
      * when they occur.
@@ -98,12 +133,39 @@ namespace Network {
         virtual void bring_up( Network::Interface * );
         virtual void capture( Network::Interface * );
 
+        MonitorStatistics stats;
+        int _interval;
+        void record_batch( int, uint64_t );
+        void tick();
+
     private:
+        /*
+         * Lookups are lock free: they probe node_index and retry if
+         * node_table_sequence changed (or was odd) meanwhile.  Writers
+         * serialize on node_table_lock.  Nodes live in fixed chunks so
+         * a Node* stays put however large the table grows, and old
+         * indexes are kept until the monitor goes away because a
+         * reader may still be probing one.
+         */
         pthread_mutex_t node_table_lock;
-        static const int NODE_TABLE_SIZE = 4096;
-        Node *node_table;
-        bool table_warning_reported;
-	bool table_error_reported;
+        uint32_t node_table_sequence;
+        NodeIndex *node_index;
+        static const int NODE_CHUNK_SIZE = 256;
+        std::vector<Node *> node_chunks;
+        std::vector<Node *> free_nodes;
+        std::vector<NodeIndex *> retired_indexes;
+
+        Node *allocate_node();
+        void insert_node( Node * );
+        void grow_node_index();
+
+        /*
+         * The hosts file stays mapped; update_hosts() rewrites only
+         * the entries that changed, inside the table's seqlock.
+         */
+        int host_fd;
+        struct host_table *host_table;
+        bool open_host_table();
 
     public:
         Monitor( Tcl_Interp *, ListenerInterfaceFactory );
@@ -128,6 +190,10 @@ namespace Network {
 
         void update_hosts();
         void clear_partners();
+
+        const MonitorStatistics& statistics() const { return stats; }
+        int interval() const { return _interval; }
+        void interval( int seconds ) { if ( seconds > 0 ) _interval = seconds; }
     };
 
     class Event {
@@ -25,7 +25,24 @@
  * \brief 
  */
 
+#include <stdint.h>
+#include <sys/types.h>
+
 extern void set_main_thread_name();
 extern void set_thread_name( const char * );
 
+/**
+ * Sleep while *address still holds value, and wake one sleeper on
+ * address.  Either may return spuriously; callers re-check.
+ */
+extern void wait_on_address( uint32_t *address, uint32_t value );
+extern void wake_address( uint32_t *address );
+
+/**
+ * A descriptor that polls readable once process pid has exited, or
+ * -1 if there is no such process.  Unlike the pid it cannot come to
+ * name some other process later.
+ */
+extern int process_handle( pid_t pid );
+
 /* vim: set autoindent expandtab sw=4 : */
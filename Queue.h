@@ -21,106 +21,187 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  */
 
+
+/** \file Queue.h
+ * \brief Bounded lock free multi-producer, single-consumer queue.
+ *
+ * Messages live in a power of two ring of cells.  Each cell carries a
+ * sequence number that says whose turn it is: a producer claims a slot
+ * by advancing the tail with a compare-and-swap, fills the cell, then
+ * bumps its sequence to hand it to the consumer.  The one consumer
+ * (the thread that owns the queue) reads cells in order and bumps the
+ * sequence again to hand them back to the producers.  Neither side
+ * ever takes a lock.
+ *
+ * The consumer only sleeps when the queue is empty.  It first yields
+ * the processor a few times so producers can build up a batch, rather
+ * than waking for every message; then it advertises that it is asleep
+ * in a waiting word and blocks on it; a producer that sees the
+ * flag after publishing a message clears it and wakes the consumer.
+ * The sleep and wake are the platform's wait_on_address() and
+ * wake_address() -- a futex on Linux.
+ *
+ * The queue is bounded: enqueue() fails rather than blocks when the
+ * ring is full, and leaves it to the caller to drop, retry or back off.
+ */
+
 #ifndef _QUEUE_H_
 #define _QUEUE_H_
-// #include <stdlib.h>
-#include <pthread.h>
+
+#include <sched.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "PlatformThread.h"
 
 class Queue {
-    class Entry {
-    public:
-        Entry *next, *previous;
+    struct Cell {
+        uint64_t sequence;
         void *message;
-        pthread_mutex_t lock;
-    
-        Entry() : message(0) {
-            pthread_mutex_init( &lock, NULL );
-            next = this;
-            previous = this;
-        }
-    
-        Entry( void *data ) {
-            pthread_mutex_init( &lock, NULL );
-            next = this;
-            previous = this;
-            message = data;
-        }
-    
-        void insert( Entry *entry ) {
-            pthread_mutex_lock( &lock );
-            entry->next = next;
-            entry->previous = this;
-            next->previous = entry;
-            next = entry;
-            pthread_mutex_unlock( &lock );
-        }
-    
-        Entry *remove() {
-            pthread_mutex_lock( &lock );
-            Entry *entry = previous;
-            previous = entry->previous;
-            previous->next = this;
-            pthread_mutex_unlock( &lock );
-            return entry;
-        }
-        bool empty() {
-            return (next == this);
-        }
     };
-    
-    pthread_cond_t messages;
-    pthread_mutex_t messages_lock;
-    Entry freelist;
-    Entry head;
-    Entry *allocate( void *data ) {
-        if ( freelist.empty() )  return new Entry( data );
-        Entry *entry = freelist.remove();
-        entry->message = data;
-        return entry;
+
+    static const int CACHE_LINE = 64;
+    static const int WAIT_YIELDS = 8;
+
+    Cell *cells;
+    uint64_t mask;
+    char pad0[CACHE_LINE];
+    uint64_t tail;                      // next slot a producer will claim
+    char pad1[CACHE_LINE];
+    uint64_t head;                      // next slot the consumer will read
+    uint32_t waiting;
+    char pad2[CACHE_LINE];
+
+    static uint64_t round_up( uint64_t n ) {
+        uint64_t size = 2;
+        while ( size < n )  size <<= 1;
+        return size;
     }
-    
+
+    Queue( const Queue& );
+    Queue& operator = ( const Queue& );
+
 public:
-    Queue() {
-        pthread_cond_init( &messages, NULL );
-        pthread_mutex_init( &messages_lock, NULL );
+    static const int DEFAULT_CAPACITY = 1024;
+
+    Queue( int capacity = DEFAULT_CAPACITY ) : tail(0), head(0), waiting(0) {
+        uint64_t size = round_up( capacity );
+        cells = new Cell[size];
+        for ( uint64_t i = 0 ; i < size ; ++i ) {
+            cells[i].sequence = i;
+            cells[i].message = 0;
+        }
+        mask = size - 1;
+    }
+
+    ~Queue() {
+        delete [] cells;
     }
-    void enqueue( void *data ) {
-        Entry *entry = allocate( data );
-        head.insert( entry );
-        pthread_mutex_lock( &messages_lock );
-        pthread_cond_signal( &messages );
-        pthread_mutex_unlock( &messages_lock );
+
+    /**
+     * Add a message from any thread.  Returns false if the ring is full.
+     */
+    bool enqueue( void *data ) {
+        uint64_t position = __atomic_load_n( &tail, __ATOMIC_RELAXED );
+        Cell *cell;
+        for (;;) {
+            cell = &cells[position & mask];
+            uint64_t sequence = __atomic_load_n( &(cell->sequence), __ATOMIC_ACQUIRE );
+            int64_t difference = (int64_t)sequence - (int64_t)position;
+            if ( difference == 0 ) {
+                if ( __atomic_compare_exchange_n(&tail, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED) ) {
+                    break;
+                }
+            } else if ( difference < 0 ) {
+                return false;
+            } else {
+                position = __atomic_load_n( &tail, __ATOMIC_RELAXED );
+            }
+        }
+        cell->message = data;
+        __atomic_store_n( &(cell->sequence), position + 1, __ATOMIC_RELEASE );
+
+        /*
+         * Pairs with the fence in wait(): either the consumer sees this
+         * message before it sleeps, or this sees it waiting.
+         */
+        __atomic_thread_fence( __ATOMIC_SEQ_CST );
+        if ( __atomic_load_n(&waiting, __ATOMIC_RELAXED) != 0 ) {
+            if ( __atomic_exchange_n(&waiting, 0, __ATOMIC_SEQ_CST) != 0 ) {
+                wake_address( &waiting );
+            }
+        }
+        return true;
     }
-    
+
+    /**
+     * Take the oldest message, or NULL if there is none.  Consumer only.
+     */
     void *dequeue() {
-        Entry *entry = head.remove();
-        void *data = entry->message;
-        freelist.insert( entry );
+        Cell *cell = &cells[head & mask];
+        uint64_t sequence = __atomic_load_n( &(cell->sequence), __ATOMIC_ACQUIRE );
+        if ( sequence != head + 1 )  return 0;
+
+        void *data = cell->message;
+        __atomic_store_n( &(cell->sequence), head + mask + 1, __ATOMIC_RELEASE );
+        __atomic_store_n( &head, head + 1, __ATOMIC_RELEASE );
         return data;
     }
-    
+
+    /**
+     * Take up to `limit' messages in order, returning how many were
+     * taken.  Consumer only.
+     */
+    int dequeue( void **messages, int limit ) {
+        int count = 0;
+        uint64_t position = head;
+        while ( count < limit ) {
+            Cell *cell = &cells[position & mask];
+            uint64_t sequence = __atomic_load_n( &(cell->sequence), __ATOMIC_ACQUIRE );
+            if ( sequence != position + 1 )  break;
+            messages[count++] = cell->message;
+            __atomic_store_n( &(cell->sequence), position + mask + 1, __ATOMIC_RELEASE );
+            position++;
+        }
+        __atomic_store_n( &head, position, __ATOMIC_RELEASE );
+        return count;
+    }
+
+    /**
+     * Block until there is a message to dequeue.  Consumer only.
+     */
     void wait() {
-        pthread_mutex_lock( &messages_lock );
+        for ( int spin = 0 ; (spin < WAIT_YIELDS) and empty() ; ++spin ) {
+            sched_yield();
+        }
         while ( empty() ) {
-            pthread_cond_wait( &messages, &messages_lock );
+            __atomic_store_n( &waiting, 1, __ATOMIC_SEQ_CST );
+            __atomic_thread_fence( __ATOMIC_SEQ_CST );
+            if ( empty() == false ) {
+                __atomic_store_n( &waiting, 0, __ATOMIC_RELAXED );
+                break;
+            }
+            wait_on_address( &waiting, 1 );
         }
-        pthread_mutex_unlock( &messages_lock );
     }
-    
+
+    /**
+     * Messages claimed by producers and not yet taken by the consumer.
+     * A message being written counts, even though it cannot be taken
+     * quite yet.
+     */
     int depth() {
-        int depth = 0;
-        pthread_mutex_lock( &messages_lock );
-        Entry *dot = head.next;
-        while ( dot != &head ) {
-            depth++;
-            dot = dot->next;
-        }
-        pthread_mutex_unlock( &messages_lock );
-        return depth;
+        uint64_t claimed = __atomic_load_n( &tail, __ATOMIC_ACQUIRE );
+        uint64_t taken = __atomic_load_n( &head, __ATOMIC_ACQUIRE );
+        return (int)(claimed - taken);
+    }
+
+    int capacity() {
+        return (int)(mask + 1);
     }
-    
+
     bool empty() {
-        return head.empty();
+        Cell *cell = &cells[__atomic_load_n(&head, __ATOMIC_RELAXED) & mask];
+        return __atomic_load_n( &(cell->sequence), __ATOMIC_ACQUIRE ) != (head + 1);
     }
 };
 #endif
@@ -53,16 +53,153 @@
 #include "util.h"
 #include "string_util.h"
 #include "traps.h"
+#include "AppInit.h"
+#include "PlatformThread.h"
 #include "Service.h"
 
+namespace {
+    int debug = 0;
+
+    uint64_t now_usec() {
+        struct timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+    }
+
+    /**
+     * Count one request.  Only the thread serving requests writes
+     * the statistics; the atomics let the stats command read them
+     * from another interpreter without tearing.
+     */
+    void record( ServiceStatistics& stats, int result, uint64_t usec ) {
+        int bucket = 0;
+        while ( (bucket < ServiceStatistics::BUCKETS - 1) and ((usec >> bucket) != 0) )  bucket++;
+        __atomic_add_fetch( &(stats.requests), 1, __ATOMIC_RELAXED );
+        if ( result != TCL_OK )  __atomic_add_fetch( &(stats.errors), 1, __ATOMIC_RELAXED );
+        __atomic_add_fetch( &(stats.total_usec), usec, __ATOMIC_RELAXED );
+        __atomic_add_fetch( &(stats.histogram[bucket]), 1, __ATOMIC_RELAXED );
+        if ( usec > __atomic_load_n(&(stats.max_usec), __ATOMIC_RELAXED) ) {
+            __atomic_store_n( &(stats.max_usec), usec, __ATOMIC_RELAXED );
+        }
+    }
+
+    void snapshot( const ServiceStatistics& from, ServiceStatistics& to ) {
+        to.requests = __atomic_load_n( &(from.requests), __ATOMIC_RELAXED );
+        to.errors = __atomic_load_n( &(from.errors), __ATOMIC_RELAXED );
+        to.total_usec = __atomic_load_n( &(from.total_usec), __ATOMIC_RELAXED );
+        to.max_usec = __atomic_load_n( &(from.max_usec), __ATOMIC_RELAXED );
+        for ( int i = 0 ; i < ServiceStatistics::BUCKETS ; ++i ) {
+            to.histogram[i] = __atomic_load_n( &(from.histogram[i]), __ATOMIC_RELAXED );
+        }
+    }
+
+    /**
+     * Worker interps are set up one at a time; the app init modules
+     * were written for a single interp at startup.
+     */
+    pthread_mutex_t worker_init_lock = PTHREAD_MUTEX_INITIALIZER;
+}
+
+/**
+ * One thread of the pool, with its own interpreter.  The dispatcher
+ * claims an idle worker (IDLE to CLAIMED), copies the request in and
+ * marks it READY; the worker evaluates it, replies and goes back to
+ * IDLE.  A worker never holds more than one request.
+ */
+class Service::Worker : public Thread {
+public:
+    enum { IDLE = 0, CLAIMED = 1, READY = 2 };
+    Service *service;
+    Tcl_Interp *interp;
+    uint32_t state;
+    long sender;
+    uint64_t received;
+    char *request;
+    ServiceStatistics stats;
+
+    Worker( Service *, int );
+    virtual ~Worker() {}
+    virtual void run();
+    void assign( long, char *, uint64_t );
+};
+
 /**
  */
-Service::Service( const char *_service_name ) : Thread("service") {
+Service::Worker::Worker( Service *service, int index )
+: Thread("service.worker"),
+  service(service),
+  interp(NULL),
+  state(CLAIMED),
+  sender(0),
+  received(0),
+  request(NULL)
+{
+    char buffer[1024];
+    snprintf( buffer, sizeof(buffer), "%s.worker.%d", service->name(), index );
+    thread_name( buffer );
+    memset( &stats, 0, sizeof(stats) );
+}
+
+/**
+ * Called by the dispatcher on a worker it has claimed.  The worker
+ * takes the request buffer and frees it when done.
+ */
+void
+Service::Worker::assign( long from, char *text, uint64_t when ) {
+    sender = from;
+    received = when;
+    request = text;
+    __atomic_store_n( &state, (uint32_t)READY, __ATOMIC_RELEASE );
+    wake_address( &state );
+}
+
+/**
+ * Build the interpreter on this thread, then serve requests.  The
+ * worker starts out CLAIMED so it is not handed work before its
+ * interpreter exists.
+ */
+void
+Service::Worker::run() {
+    interp = service->create_worker_interp();
+
+    for (;;) {
+        __atomic_store_n( &state, (uint32_t)IDLE, __ATOMIC_RELEASE );
+        __atomic_add_fetch( &(service->idle_workers), 1, __ATOMIC_SEQ_CST );
+        wake_address( &(service->idle_workers) );
+
+        uint32_t current;
+        while ( (current = __atomic_load_n(&state, __ATOMIC_ACQUIRE)) != READY ) {
+            wait_on_address( &state, current );
+        }
+
+        int result = Tcl_EvalEx( interp, request, -1, TCL_EVAL_GLOBAL );
+        free( request );
+        request = NULL;
+        int length;
+        const char *response = Tcl_GetStringFromObj( Tcl_GetObjResult(interp), &length );
+        service->channel->send( sender, result, response, length );
+        record( stats, result, now_usec() - received );
+    }
+}
+
+/**
+ */
+Service::Service( const char *_service_name )
+: Thread("service"),
+  interp(NULL),
+  channel(NULL),
+  transport(Channel::MESSAGE_QUEUE),
+  argc(0),
+  argv(NULL),
+  idle_workers(0)
+{
     service_name = strdup( _service_name );
     char buffer[1024];
     sprintf( buffer, "%s.service", service_name );
     thread_name( buffer );
     facility = LOG_DAEMON;
+    memset( &stats, 0, sizeof(stats) );
+    pthread_mutex_init( &setup_lock, NULL );
 }
 
 /**
@@ -80,6 +217,16 @@ Service::set_facility( int syslog_facility ) {
     facility = syslog_facility;
 }
 
+/**
+ * Which channel transport to listen on.  Must be called before
+ * initialize(), which creates the channel; the configuration's
+ * Service::transport overrides it.
+ */
+void
+Service::set_transport( Channel::Transport kind ) {
+    transport = kind;
+}
+
 /**
  */
 Tcl_CmdInfo putsObjCmd;
@@ -155,25 +302,60 @@ SyslogErr_cmd( ClientData data, Tcl_Interp *interp,
 }
 
 /**
- * This is a convenience wrapper function that creates a TCL interpreter, performs
- * its basic initialization.
+ * The latency histogram of the inline service, or of each worker.
+ */
+static int
+ServiceStats_cmd( ClientData data, Tcl_Interp *interp,
+             int objc, Tcl_Obj * CONST *objv )
+{
+    Service *service = (Service *)data;
+    Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+
+    int first = (service->worker_count() == 0) ? -1 : 0;
+    for ( int i = first ; i < service->worker_count() ; ++i ) {
+        ServiceStatistics stats;
+        service->statistics( i, stats );
+        uint64_t average = 0;
+        if ( stats.requests > 0 )  average = stats.total_usec / stats.requests;
+
+        Tcl_Obj *histogram = Tcl_NewListObj( 0, 0 );
+        for ( int b = 0 ; b < ServiceStatistics::BUCKETS ; ++b ) {
+            if ( stats.histogram[b] == 0 )  continue;
+            Tcl_Obj *bound = (b == ServiceStatistics::BUCKETS - 1) ? Tcl_NewStringObj("inf", -1)
+                                                                   : Tcl_NewWideIntObj((Tcl_WideInt)1 << b);
+            Tcl_ListObjAppendElement( interp, histogram, bound );
+            Tcl_ListObjAppendElement( interp, histogram, Tcl_NewWideIntObj(stats.histogram[b]) );
+        }
+
+        Tcl_Obj *entry = Tcl_NewListObj( 0, 0 );
+        Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("worker", -1) );
+        Tcl_ListObjAppendElement( interp, entry, Tcl_NewIntObj(i) );
+        Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("requests", -1) );
+        Tcl_ListObjAppendElement( interp, entry, Tcl_NewWideIntObj(stats.requests) );
+        Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("errors", -1) );
+        Tcl_ListObjAppendElement( interp, entry, Tcl_NewWideIntObj(stats.errors) );
+        Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("avg_usec", -1) );
+        Tcl_ListObjAppendElement( interp, entry, Tcl_NewWideIntObj(average) );
+        Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("max_usec", -1) );
+        Tcl_ListObjAppendElement( interp, entry, Tcl_NewWideIntObj(stats.max_usec) );
+        Tcl_ListObjAppendElement( interp, entry, Tcl_NewStringObj("histogram", -1) );
+        Tcl_ListObjAppendElement( interp, entry, histogram );
+        Tcl_ListObjAppendElement( interp, result, entry );
+    }
+
+    Tcl_SetObjResult( interp, result );
+    return TCL_OK;
+}
+
+/**
+ * The part of interpreter setup shared by the service interpreter and
+ * the worker interpreters.
  *
  * - set the interpreters variables for the command line arguments of the service
  * - forces interactive to false
  * - hides some dangerous commands
- * - calls back the applications initialization function
- *
- * This interpreter acts as a remote command interpreter for other services that
- * need to call into this service.
  */
-static Tcl_Interp* create_tcl_interp( int argc, char **argv, Tcl_AppInitProc *appInit ) {
-    Tcl_Interp *interp;
-    Tcl_FindExecutable( argv[0] );
-    interp = Thread::global_interp();
-    if ( interp == NULL ) {
-        log_err( "failed to create interpreter" );
-        exit( 1 );
-    }   
+static void prepare_tcl_interp( Tcl_Interp *interp, int argc, char **argv ) {
     char *args = Tcl_Merge(argc-1, argv+1);
     Tcl_DString argString;
     Tcl_ExternalToUtfDString(NULL, args, -1, &argString);
@@ -195,10 +377,30 @@ static Tcl_Interp* create_tcl_interp( int argc, char **argv, Tcl_AppInitProc *ap
 
     // disable some dangerous commands
     Tcl_HideCommand( interp, "exit", "hiddenExit" );
-    Tcl_GetCommandInfo(interp, "puts", &putsObjCmd);
+    // every interp has the same builtin puts, so keep the first one found
+    if ( putsObjCmd.objProc == NULL )  Tcl_GetCommandInfo(interp, "puts", &putsObjCmd);
     Tcl_CreateObjCommand(interp, "puts", PutsSyslog_cmd, (ClientData)0, NULL);
     Tcl_CreateObjCommand(interp, "ERROR", SyslogErr_cmd, (ClientData)0, NULL);
     Tcl_CreateObjCommand(interp, "WARN", SyslogWarn_cmd, (ClientData)0, NULL);
+}
+
+/**
+ * This is a convenience wrapper function that creates a TCL interpreter, performs
+ * its basic initialization and calls back the applications initialization function.
+ *
+ * This interpreter acts as a remote command interpreter for other services that
+ * need to call into this service.
+ */
+static Tcl_Interp* create_tcl_interp( int argc, char **argv, Tcl_AppInitProc *appInit ) {
+    Tcl_Interp *interp;
+    Tcl_FindExecutable( argv[0] );
+    interp = Thread::global_interp();
+    if ( interp == NULL )  interp = Tcl_CreateInterp();
+    if ( interp == NULL ) {
+        log_err( "failed to create interpreter" );
+        exit( 1 );
+    }   
+    prepare_tcl_interp( interp, argc, argv );
 
 #if 0
     // temp comment out
@@ -252,9 +454,10 @@ clean_up_core_dumps( const char *service_name ) {
 
 /**
  * create the rundir 
- * create the channel
  * create the interp
  * call the appinit
+ * read the configuration
+ * create the channel
  *
  * I may want to read the systems UUID for all applications/services.
  */
@@ -299,8 +502,6 @@ Service::initialize( int argc, char **argv, Tcl_AppInitProc *appInit ) {
     if ( chdir(buffer) != 0 ) {
         log_warn( " failed to chdir " );
     }
-    channel = new Channel( this );
-
     enable_core_dumps( service_name );
     clean_up_core_dumps( service_name );
 
@@ -308,7 +509,48 @@ Service::initialize( int argc, char **argv, Tcl_AppInitProc *appInit ) {
      * Create the TCL interpreter that manages this service and read the
      * service configuration script.
      */
+    this->argc = argc;
+    this->argv = argv;
     interp = create_tcl_interp( argc, argv, appInit );
+    configure( interp );
+
+    /**
+     * The configuration script picks the channel transport with
+     * `set Service::transport seqpacket'; the channel is made once it
+     * has been read.
+     */
+    Tcl_Obj *kind = Tcl_GetVar2Ex( interp, "Service::transport", NULL, TCL_GLOBAL_ONLY );
+    if ( (kind != NULL) and (Channel::transport_named(Tcl_GetString(kind), &transport) == false) ) {
+        log_warn( "Service::transport must be msgq or seqpacket, using %s",
+                  Channel::transport_name(transport) );
+    }
+    channel = new Channel( this, transport );
+
+    /**
+     * The configuration script asks for a pool of worker interpreters
+     * with `set Service::workers n'.
+     */
+    Tcl_Obj *workers = Tcl_GetVar2Ex( interp, "Service::workers", NULL, TCL_GLOBAL_ONLY );
+    if ( workers != NULL ) {
+        int count;
+        if ( (Tcl_GetIntFromObj(interp, workers, &count) != TCL_OK) or (count < 0) ) {
+            log_warn( "Service::workers must be a count of workers, serving inline" );
+        } else {
+            set_workers( count );
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Read the service configuration script into an interpreter and add
+ * the service's own commands.
+ */
+void
+Service::configure( Tcl_Interp *interp ) {
+    char buffer[1024];
+    Tcl_EvalEx( interp, "namespace eval Service {}", -1, TCL_EVAL_GLOBAL );
     sprintf( buffer, "/etc/%s/%s.conf", service_name, service_name );
     if ( access(buffer, R_OK) == 0 ) {
         if ( Tcl_EvalFile(interp, buffer) == TCL_ERROR ) {
@@ -318,8 +560,40 @@ Service::initialize( int argc, char **argv, Tcl_AppInitProc *appInit ) {
 
     Tcl_EvalEx( interp, "proc clock {command} { namespace eval ::tcl::clock $command}", -1, TCL_EVAL_GLOBAL );
     Tcl_EvalEx( interp, "proc commands {} {namespace eval commands {info procs}}", -1, TCL_EVAL_GLOBAL );
+    Tcl_CreateObjCommand( interp, "Service::stats", ServiceStats_cmd, (ClientData)this, NULL );
+}
 
-    return true;
+/**
+ * Record a command or script loaded into the service interpreter, so
+ * worker interpreters started later get the same.
+ */
+void
+Service::remember( Setup::Kind kind, const char *name, Tcl_ObjCmdProc *proc, ClientData data ) {
+    Setup entry;
+    entry.kind = kind;
+    entry.name = strdup( name );
+    entry.proc = proc;
+    entry.data = data;
+    pthread_mutex_lock( &setup_lock );
+    setup.push_back( entry );
+    pthread_mutex_unlock( &setup_lock );
+}
+
+/**
+ * Load a command from a file into an interpreter, using the basename
+ * of the file for the command name.
+ */
+static int
+source_command( Tcl_Interp *interp, const char *filename ) {
+    const char *name = strrchr(filename, '/');
+    name = (name == NULL) ? filename : name+1 ;
+
+    return Tcl_VarEval( interp,
+    "namespace eval ", name, " {source ", filename, "}\n",
+    "namespace eval commands {proc ", name, " {args} { namespace eval ::", name, " $args }}\n",
+    "namespace eval commands {namespace export -clear *}\n",
+    "namespace import -force commands::*\n",
+    NULL );
 }
 
 /**
@@ -331,6 +605,7 @@ bool
 Service::add_command( char *cmdName, Tcl_ObjCmdProc *proc, ClientData data ) {
     Tcl_Command command;
     command = Tcl_CreateObjCommand(interp, cmdName, proc, data, NULL);
+    if ( command != NULL )  remember( Setup::COMMAND, cmdName, proc, data );
     return (command != NULL);
 }
 
@@ -340,17 +615,10 @@ Service::add_command( char *cmdName, Tcl_ObjCmdProc *proc, ClientData data ) {
  */
 bool
 Service::load_command( const char *filename ) {
-    const char *name = strrchr(filename, '/');
-    name = (name == NULL) ? filename : name+1 ;
-
-    int retcode = Tcl_VarEval( interp,
-    "namespace eval ", name, " {source ", filename, "}\n",
-    "namespace eval commands {proc ", name, " {args} { namespace eval ::", name, " $args }}\n",
-    "namespace eval commands {namespace export -clear *}\n",
-    "namespace import -force commands::*\n",
-    NULL );
+    int retcode = source_command( interp, filename );
     if ( retcode != TCL_OK ) return false;
 
+    remember( Setup::LOAD_COMMAND, filename );
     return true;
 }
 
@@ -398,6 +666,8 @@ Service::load_directory( const char *dir ) {
         if ( access(filename, R_OK) == 0 ) {
             if ( Tcl_EvalFile(interp, filename) != TCL_OK ) {
                 log_notice( "error: %s", Tcl_GetStringResult(interp) );
+            } else {
+                remember( Setup::LOAD_FILE, filename );
             }
         }
     }
@@ -417,9 +687,99 @@ Service::load_file( const char *filename ) {
         log_warn( "error evaluating file" );
         return false;
     }
+    remember( Setup::LOAD_FILE, filename );
     return true;
 }
 
+/**
+ * Serve requests from a pool of this many worker interpreters instead
+ * of the service interpreter.  Must be called from the main thread
+ * before the service is started: the workers are Threads, and each
+ * one registers with the TCL thread commands when it is created.
+ */
+void
+Service::set_workers( int count ) {
+    while ( (int)workers.size() < count ) {
+        workers.push_back( new Worker(this, workers.size()) );
+    }
+}
+
+/**
+ * A statistics snapshot for worker `index', or for the service
+ * interpreter itself when index is -1.
+ */
+void
+Service::statistics( int index, ServiceStatistics& result ) const {
+    if ( (index < 0) or (index >= (int)workers.size()) ) {
+        snapshot( stats, result );
+    } else {
+        snapshot( workers[index]->stats, result );
+    }
+}
+
+/**
+ * Runs on the worker's own thread.  The interpreter gets what the
+ * service interpreter got: the app init chain, the configuration
+ * script, and every command and file loaded into it so far.
+ */
+Tcl_Interp *
+Service::create_worker_interp() {
+    pthread_mutex_lock( &worker_init_lock );
+
+    Tcl_Interp *worker = Tcl_CreateInterp();
+    if ( Tcl_Init(worker) != TCL_OK ) {
+        log_warn( "worker interp init: %s", Tcl_GetStringResult(worker) );
+    }
+    prepare_tcl_interp( worker, argc, argv );
+    if ( Tcl_CallAppInitChain(worker) == false ) {
+        log_err( "app init failed for a %s worker", service_name );
+    }
+    configure( worker );
+
+    pthread_mutex_lock( &setup_lock );
+    std::vector<Setup> steps( setup );
+    pthread_mutex_unlock( &setup_lock );
+
+    for ( size_t i = 0 ; i < steps.size() ; ++i ) {
+        Setup& step = steps[i];
+        switch ( step.kind ) {
+        case Setup::COMMAND:
+            Tcl_CreateObjCommand( worker, step.name, step.proc, step.data, NULL );
+            break;
+        case Setup::LOAD_COMMAND:
+            if ( source_command(worker, step.name) != TCL_OK ) {
+                log_warn( "worker: %s: %s", step.name, Tcl_GetStringResult(worker) );
+            }
+            break;
+        case Setup::LOAD_FILE:
+            if ( Tcl_EvalFile(worker, step.name) != TCL_OK ) {
+                log_warn( "worker: %s: %s", step.name, Tcl_GetStringResult(worker) );
+            }
+            break;
+        }
+    }
+
+    pthread_mutex_unlock( &worker_init_lock );
+    return worker;
+}
+
+/**
+ * Claim a worker that is waiting for a request, or NULL if all of
+ * them are busy.
+ */
+Service::Worker *
+Service::idle_worker() {
+    for ( size_t i = 0 ; i < workers.size() ; ++i ) {
+        uint32_t expected = Worker::IDLE;
+        if ( __atomic_compare_exchange_n(&(workers[i]->state), &expected, (uint32_t)Worker::CLAIMED,
+                                         false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) ) {
+            __atomic_sub_fetch( &idle_workers, 1, __ATOMIC_SEQ_CST );
+            return workers[i];
+        }
+    }
+    return NULL;
+}
+
 /**
  * A service object is a thread that waits for messages from a Channel, processes
  * them in a TCL interpreter and responds.
@@ -427,17 +787,67 @@ Service::load_file( const char *filename ) {
 void
 Service::run() {
     log_notice( "Channel listening" );
-    char request[1024];
-    char response[1024];
+    if ( workers.empty() ) {
+        serve_inline();
+    } else {
+        serve_pooled();
+    }
+}
+
+/**
+ * One request at a time, in the service interpreter.
+ */
+void
+Service::serve_inline() {
     for (;;) {
-        long sender = channel->receive( request, sizeof(request) );
-        if ( ::kill(sender, 0) < 0 ) {
-            log_err( "client is dead: %s. Ignoring message", strerror(errno) );
+        char *request;
+        size_t request_length;
+        long sender = channel->receive( &request, &request_length );
+        uint64_t received = now_usec();
+        if ( channel->alive(sender) == false ) {
+            log_err( "client is dead. Ignoring message" );
+            free( request );
             continue;
         }
-        int result = Tcl_EvalEx( interp, request, -1, TCL_EVAL_GLOBAL );
-        strlcpy( response, Tcl_GetStringResult(interp), sizeof(response) );
-        channel->send( sender, result, response );
+        int result = Tcl_EvalEx( interp, request, request_length, TCL_EVAL_GLOBAL );
+        free( request );
+        int length;
+        const char *response = Tcl_GetStringFromObj( Tcl_GetObjResult(interp), &length );
+        channel->send( sender, result, response, length );
+        record( stats, result, now_usec() - received );
+    }
+}
+
+/**
+ * Hand each request to an idle worker.  When every worker is busy
+ * this thread sleeps on the idle count, and requests wait in the
+ * channel until one finishes.
+ */
+void
+Service::serve_pooled() {
+    for ( size_t i = 0 ; i < workers.size() ; ++i ) {
+        workers[i]->start();
+    }
+    log_notice( "%s serving with %d workers", service_name, (int)workers.size() );
+
+    for (;;) {
+        char *request;
+        size_t request_length;
+        long sender = channel->receive( &request, &request_length );
+        uint64_t received = now_usec();
+        if ( channel->alive(sender) == false ) {
+            log_err( "client is dead. Ignoring message" );
+            free( request );
+            continue;
+        }
+
+        Worker *worker;
+        while ( (worker = idle_worker()) == NULL ) {
+            uint32_t idle = __atomic_load_n( &idle_workers, __ATOMIC_SEQ_CST );
+            if ( idle == 0 )  wait_on_address( &idle_workers, 0 );
+        }
+        if ( debug > 0 ) log_notice( "request to %s", worker->thread_name() );
+        worker->assign( sender, request, received );
     }
 }
 
@@ -29,23 +29,90 @@
 #ifndef _SERVICE_H_
 #define _SERVICE_H_
 
+#include <stdint.h>
+#include <pthread.h>
 #include <tcl.h>
+
+#include <vector>
+
 #include "Thread.h"
 #include "Channel.h"
 
+/**
+ * Request latency, from receipt on the channel to the reply, in
+ * power of two buckets: bucket b counts requests that took less
+ * than 2^b microseconds (and at least 2^(b-1)), the last bucket
+ * everything slower.
+ */
+struct ServiceStatistics {
+    static const int BUCKETS = 24;
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t total_usec;
+    uint64_t max_usec;
+    uint64_t histogram[BUCKETS];
+};
+
 /**
  * run() should not be able to execute unless initialized
  * or maybe when run -- initialize is called -- then it could 
  * be private
+ *
+ * The channel is made after the service configuration script has
+ * run, so the script can choose its transport with
+ * `set Service::transport msgq|seqpacket'.
+ *
+ * By default every request is evaluated in the one service
+ * interpreter, in order.  With set_workers(), or `set Service::workers
+ * n' in the service configuration script, the service instead keeps a
+ * pool of worker threads, each with its own interpreter (TCL interps
+ * are bound to the thread that created them) set up through
+ * Tcl_CallAppInitChain, the service configuration and the commands
+ * and files loaded into the service interpreter before it was
+ * started.  Each request goes to an idle worker, so one slow command
+ * no longer holds up every other client; the commands the service
+ * exposes must then be safe to run concurrently.
+ *
+ * The app init modules are safe to run per worker: most only create
+ * commands and link their debug variables.  Thread hooks thread
+ * creation to the first interpreter only, Process::snapshot keeps a
+ * /proc descriptor per interpreter, and the process manager and the
+ * ethtool cache are shared and locked.  Workers run no event loop,
+ * so Process::spawn -callback and channel `post' are of no use in
+ * them; their event handlers are only made on first use.
  */
 class Service : public Thread {
 private:
+    class Worker;
+    struct Setup {
+        enum Kind { COMMAND, LOAD_COMMAND, LOAD_FILE } kind;
+        char *name;
+        Tcl_ObjCmdProc *proc;
+        ClientData data;
+    };
+
     Tcl_Interp *interp;
     const char *service_name;
     char logfilename[80];
     char rundir[80];
     Channel *channel;
+    Channel::Transport transport;
     int facility;
+    int argc;
+    char **argv;
+
+    ServiceStatistics stats;
+    std::vector<Worker *> workers;
+    uint32_t idle_workers;
+    pthread_mutex_t setup_lock;
+    std::vector<Setup> setup;
+
+    void remember( Setup::Kind, const char *, Tcl_ObjCmdProc * = 0, ClientData = 0 );
+    void configure( Tcl_Interp * );
+    Tcl_Interp *create_worker_interp();
+    Worker *idle_worker();
+    void serve_inline();
+    void serve_pooled();
 public:
     Service( const char * );
     virtual ~Service();
@@ -53,6 +120,10 @@ public:
     virtual void run();
     const char *name() const { return service_name; }
     void set_facility( int );
+    void set_transport( Channel::Transport );
+    void set_workers( int );
+    int worker_count() const { return workers.size(); }
+    void statistics( int, ServiceStatistics& ) const;
     bool add_command( char *, Tcl_ObjCmdProc *, ClientData );
     bool load_command( const char * );
     bool load_commands( const char * );
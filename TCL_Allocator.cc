@@ -27,6 +27,9 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <execinfo.h>
 
 #include <tcl.h>
 #include "tcl_util.h"
@@ -37,7 +40,195 @@
 
 namespace { int debug = 0; }
 
+namespace {
+
+    /**
+     * One key/value element per pool.
+     */
+    class PoolUsage : public Allocator::Injector {
+        Tcl_Interp *interp;
+        Tcl_Obj *result;
+    public:
+        PoolUsage( Tcl_Interp *interp, Tcl_Obj *result )
+        : interp(interp), result(result) {}
+        virtual ~PoolUsage() {}
+        virtual void operator () ( size_t size, int count, uint32_t available ) {
+            Tcl_Obj *element = Tcl_NewListObj( 0, 0 );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("size", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewLongObj(size) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("capacity", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewLongObj(count * size) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("available", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewLongObj(available * size) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("objects", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewLongObj(count - available) );
+            Tcl_ListObjAppendElement( interp, result, element );
+        }
+    };
+
+    /**
+     * One key/value element per object size per thread cache.
+     */
+    class CacheUsage : public Allocator::CacheInjector {
+        Tcl_Interp *interp;
+        Tcl_Obj *result;
+    public:
+        CacheUsage( Tcl_Interp *interp, Tcl_Obj *result )
+        : interp(interp), result(result) {}
+        virtual ~CacheUsage() {}
+        virtual void operator () ( pid_t thread, size_t size, int cached ) {
+            Tcl_Obj *element = Tcl_NewListObj( 0, 0 );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("thread", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewLongObj(thread) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("size", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewLongObj(size) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("cached", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewIntObj(cached) );
+            Tcl_ListObjAppendElement( interp, result, element );
+        }
+    };
+
+    /**
+     * One key/value element per heap tier.  Fragmentation is the share
+     * of resident memory not holding live objects, as a percentage.
+     */
+    class TierUsage : public Allocator::TierInjector {
+        Tcl_Interp *interp;
+        Tcl_Obj *result;
+    public:
+        TierUsage( Tcl_Interp *interp, Tcl_Obj *result )
+        : interp(interp), result(result) {}
+        virtual ~TierUsage() {}
+        virtual void operator () ( const char *tier, size_t reserved, size_t resident, size_t allocated, unsigned long objects ) {
+            double fragmentation = 0.0;
+            if ( resident > allocated )  fragmentation = (100.0 * (resident - allocated)) / resident;
+
+            Tcl_Obj *element = Tcl_NewListObj( 0, 0 );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("tier", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj(tier, -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("reserved", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewWideIntObj(reserved) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("resident", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewWideIntObj(resident) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("allocated", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewWideIntObj(allocated) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("objects", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewWideIntObj(objects) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("fragmentation", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewDoubleObj(fragmentation) );
+            Tcl_ListObjAppendElement( interp, result, element );
+        }
+    };
+
+}
+
+namespace {
+
+    /*
+     * Counts from the previous Allocator::stats call, for the rates.
+     */
+    const int MAX_ROWS = 64;
+    unsigned long previous_allocations[MAX_ROWS];
+    unsigned long previous_frees[MAX_ROWS];
+    uint64_t previous_usec = 0;
+
+    uint64_t now_usec() {
+        struct timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+    }
+
+    /**
+     * One key/value element per size class that has seen any use.
+     * Rates are per second since the previous call.
+     */
+    class ClassStats : public Allocator::StatsInjector {
+        Tcl_Interp *interp;
+        Tcl_Obj *result;
+        double elapsed;
+        int row;
+    public:
+        ClassStats( Tcl_Interp *interp, Tcl_Obj *result, double elapsed )
+        : interp(interp), result(result), elapsed(elapsed), row(0) {}
+        virtual ~ClassStats() {}
+        virtual void operator () ( const char *tier, size_t size, unsigned long allocations, unsigned long frees, unsigned long peak ) {
+            double allocation_rate = 0.0, free_rate = 0.0;
+            if ( row < MAX_ROWS ) {
+                if ( elapsed > 0.0 ) {
+                    allocation_rate = (allocations - previous_allocations[row]) / elapsed;
+                    free_rate = (frees - previous_frees[row]) / elapsed;
+                }
+                previous_allocations[row] = allocations;
+                previous_frees[row] = frees;
+            }
+            row++;
+            if ( allocations == 0 )  return;
+
+            Tcl_Obj *element = Tcl_NewListObj( 0, 0 );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("tier", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj(tier, -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("size", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewWideIntObj(size) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("allocations", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewWideIntObj(allocations) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("frees", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewWideIntObj(frees) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("live", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewWideIntObj((Tcl_WideInt)(allocations - frees)) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("peak", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewWideIntObj(peak) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("allocation_rate", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewDoubleObj(allocation_rate) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("free_rate", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewDoubleObj(free_rate) );
+            Tcl_ListObjAppendElement( interp, result, element );
+        }
+    };
+
+    /**
+     * One key/value element per sampled stack, with the frames
+     * symbolized.
+     */
+    class SampleStats : public Allocator::SampleInjector {
+        Tcl_Interp *interp;
+        Tcl_Obj *result;
+    public:
+        SampleStats( Tcl_Interp *interp, Tcl_Obj *result )
+        : interp(interp), result(result) {}
+        virtual ~SampleStats() {}
+        virtual void operator () ( unsigned long count, size_t bytes, void **frames, int depth ) {
+            Tcl_Obj *stack = Tcl_NewListObj( 0, 0 );
+            char **symbols = backtrace_symbols( frames, depth );
+            for ( int i = 0 ; i < depth ; ++i ) {
+                if ( symbols != NULL ) {
+                    Tcl_ListObjAppendElement( interp, stack, Tcl_NewStringObj(symbols[i], -1) );
+                } else {
+                    Tcl_ListObjAppendElement( interp, stack, Tcl_ObjPrintf("%p", frames[i]) );
+                }
+            }
+            free( symbols );
+
+            Tcl_Obj *element = Tcl_NewListObj( 0, 0 );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("count", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewWideIntObj(count) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("bytes", -1) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewWideIntObj(bytes) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj("stack", -1) );
+            Tcl_ListObjAppendElement( interp, element, stack );
+            Tcl_ListObjAppendElement( interp, result, element );
+        }
+    };
+
+}
+
 /**
+ * Returns "lock {...} classes {...} sampling {...} samples {...}".
+ *
+ * lock has the heap lock acquisitions, how many had to wait and for
+ * how long in total and at most.  classes has allocation and free
+ * counts, live and peak objects, and rates since the last call for each
+ * size class in use.  samples has the stacks recorded while sampling
+ * is on (see Allocator::sampling).
  */
 static int
 stats_cmd( ClientData data, Tcl_Interp *interp,
@@ -49,11 +240,84 @@ stats_cmd( ClientData data, Tcl_Interp *interp,
         return TCL_ERROR;
     }
 
-    Tcl_ResetResult( interp );
+    Allocator::LockStatistics statistics;
+    Allocator::lock_statistics( &statistics );
+
+    Tcl_Obj *lock = Tcl_NewListObj( 0, 0 );
+    Tcl_ListObjAppendElement( interp, lock, Tcl_NewStringObj("acquisitions", -1) );
+    Tcl_ListObjAppendElement( interp, lock, Tcl_NewWideIntObj(statistics.acquisitions) );
+    Tcl_ListObjAppendElement( interp, lock, Tcl_NewStringObj("contentions", -1) );
+    Tcl_ListObjAppendElement( interp, lock, Tcl_NewWideIntObj(statistics.contentions) );
+    Tcl_ListObjAppendElement( interp, lock, Tcl_NewStringObj("contended_usec", -1) );
+    Tcl_ListObjAppendElement( interp, lock, Tcl_NewWideIntObj(statistics.contended_nsec / 1000) );
+    Tcl_ListObjAppendElement( interp, lock, Tcl_NewStringObj("longest_wait_usec", -1) );
+    Tcl_ListObjAppendElement( interp, lock, Tcl_NewWideIntObj(statistics.longest_wait_nsec / 1000) );
+
+    uint64_t now = now_usec();
+    double elapsed = 0.0;
+    if ( previous_usec != 0 )  elapsed = (now - previous_usec) / 1000000.0;
+    previous_usec = now;
+
+    Tcl_Obj *classes = Tcl_NewListObj( 0, 0 );
+    ClassStats class_stats( interp, classes, elapsed );
+    Allocator::inject( &class_stats );
+
+    Tcl_Obj *sampling = Tcl_NewListObj( 0, 0 );
+    Tcl_ListObjAppendElement( interp, sampling, Tcl_NewStringObj("every", -1) );
+    Tcl_ListObjAppendElement( interp, sampling, Tcl_NewIntObj(Allocator::sampling()) );
+    Tcl_ListObjAppendElement( interp, sampling, Tcl_NewStringObj("dropped", -1) );
+    Tcl_ListObjAppendElement( interp, sampling, Tcl_NewWideIntObj(Allocator::dropped_samples()) );
+
+    Tcl_Obj *samples = Tcl_NewListObj( 0, 0 );
+    SampleStats sample_stats( interp, samples );
+    Allocator::inject( &sample_stats );
+
+    Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+    Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("lock", -1) );
+    Tcl_ListObjAppendElement( interp, result, lock );
+    Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("classes", -1) );
+    Tcl_ListObjAppendElement( interp, result, classes );
+    Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("sampling", -1) );
+    Tcl_ListObjAppendElement( interp, result, sampling );
+    Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("samples", -1) );
+    Tcl_ListObjAppendElement( interp, result, samples );
+
+    Tcl_SetObjResult( interp, result );
+    return TCL_OK;
+}
+
+/**
+ * Allocator::sampling ?every?
+ *
+ * Record the call stack of one allocation in every `every' per thread;
+ * 0 turns sampling off.  Changing the rate clears the sample table.
+ */
+static int
+sampling_cmd( ClientData data, Tcl_Interp *interp,
+             int objc, Tcl_Obj * CONST *objv )
+{
+    if ( objc > 2 ) {
+        Tcl_ResetResult( interp );
+        Tcl_WrongNumArgs( interp, 1, objv, "?every?" );
+        return TCL_ERROR;
+    }
+
+    if ( objc == 2 ) {
+        int every;
+        if ( Tcl_GetIntFromObj(interp, objv[1], &every) != TCL_OK ) {
+            return TCL_ERROR;
+        }
+        Allocator::sampling( every );
+    }
+
+    Tcl_SetObjResult( interp, Tcl_NewIntObj(Allocator::sampling()) );
     return TCL_OK;
 }
 
 /**
+ * Returns "pools {...} caches {...} tiers {...}" -- the occupancy of
+ * each small object slab, the free slots held in each thread's magazine
+ * cache, and the reserved/resident/allocated bytes for each heap tier.
  */
 static int
 usage_cmd( ClientData data, Tcl_Interp *interp,
@@ -65,16 +329,55 @@ usage_cmd( ClientData data, Tcl_Interp *interp,
         return TCL_ERROR;
     }
 
+    Tcl_Obj *pools = Tcl_NewListObj( 0, 0 );
+    PoolUsage pool_usage( interp, pools );
+    Allocator::inject( &pool_usage );
+
+    Tcl_Obj *caches = Tcl_NewListObj( 0, 0 );
+    CacheUsage cache_usage( interp, caches );
+    Allocator::inject( &cache_usage );
+
+    Tcl_Obj *tiers = Tcl_NewListObj( 0, 0 );
+    TierUsage tier_usage( interp, tiers );
+    Allocator::inject( &tier_usage );
+
     Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
-    // THIS currently is implemented within the object...
-    // this needs to move to the TCL part - need
-    // iterator within the class ??
-    //heap.usage( interp, result );
+    Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("pools", -1) );
+    Tcl_ListObjAppendElement( interp, result, pools );
+    Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("caches", -1) );
+    Tcl_ListObjAppendElement( interp, result, caches );
+    Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("tiers", -1) );
+    Tcl_ListObjAppendElement( interp, result, tiers );
 
     Tcl_SetObjResult( interp, result );
     return TCL_OK;
 }
-
+
+/**
+ * Allocator::thread_caches ?on|off?
+ */
+static int
+thread_caches_cmd( ClientData data, Tcl_Interp *interp,
+             int objc, Tcl_Obj * CONST *objv )
+{
+    if ( objc > 2 ) {
+        Tcl_ResetResult( interp );
+        Tcl_WrongNumArgs( interp, 1, objv, "?enabled?" );
+        return TCL_ERROR;
+    }
+
+    if ( objc == 2 ) {
+        int enabled;
+        if ( Tcl_GetBooleanFromObj(interp, objv[1], &enabled) != TCL_OK ) {
+            return TCL_ERROR;
+        }
+        Allocator::thread_caches( enabled );
+    }
+
+    Tcl_SetObjResult( interp, Tcl_NewBooleanObj(Allocator::thread_caches()) );
+    return TCL_OK;
+}
+
 /**
  */
 static bool
@@ -102,6 +405,16 @@ Allocator_Module( Tcl_Interp *interp ) {
         return false;
     }
 
+    command = Tcl_CreateObjCommand(interp, "Allocator::thread_caches", thread_caches_cmd, (ClientData)0, NULL);
+    if ( command == NULL ) {
+        return false;
+    }
+
+    command = Tcl_CreateObjCommand(interp, "Allocator::sampling", sampling_cmd, (ClientData)0, NULL);
+    if ( command == NULL ) {
+        return false;
+    }
+
     return true;
 }
 
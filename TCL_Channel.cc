@@ -39,6 +39,9 @@
 #include <syslog.h>
 #include <glob.h>
 
+#include <map>
+#include <vector>
+
 #include <tcl.h>
 #include "tcl_util.h"
 
@@ -50,6 +53,125 @@
 
 namespace {
     int debug = 0;
+
+    /**
+     * A channel object: the client and the callbacks of requests
+     * posted with `post'.  While any are pending the client's socket
+     * is watched by the event loop, and each callback is run as its
+     * response arrives.  `wait' and `receive' leave posted requests to
+     * their callbacks.
+     */
+    struct Client {
+        ChannelClient *channel;
+        Tcl_Interp *interp;
+        std::map<uint64_t, Tcl_Obj *> callbacks;
+        int watched;
+        bool idle;
+    };
+
+    void deliver( Client * );
+
+    void file_ready( ClientData data, int mask ) {
+        Client *client = (Client *)data;
+        client->channel->collect();
+        deliver( client );
+    }
+
+    void idle_ready( ClientData data ) {
+        Client *client = (Client *)data;
+        client->idle = false;
+        deliver( client );
+    }
+
+    void unwatch( Client *client ) {
+        if ( client->watched == -1 )  return;
+        Tcl_DeleteFileHandler( client->watched );
+        client->watched = -1;
+    }
+
+    /**
+     * Watch the socket while callbacks are pending on it.  Callbacks
+     * that are already answered (locally, or by a lost connection)
+     * are run from the idle loop, since the socket will not wake us.
+     */
+    void watch( Client *client ) {
+        ChannelClient *channel = client->channel;
+        if ( client->callbacks.empty() ) {
+            unwatch( client );
+            return;
+        }
+        if ( channel->connected() and (client->watched != channel->descriptor()) ) {
+            unwatch( client );
+            client->watched = channel->descriptor();
+            Tcl_CreateFileHandler( client->watched, TCL_READABLE, file_ready, (ClientData)client );
+        }
+        if ( client->idle )  return;
+        std::map<uint64_t, Tcl_Obj *>::iterator entry = client->callbacks.begin();
+        for ( ; entry != client->callbacks.end() ; ++entry ) {
+            if ( channel->ready(entry->first) ) {
+                client->idle = true;
+                Tcl_DoWhenIdle( idle_ready, (ClientData)client );
+                break;
+            }
+        }
+    }
+
+    /**
+     * Every submit goes through here: a reconnect closes the old
+     * socket, which must not still be registered with the notifier.
+     */
+    uint64_t submit( Client *client, const char *request, size_t length ) {
+        if ( client->channel->connected() == false )  unwatch( client );
+        return client->channel->submit( request, length );
+    }
+
+    /**
+     * Run the callback of every posted request that has its response,
+     * as `callback id code result' at global level.  A callback may
+     * post more requests or delete the channel command.
+     */
+    void deliver( Client *client ) {
+        Tcl_Preserve( (ClientData)client );
+        ChannelClient *channel = client->channel;
+
+        std::vector<uint64_t> done;
+        std::map<uint64_t, Tcl_Obj *>::iterator entry = client->callbacks.begin();
+        for ( ; entry != client->callbacks.end() ; ++entry ) {
+            if ( channel->ready(entry->first) )  done.push_back( entry->first );
+        }
+
+        for ( size_t i = 0 ; i < done.size() ; ++i ) {
+            if ( client->channel == NULL )  break;
+            std::map<uint64_t, Tcl_Obj *>::iterator found = client->callbacks.find( done[i] );
+            if ( found == client->callbacks.end() )  continue;
+            Tcl_Obj *callback = found->second;
+            client->callbacks.erase( found );
+
+            char *body;
+            size_t length;
+            int result = channel->wait( done[i], &body, &length );
+
+            Tcl_Obj *command = Tcl_DuplicateObj( callback );
+            Tcl_IncrRefCount( command );
+            Tcl_ListObjAppendElement( NULL, command, Tcl_NewWideIntObj((Tcl_WideInt)done[i]) );
+            Tcl_ListObjAppendElement( NULL, command, Tcl_NewIntObj(result) );
+            Tcl_ListObjAppendElement( NULL, command, Tcl_NewStringObj(body, length) );
+            free( body );
+            Tcl_DecrRefCount( callback );
+
+            if ( Tcl_EvalObjEx(client->interp, command, TCL_EVAL_GLOBAL) != TCL_OK ) {
+                Tcl_BackgroundError( client->interp );
+            }
+            Tcl_DecrRefCount( command );
+        }
+
+        if ( client->channel != NULL )  watch( client );
+        Tcl_Release( (ClientData)client );
+    }
+
+    void free_client( char *data ) {
+        delete (Client *)data;
+    }
 }
 
 /**
@@ -58,7 +180,8 @@ static int
 Channel_obj( ClientData data, Tcl_Interp *interp,
              int objc, Tcl_Obj * CONST *objv )
 {
-    ChannelClient *channel = (ChannelClient *)data;
+    Client *client = (Client *)data;
+    ChannelClient *channel = client->channel;
 
     if ( objc == 1 ) {
         Tcl_SetObjResult( interp, Tcl_NewLongObj((long)(channel)) );
@@ -71,14 +194,25 @@ Channel_obj( ClientData data, Tcl_Interp *interp,
         return TCL_OK;
     }
 
+    if ( Tcl_StringMatch(command, "transport") ) {
+        Tcl_StaticSetResult( interp, Channel::transport_name(channel->kind()) );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "alive") ) {
+        Tcl_SetObjResult( interp, Tcl_NewBooleanObj(channel->alive()) );
+        return TCL_OK;
+    }
+
     if ( Tcl_StringMatch(command, "send") ) {
         if ( objc != 3 ) {
             Tcl_ResetResult( interp );
             Tcl_WrongNumArgs( interp, 2, objv, "request" );
             return TCL_ERROR;
         }
-        char *request = Tcl_GetStringFromObj( objv[2], NULL );
-        channel->send( request );
+        int length;
+        char *request = Tcl_GetStringFromObj( objv[2], &length );
+        submit( client, request, length );
         Tcl_ResetResult( interp );
         return TCL_OK;
     }
@@ -89,9 +223,142 @@ Channel_obj( ClientData data, Tcl_Interp *interp,
             Tcl_WrongNumArgs( interp, 2, objv, "" );
             return TCL_ERROR;
         }
-        char buffer[1024];
-        int result = channel->receive( buffer, sizeof(buffer) );
-        Tcl_SetObjResult( interp, Tcl_NewStringObj(buffer, -1) );
+        // the oldest request that no `post' callback is waiting for
+        uint64_t id = channel->next_outstanding( 0 );
+        while ( (id != 0) and (client->callbacks.count(id) > 0) ) {
+            id = channel->next_outstanding( id );
+        }
+        if ( (channel->kind() == Channel::SEQPACKET) and (id == 0) ) {
+            Tcl_StaticSetResult( interp, "no request outstanding" );
+            return TCL_ERROR;
+        }
+        char *body;
+        size_t length;
+        int result = (channel->kind() == Channel::SEQPACKET) ? channel->wait( id, &body, &length )
+                                                             : channel->receive( &body, &length );
+        watch( client );
+        Tcl_SetObjResult( interp, Tcl_NewStringObj(body, length) );
+        free( body );
+        return result;
+    }
+
+    if ( Tcl_StringMatch(command, "submit") ) {
+        if ( objc != 3 ) {
+            Tcl_ResetResult( interp );
+            Tcl_WrongNumArgs( interp, 2, objv, "request" );
+            return TCL_ERROR;
+        }
+        int length;
+        char *request = Tcl_GetStringFromObj( objv[2], &length );
+        uint64_t id = submit( client, request, length );
+        Tcl_SetObjResult( interp, Tcl_NewWideIntObj((Tcl_WideInt)id) );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "post") ) {
+        if ( objc != 4 ) {
+            Tcl_ResetResult( interp );
+            Tcl_WrongNumArgs( interp, 2, objv, "request callback" );
+            return TCL_ERROR;
+        }
+        if ( channel->kind() != Channel::SEQPACKET ) {
+            Tcl_StaticSetResult( interp, "post needs the seqpacket transport" );
+            return TCL_ERROR;
+        }
+        int length;
+        char *request = Tcl_GetStringFromObj( objv[2], &length );
+        uint64_t id = submit( client, request, length );
+        Tcl_IncrRefCount( objv[3] );
+        client->callbacks[id] = objv[3];
+        watch( client );
+        Tcl_SetObjResult( interp, Tcl_NewWideIntObj((Tcl_WideInt)id) );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "pending") ) {
+        Tcl_SetObjResult( interp, Tcl_NewIntObj(client->callbacks.size()) );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "batch") ) {
+        if ( (objc != 3) and (objc != 4) ) {
+            Tcl_ResetResult( interp );
+            Tcl_WrongNumArgs( interp, 2, objv, "requests ?seconds?" );
+            return TCL_ERROR;
+        }
+        int count;
+        Tcl_Obj **requests;
+        if ( Tcl_ListObjGetElements(interp, objv[2], &count, &requests) != TCL_OK ) {
+            return TCL_ERROR;
+        }
+        int seconds = 0;
+        if ( objc == 4 ) {
+            if ( Tcl_GetIntFromObj(interp, objv[3], &seconds) != TCL_OK ) {
+                return TCL_ERROR;
+            }
+        }
+
+        // the message queue cannot match responses, so one at a time
+        bool pipelined = channel->kind() == Channel::SEQPACKET;
+        std::vector<uint64_t> ids;
+        if ( pipelined ) {
+            for ( int i = 0 ; i < count ; ++i ) {
+                int length;
+                char *request = Tcl_GetStringFromObj( requests[i], &length );
+                ids.push_back( submit(client, request, length) );
+            }
+        }
+
+        Tcl_Obj *list = Tcl_NewListObj( 0, 0 );
+        for ( int i = 0 ; i < count ; ++i ) {
+            uint64_t id;
+            if ( pipelined ) {
+                id = ids[i];
+            } else {
+                int length;
+                char *request = Tcl_GetStringFromObj( requests[i], &length );
+                id = submit( client, request, length );
+            }
+            char *body;
+            size_t length;
+            int result = channel->wait( id, &body, &length, seconds );
+            Tcl_Obj *element = Tcl_NewListObj( 0, 0 );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewIntObj(result) );
+            Tcl_ListObjAppendElement( interp, element, Tcl_NewStringObj(body, length) );
+            Tcl_ListObjAppendElement( interp, list, element );
+            free( body );
+        }
+        watch( client );
+        Tcl_SetObjResult( interp, list );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "wait") ) {
+        if ( (objc != 3) and (objc != 4) ) {
+            Tcl_ResetResult( interp );
+            Tcl_WrongNumArgs( interp, 2, objv, "id ?seconds?" );
+            return TCL_ERROR;
+        }
+        Tcl_WideInt id;
+        if ( Tcl_GetWideIntFromObj(interp, objv[2], &id) != TCL_OK ) {
+            return TCL_ERROR;
+        }
+        int seconds = 0;
+        if ( objc == 4 ) {
+            if ( Tcl_GetIntFromObj(interp, objv[3], &seconds) != TCL_OK ) {
+                return TCL_ERROR;
+            }
+        }
+        if ( client->callbacks.count((uint64_t)id) > 0 ) {
+            Tcl_StaticSetResult( interp, "request was posted, its callback gets the response" );
+            return TCL_ERROR;
+        }
+        char *body;
+        size_t length;
+        int result = channel->wait( (uint64_t)id, &body, &length, seconds );
+        watch( client );
+        Tcl_SetObjResult( interp, Tcl_NewStringObj(body, length) );
+        free( body );
         return result;
     }
 
@@ -101,11 +368,15 @@ Channel_obj( ClientData data, Tcl_Interp *interp,
             Tcl_WrongNumArgs( interp, 2, objv, "request" );
             return TCL_ERROR;
         }
-        char *request = Tcl_GetStringFromObj( objv[2], NULL );
-        channel->send( request );
-        char buffer[1024];
-        int result = channel->receive( buffer, sizeof(buffer) );
-        Tcl_SetObjResult( interp, Tcl_NewStringObj(buffer, -1) );
+        int length;
+        char *request = Tcl_GetStringFromObj( objv[2], &length );
+        uint64_t id = submit( client, request, length );
+        char *body;
+        size_t body_length;
+        int result = channel->wait( id, &body, &body_length );
+        watch( client );
+        Tcl_SetObjResult( interp, Tcl_NewStringObj(body, body_length) );
+        free( body );
         return result;
     }
 
@@ -140,8 +411,15 @@ Channel_obj( ClientData data, Tcl_Interp *interp,
  */
 static void
 Channel_delete( ClientData data ) {
-    ChannelClient *channel = (ChannelClient *)data;
-    delete channel;
+    Client *client = (Client *)data;
+    unwatch( client );
+    if ( client->idle )  Tcl_CancelIdleCall( idle_ready, data );
+    std::map<uint64_t, Tcl_Obj *>::iterator entry = client->callbacks.begin();
+    for ( ; entry != client->callbacks.end() ; ++entry )  Tcl_DecrRefCount( entry->second );
+    client->callbacks.clear();
+    delete client->channel;
+    client->channel = NULL;
+    Tcl_EventuallyFree( data, free_client );
 }
 
 /**
@@ -151,16 +429,29 @@ static int
 Channel_cmd( ClientData data, Tcl_Interp *interp,
              int objc, Tcl_Obj * CONST *objv )
 {
-    if ( objc != 2 ) {
+    if ( (objc != 2) and (objc != 3) ) {
         Tcl_ResetResult( interp );
-        Tcl_WrongNumArgs( interp, 1, objv, "service" );
+        Tcl_WrongNumArgs( interp, 1, objv, "service ?msgq|seqpacket?" );
         return TCL_ERROR;
     }
 
+    Channel::Transport transport = Channel::MESSAGE_QUEUE;
+    if ( objc == 3 ) {
+        char *kind = Tcl_GetStringFromObj( objv[2], NULL );
+        if ( Channel::transport_named(kind, &transport) == false ) {
+            Tcl_StaticSetResult( interp, "transport must be msgq or seqpacket" );
+            return TCL_ERROR;
+        }
+    }
+
     char *name = Tcl_GetStringFromObj( objv[1], NULL );
     // Should check if the service is really there
-    ChannelClient *object = new ChannelClient( name );
-    Tcl_CreateObjCommand( interp, name, Channel_obj, (ClientData)object, Channel_delete );
+    Client *client = new Client;
+    client->channel = new ChannelClient( name, transport );
+    client->interp = interp;
+    client->watched = -1;
+    client->idle = false;
+    Tcl_CreateObjCommand( interp, name, Channel_obj, (ClientData)client, Channel_delete );
     Svc_SetResult( interp, name, TCL_VOLATILE );
     return TCL_OK;
 }
@@ -359,6 +359,51 @@ Socket_obj( ClientData data, Tcl_Interp *interp,
         Tcl_ResetResult( interp );
         return TCL_OK;
     }
+    /**
+     * Like send, but the message waits for the next flush
+     */
+    if ( Tcl_StringMatch(command, "queue") ) {
+        if ( objc != 4 ) {
+            Tcl_ResetResult( interp );
+            Tcl_WrongNumArgs( interp, 1, objv, "queue message recipient" );
+            return TCL_ERROR;
+        }
+
+        PDU *pdu;
+        void *p = (void *)&(pdu);
+        if ( Tcl_GetLongFromObj(interp,objv[2],(long*)p) != TCL_OK ) {
+            return TCL_ERROR;
+        }
+
+        char *address_string = Tcl_GetStringFromObj( objv[3], NULL );
+        struct in6_addr address;
+        inet_pton( AF_INET6, address_string, &address );
+
+        pdu->queue( *socket, &address );
+        Tcl_ResetResult( interp );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "flush") ) {
+        Tcl_SetObjResult( interp, Tcl_NewIntObj(socket->flush()) );
+        return TCL_OK;
+    }
+
+    if ( Tcl_StringMatch(command, "stats") ) {
+        const SendStatistics& stats = socket->send_statistics();
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("batches", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(stats.batches) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("syscalls", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(stats.syscalls) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("sent", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(stats.sent) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("failed", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewLongObj(stats.failed) );
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
     Tcl_SetResult( interp, (char *)"Unknown command for Socket object", TCL_STATIC );
     return TCL_ERROR;
 }
@@ -400,7 +445,9 @@ static bool
 ICMPv6_Module( Tcl_Interp *interp ) {
     Tcl_Command command;
 
-    Tcl_Namespace *ns = Tcl_CreateNamespace(interp, "ICMPv6", (ClientData)0, NULL);
+    // the platform receive engine may have registered into it already
+    Tcl_Namespace *ns = Tcl_FindNamespace(interp, "ICMPv6", NULL, 0);
+    if ( ns == NULL )  ns = Tcl_CreateNamespace(interp, "ICMPv6", (ClientData)0, NULL);
     if ( ns == NULL ) {
         return false;
     }
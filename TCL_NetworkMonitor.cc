@@ -103,6 +103,63 @@ Monitor_obj( ClientData data, Tcl_Interp *interp,
             return TCL_OK;
     }
 
+    /**
+     * Event loop counters as a key/value list.  avg_latency and
+     * max_latency are microseconds per batch of netlink events.
+     */
+    if ( Tcl_StringMatch(command, "stats") ) {
+        const Network::MonitorStatistics& stats = monitor->statistics();
+        uint64_t average = 0;
+        if ( stats.batches > 0 )  average = stats.total_latency / stats.batches;
+
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("batches", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.batches) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("events", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.events) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("largest_batch", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.largest_batch) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("last_latency", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.last_latency) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("avg_latency", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(average) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("max_latency", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.max_latency) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("overruns", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.overruns) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("ticks", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.ticks) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("host_updates", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.host_updates) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("host_entries_written", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(stats.host_entries_written) );
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
+    /**
+     * Seconds between periodic advertise/update_hosts runs.
+     */
+    if ( Tcl_StringMatch(command, "interval") ) {
+        if ( objc == 3 ) {
+            int seconds;
+            if ( Tcl_GetIntFromObj(interp, objv[2], &seconds) != TCL_OK ) {
+                return TCL_ERROR;
+            }
+            if ( seconds < 1 ) {
+                Svc_SetResult( interp, "interval must be at least 1 second", TCL_STATIC );
+                return TCL_ERROR;
+            }
+            monitor->interval( seconds );
+        } else if ( objc != 2 ) {
+            Tcl_ResetResult( interp );
+            Tcl_WrongNumArgs( interp, 2, objv, "?seconds?" );
+            return TCL_ERROR;
+        }
+        Tcl_SetObjResult( interp, Tcl_NewIntObj(monitor->interval()) );
+        return TCL_OK;
+    }
+
     /*
      * I want an 'interfaces' sub command ...
      */
@@ -292,7 +349,8 @@ finish:
 bool NetworkMonitor_Module( Tcl_Interp *interp ) {
     Tcl_Command command;
 
-    Tcl_Namespace *ns = Tcl_CreateNamespace(interp, "Network", (ClientData)0, NULL);
+    Tcl_Namespace *ns = Tcl_FindNamespace(interp, "Network", NULL, 0);
+    if ( ns == NULL )  ns = Tcl_CreateNamespace(interp, "Network", (ClientData)0, NULL);
     if ( ns == NULL ) {
         return false;
     }
@@ -58,10 +58,6 @@ namespace {
     int debug = 0;
     int pid = 0;
     int ppid = 0;
-    char *static_envp[] = {
-        const_cast<char*>("HOME=/root"),
-        NULL
-    };
 }
 
 /**
@@ -243,129 +239,14 @@ restart_cmd( ClientData data, Tcl_Interp *interp,
     return TCL_ERROR;
 }
 
-/**
- */
-static pid_t
-spawn_child( Tcl_Interp *interp, const char *command, int objc, Tcl_Obj * CONST *objv, int *out ) {
-
-    char *argv[30];
-    int argc = 1;
-    argv[0] = const_cast<char*>(command);
-
-    for ( int i = 0 ; i < objc ; i++ ) {
-        argv[argc++] = Tcl_GetStringFromObj( objv[i], NULL );
-    }
-    argv[argc] = NULL;
-
-    int fd[2];
-
-    /*
-     * fd[0] is for reading - parent input fd
-     * fd[1] is for writing - child stdout
-     */
-    if ( pipe(fd) < 0 ) {
-        log_notice( "failed to generate pipe for '%s'", command );
-        return -1;
-    }
-
-    pid_t child = fork();
-
-    /*
-     * if child < 0 this is an error
-     * if child > 0 this is the parent
-     */
-    if ( child != 0 ) {
-        close( fd[1] );
-        *out = fd[0];
-        return child;
-    }
-
-    /*
-     * Redirect stdout and stderr to the pipe
-     */
-    close( fd[0] );
-    close( 1 );
-    dup2( fd[1], 1 );
-    close( 2 );
-    dup2( fd[1], 2 );
-
-    if ( execve(command, argv, static_envp) < 0 ) {
-        log_notice( "failed to execve '%s'", command );
-        _exit( 0 );
-    }
-    log_notice( "THIS MESSAGE SHOULD NEVER HAPPEN - exec failed" );
-    _exit( 0 );
-}
-
-/**
- */
-static int
-wait_for_child( pid_t child, int timeout ) {
-    int status;
-    int pid;
-
-    struct timespec delay = { 1, 0 };
-    struct timespec remaining = { 0, 0 };
-
-    if ( child == 0 ) {
-        log_notice( "asked to wait for an invalid pid" );
-        return 0;
-    }
-
-    while ( timeout > 0 ) {
-        pid = waitpid( child, &status, WNOHANG );
-        if ( pid == child ) {
-            if ( WIFEXITED(status) ) {
-                if ( WEXITSTATUS(status) != 0 ) {
-                    log_notice( "%d exited with status %d", pid, WEXITSTATUS(status) );
-                }
-                return child; 
-            }
-            if ( WIFSIGNALED(status) ) {
-                log_notice( "%d killed by signal %d", pid, WTERMSIG(status) );
-                return child;
-            }
-        }
-        if ( pid == 0 ) {
-            // sleep_for_second();
-            --timeout;
-            continue;
-        }
-        if ( pid < 0 ) {
-            switch (errno) {
-            case EINTR: continue;
-            case EINVAL:
-                log_notice( "waitpid() with an invalid argument" );
-                break;
-            case ECHILD:
-                log_notice( "waitpid() for an invalid pid" );
-                break;
-            default:
-                log_notice( "unknown errno from waitpid()" );
-                break;
-            }
-        }
-        log_notice(
-                "waitpid() returned an invalid value with %d seconds remaining",
-                timeout );
-        break;
-    }
-
-    if ( debug ) log_notice( "timed out, killing pid %d", child );
-    ::kill( child, SIGKILL );
-
-    /* pid = waitpid( child, &status, WNOHANG ); */
-    pid = waitpid( child, &status, 0 );
-    return -1;
-}
-
 /**
  */
 bool
 Process_Module( Tcl_Interp *interp ) {
     Tcl_Command command;
 
-    Tcl_Namespace *ns = Tcl_CreateNamespace(interp, "Process", (ClientData)0, NULL);
+    Tcl_Namespace *ns = Tcl_FindNamespace(interp, "Process", NULL, 0);
+    if ( ns == NULL )  ns = Tcl_CreateNamespace(interp, "Process", (ClientData)0, NULL);
     if ( ns == NULL ) {
         return false;
     }
@@ -32,6 +32,7 @@
 #include <tcl.h>
 #include "tcl_util.h"
 #include "Thread.h"
+#include "Executor.h"
 #include "PlatformThread.h"
 #include "AppInit.h"
 
@@ -90,6 +91,16 @@ Thread_obj( ClientData data, Tcl_Interp *interp,
         return TCL_OK;
     }
 
+    if ( Tcl_StringMatch(command, "queue") ) {
+        Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("depth", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewIntObj(thread->queue()->depth()) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("capacity", -1) );
+        Tcl_ListObjAppendElement( interp, result, Tcl_NewIntObj(thread->queue()->capacity()) );
+        Tcl_SetObjResult( interp, result );
+        return TCL_OK;
+    }
+
     Tcl_StaticSetResult( interp, "Unknown command for thread object" );
     return TCL_ERROR;
 }
@@ -106,9 +117,70 @@ RegisterThreadWithTcl::operator () ( Thread *thread ) {
     return true;
 }
 
+/**
+ * Report each executor worker's deque and inbox depth, how many tasks
+ * it ran and stole, how often it went to sleep, and its busy time.
+ */
+static int
+Executor_cmd( ClientData data, Tcl_Interp *interp,
+              int objc, Tcl_Obj * CONST *objv )
+{
+    Executor *executor = (Executor *)data;
+    if ( objc != 1 ) {
+        Tcl_ResetResult( interp );
+        Tcl_WrongNumArgs( interp, 1, objv, "" );
+        return TCL_ERROR;
+    }
+
+    Tcl_Obj *workers = Tcl_NewListObj( 0, 0 );
+    for ( int i = 0 ; i < executor->workers_count() ; ++i ) {
+        WorkerStatistics s;
+        executor->statistics( i, &s );
+        Tcl_Obj *worker = Tcl_NewListObj( 0, 0 );
+        Tcl_ListObjAppendElement( interp, worker, Tcl_NewStringObj("worker", -1) );
+        Tcl_ListObjAppendElement( interp, worker, Tcl_NewIntObj(i) );
+        Tcl_ListObjAppendElement( interp, worker, Tcl_NewStringObj("thread", -1) );
+        Tcl_ListObjAppendElement( interp, worker, Tcl_NewIntObj(s.thread) );
+        Tcl_ListObjAppendElement( interp, worker, Tcl_NewStringObj("depth", -1) );
+        Tcl_ListObjAppendElement( interp, worker, Tcl_NewIntObj(s.depth) );
+        Tcl_ListObjAppendElement( interp, worker, Tcl_NewStringObj("inbox", -1) );
+        Tcl_ListObjAppendElement( interp, worker, Tcl_NewIntObj(s.inbox) );
+        Tcl_ListObjAppendElement( interp, worker, Tcl_NewStringObj("executed", -1) );
+        Tcl_ListObjAppendElement( interp, worker, Tcl_NewWideIntObj(s.executed) );
+        Tcl_ListObjAppendElement( interp, worker, Tcl_NewStringObj("stolen", -1) );
+        Tcl_ListObjAppendElement( interp, worker, Tcl_NewWideIntObj(s.stolen) );
+        Tcl_ListObjAppendElement( interp, worker, Tcl_NewStringObj("sleeps", -1) );
+        Tcl_ListObjAppendElement( interp, worker, Tcl_NewWideIntObj(s.sleeps) );
+        Tcl_ListObjAppendElement( interp, worker, Tcl_NewStringObj("busy_usec", -1) );
+        Tcl_ListObjAppendElement( interp, worker, Tcl_NewWideIntObj(s.busy_nsec / 1000) );
+        Tcl_ListObjAppendElement( interp, workers, worker );
+    }
+
+    Tcl_Obj *result = Tcl_NewListObj( 0, 0 );
+    Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("rejected", -1) );
+    Tcl_ListObjAppendElement( interp, result, Tcl_NewWideIntObj(executor->rejected_tasks()) );
+    Tcl_ListObjAppendElement( interp, result, Tcl_NewStringObj("workers", -1) );
+    Tcl_ListObjAppendElement( interp, result, workers );
+    Tcl_SetObjResult( interp, result );
+    return TCL_OK;
+}
+
+/**
+ * The executor is built here, once the creation hook is in place, so
+ * its workers get Thread:: commands like every other thread.  The
+ * app init chain also runs for interps made later (service workers),
+ * which must not take the hook over.
+ */
 static bool
 Thread_Module( Tcl_Interp *interp ) {
-    thread_create_hook = new RegisterThreadWithTcl( interp );
+    // only the first interp; others may be bound to other threads
+    if ( thread_create_hook == NULL ) {
+        thread_create_hook = new RegisterThreadWithTcl( interp );
+        interpreter = interp;
+    }
+
+    Tcl_EvalEx( interp, "namespace eval Thread {}", -1, TCL_EVAL_GLOBAL );
+    Tcl_CreateObjCommand( interp, "Thread::executor", Executor_cmd, (ClientData)Executor::instance(), NULL );
     return true;
 }
 
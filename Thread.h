@@ -41,6 +41,7 @@ extern pthread_key_t CurrentThread;
 extern void InitializeThreads();
 
 class Thread;
+class Task;
 
 class ThreadCallback {
 public:
@@ -73,6 +74,8 @@ public:
     void setpid() { pid = ::getpid(); }
     pid_t getpid() { return pid; }
     const char *thread_name() const { return _thread_name; }
+    Queue *queue() { return &q; }
+    bool submit( Task * );
     void thread_name( const char * );
     int TclCommand(ClientData, Tcl_Interp *, int, Tcl_Obj * CONST *);
 };
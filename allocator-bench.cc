@@ -0,0 +1,142 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** \file allocator-bench.cc
+ * \brief Multi-threaded alloc/free benchmark for the global allocator.
+ *
+ * Each thread repeatedly fills a window of objects of mixed sizes and
+ * frees them again, the same churn the monitor and service threads
+ * produce with netlink messages and channel buffers.  The run is
+ * repeated for 1, 2, 4 ... threads, once with the per-thread magazine
+ * caches and once without, and the throughput of each is reported.
+ *
+ *   allocator-bench [-t max-threads] [-n operations-per-thread] [-w window]
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "Allocator.h"
+
+namespace {
+    int debug = 0;
+
+    static const int MAX_THREADS = 64;
+    static const int MAX_WINDOW = 4096;
+    static const size_t sizes[] = { 16, 24, 32, 48, 64, 96, 128, 256 };
+    static const int size_count = sizeof(sizes) / sizeof(sizes[0]);
+
+    long operations = 1000000;
+    int window = 64;
+
+    pthread_barrier_t barrier;
+
+    uint64_t now_nsec() {
+        struct timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        return ((uint64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+    }
+
+    void *churn( void *data ) {
+        char **slots = new char*[MAX_WINDOW];
+        long rounds = operations / window;
+
+        pthread_barrier_wait( &barrier );
+        for ( long round = 0 ; round < rounds ; ++round ) {
+            for ( int i = 0 ; i < window ; ++i ) {
+                slots[i] = new char[ sizes[(round + i) % size_count] ];
+                slots[i][0] = i;
+            }
+            for ( int i = 0 ; i < window ; ++i ) {
+                delete [] slots[i];
+            }
+        }
+
+        delete [] slots;
+        return NULL;
+    }
+
+    /**
+     * Returns the number of alloc/free pairs per second across all threads.
+     */
+    double run( int threads ) {
+        pthread_t id[MAX_THREADS];
+
+        pthread_barrier_init( &barrier, NULL, threads + 1 );
+        for ( int i = 0 ; i < threads ; ++i ) {
+            pthread_create( &id[i], NULL, churn, NULL );
+        }
+
+        uint64_t start = now_nsec();
+        pthread_barrier_wait( &barrier );
+        for ( int i = 0 ; i < threads ; ++i ) {
+            pthread_join( id[i], NULL );
+        }
+        uint64_t elapsed = now_nsec() - start;
+        pthread_barrier_destroy( &barrier );
+
+        long pairs = (operations / window) * window * threads;
+        return (pairs * 1000000000.0) / elapsed;
+    }
+}
+
+/**
+ */
+int main( int argc, char **argv ) {
+    int max_threads = 8;
+
+    int opt;
+    while ( (opt = getopt(argc, argv, "t:n:w:d")) != -1 ) {
+        switch ( opt ) {
+        case 't': max_threads = atoi( optarg ); break;
+        case 'n': operations = atol( optarg ); break;
+        case 'w': window = atoi( optarg ); break;
+        case 'd': debug++; break;
+        default:
+            fprintf( stderr, "usage: %s [-t max-threads] [-n operations] [-w window]\n", argv[0] );
+            exit( 1 );
+        }
+    }
+    if ( max_threads > MAX_THREADS )  max_threads = MAX_THREADS;
+    if ( window > MAX_WINDOW )  window = MAX_WINDOW;
+    if ( window < 1 )  window = 1;
+
+    printf( "%ld operations per thread, window %d, %ld cpus\n",
+            operations, window, sysconf(_SC_NPROCESSORS_ONLN) );
+    printf( "%8s %16s %16s %8s\n", "threads", "locked ops/s", "cached ops/s", "speedup" );
+
+    for ( int threads = 1 ; threads <= max_threads ; threads *= 2 ) {
+        Allocator::thread_caches( false );
+        double locked = run( threads );
+        Allocator::thread_caches( true );
+        double cached = run( threads );
+        printf( "%8d %16.0f %16.0f %7.2fx\n", threads, locked, cached, cached / locked );
+    }
+    return 0;
+}
+
+/* vim: set autoindent expandtab sw=4 : */
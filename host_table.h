@@ -25,6 +25,7 @@
 #define _HOST_TABLE_H_
 
 #include <stdint.h>
+#include <string.h>
 #include <netinet/in.h>
 
 struct host_entry {
@@ -48,6 +49,57 @@ struct host_entry {
 #define HOST_TABLE_ENTRIES 256
 #define HOST_TABLE_SIZE (sizeof(struct host_entry)*HOST_TABLE_ENTRIES)
 
+/*
+ * The hosts file is a header followed by the entries, mapped shared
+ * by the network monitor and updated in place.  generation is a
+ * seqlock: it is odd while the monitor is changing entries, so a
+ * reader copies the table and keeps the copy only if generation was
+ * even and unchanged across the copy.  Valid entries are packed at
+ * the front; count of them are in use.
+ */
+#define HOST_TABLE_MAGIC   0x48535442    /* "HSTB" */
+#define HOST_TABLE_VERSION 1
+#define HOST_TABLE_RETRIES 100000
+
+struct host_table_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entries;
+    uint32_t count;
+    uint64_t generation;
+    uint64_t updated;       /* wall clock seconds of the last change */
+    uint8_t reserved[32];
+};
+
+struct host_table {
+    struct host_table_header header;
+    struct host_entry entry[HOST_TABLE_ENTRIES];
+};
+
+/*
+ * Copy a consistent snapshot of a mapped host table into table,
+ * retrying while the monitor is writing.  Returns the number of
+ * entries in use, or -1 if the mapping is not a host table or stays
+ * mid-update (a monitor that died while writing).
+ */
+static inline int
+host_table_snapshot( const struct host_table *mapped, struct host_table *table ) {
+    if ( mapped->header.magic != HOST_TABLE_MAGIC ) return -1;
+    if ( mapped->header.version != HOST_TABLE_VERSION ) return -1;
+    int attempts;
+    for ( attempts = 0 ; attempts < HOST_TABLE_RETRIES ; ++attempts ) {
+        uint64_t before = __atomic_load_n( &(mapped->header.generation), __ATOMIC_ACQUIRE );
+        if ( before & 1 ) continue;
+        memcpy( table, (const void *)mapped, sizeof(*table) );
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        uint64_t after = __atomic_load_n( &(mapped->header.generation), __ATOMIC_RELAXED );
+        if ( before == after ) break;
+    }
+    if ( attempts == HOST_TABLE_RETRIES ) return -1;
+    if ( table->header.count > HOST_TABLE_ENTRIES ) return -1;
+    return table->header.count;
+}
+
 #endif
 
 /* vim: set autoindent expandtab sw=4 : */
@@ -0,0 +1,260 @@
+
+/*
+ * Copyright (c) 2012-2021 Karl N. Redgate
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** \file queue-bench.cc
+ * \brief Messages per second through Thread's Queue, old and new.
+ *
+ * A number of producer threads push messages at one consumer thread,
+ * first through the mutex and condition variable queue Thread used to
+ * embed, then through the lock free ring that replaced it.  The
+ * consumer of the ring takes messages in batches.
+ *
+ *   queue-bench [-p max-producers] [-n messages-per-producer]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "Queue.h"
+
+namespace {
+    int debug = 0;
+
+    /**
+     * The queue as it was before the lock free ring, kept here only
+     * so there is something to measure against.  The original checked
+     * and popped its freelist in two steps, which two producers could
+     * interleave; allocate() is serialized here so the comparison can
+     * run with more than one producer at all.
+     */
+    class LockedQueue {
+        class Entry {
+        public:
+            Entry *next, *previous;
+            void *message;
+            pthread_mutex_t lock;
+
+            Entry() : message(0) {
+                pthread_mutex_init( &lock, NULL );
+                next = this;
+                previous = this;
+            }
+
+            Entry( void *data ) {
+                pthread_mutex_init( &lock, NULL );
+                next = this;
+                previous = this;
+                message = data;
+            }
+
+            void insert( Entry *entry ) {
+                pthread_mutex_lock( &lock );
+                entry->next = next;
+                entry->previous = this;
+                next->previous = entry;
+                next = entry;
+                pthread_mutex_unlock( &lock );
+            }
+
+            Entry *remove() {
+                pthread_mutex_lock( &lock );
+                Entry *entry = previous;
+                previous = entry->previous;
+                previous->next = this;
+                pthread_mutex_unlock( &lock );
+                return entry;
+            }
+            bool empty() {
+                return (next == this);
+            }
+        };
+
+        pthread_cond_t messages;
+        pthread_mutex_t messages_lock;
+        pthread_mutex_t producer_lock;
+        Entry freelist;
+        Entry head;
+        Entry *allocate( void *data ) {
+            pthread_mutex_lock( &producer_lock );
+            Entry *entry;
+            if ( freelist.empty() ) {
+                entry = new Entry( data );
+            } else {
+                entry = freelist.remove();
+                entry->message = data;
+            }
+            pthread_mutex_unlock( &producer_lock );
+            return entry;
+        }
+
+    public:
+        LockedQueue() {
+            pthread_cond_init( &messages, NULL );
+            pthread_mutex_init( &messages_lock, NULL );
+            pthread_mutex_init( &producer_lock, NULL );
+        }
+        void enqueue( void *data ) {
+            Entry *entry = allocate( data );
+            head.insert( entry );
+            pthread_mutex_lock( &messages_lock );
+            pthread_cond_signal( &messages );
+            pthread_mutex_unlock( &messages_lock );
+        }
+
+        void *dequeue() {
+            Entry *entry = head.remove();
+            void *data = entry->message;
+            freelist.insert( entry );
+            return data;
+        }
+
+        void wait() {
+            pthread_mutex_lock( &messages_lock );
+            while ( empty() ) {
+                pthread_cond_wait( &messages, &messages_lock );
+            }
+            pthread_mutex_unlock( &messages_lock );
+        }
+
+        bool empty() {
+            return head.empty();
+        }
+    };
+
+    static const int MAX_PRODUCERS = 32;
+    static const int BATCH = 64;
+
+    long messages = 1000000;
+    long expected = 0;
+    long full = 0;
+
+    uint64_t now_nsec() {
+        struct timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        return ((uint64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+    }
+
+    void *locked_producer( void *data ) {
+        LockedQueue *q = (LockedQueue *)data;
+        for ( long i = 1 ; i <= messages ; ++i )  q->enqueue( (void *)i );
+        return NULL;
+    }
+
+    void *locked_consumer( void *data ) {
+        LockedQueue *q = (LockedQueue *)data;
+        long received = 0;
+        while ( received < expected ) {
+            q->wait();
+            while ( (received < expected) and (q->empty() == false) ) {
+                q->dequeue();
+                received++;
+            }
+        }
+        return NULL;
+    }
+
+    void *ring_producer( void *data ) {
+        Queue *q = (Queue *)data;
+        for ( long i = 1 ; i <= messages ; ++i ) {
+            while ( q->enqueue((void *)i) == false ) {
+                __atomic_add_fetch( &full, 1, __ATOMIC_RELAXED );
+                sched_yield();
+            }
+        }
+        return NULL;
+    }
+
+    void *ring_consumer( void *data ) {
+        Queue *q = (Queue *)data;
+        void *batch[BATCH];
+        long received = 0;
+        while ( received < expected ) {
+            q->wait();
+            received += q->dequeue( batch, BATCH );
+        }
+        return NULL;
+    }
+
+    /**
+     * Returns messages per second.
+     */
+    double run( int producers, void *q, void *(*producer)(void *), void *(*consumer)(void *) ) {
+        pthread_t id[MAX_PRODUCERS], consumer_id;
+        expected = messages * producers;
+
+        uint64_t start = now_nsec();
+        pthread_create( &consumer_id, NULL, consumer, q );
+        for ( int i = 0 ; i < producers ; ++i ) {
+            pthread_create( &id[i], NULL, producer, q );
+        }
+        for ( int i = 0 ; i < producers ; ++i ) {
+            pthread_join( id[i], NULL );
+        }
+        pthread_join( consumer_id, NULL );
+        uint64_t elapsed = now_nsec() - start;
+
+        return (expected * 1000000000.0) / elapsed;
+    }
+}
+
+/**
+ */
+int main( int argc, char **argv ) {
+    int max_producers = 4;
+
+    int opt;
+    while ( (opt = getopt(argc, argv, "p:n:d")) != -1 ) {
+        switch ( opt ) {
+        case 'p': max_producers = atoi( optarg ); break;
+        case 'n': messages = atol( optarg ); break;
+        case 'd': debug++; break;
+        default:
+            fprintf( stderr, "usage: %s [-p max-producers] [-n messages]\n", argv[0] );
+            exit( 1 );
+        }
+    }
+    if ( max_producers > MAX_PRODUCERS )  max_producers = MAX_PRODUCERS;
+
+    setvbuf( stdout, NULL, _IOLBF, 0 );
+    printf( "%ld messages per producer, %ld cpus\n", messages, sysconf(_SC_NPROCESSORS_ONLN) );
+    printf( "%10s %16s %16s %8s %10s\n", "producers", "locked msg/s", "ring msg/s", "speedup", "ring full" );
+
+    for ( int producers = 1 ; producers <= max_producers ; producers *= 2 ) {
+        LockedQueue locked;
+        double locked_rate = run( producers, &locked, locked_producer, locked_consumer );
+
+        Queue ring;
+        full = 0;
+        double ring_rate = run( producers, &ring, ring_producer, ring_consumer );
+
+        printf( "%10d %16.0f %16.0f %7.2fx %10ld\n", producers, locked_rate, ring_rate, ring_rate / locked_rate, full );
+    }
+    return 0;
+}
+
+/* vim: set autoindent expandtab sw=4 : */
@@ -0,0 +1,35 @@
+/*
+ * Sample socket filter for testcases/ebpf.redx: counts every packet
+ * the socket receives in slot 0 of the packets array, and accepts it.
+ *
+ *   clang -O2 -target bpf -c count.c -o count.o
+ */
+
+#include <linux/bpf.h>
+
+struct bpf_map_def {
+    unsigned int type;
+    unsigned int key_size;
+    unsigned int value_size;
+    unsigned int max_entries;
+    unsigned int map_flags;
+};
+
+static void *(*bpf_map_lookup_elem)( void *map, const void *key ) = (void *)BPF_FUNC_map_lookup_elem;
+
+struct bpf_map_def packets __attribute__((section("maps"), used)) = {
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(unsigned int),
+    .value_size = sizeof(unsigned long long),
+    .max_entries = 2,
+};
+
+__attribute__((section("socket"), used))
+int count( struct __sk_buff *skb ) {
+    unsigned int key = 0;
+    unsigned long long *value = bpf_map_lookup_elem( &packets, &key );
+    if ( value != 0 )  __sync_fetch_and_add( value, 1 );
+    return skb->len;
+}
+
+char _license[] __attribute__((section("license"), used)) = "GPL";